@@ -0,0 +1,126 @@
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+
+#include "log_filter.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+/*
+ * wifi_log_buffer(): binary blobs sent as they are, in LOG_RECORD_TYPE_BUFFER records, and turned into a hexdump by
+ * the collector. Each record holds one chunk, with everything needed to place it:
+ *
+ *   [level] [timestamp_ms, 4] [blob id, 2] [offset, 4] [total length, 4] [device id length] [device id] [tag length] [tag] [data]
+ *
+ * numbers are big-endian. Chunks are as big as a batch (or a datagram, if that's bigger), so a 4 KB packet is a
+ * handful of queue items and datagrams, not ESP_LOG_BUFFER_HEX's 256 formatted lines.
+ */
+
+#define BUFFER_RECORD_MAX_SIZE MAX(CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE, CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE)
+
+// level, timestamp, blob id, offset, total length, and the two string lengths
+#define BUFFER_RECORD_FIXED_SIZE (1 + 4 + 2 + 4 + 4 + 1 + 1)
+
+static uint16_t s_next_blob_id = 0;
+static portMUX_TYPE s_blob_id_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t* put_u16(uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+    return p + 2;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+/**
+ * @brief sends a binary blob as LOG_RECORD_TYPE_BUFFER records, for the collector to show as a hexdump
+ *
+ * @param level ESP log level
+ * @param tag tag for the blob, at most 255 chars
+ * @param data bytes to send
+ * @param len number of bytes, at most 4 GB. If the queue fills up, the rest of the blob is dropped
+ */
+void wifi_log_buffer(esp_log_level_t level, const char *tag, const void* data, size_t len)
+{
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+    // syslog receivers have no use for our binary records
+    (void) level; (void) tag; (void) data; (void) len;
+    return;
+#endif
+
+    if (!data || !is_network_logging_allowed_here())
+        return;
+
+    // the whole blob counts as one line
+    if (!log_filter_level_allows(tag, level) || !log_filter_rate_allows())
+        return;
+
+    const char* device_id = udp_logging_get_device_id();
+    const size_t device_len = strlen(device_id);
+    const size_t tag_len = MIN(strlen(tag), 255);
+    const size_t header_len = LOG_RECORD_HEADER_SIZE + BUFFER_RECORD_FIXED_SIZE + device_len + tag_len;
+    if (header_len >= BUFFER_RECORD_MAX_SIZE)
+        return;
+
+    // whole hexdump rows per chunk, so the rows line up with the blob's offsets
+    size_t max_chunk = BUFFER_RECORD_MAX_SIZE - header_len;
+    if (max_chunk > 16)
+        max_chunk &= ~(size_t)15;
+    const uint32_t timestamp = esp_log_timestamp();
+
+    portENTER_CRITICAL(&s_blob_id_lock);
+    const uint16_t blob_id = s_next_blob_id++;
+    portEXIT_CRITICAL(&s_blob_id_lock);
+
+    // an empty blob still gets one record, so it shows up
+    size_t offset = 0;
+    do
+    {
+        const size_t chunk = MIN(len - offset, max_chunk);
+        const size_t record_len = header_len + chunk;
+
+        // the queue consumer will free() this
+        uint8_t* record = malloc(record_len);
+        if (!record)
+            return;
+
+        log_record_write_header(record, LOG_RECORD_TYPE_BUFFER, (uint16_t)(record_len - LOG_RECORD_HEADER_SIZE));
+        uint8_t* p = &record[LOG_RECORD_HEADER_SIZE];
+        *p++ = (uint8_t)level;
+        p = put_u32(p, timestamp);
+        p = put_u16(p, blob_id);
+        p = put_u32(p, (uint32_t)offset);
+        p = put_u32(p, (uint32_t)len);
+        *p++ = (uint8_t)device_len;
+        memcpy(p, device_id, device_len);
+        p += device_len;
+        *p++ = (uint8_t)tag_len;
+        memcpy(p, tag, tag_len);
+        p += tag_len;
+        memcpy(p, (const uint8_t*)data + offset, chunk);
+
+        const struct log_queue_item item = {
+            .message = (char*)record,
+            .flags = LOG_ITEM_FLAG_BINARY,
+            .len = (uint16_t)record_len,
+        };
+        if (send_to_queue(&item, record_len) != ESP_OK) {
+            // the rest of the blob is dropped. the collector shows what made it
+            free(record);
+            return;
+        }
+
+        offset += chunk;
+    } while (offset < len);
+}
@@ -0,0 +1,135 @@
+#include <string.h>
+#include "cbor.h"
+
+// major types, already shifted into the top 3 bits of the initial byte
+#define CBOR_MAJOR_UINT     0x00
+#define CBOR_MAJOR_NEGINT   0x20
+#define CBOR_MAJOR_BYTES    0x40
+#define CBOR_MAJOR_TEXT     0x60
+#define CBOR_MAJOR_ARRAY    0x80
+#define CBOR_MAJOR_MAP      0xa0
+
+#define CBOR_FALSE          0xf4
+#define CBOR_TRUE           0xf5
+#define CBOR_FLOAT32        0xfa
+#define CBOR_INDEFINITE     0x1f
+#define CBOR_BREAK          0xff
+
+void cbor_writer_init(struct cbor_writer* w, uint8_t* buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = false;
+}
+
+static bool reserve(struct cbor_writer* w, size_t n)
+{
+    if (w->overflow || w->size - w->len < n) {
+        w->overflow = true;
+        return false;
+    }
+    return true;
+}
+
+static void put_byte(struct cbor_writer* w, uint8_t b)
+{
+    if (reserve(w, 1))
+        w->buf[w->len++] = b;
+}
+
+/**
+ * @brief writes an initial byte + argument, using the shortest encoding that holds the value
+ */
+static void put_head(struct cbor_writer* w, uint8_t major, uint64_t value)
+{
+    if (value < 24) {
+        put_byte(w, major | (uint8_t)value);
+        return;
+    }
+
+    uint8_t additional;
+    size_t n;
+    if (value <= 0xff)          { additional = 24; n = 1; }
+    else if (value <= 0xffff)   { additional = 25; n = 2; }
+    else if (value <= 0xffffffff) { additional = 26; n = 4; }
+    else                        { additional = 27; n = 8; }
+
+    if (!reserve(w, 1 + n))
+        return;
+
+    w->buf[w->len++] = major | additional;
+    for (size_t i = n; i > 0; i--)
+        w->buf[w->len++] = (uint8_t)(value >> (8 * (i - 1)));
+}
+
+void cbor_put_uint(struct cbor_writer* w, uint64_t value)
+{
+    put_head(w, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_put_int(struct cbor_writer* w, int64_t value)
+{
+    if (value >= 0)
+        put_head(w, CBOR_MAJOR_UINT, (uint64_t)value);
+    else
+        put_head(w, CBOR_MAJOR_NEGINT, (uint64_t)(-1 - value));
+}
+
+void cbor_put_text(struct cbor_writer* w, const char* text, size_t len)
+{
+    put_head(w, CBOR_MAJOR_TEXT, len);
+    if (reserve(w, len)) {
+        memcpy(&w->buf[w->len], text, len);
+        w->len += len;
+    }
+}
+
+void cbor_put_bytes(struct cbor_writer* w, const void* data, size_t len)
+{
+    put_head(w, CBOR_MAJOR_BYTES, len);
+    if (reserve(w, len)) {
+        memcpy(&w->buf[w->len], data, len);
+        w->len += len;
+    }
+}
+
+void cbor_put_float(struct cbor_writer* w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (!reserve(w, 5))
+        return;
+
+    w->buf[w->len++] = CBOR_FLOAT32;
+    w->buf[w->len++] = (uint8_t)(bits >> 24);
+    w->buf[w->len++] = (uint8_t)(bits >> 16);
+    w->buf[w->len++] = (uint8_t)(bits >> 8);
+    w->buf[w->len++] = (uint8_t)bits;
+}
+
+void cbor_put_bool(struct cbor_writer* w, bool value)
+{
+    put_byte(w, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void cbor_put_array(struct cbor_writer* w, size_t count)
+{
+    put_head(w, CBOR_MAJOR_ARRAY, count);
+}
+
+void cbor_put_map(struct cbor_writer* w, size_t count)
+{
+    put_head(w, CBOR_MAJOR_MAP, count);
+}
+
+void cbor_put_map_indefinite(struct cbor_writer* w)
+{
+    put_byte(w, CBOR_MAJOR_MAP | CBOR_INDEFINITE);
+}
+
+void cbor_put_break(struct cbor_writer* w)
+{
+    put_byte(w, CBOR_BREAK);
+}
@@ -0,0 +1,45 @@
+#ifndef WIFI_LOGGER_CBOR_H
+#define WIFI_LOGGER_CBOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Minimal CBOR (RFC 8949) writer into a caller-supplied buffer. Only the parts the logger needs.
+ * Once something doesn't fit, overflow is set and every later write is a no-op, so callers can check once at the end
+ * (or use cbor_mark()/cbor_rewind() to drop the last item that didn't fit).
+ */
+struct cbor_writer {
+    uint8_t* buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+};
+
+void cbor_writer_init(struct cbor_writer* w, uint8_t* buf, size_t size);
+
+void cbor_put_uint(struct cbor_writer* w, uint64_t value);
+void cbor_put_int(struct cbor_writer* w, int64_t value);
+void cbor_put_text(struct cbor_writer* w, const char* text, size_t len);
+void cbor_put_bytes(struct cbor_writer* w, const void* data, size_t len);
+void cbor_put_float(struct cbor_writer* w, float value);
+void cbor_put_bool(struct cbor_writer* w, bool value);
+void cbor_put_array(struct cbor_writer* w, size_t count);
+void cbor_put_map(struct cbor_writer* w, size_t count);
+void cbor_put_map_indefinite(struct cbor_writer* w);
+void cbor_put_break(struct cbor_writer* w);
+
+// remember the current position, and go back to it (clearing overflow), e.g. to drop a map entry that didn't fit
+static inline size_t cbor_mark(const struct cbor_writer* w) { return w->len; }
+static inline void cbor_rewind(struct cbor_writer* w, size_t mark) { w->len = mark; w->overflow = false; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_CBOR_H
@@ -0,0 +1,400 @@
+#include <esp_err.h>
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mbedtls/md.h"
+#include "nvs.h"
+
+#include "control_channel.h"
+#include "log_filter.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+#include "net_impair.h"
+#endif
+
+/*
+ * Commands from the log server, received on the same socket the logs go out on. One command per message:
+ *
+ *   wlctl <seq> <command> [args...] <mac>
+ *
+ * mac is the first 16 bytes (32 hex chars) of HMAC-SHA256(CONFIG_LOGGING_SERVER_CONTROL_KEY, "<device_id> <seq> <command> [args...]").
+ * seq must go up with every command (the server uses a millisecond clock), so a captured command can't be replayed,
+ * and including the device id means a command for one device can't be replayed against another. The highest seq
+ * accepted is kept in NVS (namespace CONTROL_NVS_NAMESPACE), so a reboot doesn't reopen the window for commands
+ * captured before it. That needs nvs_flash_init() to have been called, as it is for Wi-Fi; without it the high-water
+ * mark is kept in RAM only and a warning is printed. It's written once per accepted command, which is rare enough
+ * not to matter for flash wear.
+ *
+ * Commands:
+ *   level <tag|*> <N|E|W|I|D|V>     network log level per tag: esp_log_level_set() for ESP_LOGx(), and wifi_log_x()
+ *   rate <lines_per_sec> [burst]    rate limit on everything sent, 0 = off
+ *   batch <max_bytes> <max_wait_ms> how many bytes of queued lines to pack into one datagram, and how long to wait for more
+ *   burst <max_bytes> <max_age_ms>  burst mode thresholds, see wifi_logger_set_burst(). 0 bytes = off
+ *   send <on|off>                   same as udp_logging_set_sending_enabled()
+ *   site <file>[:<line>] <on|off>   mute or unmute wifi_log_x() call sites, see wifi_log_site_set_enabled()
+ *   ping                            replies "pong"
+ *   recorder                        (CONFIG_LOGGING_SERVER_FLIGHT_RECORDER only) send the flight recorder's window now,
+ *                                   see wifi_logger_flight_recorder_flush()
+ *   impair [key=value...|@path]     (CONFIG_LOGGING_SERVER_NET_IMPAIRMENT only) start a new impairment scenario, or the
+ *                                   one in a file, see net_impair.h. no args: reply with the current scenario's stats
+ *   transport [auto|udp|tcp]        (CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT only) pin log data to UDP or TCP, or let
+ *                                   the logger choose, see wifi_logger_set_transport(). no args: reply with what it
+ *                                   measured, see wifi_logger_get_link_stats()
+ */
+
+#define CONTROL_MAC_LEN 16
+#define CONTROL_MAX_ARGS 10
+
+#define CONTROL_NVS_NAMESPACE "wifi_logger"
+#define CONTROL_NVS_SEQ_KEY "ctl_seq"
+
+static unsigned long long s_last_seq = 0;
+static bool s_last_seq_loaded = false;
+
+/**
+ * @brief reads the highest seq accepted before this boot from NVS, once
+ */
+static void load_last_seq(void)
+{
+    if (s_last_seq_loaded)
+        return;
+    s_last_seq_loaded = true;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CONTROL_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        uint64_t seq = 0;
+        err = nvs_get_u64(handle, CONTROL_NVS_SEQ_KEY, &seq);
+        nvs_close(handle);
+        if (err == ESP_OK)
+            s_last_seq = seq;
+    }
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+        printf("control channel: can't read the last command seq from NVS (%s), replays from before this boot aren't rejected\n",
+               esp_err_to_name(err));
+}
+
+/**
+ * @brief stores the highest seq accepted, so it survives a reboot
+ *
+ * @param seq the seq just accepted
+ */
+static void store_last_seq(unsigned long long seq)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CONTROL_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_u64(handle, CONTROL_NVS_SEQ_KEY, seq);
+        if (err == ESP_OK)
+            err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    if (err != ESP_OK)
+        printf("control channel: can't store the last command seq in NVS (%s)\n", esp_err_to_name(err));
+}
+
+bool control_channel_enabled(void)
+{
+    return strlen(CONFIG_LOGGING_SERVER_CONTROL_KEY) > 0;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief checks the mac on a command
+ *
+ * @param body the signed part of the message: "<seq> <command> [args...]"
+ * @param body_len length of body
+ * @param mac_hex the mac as sent, CONTROL_MAC_LEN * 2 hex chars
+ * @return bool true if the mac matches
+ */
+static bool mac_is_valid(const char* body, size_t body_len, const char* mac_hex)
+{
+    const char* device_id = udp_logging_get_device_id();
+    const size_t device_id_len = strlen(device_id);
+
+    // "<device_id> " + body
+    char signed_text[DEVICE_ID_SIZE + 1 + 256];
+    if (device_id_len + 1 + body_len > sizeof(signed_text))
+        return false;
+    memcpy(signed_text, device_id, device_id_len);
+    signed_text[device_id_len] = ' ';
+    memcpy(&signed_text[device_id_len + 1], body, body_len);
+
+    const char* key = CONFIG_LOGGING_SERVER_CONTROL_KEY;
+    uint8_t expected[32];
+    if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const unsigned char*)key, strlen(key),
+                        (const unsigned char*)signed_text, device_id_len + 1 + body_len, expected) != 0)
+        return false;
+
+    // constant time compare, so the mac can't be guessed a byte at a time
+    uint8_t diff = 0;
+    for (size_t i = 0; i < CONTROL_MAC_LEN; i++) {
+        const int hi = hex_value(mac_hex[2 * i]);
+        const int lo = hex_value(mac_hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        diff |= expected[i] ^ (uint8_t)((hi << 4) | lo);
+    }
+
+    return diff == 0;
+}
+
+/**
+ * @brief checks a mac made with the control channel key over "<device_id> <text>", for other messages from the log
+ *        server that only it may send (credit grants, see wifi_logger.c)
+ *
+ * @param text the signed part of the message
+ * @param text_len length of text
+ * @param mac_hex the rest of the message: CONTROL_MAC_LEN * 2 hex chars, and nothing after them
+ * @return bool true if the mac matches. always false without a key
+ */
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    return control_channel_enabled() && strlen(mac_hex) == CONTROL_MAC_LEN * 2 && mac_is_valid(text, text_len, mac_hex);
+}
+
+static bool parse_level(const char* text, esp_log_level_t* level)
+{
+    static const char level_chars[] = "NEWIDV"; // same order as esp_log_level_t
+
+    const char* found = (strlen(text) == 1) ? strchr(level_chars, text[0]) : NULL;
+    if (!found)
+        return false;
+
+    *level = (esp_log_level_t)(found - level_chars);
+    return true;
+}
+
+static bool parse_uint(const char* text, uint32_t* value)
+{
+    char* end = NULL;
+    const unsigned long parsed = strtoul(text, &end, 10);
+    if (!text[0] || *end != '\0')
+        return false;
+
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+/**
+ * @brief runs one (already authenticated) command
+ *
+ * @return const char* NULL on success, otherwise what was wrong with it
+ */
+static const char* run_command(int argc, char** argv)
+{
+    const char* cmd = argv[0];
+
+    if (strcmp(cmd, "level") == 0 && argc == 3)
+    {
+        esp_log_level_t level;
+        if (!parse_level(argv[2], &level))
+            return "bad level";
+        if (!log_filter_set_level(argv[1], level))
+            return "too many tags";
+        esp_log_level_set(argv[1], level);
+        return NULL;
+    }
+
+    if (strcmp(cmd, "rate") == 0 && (argc == 2 || argc == 3))
+    {
+        uint32_t lines_per_sec, burst = 0;
+        if (!parse_uint(argv[1], &lines_per_sec) || (argc == 3 && !parse_uint(argv[2], &burst)))
+            return "bad number";
+        log_filter_set_rate(lines_per_sec, burst ? burst : lines_per_sec);
+        return NULL;
+    }
+
+    if (strcmp(cmd, "batch") == 0 && argc == 3)
+    {
+        uint32_t max_bytes, max_wait_ms;
+        if (!parse_uint(argv[1], &max_bytes) || !parse_uint(argv[2], &max_wait_ms))
+            return "bad number";
+        wifi_logger_set_batching(max_bytes, max_wait_ms);
+        return NULL;
+    }
+
+    if (strcmp(cmd, "burst") == 0 && argc == 3)
+    {
+        uint32_t max_bytes, max_age_ms;
+        if (!parse_uint(argv[1], &max_bytes) || !parse_uint(argv[2], &max_age_ms))
+            return "bad number";
+        wifi_logger_set_burst(max_bytes, max_age_ms);
+        return NULL;
+    }
+
+    if (strcmp(cmd, "send") == 0 && argc == 2)
+    {
+        if (strcmp(argv[1], "on") == 0)
+            udp_logging_set_sending_enabled(true);
+        else if (strcmp(argv[1], "off") == 0)
+            udp_logging_set_sending_enabled(false);
+        else
+            return "expected on|off";
+        return NULL;
+    }
+
+    if (strcmp(cmd, "site") == 0 && argc == 3)
+    {
+        bool enabled;
+        if (strcmp(argv[2], "on") == 0)
+            enabled = true;
+        else if (strcmp(argv[2], "off") == 0)
+            enabled = false;
+        else
+            return "expected on|off";
+
+        uint32_t line = 0;
+        char* colon = strrchr(argv[1], ':');
+        if (colon)
+        {
+            *colon = '\0';
+            if (!parse_uint(&colon[1], &line))
+                return "bad line";
+        }
+        if (wifi_log_site_set_enabled(argv[1], (int) line, enabled) == 0)
+            return "no such site";
+        return NULL;
+    }
+
+    if (strcmp(cmd, "ping") == 0 && argc == 1)
+        return NULL;
+
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+    if (strcmp(cmd, "recorder") == 0 && argc == 1)
+    {
+        wifi_logger_flight_recorder_flush();
+        return NULL;
+    }
+#endif
+
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    if (strcmp(cmd, "impair") == 0 && argc > 1)
+    {
+        char scenario[160] = "";
+        size_t used = 0;
+        for (int i = 1; i < argc && used < sizeof(scenario); i++)
+            used += snprintf(&scenario[used], sizeof(scenario) - used, "%s%s", i > 1 ? " " : "", argv[i]);
+        return net_impair_configure(scenario) ? NULL : "bad scenario";
+    }
+
+    if (strcmp(cmd, "impair") == 0)
+        return NULL; // stats go in the reply
+#endif
+
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (strcmp(cmd, "transport") == 0 && argc == 2)
+    {
+        if (strcmp(argv[1], "auto") == 0)
+            wifi_logger_set_transport(WIFI_LOGGER_TRANSPORT_AUTO);
+        else if (strcmp(argv[1], "udp") == 0)
+            wifi_logger_set_transport(WIFI_LOGGER_TRANSPORT_UDP);
+        else if (strcmp(argv[1], "tcp") == 0)
+            wifi_logger_set_transport(WIFI_LOGGER_TRANSPORT_TCP);
+        else
+            return "expected auto|udp|tcp";
+        return NULL;
+    }
+
+    if (strcmp(cmd, "transport") == 0 && argc == 1)
+        return NULL; // stats go in the reply
+#endif
+
+    return "unknown command";
+}
+
+/**
+ * @brief handles one message received from the log server
+ *
+ * @param message null-terminated message as received
+ * @param reply (out param) text to send back, e.g. "ok 1234 level" or "error 1234 bad level"
+ * @param reply_size size of reply
+ * @return bool false if this isn't a control message at all (reply is left alone, nothing should be sent back)
+ */
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    const size_t prefix_len = strlen(CONTROL_MESSAGE_PREFIX);
+    if (!control_channel_enabled() || strncmp(message, CONTROL_MESSAGE_PREFIX, prefix_len) != 0)
+        return false;
+
+    // copy, so we can chop it up into args
+    char text[256];
+    size_t len = strlen(message) - prefix_len;
+    if (len >= sizeof(text)) {
+        snprintf(reply, reply_size, "error too long");
+        return true;
+    }
+    memcpy(text, &message[prefix_len], len + 1);
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r' || text[len - 1] == ' '))
+        text[--len] = '\0';
+
+    // the mac is the last word, everything before it is signed
+    char* mac = strrchr(text, ' ');
+    if (!mac || strlen(mac + 1) != CONTROL_MAC_LEN * 2 || !mac_is_valid(text, mac - text, mac + 1)) {
+        snprintf(reply, reply_size, "error auth");
+        return true;
+    }
+    *mac = '\0';
+
+    load_last_seq();
+
+    char* save = NULL;
+    char* seq_text = strtok_r(text, " ", &save);
+    char* end = NULL;
+    const unsigned long long seq = seq_text ? strtoull(seq_text, &end, 10) : 0;
+    if (!seq_text || *end != '\0' || seq <= s_last_seq) {
+        snprintf(reply, reply_size, "error %s replayed", seq_text ? seq_text : "-");
+        return true;
+    }
+    s_last_seq = seq;
+    store_last_seq(seq);
+
+    char* argv[CONTROL_MAX_ARGS];
+    int argc = 0;
+    char* arg;
+    while (argc < CONTROL_MAX_ARGS && (arg = strtok_r(NULL, " ", &save)) != NULL)
+        argv[argc++] = arg;
+
+    if (argc == 0) {
+        snprintf(reply, reply_size, "error %llu no command", seq);
+        return true;
+    }
+
+    const char* error = run_command(argc, argv);
+    if (error)
+        snprintf(reply, reply_size, "error %llu %s", seq, error);
+    else if (strcmp(argv[0], "ping") == 0)
+        snprintf(reply, reply_size, "pong %llu", seq);
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    else if (strcmp(argv[0], "impair") == 0 && argc == 1) {
+        struct net_impair_stats stats;
+        net_impair_get_stats(&stats);
+        snprintf(reply, reply_size, "ok %llu impair sent=%u lost=%u failed=%u delayed_ms=%u blocked_ms=%u", seq,
+                 (unsigned)stats.sent, (unsigned)stats.lost, (unsigned)stats.failed, (unsigned)stats.delayed_ms,
+                 (unsigned)stats.blocked_ms);
+    }
+#endif
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    else if (strcmp(argv[0], "transport") == 0 && argc == 1) {
+        struct wifi_logger_link_stats stats;
+        wifi_logger_get_link_stats(&stats);
+        snprintf(reply, reply_size, "ok %llu transport %s loss=%u%% samples=%u rtt_ms=%u switches=%u tcp_stall=%u%%", seq,
+                 stats.transport == WIFI_LOGGER_TRANSPORT_TCP ? "tcp" : "udp", stats.loss_percent, stats.samples,
+                 (unsigned)stats.rtt_ms, (unsigned)stats.switches, stats.tcp_stall_percent);
+    }
+#endif
+    else
+        snprintf(reply, reply_size, "ok %llu %s", seq, argv[0]);
+
+    return true;
+}
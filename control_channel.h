@@ -0,0 +1,22 @@
+#ifndef WIFI_LOGGER_CONTROL_CHANNEL_H
+#define WIFI_LOGGER_CONTROL_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// every control message starts with this
+#define CONTROL_MESSAGE_PREFIX "wlctl "
+
+bool control_channel_enabled(void);
+bool control_channel_handle(const char* message, char* reply, size_t reply_size);
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_CONTROL_CHANNEL_H
@@ -0,0 +1,151 @@
+#include <esp_random.h>
+#include <stdio.h>
+#include <string.h>
+#include "mbedtls/gcm.h"
+
+#include "datagram_crypto.h"
+
+/*
+ * Optional encryption of everything the logger sends, with AES-256-GCM and the pre-shared
+ * CONFIG_LOGGING_SERVER_ENCRYPTION_KEY. It's done once per datagram, so a batch of lines costs one seal, not one per line.
+ *
+ * nonce = [salt, 8 bytes] [counter, 4 bytes big-endian]. The salt is random at every start, and picked again before the
+ * counter wraps, so a nonce is never used twice with the same key. The magic byte and nonce are authenticated too.
+ *
+ * The collector seals whatever it sends back (probe acks, credit grants, commands) the same way, with a random nonce,
+ * and datagram_crypto_open() drops anything that isn't: acks and grants decide what we send, so with a key they must
+ * come from someone who has it too.
+ *
+ * Only the logger task calls datagram_crypto_seal() and datagram_crypto_open().
+ */
+
+#define DATAGRAM_KEY_SIZE   32
+#define DATAGRAM_SALT_SIZE  8
+
+static const char *TAG = "wifi_logger_crypto";
+
+static mbedtls_gcm_context s_gcm;
+static bool s_ready = false;
+static uint8_t s_salt[DATAGRAM_SALT_SIZE];
+static uint32_t s_counter = 0;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void new_salt(void)
+{
+    esp_fill_random(s_salt, sizeof(s_salt));
+    s_counter = 0;
+}
+
+/**
+ * @brief sets up the key. call before datagram_crypto_seal()
+ *
+ * @return bool false if the key isn't 64 hex chars. nothing must be sent then: it would go out in the clear
+ */
+bool datagram_crypto_init(void)
+{
+    if (s_ready)
+        return true;
+
+    const char* key_hex = CONFIG_LOGGING_SERVER_ENCRYPTION_KEY;
+    if (strlen(key_hex) != DATAGRAM_KEY_SIZE * 2) {
+        printf("%s: encryption key must be %d hex chars\n", TAG, DATAGRAM_KEY_SIZE * 2);
+        return false;
+    }
+
+    uint8_t key[DATAGRAM_KEY_SIZE];
+    for (int i = 0; i < DATAGRAM_KEY_SIZE; i++)
+    {
+        const int hi = hex_value(key_hex[i * 2]);
+        const int lo = hex_value(key_hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            printf("%s: encryption key must be %d hex chars\n", TAG, DATAGRAM_KEY_SIZE * 2);
+            return false;
+        }
+        key[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    mbedtls_gcm_init(&s_gcm);
+    const int err = mbedtls_gcm_setkey(&s_gcm, MBEDTLS_CIPHER_ID_AES, key, DATAGRAM_KEY_SIZE * 8);
+    memset(key, 0, sizeof(key));
+    if (err != 0) {
+        printf("%s: setting the key failed: %d\n", TAG, err);
+        mbedtls_gcm_free(&s_gcm);
+        return false;
+    }
+
+    new_salt();
+    s_ready = true;
+    return true;
+}
+
+/**
+ * @brief encrypts and authenticates one datagram
+ *
+ * @param payload what would have been sent
+ * @param len length of payload
+ * @param out where to put the sealed datagram. may not overlap payload
+ * @param out_size size of out: at least len + DATAGRAM_SEAL_OVERHEAD
+ * @return int length of the sealed datagram, -1 on error
+ */
+int datagram_crypto_seal(const uint8_t* payload, size_t len, uint8_t* out, size_t out_size)
+{
+    if (!s_ready || len + DATAGRAM_SEAL_OVERHEAD > out_size)
+        return -1;
+
+    if (s_counter == UINT32_MAX)
+        new_salt();
+    const uint32_t counter = s_counter++;
+
+    uint8_t* nonce = &out[1];
+    out[0] = DATAGRAM_SEALED_MAGIC;
+    memcpy(nonce, s_salt, DATAGRAM_SALT_SIZE);
+    nonce[8] = (uint8_t)(counter >> 24);
+    nonce[9] = (uint8_t)(counter >> 16);
+    nonce[10] = (uint8_t)(counter >> 8);
+    nonce[11] = (uint8_t)counter;
+
+    const size_t header_len = 1 + DATAGRAM_NONCE_SIZE;
+    const int err = mbedtls_gcm_crypt_and_tag(&s_gcm, MBEDTLS_GCM_ENCRYPT, len,
+                                              nonce, DATAGRAM_NONCE_SIZE, out, header_len,
+                                              payload, &out[header_len],
+                                              DATAGRAM_TAG_SIZE, &out[header_len + len]);
+    if (err != 0)
+        return -1;
+
+    return (int)(len + DATAGRAM_SEAL_OVERHEAD);
+}
+
+/**
+ * @brief checks and decrypts one datagram sealed with our key, by the collector
+ *
+ * @param sealed what was received
+ * @param len length of sealed
+ * @param out where to put what the collector would have sent in the clear. may not overlap sealed
+ * @param out_size size of out
+ * @return int length of the opened datagram, -1 if it isn't sealed with our key (or doesn't fit)
+ */
+int datagram_crypto_open(const uint8_t* sealed, size_t len, uint8_t* out, size_t out_size)
+{
+    if (!s_ready || len < DATAGRAM_SEAL_OVERHEAD || sealed[0] != DATAGRAM_SEALED_MAGIC)
+        return -1;
+
+    const size_t header_len = 1 + DATAGRAM_NONCE_SIZE;
+    const size_t payload_len = len - DATAGRAM_SEAL_OVERHEAD;
+    if (payload_len > out_size)
+        return -1;
+
+    const int err = mbedtls_gcm_auth_decrypt(&s_gcm, payload_len, &sealed[1], DATAGRAM_NONCE_SIZE, sealed, header_len,
+                                             &sealed[header_len + payload_len], DATAGRAM_TAG_SIZE,
+                                             &sealed[header_len], out);
+    if (err != 0)
+        return -1;
+
+    return (int)payload_len;
+}
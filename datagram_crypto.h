@@ -0,0 +1,30 @@
+#ifndef WIFI_LOGGER_DATAGRAM_CRYPTO_H
+#define WIFI_LOGGER_DATAGRAM_CRYPTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A sealed datagram. Nothing else we send starts with this byte: text is printable, records start with LOG_RECORD_MAGIC.
+ *
+ *   [DATAGRAM_SEALED_MAGIC] [nonce, 12 bytes] [ciphertext] [tag, 16 bytes]
+ */
+#define DATAGRAM_SEALED_MAGIC   0x1d    // ASCII "group separator"
+#define DATAGRAM_NONCE_SIZE     12
+#define DATAGRAM_TAG_SIZE       16
+#define DATAGRAM_SEAL_OVERHEAD  (1 + DATAGRAM_NONCE_SIZE + DATAGRAM_TAG_SIZE)
+
+bool datagram_crypto_init(void);
+int datagram_crypto_seal(const uint8_t* payload, size_t len, uint8_t* out, size_t out_size);
+int datagram_crypto_open(const uint8_t* sealed, size_t len, uint8_t* out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_DATAGRAM_CRYPTO_H
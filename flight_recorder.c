@@ -0,0 +1,249 @@
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+
+#include "flight_recorder.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+/*
+ * The flight recorder: lines below CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_SEND_LEVEL aren't queued, they're copied into
+ * a ring in RAM as they were formatted, and nothing else happens to them. The device id, colors and the heap copy the
+ * logger task needs only happen to the ones that get sent, when an ERROR (or wifi_logger_flight_recorder_flush())
+ * asks for the last CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_WINDOW_MS of them.
+ *
+ * Each line in the ring, at any byte offset (lines wrap around the end):
+ *   [length of text, 2 bytes] [level, | FLIGHT_RECORDER_HAS_HEADER] [timestamp ms, 4] [text]
+ *
+ * Positions are absolute byte counts that only go up (and wrap at 2^32): head is where the next line goes, tail is the
+ * oldest line still there, flush_pos the next one to send. Writers make room by moving tail past the oldest lines;
+ * a flush that gets overtaken skips ahead with it.
+ *
+ * Only making room and writing the header happen in the critical section. The header is marked
+ * FLIGHT_RECORDER_PENDING until the text has been copied in, outside of it: a flush stops at a pending line until
+ * it's done, and a writer that would have to overwrite one drops its own line instead.
+ */
+
+#define FLIGHT_RECORDER_SIZE CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_SIZE
+#define FLIGHT_RECORDER_LINE_HEADER_SIZE 7
+// the text of ESP_LOGx() lines already starts with "I (1234) tag: ", colors and all
+#define FLIGHT_RECORDER_HAS_HEADER 0x80
+// the text is still being copied in
+#define FLIGHT_RECORDER_PENDING 0x40
+// longer lines are cut short. they're context, and this keeps a single line from taking over the ring. ESP_LOGx()
+// lines are formatted on the stack of whichever task logs them, so no more than 256 bytes either
+#define FLIGHT_RECORDER_MAX_TEXT MIN(MIN(CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE, FLIGHT_RECORDER_SIZE / 4), 256)
+// how many recorded lines the logger task queues each time around its loop while flushing
+#define FLIGHT_RECORDER_LINES_PER_PASS 8
+
+static uint8_t s_ring[FLIGHT_RECORDER_SIZE];
+static uint32_t s_head;
+static uint32_t s_tail;
+static uint32_t s_flush_pos;
+static uint32_t s_flush_end;            // flush up to here, i.e. what had been recorded when it was asked for
+static uint32_t s_flush_from_ms;        // lines older than this aren't part of the flush
+static bool s_flush_announce;           // the flush hasn't sent its first line yet
+static bool s_triggered = false;
+static uint32_t s_last_trigger_ms;
+static portMUX_TYPE s_recorder_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// where the logger task puts a line it's about to send. only ever touched by the logger task
+static char s_flush_line[FLIGHT_RECORDER_MAX_TEXT + 1];
+
+static void ring_write(uint32_t pos, const void* data, size_t len)
+{
+    const size_t offset = pos % FLIGHT_RECORDER_SIZE;
+    const size_t first = MIN(len, FLIGHT_RECORDER_SIZE - offset);
+    memcpy(&s_ring[offset], data, first);
+    memcpy(s_ring, (const uint8_t*)data + first, len - first);
+}
+
+static void ring_read(uint32_t pos, void* data, size_t len)
+{
+    const size_t offset = pos % FLIGHT_RECORDER_SIZE;
+    const size_t first = MIN(len, FLIGHT_RECORDER_SIZE - offset);
+    memcpy(data, &s_ring[offset], first);
+    memcpy((uint8_t*)data + first, s_ring, len - first);
+}
+
+static uint32_t ring_line_size(uint32_t pos)
+{
+    uint8_t len[2];
+    ring_read(pos, len, sizeof(len));
+    return FLIGHT_RECORDER_LINE_HEADER_SIZE + ((uint32_t)len[0] << 8 | len[1]);
+}
+
+static bool ring_line_pending(uint32_t pos)
+{
+    uint8_t level_and_flags;
+    ring_read(pos + 2, &level_and_flags, 1);
+    return (level_and_flags & FLIGHT_RECORDER_PENDING) != 0;
+}
+
+/**
+ * @brief keeps one line in the recorder instead of sending it
+ *
+ * @param level level of the line
+ * @param has_header true if text already starts with the level and timestamp (an ESP_LOGx() line)
+ * @param text the line as formatted, without device id. doesn't need to be null-terminated
+ * @param len length of text. only the first FLIGHT_RECORDER_MAX_TEXT bytes are kept
+ */
+void flight_recorder_capture(esp_log_level_t level, bool has_header, const char* text, size_t len)
+{
+    len = MIN(len, FLIGHT_RECORDER_MAX_TEXT);
+    const uint32_t size = FLIGHT_RECORDER_LINE_HEADER_SIZE + len;
+    const uint32_t timestamp = esp_log_timestamp();
+    const uint8_t level_and_flags = (uint8_t)level | (has_header ? FLIGHT_RECORDER_HAS_HEADER : 0);
+    const uint8_t header[FLIGHT_RECORDER_LINE_HEADER_SIZE] = {
+        (uint8_t)(len >> 8), (uint8_t)len,
+        level_and_flags | FLIGHT_RECORDER_PENDING,
+        (uint8_t)(timestamp >> 24), (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 8), (uint8_t)timestamp,
+    };
+
+    // reserve the space...
+    portENTER_CRITICAL(&s_recorder_lock);
+    while (s_head + size - s_tail > FLIGHT_RECORDER_SIZE) {
+        if (ring_line_pending(s_tail)) {
+            // another task is still copying the oldest line in. the ring is tiny or flooded: this line is the one lost
+            portEXIT_CRITICAL(&s_recorder_lock);
+            return;
+        }
+        s_tail += ring_line_size(s_tail);
+    }
+    const uint32_t pos = s_head;
+    ring_write(pos, header, sizeof(header));
+    s_head += size;
+    portEXIT_CRITICAL(&s_recorder_lock);
+
+    // ...copy the text in without holding anyone up, then let it be read
+    ring_write(pos + sizeof(header), text, len);
+    portENTER_CRITICAL(&s_recorder_lock);
+    ring_write(pos + 2, &level_and_flags, 1);
+    portEXIT_CRITICAL(&s_recorder_lock);
+}
+
+/**
+ * @brief (ESP_LOGx() hook) formats a line esp_log handed us, keeps it in the recorder, and prints it to the console
+ *
+ * @param level from log_filter_line_level()
+ * @param fmt logger string format
+ * @param args arguments
+ * @return int number of chars written to the console, like vprintf
+ */
+int flight_recorder_capture_v(esp_log_level_t level, const char* fmt, va_list args)
+{
+    // formatted once, on the stack, for both the recorder and the console
+    char line[FLIGHT_RECORDER_MAX_TEXT + 1];
+    va_list console_args;
+    va_copy(console_args, args);
+    const int len = vsnprintf(line, sizeof(line), fmt, args);
+
+    if (len < 0) {
+        va_end(console_args);
+        return len;
+    }
+
+    if ((size_t)len < sizeof(line)) {
+        flight_recorder_capture(level, true, line, len);
+        fputs(line, stdout);
+        va_end(console_args);
+        return len;
+    }
+
+    // too long for the recorder, which keeps the start of it. the console still gets all of it
+    line[sizeof(line) - 2] = '\n';
+    flight_recorder_capture(level, true, line, sizeof(line) - 1);
+    const int printed = vprintf(fmt, console_args);
+    va_end(console_args);
+    return printed;
+}
+
+/**
+ * @brief asks the logger task to send the recorded lines from the window before now
+ *
+ * @param forced false for an ERROR: ignored within CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_HOLDOFF_MS of the last one
+ */
+void flight_recorder_trigger(bool forced)
+{
+    const uint32_t now = esp_log_timestamp();
+
+    portENTER_CRITICAL(&s_recorder_lock);
+    if (forced || !s_triggered || now - s_last_trigger_ms >= CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_HOLDOFF_MS) {
+        if (!forced) {
+            s_triggered = true;
+            s_last_trigger_ms = now;
+        }
+        // a new flush starts from the oldest line there is, the window picks out which ones get sent
+        if ((int32_t)(s_flush_end - s_flush_pos) <= 0)
+            s_flush_pos = s_tail;
+        s_flush_end = s_head;
+        s_flush_from_ms = now - CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_WINDOW_MS;
+        s_flush_announce = true;
+    }
+    portEXIT_CRITICAL(&s_recorder_lock);
+}
+
+void wifi_logger_flight_recorder_flush(void)
+{
+    flight_recorder_trigger(true);
+}
+
+/**
+ * @brief queues a line, formatted the way it would have been if it had been sent when it was logged
+ */
+static void queue_recorded_line(uint8_t level_and_flags, uint32_t timestamp, const char* text)
+{
+    const bool has_header = (level_and_flags & FLIGHT_RECORDER_HAS_HEADER) != 0;
+    const uint8_t level = level_and_flags & ~FLIGHT_RECORDER_HAS_HEADER;
+    const uint8_t log_level_opt = (level >= ESP_LOG_ERROR && level <= ESP_LOG_VERBOSE) ? level - ESP_LOG_ERROR : 2;
+
+    char* message = generate_log_message_timestamp_and_device_id(true, !has_header, log_level_opt, timestamp, text);
+    if (!message)
+        return;
+
+    const struct log_queue_item item = { .message = message };
+    if (send_to_queue(&item, 0) != ESP_OK)
+        free(message);
+}
+
+/**
+ * @brief (logger task) queues the next few lines of a flush, if one is going on
+ */
+void flight_recorder_pump(void)
+{
+    for (int i = 0; i < FLIGHT_RECORDER_LINES_PER_PASS; i++) {
+        uint8_t header[FLIGHT_RECORDER_LINE_HEADER_SIZE];
+
+        portENTER_CRITICAL(&s_recorder_lock);
+        if ((int32_t)(s_flush_pos - s_tail) < 0)
+            s_flush_pos = s_tail; // overwritten before we got to them
+        if ((int32_t)(s_flush_end - s_flush_pos) <= 0 || ring_line_pending(s_flush_pos)) {
+            // done, or the next line is still being written: it's read next time around
+            portEXIT_CRITICAL(&s_recorder_lock);
+            return;
+        }
+        ring_read(s_flush_pos, header, sizeof(header));
+        const size_t len = (size_t)header[0] << 8 | header[1];
+        ring_read(s_flush_pos + sizeof(header), s_flush_line, len);
+        s_flush_pos += sizeof(header) + len;
+        const bool announce = s_flush_announce;
+        s_flush_announce = false;
+        const uint32_t flush_from_ms = s_flush_from_ms;
+        portEXIT_CRITICAL(&s_recorder_lock);
+
+        const uint32_t timestamp = (uint32_t)header[3] << 24 | (uint32_t)header[4] << 16 | (uint32_t)header[5] << 8 | header[6];
+        if ((int32_t)(timestamp - flush_from_ms) < 0)
+            continue; // before the window
+
+        if (announce)
+            queue_recorded_line(ESP_LOG_WARN, timestamp, "wifi_logger: flight recorder, lines that weren't sent at the time:");
+
+        // ESP_LOGx() lines end in a newline already, wifi_log_x() ones get one from utils.cpp
+        s_flush_line[len] = '\0';
+        queue_recorded_line(header[2], timestamp, s_flush_line);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef WIFI_LOGGER_FLIGHT_RECORDER_H
+#define WIFI_LOGGER_FLIGHT_RECORDER_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_log.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void flight_recorder_capture(esp_log_level_t level, bool has_header, const char* text, size_t len);
+int flight_recorder_capture_v(esp_log_level_t level, const char* fmt, va_list args);
+void flight_recorder_trigger(bool forced);
+void flight_recorder_pump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_FLIGHT_RECORDER_H
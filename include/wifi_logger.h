@@ -1,6 +1,12 @@
 #ifndef WIFI_LOGGER_H
 #define WIFI_LOGGER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,27 +16,377 @@ extern "C" {
 // caller-supplied id.
 #define DEVICE_ID_SIZE 32
 
+// how many collectors can back up the one in wifi_logger_config.host/port
+#define WIFI_LOGGER_MAX_FALLBACK_COLLECTORS 3
+
+struct wifi_logger_collector {
+    char host[128];
+    int port;
+};
+
 struct wifi_logger_config {
     char host[128];
     int port;
     bool route_esp_idf_api_logs_to_wifi;
     char device_id[DEVICE_ID_SIZE]; // if empty string, defaults to the efuse MAC address
+    // (UDP only) tried in order when the collector in use stops answering probes, see CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS.
+    // the list ends at the first one with port 0. add these with wifi_logger_add_fallback_collector()
+    struct wifi_logger_collector fallback[WIFI_LOGGER_MAX_FALLBACK_COLLECTORS];
+};
+
+/**
+ * Log sites: every wifi_log_x() call gets a static descriptor, kept in the .wifi_log_sites linker section (see
+ * linker.lf), so all of them can be found and muted one by one at runtime (wifi_log_site_set_enabled(), or the
+ * control channel's "site" command).
+ *
+ * A muted site, or any site while sending is off, costs one load and a branch: its arguments aren't evaluated.
+ * Sites above WIFI_LOG_LOCAL_LEVEL aren't compiled in at all (their format string is still checked).
+ * fmt must be a string literal.
+ *
+ * A site whose fmt has no conversions and that passes no arguments (wifi_log_i(TAG, "state entered")) has nothing to
+ * format: the compiler sees that, and the call queues a reference to the literal instead of a formatted copy of the
+ * line. What the logging task pays is the same whatever the length. UDP only, native output format only: otherwise
+ * (or when the line goes to the flight recorder) it's formatted like any other.
+ */
+#define WIFI_LOG_SITE_MUTED         0x01 // wifi_log_site_set_enabled(..., false)
+#define WIFI_LOG_SITE_SENDING_OFF   0x02 // udp_logging_set_sending_enabled(false)
+
+struct wifi_log_site {
+    const char* tag; // filled in the first time the site logs: TAG is usually a variable, not a constant
+    const char* file;
+    const char* func;
+    const char* fmt;
+    uint32_t line;             // not 16 bits: generated and amalgamated sources go past 65535 lines
+    uint8_t level;             // esp_log_level_t
+    volatile uint8_t disabled; // WIFI_LOG_SITE_x bits. 0 = log
+};
+
+// like LOG_LOCAL_LEVEL: define it before including this header to change the floor for one file
+#ifndef WIFI_LOG_LOCAL_LEVEL
+#ifdef CONFIG_LOGGING_SERVER_MAXIMUM_LEVEL
+#define WIFI_LOG_LOCAL_LEVEL CONFIG_LOGGING_SERVER_MAXIMUM_LEVEL
+#else
+#define WIFI_LOG_LOCAL_LEVEL 5 // ESP_LOG_VERBOSE
+#endif
+#endif
+
+// true if a wifi_log_x() call has nothing to format. a constant expression, for string literals
+#define WIFI_LOG_NO_ARGS(...) (sizeof(#__VA_ARGS__) == 1)
+#define WIFI_LOG_IS_CONSTANT(FMT, ...) (WIFI_LOG_NO_ARGS(__VA_ARGS__) && __builtin_strchr(FMT, '%') == NULL)
+
+#define WIFI_LOG_SITE(LEVEL, TAG, FMT, ...) do { \
+        static struct wifi_log_site wifi_log_site_ __attribute__((section(".wifi_log_sites"), used, aligned(4))) = \
+            { .file = __FILE__, .func = __func__, .fmt = FMT, .line = __LINE__, .level = LEVEL }; \
+        if (!wifi_log_site_.disabled) { \
+            if (WIFI_LOG_IS_CONSTANT(FMT, __VA_ARGS__)) \
+                wifi_log_site_static(&wifi_log_site_, TAG, FMT); \
+            else \
+                wifi_log_site_message(&wifi_log_site_, TAG, FMT, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+// compiled out: nothing is evaluated, but the compiler still checks the format string against the arguments
+#define WIFI_LOG_SITE_DISABLED(TAG, FMT, ...) do { \
+        if (0) { \
+            (void) (TAG); \
+            wifi_log_check_format(FMT, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#if WIFI_LOG_LOCAL_LEVEL >= 1
+#define wifi_log_e(TAG, fmt, ...) WIFI_LOG_SITE(ESP_LOG_ERROR, TAG, fmt, ##__VA_ARGS__)
+#else
+#define wifi_log_e(TAG, fmt, ...) WIFI_LOG_SITE_DISABLED(TAG, fmt, ##__VA_ARGS__)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 2
+#define wifi_log_w(TAG, fmt, ...) WIFI_LOG_SITE(ESP_LOG_WARN, TAG, fmt, ##__VA_ARGS__)
+#else
+#define wifi_log_w(TAG, fmt, ...) WIFI_LOG_SITE_DISABLED(TAG, fmt, ##__VA_ARGS__)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 3
+#define wifi_log_i(TAG, fmt, ...) WIFI_LOG_SITE(ESP_LOG_INFO, TAG, fmt, ##__VA_ARGS__)
+#else
+#define wifi_log_i(TAG, fmt, ...) WIFI_LOG_SITE_DISABLED(TAG, fmt, ##__VA_ARGS__)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 4
+#define wifi_log_d(TAG, fmt, ...) WIFI_LOG_SITE(ESP_LOG_DEBUG, TAG, fmt, ##__VA_ARGS__)
+#else
+#define wifi_log_d(TAG, fmt, ...) WIFI_LOG_SITE_DISABLED(TAG, fmt, ##__VA_ARGS__)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 5
+#define wifi_log_v(TAG, fmt, ...) WIFI_LOG_SITE(ESP_LOG_VERBOSE, TAG, fmt, ##__VA_ARGS__)
+#else
+#define wifi_log_v(TAG, fmt, ...) WIFI_LOG_SITE_DISABLED(TAG, fmt, ##__VA_ARGS__)
+#endif
+
+/**
+ * Lines that are already text, and stay as they are: text is logged as it is (no formatting), and only a reference to
+ * it is queued. The logging task pays the same whatever its length; the logger task reads the text when it sends the
+ * line, which can be a while later (burst mode, a slow link), so it must stay valid and unchanged until then: a string
+ * literal, a const table, or a buffer that's only ever written once. Same fallback as above.
+ *
+ * Example: wifi_log_static_i(TAG, s_state_names[state]);
+ */
+#define WIFI_LOG_STATIC_SITE(LEVEL, TAG, TEXT) do { \
+        static struct wifi_log_site wifi_log_site_ __attribute__((section(".wifi_log_sites"), used, aligned(4))) = \
+            { .file = __FILE__, .func = __func__, .fmt = "%s", .line = __LINE__, .level = LEVEL }; \
+        if (!wifi_log_site_.disabled) \
+            wifi_log_site_static(&wifi_log_site_, TAG, TEXT); \
+    } while (0)
+
+#define WIFI_LOG_STATIC_SITE_DISABLED(TAG, TEXT) do { \
+        if (0) { \
+            (void) (TAG); \
+            (void) (TEXT); \
+        } \
+    } while (0)
+
+#if WIFI_LOG_LOCAL_LEVEL >= 1
+#define wifi_log_static_e(TAG, text) WIFI_LOG_STATIC_SITE(ESP_LOG_ERROR, TAG, text)
+#else
+#define wifi_log_static_e(TAG, text) WIFI_LOG_STATIC_SITE_DISABLED(TAG, text)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 2
+#define wifi_log_static_w(TAG, text) WIFI_LOG_STATIC_SITE(ESP_LOG_WARN, TAG, text)
+#else
+#define wifi_log_static_w(TAG, text) WIFI_LOG_STATIC_SITE_DISABLED(TAG, text)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 3
+#define wifi_log_static_i(TAG, text) WIFI_LOG_STATIC_SITE(ESP_LOG_INFO, TAG, text)
+#else
+#define wifi_log_static_i(TAG, text) WIFI_LOG_STATIC_SITE_DISABLED(TAG, text)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 4
+#define wifi_log_static_d(TAG, text) WIFI_LOG_STATIC_SITE(ESP_LOG_DEBUG, TAG, text)
+#else
+#define wifi_log_static_d(TAG, text) WIFI_LOG_STATIC_SITE_DISABLED(TAG, text)
+#endif
+#if WIFI_LOG_LOCAL_LEVEL >= 5
+#define wifi_log_static_v(TAG, text) WIFI_LOG_STATIC_SITE(ESP_LOG_VERBOSE, TAG, text)
+#else
+#define wifi_log_static_v(TAG, text) WIFI_LOG_STATIC_SITE_DISABLED(TAG, text)
+#endif
+
+/**
+ * Structured logging: typed key/value fields, sent as a compact binary record instead of a formatted text line.
+ * No printf on the device, and nothing to parse on the server: tools/wifi_log_collector.py decodes these to JSON Lines.
+ *
+ * Keys are interned by pointer, so use string literals (or anything else that lives forever) for them.
+ *
+ * Example: wifi_log_kv_i(TAG, WIFI_KV_INT("rssi", rssi), WIFI_KV_UINT("heap", free_heap), WIFI_KV_STR("state", "idle"));
+ */
+enum wifi_log_kv_type {
+    WIFI_LOG_KV_INT,
+    WIFI_LOG_KV_UINT,
+    WIFI_LOG_KV_FLOAT,
+    WIFI_LOG_KV_BOOL,
+    WIFI_LOG_KV_STR,
 };
 
-#define wifi_log_e(TAG, fmt, ...) generate_log_message(ESP_LOG_ERROR, TAG, __LINE__, __func__, fmt, __VA_ARGS__)
-#define wifi_log_w(TAG, fmt, ...) generate_log_message(ESP_LOG_WARN, TAG, __LINE__, __func__, fmt, __VA_ARGS__)
-#define wifi_log_i(TAG, fmt, ...) generate_log_message(ESP_LOG_INFO, TAG, __LINE__, __func__, fmt, __VA_ARGS__)
-#define wifi_log_d(TAG, fmt, ...) generate_log_message(ESP_LOG_DEBUG, TAG, __LINE__, __func__, fmt, __VA_ARGS__)
-#define wifi_log_v(TAG, fmt, ...) generate_log_message(ESP_LOG_VERBOSE, TAG, __LINE__, __func__, fmt, __VA_ARGS__)
+struct wifi_log_kv {
+    const char* key;
+    enum wifi_log_kv_type type;
+    union {
+        int32_t i;
+        uint32_t u;
+        float f;
+        bool b;
+        const char* s;
+    } value;
+};
+
+#define WIFI_KV_INT(KEY, VAL)   ((struct wifi_log_kv){ .key = (KEY), .type = WIFI_LOG_KV_INT, .value.i = (VAL) })
+#define WIFI_KV_UINT(KEY, VAL)  ((struct wifi_log_kv){ .key = (KEY), .type = WIFI_LOG_KV_UINT, .value.u = (VAL) })
+#define WIFI_KV_FLOAT(KEY, VAL) ((struct wifi_log_kv){ .key = (KEY), .type = WIFI_LOG_KV_FLOAT, .value.f = (VAL) })
+#define WIFI_KV_BOOL(KEY, VAL)  ((struct wifi_log_kv){ .key = (KEY), .type = WIFI_LOG_KV_BOOL, .value.b = (VAL) })
+#define WIFI_KV_STR(KEY, VAL)   ((struct wifi_log_kv){ .key = (KEY), .type = WIFI_LOG_KV_STR, .value.s = (VAL) })
+
+#define WIFI_LOG_KV(LEVEL, TAG, ...) do { \
+        const struct wifi_log_kv wifi_log_kv_fields_[] = { __VA_ARGS__ }; \
+        wifi_log_kv(LEVEL, TAG, wifi_log_kv_fields_, sizeof(wifi_log_kv_fields_) / sizeof(wifi_log_kv_fields_[0])); \
+    } while (0)
+
+#define wifi_log_kv_e(TAG, ...) WIFI_LOG_KV(ESP_LOG_ERROR, TAG, __VA_ARGS__)
+#define wifi_log_kv_w(TAG, ...) WIFI_LOG_KV(ESP_LOG_WARN, TAG, __VA_ARGS__)
+#define wifi_log_kv_i(TAG, ...) WIFI_LOG_KV(ESP_LOG_INFO, TAG, __VA_ARGS__)
+#define wifi_log_kv_d(TAG, ...) WIFI_LOG_KV(ESP_LOG_DEBUG, TAG, __VA_ARGS__)
+#define wifi_log_kv_v(TAG, ...) WIFI_LOG_KV(ESP_LOG_VERBOSE, TAG, __VA_ARGS__)
+
+/**
+ * Tracing, for profiling firmware: spans and counters, recorded as fixed size binary events with a cycle counter
+ * timestamp, and sent alongside the logs. Each one is a few dozen cycles with interrupts masked, and works from ISRs.
+ * tools/wifi_log_collector.py --trace writes them out as Chrome trace / Perfetto JSON.
+ *
+ * ids are yours to choose; give the collector a --trace-names file to name them.
+ * Needs CONFIG_LOGGING_SERVER_TRACE, otherwise these do nothing.
+ *
+ * Example: wifi_trace_begin(TRACE_FFT); fft(samples); wifi_trace_end(TRACE_FFT); wifi_trace_counter(TRACE_HEAP, free_heap);
+ */
+#if CONFIG_LOGGING_SERVER_TRACE==1
+void wifi_trace_begin(uint16_t id);
+void wifi_trace_end(uint16_t id);
+void wifi_trace_counter(uint16_t id, int32_t value);
+#else
+static inline void wifi_trace_begin(uint16_t id) { (void) id; }
+static inline void wifi_trace_end(uint16_t id) { (void) id; }
+static inline void wifi_trace_counter(uint16_t id, int32_t value) { (void) id; (void) value; }
+#endif
+
+/**
+ * Metrics: counters, gauges and histograms, aggregated where they're updated and sent as one record per
+ * CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS (tools/wifi_log_collector.py writes them out as JSON Lines), instead of a
+ * log line per event. An update is a few 32-bit atomic operations, which the ESP32 does without a lock, so it's safe from
+ * any task or ISR (histogram bounds are kept in DRAM, so that holds with the flash cache off too); nothing is formatted
+ * or queued. Values and sums are 32 bits: a histogram's sum wraps if one interval's observations add up past 2^31.
+ *
+ * Define each metric once, at file scope. Its descriptor goes in the .wifi_metrics linker section (see linker.lf), so
+ * the logger task finds every one of them without registering anything. name must be a string literal.
+ * Each record carries what changed since the last one: counters send how much they went up, histograms the values
+ * observed (count, sum and per-bucket counts), gauges their last value, if it was set.
+ * Needs CONFIG_LOGGING_SERVER_METRICS, otherwise updates do nothing.
+ *
+ * Example:
+ *   WIFI_METRIC_COUNTER(s_retries, "retry");
+ *   WIFI_METRIC_GAUGE(s_heap, "heap");
+ *   WIFI_METRIC_HISTOGRAM(s_rtt, "rtt_ms", 5, 10, 20, 50, 100);   // buckets <=5, <=10, ... <=100, >100
+ *   wifi_metric_add(&s_retries, 1); wifi_metric_set(&s_heap, free_heap); wifi_metric_observe(&s_rtt, rtt);
+ */
+enum wifi_metric_type {
+    WIFI_METRIC_TYPE_COUNTER,
+    WIFI_METRIC_TYPE_GAUGE,
+    WIFI_METRIC_TYPE_HISTOGRAM,
+};
+
+struct wifi_metric {
+    const char* name;
+    const int32_t* bounds;  // histograms: upper bounds of the buckets, ascending. the last bucket has no upper bound
+    uint32_t* buckets;      // histograms: num_bounds + 1 counts
+    uint8_t type;           // enum wifi_metric_type
+    uint8_t num_bounds;
+    volatile uint8_t updated;
+    volatile int32_t value; // counters: count since the last record. gauges: last value. histograms: observations
+    volatile int32_t sum;   // histograms: sum of the observations since the last record. not 64 bits: the ESP32 has no
+                            // 64-bit atomics, GCC would take a lock for them
+};
+
+#if CONFIG_LOGGING_SERVER_METRICS==1
+#define WIFI_METRIC_SECTION __attribute__((section(".wifi_metrics"), used, aligned(4)))
+#else
+#define WIFI_METRIC_SECTION __attribute__((unused))
+#endif
+
+// most bounds a histogram can have. more is a compile error ("size of array is negative")
+#define WIFI_METRIC_MAX_BOUNDS 16
+#define WIFI_METRIC_BUCKETS_(BOUNDS) \
+    (sizeof(BOUNDS) / sizeof((BOUNDS)[0]) <= WIFI_METRIC_MAX_BOUNDS ? (long)(sizeof(BOUNDS) / sizeof((BOUNDS)[0])) + 1 : -1L)
+
+#define WIFI_METRIC_COUNTER(VAR, NAME) \
+    static struct wifi_metric VAR WIFI_METRIC_SECTION = { .name = NAME, .type = WIFI_METRIC_TYPE_COUNTER }
+
+#define WIFI_METRIC_GAUGE(VAR, NAME) \
+    static struct wifi_metric VAR WIFI_METRIC_SECTION = { .name = NAME, .type = WIFI_METRIC_TYPE_GAUGE }
+
+#define WIFI_METRIC_HISTOGRAM(VAR, NAME, ...) \
+    static const DRAM_ATTR int32_t VAR##_bounds_[] = { __VA_ARGS__ }; \
+    static uint32_t VAR##_buckets_[WIFI_METRIC_BUCKETS_(VAR##_bounds_)]; \
+    static struct wifi_metric VAR WIFI_METRIC_SECTION = { .name = NAME, \
+        .bounds = VAR##_bounds_, .buckets = VAR##_buckets_, .type = WIFI_METRIC_TYPE_HISTOGRAM, \
+        .num_bounds = sizeof(VAR##_bounds_) / sizeof(VAR##_bounds_[0]) }
+
+#if CONFIG_LOGGING_SERVER_METRICS==1
+// counter: add n to it
+static inline void wifi_metric_add(struct wifi_metric* metric, int32_t n)
+{
+    __atomic_fetch_add(&metric->value, n, __ATOMIC_RELAXED);
+}
+
+// gauge: its value is now value
+static inline void wifi_metric_set(struct wifi_metric* metric, int32_t value)
+{
+    __atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&metric->updated, 1, __ATOMIC_RELEASE);
+}
+
+// histogram: one more observation. finding the bucket is a scan of the bounds, which are few and fixed
+static inline void wifi_metric_observe(struct wifi_metric* metric, int32_t value)
+{
+    uint8_t bucket = 0;
+    while (bucket < metric->num_bounds && value > metric->bounds[bucket])
+        bucket++;
+    __atomic_fetch_add(&metric->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->value, 1, __ATOMIC_RELAXED);
+}
+#else
+static inline void wifi_metric_add(struct wifi_metric* metric, int32_t n) { (void) metric; (void) n; }
+static inline void wifi_metric_set(struct wifi_metric* metric, int32_t value) { (void) metric; (void) value; }
+static inline void wifi_metric_observe(struct wifi_metric* metric, int32_t value) { (void) metric; (void) value; }
+#endif
+
+/**
+ * @brief sends what the flight recorder holds from the last CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_WINDOW_MS, as an
+ * ERROR would, but without the holdoff. Lines go out from the logger task, a few at a time.
+ * Needs CONFIG_LOGGING_SERVER_FLIGHT_RECORDER, otherwise this does nothing.
+ */
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+void wifi_logger_flight_recorder_flush(void);
+#else
+static inline void wifi_logger_flight_recorder_flush(void) { }
+#endif
 
 // if using websockets, port is ignored and your host line should be a URI like: "ws://192.168.0.1:1234"
 bool set_wifi_logger_config(struct wifi_logger_config* config, const char* host, int port, bool route_esp_idf_api_logs_to_wifi);
+bool wifi_logger_add_fallback_collector(struct wifi_logger_config* config, const char* host, int port);
 bool start_wifi_logger(const struct wifi_logger_config* config);
 
+// (UDP only) stops the logger task and un-routes ESP_LOGx(). anything still queued stays queued for the next start_wifi_logger()
+bool wifi_logger_stop(void);
+// (UDP only) switches a running logger to config's collectors (host/port and fallback), without losing anything queued
+bool wifi_logger_reconfigure(const struct wifi_logger_config* config);
+// (UDP only) burst mode: lines are held until max_bytes of them are queued or the oldest is max_age_ms old (or an ERROR
+// comes in), then sent all at once, so the radio can sleep in between. max_bytes = 0 turns it off
+bool wifi_logger_set_burst(uint32_t max_bytes, uint32_t max_age_ms);
+
+// (CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT only) what log data goes out on. AUTO, the default, moves it between UDP and
+// TCP as the measured loss comes and goes; UDP and TCP pin it there
+enum wifi_logger_transport {
+    WIFI_LOGGER_TRANSPORT_AUTO,
+    WIFI_LOGGER_TRANSPORT_UDP,
+    WIFI_LOGGER_TRANSPORT_TCP,
+};
+
+struct wifi_logger_link_stats {
+    enum wifi_logger_transport transport;   // UDP or TCP: what log data goes out on right now
+    uint8_t loss_percent;                   // share of the last (up to 64) probes to the collector that went unanswered
+    uint16_t samples;                       // how many probes loss_percent is based on
+    uint32_t rtt_ms;                        // smoothed probe round trip time, as seen by the logger task. 0 until the first answer
+    uint32_t switches;                      // times log data changed transport since boot, across stops and restarts
+    uint8_t tcp_stall_percent;              // share of the last (up to 64) TCP sends that blocked for longer than a probe
+                                            // may go unanswered, the last time log data went over TCP. 0 until then
+};
+
+// both return false without CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT. the logger task makes the switch, between datagrams
+bool wifi_logger_set_transport(enum wifi_logger_transport transport);
+bool wifi_logger_get_link_stats(struct wifi_logger_link_stats* stats);
+
 // after starting everything else up, you can use this to toggle whether logs are being sent out or not.
 void udp_logging_set_sending_enabled(bool sending_enabled);
 
-void generate_log_message(esp_log_level_t level, const char *TAG, int line, const char *func, const char *fmt, ...);
+void generate_log_message(esp_log_level_t level, const char *TAG, int line, const char *func, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+// what wifi_log_x() calls. fmt is site->fmt, passed again so the compiler checks it against the arguments
+void wifi_log_site_message(struct wifi_log_site* site, const char *TAG, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+// what wifi_log_x() calls when there's nothing to format, and wifi_log_static_x(). text must outlive the queued line
+void wifi_log_site_static(struct wifi_log_site* site, const char *TAG, const char *text);
+static inline __attribute__((format(printf, 1, 2))) void wifi_log_check_format(const char *fmt, ...) { (void) fmt; }
+// mutes or unmutes every wifi_log_x() call in files whose path ends in file (e.g. "main/app.c"), at line (0 = any line).
+// returns how many sites matched
+size_t wifi_log_site_set_enabled(const char* file, int line, bool enabled);
+// a record holds at most CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE bytes: fields past that are dropped.
+void wifi_log_kv(esp_log_level_t level, const char *TAG, const struct wifi_log_kv* fields, size_t num_fields);
+// binary blobs (packets, register dumps...) sent as they are, in chunks, for tools/wifi_log_collector.py to show as a
+// hexdump. Far cheaper than ESP_LOG_BUFFER_HEX()'s line per 16 bytes. Native output format only
+void wifi_log_buffer(esp_log_level_t level, const char *TAG, const void* data, size_t len);
 bool is_connected(void* handle_t); // TODO: fix definition
 
 #ifdef __cplusplus
@@ -0,0 +1,223 @@
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#include "cbor.h"
+#include "log_filter.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+// how many distinct keys get a short numeric id. keys beyond this are sent as plain text every time.
+#define KV_KEY_TABLE_SIZE 32
+
+// key definitions are re-sent every this many records, so a collector that starts late (or lost the datagram with
+// the definition) still learns the key names.
+#define KV_KEY_REANNOUNCE_INTERVAL 64
+
+/*
+ * Interned keys. The first record (per announce epoch) that uses a key sends it as [id, "name"]; after that just the id.
+ * Lookups are by pointer, so the same literal from two compilation units may get two ids. That's harmless.
+ */
+static const char* s_keys[KV_KEY_TABLE_SIZE];
+static uint32_t s_key_announced_epoch[KV_KEY_TABLE_SIZE];
+static uint32_t s_num_keys = 0;
+static uint32_t s_announce_epoch = 1;
+static uint32_t s_records_this_epoch = 0;
+static portMUX_TYPE s_keys_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief starts a new record for the interning table, re-announcing every key once in a while
+ *
+ * @return uint32_t the announce epoch the record belongs to, for intern_commit()
+ */
+static uint32_t intern_next_record(void)
+{
+    portENTER_CRITICAL(&s_keys_lock);
+    if (++s_records_this_epoch >= KV_KEY_REANNOUNCE_INTERVAL) {
+        s_records_this_epoch = 0;
+        s_announce_epoch++;
+    }
+    const uint32_t epoch = s_announce_epoch;
+    portEXIT_CRITICAL(&s_keys_lock);
+    return epoch;
+}
+
+/**
+ * @brief looks up (or adds) a key in the intern table
+ *
+ * @param key key string, compared by pointer
+ * @param announce (out param) true if the record must carry the key's name along with its id. it only counts as
+ *                 announced once the record is queued, see intern_commit()
+ * @return int key id, or -1 if the table is full
+ */
+static int intern_key(const char* key, bool* announce)
+{
+    int id = -1;
+
+    portENTER_CRITICAL(&s_keys_lock);
+    for (uint32_t i = 0; i < s_num_keys; i++) {
+        if (s_keys[i] == key) {
+            id = (int)i;
+            break;
+        }
+    }
+
+    if (id < 0 && s_num_keys < KV_KEY_TABLE_SIZE) {
+        id = (int)s_num_keys++;
+        s_keys[id] = key;
+        s_key_announced_epoch[id] = 0;
+    }
+
+    if (id >= 0)
+        *announce = s_key_announced_epoch[id] != s_announce_epoch;
+    portEXIT_CRITICAL(&s_keys_lock);
+
+    return id;
+}
+
+/**
+ * @brief marks the keys a queued record announced as announced, so the records after it just use their ids
+ *
+ * @param announced bit n set: the record carried key n's name
+ * @param epoch what intern_next_record() said when the record was started
+ */
+static void intern_commit(uint32_t announced, uint32_t epoch)
+{
+    portENTER_CRITICAL(&s_keys_lock);
+    for (uint32_t id = 0; id < KV_KEY_TABLE_SIZE; id++) {
+        if (announced & (1u << id))
+            s_key_announced_epoch[id] = epoch;
+    }
+    portEXIT_CRITICAL(&s_keys_lock);
+}
+
+/**
+ * @brief writes a key: just its id, or its id and name if the collector may not know it yet
+ *
+ * @param announced (in/out param) bit n is set if this announces key n
+ */
+static void put_key(struct cbor_writer* w, const char* key, uint32_t* announced)
+{
+    bool announce = false;
+    const int id = intern_key(key, &announce);
+
+    if (id < 0) {
+        cbor_put_text(w, key, strlen(key));
+    } else if (announce) {
+        *announced |= 1u << id;
+        cbor_put_array(w, 2);
+        cbor_put_uint(w, id);
+        cbor_put_text(w, key, strlen(key));
+    } else {
+        cbor_put_uint(w, id);
+    }
+}
+
+static void put_value(struct cbor_writer* w, const struct wifi_log_kv* field)
+{
+    switch (field->type)
+    {
+    case WIFI_LOG_KV_INT:
+        cbor_put_int(w, field->value.i);
+        break;
+    case WIFI_LOG_KV_UINT:
+        cbor_put_uint(w, field->value.u);
+        break;
+    case WIFI_LOG_KV_FLOAT:
+        cbor_put_float(w, field->value.f);
+        break;
+    case WIFI_LOG_KV_BOOL:
+        cbor_put_bool(w, field->value.b);
+        break;
+    case WIFI_LOG_KV_STR:
+        if (field->value.s)
+            cbor_put_text(w, field->value.s, strlen(field->value.s));
+        else
+            cbor_put_text(w, "", 0);
+        break;
+    }
+}
+
+/**
+ * @brief sends typed key/value fields as one binary record (LOG_RECORD_TYPE_KV)
+ *
+ * @param level ESP log level
+ * @param tag tag for the record
+ * @param fields fields to send, in order. fields that don't fit in CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE are dropped
+ * @param num_fields number of entries in fields
+ */
+void wifi_log_kv(esp_log_level_t level, const char *tag, const struct wifi_log_kv* fields, size_t num_fields)
+{
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+    // syslog receivers have no use for our binary records
+    (void) level; (void) tag; (void) fields; (void) num_fields;
+    return;
+#endif
+
+    if (!is_network_logging_allowed_here())
+        return;
+
+    if (!log_filter_level_allows(tag, level) || !log_filter_rate_allows())
+        return;
+
+    // written in place, then trimmed to size. the queue consumer will free() this
+    uint8_t* record = malloc(CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE);
+    if (!record)
+        return;
+    struct cbor_writer w;
+
+    // leave a byte at the end for the map's break, so a field that doesn't fit never costs us the terminator
+    cbor_writer_init(&w, &record[LOG_RECORD_HEADER_SIZE], CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE - LOG_RECORD_HEADER_SIZE - 1);
+
+    const char* device_id = udp_logging_get_device_id();
+    cbor_put_array(&w, 5);
+    cbor_put_text(&w, device_id, strlen(device_id));
+    cbor_put_uint(&w, level);
+    cbor_put_uint(&w, esp_log_timestamp());
+    cbor_put_text(&w, tag, strlen(tag));
+    if (w.overflow) {
+        free(record);
+        return;
+    }
+
+    const uint32_t epoch = intern_next_record();
+    uint32_t announced = 0;
+    cbor_put_map_indefinite(&w);
+    for (size_t i = 0; i < num_fields; i++)
+    {
+        const size_t mark = cbor_mark(&w);
+        const uint32_t announced_before = announced;
+        put_key(&w, fields[i].key, &announced);
+        put_value(&w, &fields[i]);
+        if (w.overflow) {
+            cbor_rewind(&w, mark);
+            announced = announced_before;
+            break;
+        }
+    }
+
+    w.size++;
+    cbor_put_break(&w);
+
+    const size_t record_len = LOG_RECORD_HEADER_SIZE + w.len;
+    log_record_write_header(record, LOG_RECORD_TYPE_KV, (uint16_t)w.len);
+
+    // shrinking happens in place, so this doesn't copy. if it fails, the record is still there, just roomier
+    uint8_t* trimmed = realloc(record, record_len);
+    if (trimmed)
+        record = trimmed;
+
+    const struct log_queue_item item = {
+        .message = (char*) record,
+        .flags = LOG_ITEM_FLAG_BINARY | (level == ESP_LOG_ERROR ? LOG_ITEM_FLAG_URGENT : 0),
+        .len = (uint16_t)record_len,
+    };
+    if (send_to_queue(&item, record_len) != ESP_OK) {
+        // the collector never saw these names, the next record that uses them says them again
+        free(record);
+        return;
+    }
+    intern_commit(announced, epoch);
+}
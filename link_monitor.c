@@ -0,0 +1,250 @@
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+
+#include "link_monitor.h"
+
+/*
+ * Adaptive transport: what the UDP path to the collector looks like, measured with the LOG_RECORD_TYPE_PROBE records
+ * the logger task sends every CONFIG_LOGGING_SERVER_ADAPTIVE_PROBE_INTERVAL_MS, and which transport log data should
+ * take because of it.
+ *
+ * Round trip time is smoothed as TCP does it (RFC 6298: srtt and rttvar, gains 1/8 and 1/4). A probe counts as lost
+ * once it has gone unanswered for srtt + 4 * rttvar, so a slow link isn't mistaken for a lossy one; an answer that
+ * comes after that still counts. Loss is the share of lost probes among the last LINK_MONITOR_WINDOW that are either
+ * answered or lost, and isn't acted on until there are LINK_MONITOR_MIN_SAMPLES of them: with fewer, a couple of
+ * unlucky probes on a 5% link read as 10%.
+ *
+ * TCP is measured too, while log data goes over it: a send that blocks for as long as a probe may go unanswered
+ * (srtt + 4 * rttvar) stalled, waiting for acks to make room in the socket's send buffer. The stall share is over the
+ * last LINK_MONITOR_WINDOW sends, and counts once there are LINK_MONITOR_MIN_SAMPLES of them.
+ *
+ * Hysteresis: UDP -> TCP at CONFIG_LOGGING_SERVER_ADAPTIVE_TCP_ABOVE_LOSS percent, unless TCP stalled more than that
+ * the last time it was used; TCP -> UDP once loss is down to CONFIG_LOGGING_SERVER_ADAPTIVE_UDP_BELOW_LOSS, or once TCP
+ * stalls on more of its sends than UDP loses probes. Either way, what calls for a switch has to hold for
+ * LINK_MONITOR_CONFIRM_PROBES probe intervals in a row, and no switch comes sooner than
+ * CONFIG_LOGGING_SERVER_ADAPTIVE_MIN_DWELL_MS after the last one. The probes always go over UDP, so UDP keeps being
+ * measured while log data goes over TCP.
+ *
+ * Everything but the published stats is only ever touched by the logger task.
+ */
+
+#define LINK_MONITOR_MIN_SAMPLES    32
+#define LINK_MONITOR_CONFIRM_PROBES 8
+#define LINK_MONITOR_MIN_TIMEOUT_MS 200
+#define LINK_MONITOR_MAX_TIMEOUT_MS 2000
+// until the first answer, there's nothing to scale the timeout by
+#define LINK_MONITOR_FIRST_TIMEOUT_MS 1000
+
+_Static_assert(CONFIG_LOGGING_SERVER_ADAPTIVE_UDP_BELOW_LOSS < CONFIG_LOGGING_SERVER_ADAPTIVE_TCP_ABOVE_LOSS,
+               "the loss that switches back to UDP must be below the one that switches to TCP");
+
+struct probe_slot {
+    uint32_t seq;       // 0 = empty
+    TickType_t sent;
+    bool acked;
+};
+
+static struct probe_slot s_slots[LINK_MONITOR_WINDOW];
+static bool s_have_rtt;
+static uint32_t s_srtt_ms;
+static uint32_t s_rttvar_ms;
+static TickType_t s_hold_until;         // no switching by ourselves before this
+static uint32_t s_last_seq;             // the probe sent last, 0 = none since the reset
+static enum wifi_logger_transport s_wanted;     // what the last decision called for...
+static TickType_t s_wanted_since;               // ...and since when, without a break
+
+// TCP sends since log data last moved to TCP: whether each one stalled
+static bool s_tcp_stalled[LINK_MONITOR_WINDOW];
+static unsigned s_tcp_sends;
+static int s_tcp_stall_percent = -1;    // from the last time TCP was used with enough sends, -1 = never
+
+static struct wifi_logger_link_stats s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief forgets everything measured so far, e.g. when the logger moves on to another collector. stays on UDP.
+ */
+void link_monitor_reset(TickType_t now)
+{
+    memset(s_slots, 0, sizeof(s_slots));
+    s_have_rtt = false;
+    s_srtt_ms = 0;
+    s_rttvar_ms = 0;
+    s_hold_until = now;
+    s_last_seq = 0;
+    s_wanted = WIFI_LOGGER_TRANSPORT_UDP;
+    s_wanted_since = now;
+    s_tcp_sends = 0;
+    s_tcp_stall_percent = -1;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.transport = WIFI_LOGGER_TRANSPORT_UDP;
+    s_stats.loss_percent = 0;
+    s_stats.samples = 0;
+    s_stats.rtt_ms = 0;
+    s_stats.tcp_stall_percent = 0;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void link_monitor_probe_sent(uint32_t seq, TickType_t now)
+{
+    struct probe_slot* slot = &s_slots[seq % LINK_MONITOR_WINDOW];
+    slot->seq = seq;
+    slot->sent = now;
+    slot->acked = false;
+    s_last_seq = seq;
+}
+
+void link_monitor_probe_acked(uint32_t seq, TickType_t now)
+{
+    struct probe_slot* slot = &s_slots[seq % LINK_MONITOR_WINDOW];
+    if (slot->seq != seq || slot->acked)
+        return; // too old to still be in the window, or answered twice
+
+    slot->acked = true;
+
+    const uint32_t rtt_ms = (now - slot->sent) * portTICK_PERIOD_MS;
+    if (!s_have_rtt) {
+        s_srtt_ms = rtt_ms;
+        s_rttvar_ms = rtt_ms / 2;
+        s_have_rtt = true;
+    } else {
+        const uint32_t delta = (rtt_ms > s_srtt_ms) ? rtt_ms - s_srtt_ms : s_srtt_ms - rtt_ms;
+        s_rttvar_ms = (3 * s_rttvar_ms + delta) / 4;
+        s_srtt_ms = (7 * s_srtt_ms + rtt_ms) / 8;
+    }
+}
+
+/**
+ * @brief how long a probe may go unanswered before it counts as lost
+ */
+static TickType_t loss_timeout(void)
+{
+    if (!s_have_rtt)
+        return pdMS_TO_TICKS(LINK_MONITOR_FIRST_TIMEOUT_MS);
+
+    const uint32_t timeout_ms = s_srtt_ms + 4 * s_rttvar_ms;
+    return pdMS_TO_TICKS(MIN(MAX(timeout_ms, LINK_MONITOR_MIN_TIMEOUT_MS), LINK_MONITOR_MAX_TIMEOUT_MS));
+}
+
+/**
+ * @brief a log datagram went out over TCP, and tcp_send_data() took this long to take it
+ */
+void link_monitor_tcp_sent(TickType_t took)
+{
+    s_tcp_stalled[s_tcp_sends++ % LINK_MONITOR_WINDOW] = took >= loss_timeout();
+}
+
+/**
+ * @brief whether the probe sent last is still worth waiting for: it's unanswered, but not lost yet. the logger
+ * task reads answers between log messages, so while it waits for one, it shouldn't block for long on an empty queue:
+ * the wait would count towards the round trip time.
+ */
+bool link_monitor_awaiting_ack(TickType_t now)
+{
+    const struct probe_slot* slot = &s_slots[s_last_seq % LINK_MONITOR_WINDOW];
+    return s_last_seq != 0 && slot->seq == s_last_seq && !slot->acked && now - slot->sent < loss_timeout();
+}
+
+/**
+ * @brief the share of the last (up to) LINK_MONITOR_WINDOW TCP sends that stalled, -1 if there weren't enough yet
+ */
+static int tcp_stall_percent(void)
+{
+    const unsigned samples = MIN(s_tcp_sends, LINK_MONITOR_WINDOW);
+    if (samples < LINK_MONITOR_MIN_SAMPLES)
+        return -1;
+
+    unsigned stalled = 0;
+    for (unsigned i = 0; i < samples; i++)
+        stalled += s_tcp_stalled[i];
+    return (int)((100 * stalled + samples / 2) / samples);
+}
+
+/**
+ * @brief measures loss over the window, and decides which transport log data should go over from now on
+ *
+ * @param current what it goes over now
+ * @param why (out param) what calls for the switch, if it's time for one
+ * @return enum wifi_logger_transport current, or the other one if it's time to switch
+ */
+enum wifi_logger_transport link_monitor_choose(enum wifi_logger_transport current, TickType_t now, const char** why)
+{
+    const TickType_t timeout = loss_timeout();
+    unsigned samples = 0, lost = 0;
+
+    for (int i = 0; i < LINK_MONITOR_WINDOW; i++)
+    {
+        const struct probe_slot* slot = &s_slots[i];
+        if (slot->seq == 0)
+            continue;
+        if (slot->acked) {
+            samples++;
+        } else if (now - slot->sent >= timeout) {
+            samples++;
+            lost++;
+        }
+    }
+
+    const unsigned loss_percent = samples ? (100 * lost + samples / 2) / samples : 0;
+    const int stall_percent = (current == WIFI_LOGGER_TRANSPORT_TCP) ? tcp_stall_percent() : -1;
+    if (stall_percent >= 0)
+        s_tcp_stall_percent = stall_percent;
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.loss_percent = (uint8_t)loss_percent;
+    s_stats.samples = (uint16_t)samples;
+    s_stats.rtt_ms = s_srtt_ms;
+    s_stats.tcp_stall_percent = (uint8_t)MAX(s_tcp_stall_percent, 0);
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    enum wifi_logger_transport wanted = current;
+    if (samples < LINK_MONITOR_MIN_SAMPLES) {
+        // not enough to go on
+    } else if (current == WIFI_LOGGER_TRANSPORT_UDP) {
+        if (loss_percent >= CONFIG_LOGGING_SERVER_ADAPTIVE_TCP_ABOVE_LOSS && (int)loss_percent > s_tcp_stall_percent) {
+            wanted = WIFI_LOGGER_TRANSPORT_TCP;
+            *why = "UDP is losing too much";
+        }
+    } else if (loss_percent <= CONFIG_LOGGING_SERVER_ADAPTIVE_UDP_BELOW_LOSS) {
+        wanted = WIFI_LOGGER_TRANSPORT_UDP;
+        *why = "UDP loss is down";
+    } else if (stall_percent > (int)loss_percent) {
+        wanted = WIFI_LOGGER_TRANSPORT_UDP;
+        *why = "TCP stalls more than UDP loses";
+    }
+
+    if (wanted != s_wanted) {
+        s_wanted = wanted;
+        s_wanted_since = now;
+    }
+    if (wanted == current || (int32_t)(now - s_hold_until) < 0 ||
+        now - s_wanted_since < pdMS_TO_TICKS(LINK_MONITOR_CONFIRM_PROBES * CONFIG_LOGGING_SERVER_ADAPTIVE_PROBE_INTERVAL_MS))
+        return current;
+    return wanted;
+}
+
+/**
+ * @brief the logger task tells us when log data moved to another transport, whoever decided it
+ */
+void link_monitor_switched(enum wifi_logger_transport transport, TickType_t now)
+{
+    s_hold_until = now + pdMS_TO_TICKS(CONFIG_LOGGING_SERVER_ADAPTIVE_MIN_DWELL_MS);
+    s_wanted = transport;
+    if (transport == WIFI_LOGGER_TRANSPORT_TCP)
+        s_tcp_sends = 0; // measured afresh each time
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.transport = transport;
+    s_stats.switches++;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void link_monitor_get_stats(struct wifi_logger_link_stats* stats)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
@@ -0,0 +1,30 @@
+#ifndef WIFI_LOGGER_LINK_MONITOR_H
+#define WIFI_LOGGER_LINK_MONITOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+#include "wifi_logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// loss is measured over this many of the most recent probes, TCP stalls over as many sends
+#define LINK_MONITOR_WINDOW 64
+
+void link_monitor_reset(TickType_t now);
+void link_monitor_probe_sent(uint32_t seq, TickType_t now);
+void link_monitor_probe_acked(uint32_t seq, TickType_t now);
+void link_monitor_tcp_sent(TickType_t took);
+bool link_monitor_awaiting_ack(TickType_t now);
+enum wifi_logger_transport link_monitor_choose(enum wifi_logger_transport current, TickType_t now, const char** why);
+void link_monitor_switched(enum wifi_logger_transport transport, TickType_t now);
+void link_monitor_get_stats(struct wifi_logger_link_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_LINK_MONITOR_H
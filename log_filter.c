@@ -0,0 +1,229 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#include "log_filter.h"
+#include "wifi_logger.h"
+
+// how many tags can have their own level
+#define LOG_FILTER_MAX_TAGS 8
+
+struct tag_level {
+    char tag[LOG_FILTER_MAX_TAG_LEN + 1];
+    esp_log_level_t level;
+};
+
+static portMUX_TYPE s_filter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct tag_level s_tag_levels[LOG_FILTER_MAX_TAGS];
+static volatile uint32_t s_num_tag_levels = 0;
+static volatile esp_log_level_t s_default_level = ESP_LOG_VERBOSE;
+
+static volatile uint32_t s_rate_per_sec = 0; // 0 = no rate limit
+static uint32_t s_rate_burst = 0;
+static uint32_t s_rate_tokens_milli = 0;     // tokens * 1000, so slow rates still refill between calls
+static uint32_t s_rate_last_refill_ms = 0;
+static uint32_t s_rate_dropped = 0;
+
+/**
+ * @brief the level of a line esp_log is about to print, from its format: LOG_FORMAT() puts the level letter first,
+ * after the color code if there is one
+ *
+ * @param fmt the format handed to the vprintf hook
+ * @return esp_log_level_t ESP_LOG_NONE if it doesn't look like an ESP_LOGx() line
+ */
+esp_log_level_t log_filter_line_level(const char* fmt)
+{
+    if (fmt[0] == '\033') {
+        const char* end = strchr(fmt, 'm');
+        if (!end)
+            return ESP_LOG_NONE;
+        fmt = end + 1;
+    }
+    if (fmt[0] == '\0' || fmt[1] != ' ' || fmt[2] != '(')
+        return ESP_LOG_NONE;
+
+    switch (fmt[0]) {
+    case 'E': return ESP_LOG_ERROR;
+    case 'W': return ESP_LOG_WARN;
+    case 'I': return ESP_LOG_INFO;
+    case 'D': return ESP_LOG_DEBUG;
+    case 'V': return ESP_LOG_VERBOSE;
+    default: return ESP_LOG_NONE;
+    }
+}
+
+/**
+ * @brief sets the network log level for one tag, or for every tag ("*")
+ *
+ * @param tag tag name, at most LOG_FILTER_MAX_TAG_LEN chars, or "*"
+ * @param level lines above this level aren't sent
+ * @return bool false if the tag is too long or there's no room left for another tag
+ */
+bool log_filter_set_level(const char* tag, esp_log_level_t level)
+{
+    if (!tag || strlen(tag) > LOG_FILTER_MAX_TAG_LEN)
+        return false;
+
+    bool ok = true;
+    portENTER_CRITICAL(&s_filter_lock);
+    if (strcmp(tag, "*") == 0) {
+        // like esp_log_level_set("*"), this resets every tag to the new default
+        s_default_level = level;
+        s_num_tag_levels = 0;
+    } else {
+        uint32_t i = 0;
+        while (i < s_num_tag_levels && strcmp(s_tag_levels[i].tag, tag) != 0)
+            i++;
+
+        if (i < LOG_FILTER_MAX_TAGS) {
+            strcpy(s_tag_levels[i].tag, tag);
+            s_tag_levels[i].level = level;
+            if (i == s_num_tag_levels)
+                s_num_tag_levels++;
+        } else {
+            ok = false;
+        }
+    }
+    portEXIT_CRITICAL(&s_filter_lock);
+
+    return ok;
+}
+
+/**
+ * @brief checks whether a line with this tag and level should be sent over the network
+ */
+bool log_filter_level_allows(const char* tag, esp_log_level_t level)
+{
+    // fast path: nobody has set per-tag levels
+    if (s_num_tag_levels == 0)
+        return level <= s_default_level;
+
+    esp_log_level_t max_level = s_default_level;
+    portENTER_CRITICAL(&s_filter_lock);
+    for (uint32_t i = 0; i < s_num_tag_levels; i++) {
+        if (strcmp(s_tag_levels[i].tag, tag) == 0) {
+            max_level = s_tag_levels[i].level;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_filter_lock);
+
+    return level <= max_level;
+}
+
+/**
+ * @brief limits how many lines per second get queued for sending. lines over the limit are dropped (and counted)
+ *
+ * @param lines_per_sec steady state rate, 0 = no limit
+ * @param burst how many lines can go out back to back after a quiet period (at least 1)
+ */
+void log_filter_set_rate(uint32_t lines_per_sec, uint32_t burst)
+{
+    if (burst == 0)
+        burst = 1;
+
+    const uint32_t now = esp_log_timestamp();
+    portENTER_CRITICAL(&s_filter_lock);
+    s_rate_per_sec = lines_per_sec;
+    s_rate_burst = burst;
+    s_rate_tokens_milli = burst * 1000;
+    s_rate_last_refill_ms = now;
+    portEXIT_CRITICAL(&s_filter_lock);
+}
+
+/**
+ * @brief takes one line's worth from the rate limiter
+ *
+ * @return bool true if the line can be sent
+ */
+bool log_filter_rate_allows(void)
+{
+    if (s_rate_per_sec == 0)
+        return true;
+
+    const uint32_t now = esp_log_timestamp();
+    bool allowed;
+
+    portENTER_CRITICAL(&s_filter_lock);
+    const uint32_t max_tokens_milli = s_rate_burst * 1000;
+    const uint64_t refill = (uint64_t)(now - s_rate_last_refill_ms) * s_rate_per_sec;
+    s_rate_last_refill_ms = now;
+    s_rate_tokens_milli = (refill >= max_tokens_milli - s_rate_tokens_milli) ? max_tokens_milli : s_rate_tokens_milli + (uint32_t)refill;
+
+    allowed = s_rate_tokens_milli >= 1000;
+    if (allowed)
+        s_rate_tokens_milli -= 1000;
+    else
+        s_rate_dropped++;
+    portEXIT_CRITICAL(&s_filter_lock);
+
+    return allowed;
+}
+
+/**
+ * @brief returns how many lines the rate limiter dropped since the last call
+ */
+uint32_t log_filter_take_rate_dropped(void)
+{
+    portENTER_CRITICAL(&s_filter_lock);
+    const uint32_t dropped = s_rate_dropped;
+    s_rate_dropped = 0;
+    portEXIT_CRITICAL(&s_filter_lock);
+
+    return dropped;
+}
+
+// the .wifi_log_sites section, from linker.lf: every wifi_log_x() call site in the firmware
+extern struct wifi_log_site _wifi_log_sites_start;
+extern struct wifi_log_site _wifi_log_sites_end;
+
+/**
+ * @brief sets or clears a flag on every wifi_log_x() call site
+ *
+ * @param flag WIFI_LOG_SITE_x
+ * @param set true to set it, false to clear it
+ */
+void log_filter_set_site_flag(uint8_t flag, bool set)
+{
+    // locked site by site, not across the walk: there can be thousands of sites, and interrupts are masked meanwhile
+    for (struct wifi_log_site* site = &_wifi_log_sites_start; site < &_wifi_log_sites_end; site++)
+    {
+        portENTER_CRITICAL(&s_filter_lock);
+        site->disabled = set ? (site->disabled | flag) : (site->disabled & ~flag);
+        portEXIT_CRITICAL(&s_filter_lock);
+    }
+}
+
+/**
+ * @brief mutes or unmutes wifi_log_x() call sites. A muted site returns before evaluating its arguments
+ *
+ * @param file path the site's file ends with, e.g. "app.c" or "main/app.c"
+ * @param line line of the wifi_log_x() call, 0 for every site in the file
+ * @param enabled false to mute
+ * @return size_t how many sites matched
+ */
+size_t wifi_log_site_set_enabled(const char* file, int line, bool enabled)
+{
+    if (!file)
+        return 0;
+
+    const size_t file_len = strlen(file);
+    size_t matched = 0;
+
+    for (struct wifi_log_site* site = &_wifi_log_sites_start; site < &_wifi_log_sites_end; site++)
+    {
+        const size_t site_file_len = strlen(site->file);
+        if (site_file_len < file_len || strcmp(&site->file[site_file_len - file_len], file) != 0)
+            continue;
+        if (line != 0 && site->line != (uint32_t)line)
+            continue;
+
+        // only the flag update is locked (against log_filter_set_site_flag()), not the string compares
+        portENTER_CRITICAL(&s_filter_lock);
+        site->disabled = enabled ? (site->disabled & ~WIFI_LOG_SITE_MUTED) : (site->disabled | WIFI_LOG_SITE_MUTED);
+        portEXIT_CRITICAL(&s_filter_lock);
+        matched++;
+    }
+
+    return matched;
+}
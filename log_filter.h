@@ -0,0 +1,39 @@
+#ifndef WIFI_LOGGER_LOG_FILTER_H
+#define WIFI_LOGGER_LOG_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_log.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// longest tag that can have its own level
+#define LOG_FILTER_MAX_TAG_LEN 23
+
+/*
+ * Runtime filters for what gets sent over the network. All are wide open until someone (normally the control
+ * channel) tightens them.
+ */
+
+// per-tag levels for wifi_log_x() / wifi_log_kv_x(). tag "*" sets the default for every tag without its own level.
+bool log_filter_set_level(const char* tag, esp_log_level_t level);
+bool log_filter_level_allows(const char* tag, esp_log_level_t level);
+
+// level of an ESP_LOGx() line, from the format esp_log hands the vprintf hook. ESP_LOG_NONE if it isn't one
+esp_log_level_t log_filter_line_level(const char* fmt);
+
+// token bucket over everything queued for sending. lines_per_sec = 0 turns rate limiting off.
+void log_filter_set_rate(uint32_t lines_per_sec, uint32_t burst);
+bool log_filter_rate_allows(void);
+uint32_t log_filter_take_rate_dropped(void);
+
+// sets or clears flag (WIFI_LOG_SITE_x) on every wifi_log_x() call site
+void log_filter_set_site_flag(uint8_t flag, bool set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_LOG_FILTER_H
@@ -0,0 +1,85 @@
+#ifndef WIFI_LOGGER_LOG_QUEUE_H
+#define WIFI_LOGGER_LOG_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// queue item flags
+#define LOG_ITEM_FLAG_ECHO_TO_CONSOLE   (1 << 0)  // logger task prints the line to the console before sending it
+#define LOG_ITEM_FLAG_BINARY            (1 << 1)  // message is a binary record (see below) of len bytes, not a string
+#define LOG_ITEM_FLAG_URGENT            (1 << 2)  // an ERROR: in burst mode, whatever is queued goes out now
+#define LOG_ITEM_FLAG_STATIC            (1 << 3)  // message is the text of a wifi_log_x() line that lives forever, see below
+
+// LOG_ITEM_FLAG_STATIC items are only ever queued with UDP and the native output format, see wifi_log_site_static()
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1 && CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG!=1
+#define LOG_ITEM_STATIC_LINES 1
+#endif
+
+struct wifi_log_site;
+
+/**
+ * @brief one entry in the message queue
+ *
+ * A LOG_ITEM_FLAG_STATIC item is a line nobody has formatted yet: message points at its text (a format string without
+ * conversions, or wifi_log_static_x()'s), which isn't ours to free, and the logger task renders the whole line from
+ * site and timestamp straight into the datagram when it sends it. Only builds that can queue them (LOG_ITEM_STATIC_LINES)
+ * have site: 16 bytes an item with it, 12 without.
+ */
+struct log_queue_item {
+    char* message;              // malloc()'d, null-terminated unless LOG_ITEM_FLAG_BINARY. whoever dequeues this must free() it, unless LOG_ITEM_FLAG_STATIC
+    uint8_t flags;              // LOG_ITEM_FLAG_xxx
+    union {
+        struct {
+            uint16_t console_offset;    // (LOG_ITEM_FLAG_ECHO_TO_CONSOLE only) where the console line starts, i.e. past the device id prefix (or the syslog message)
+            uint16_t len;               // (LOG_ITEM_FLAG_BINARY only) size of message in bytes
+        };
+        uint32_t timestamp;             // (LOG_ITEM_FLAG_STATIC only) esp_log_timestamp() when it was logged
+    };
+#ifdef LOG_ITEM_STATIC_LINES
+    const struct wifi_log_site* site;   // (LOG_ITEM_FLAG_STATIC only) where it was logged: tag, function, line and level
+#endif
+};
+
+esp_err_t send_to_queue(const struct log_queue_item* item, size_t len);
+bool is_network_logging_allowed_here();
+void wifi_logger_set_batching(uint32_t max_bytes, uint32_t max_wait_ms);
+
+/*
+ * Binary records go out alongside the text lines. A text line never starts with a control char, so a record is
+ * recognised by its first byte:
+ *
+ *   [LOG_RECORD_MAGIC] [type] [payload length, 2 bytes big-endian] [payload]
+ */
+#define LOG_RECORD_MAGIC        0x1e    // ASCII "record separator"
+#define LOG_RECORD_HEADER_SIZE  4
+
+// record types
+#define LOG_RECORD_TYPE_KV      1       // wifi_log_kv(): CBOR [device_id, level, timestamp_ms, tag, {key: value, ...}]
+#define LOG_RECORD_TYPE_PROBE   2       // collector health probe: [sequence number, 4 bytes big-endian]. answered with "wlack <seq>"
+#define LOG_RECORD_TYPE_TRACE   3       // wifi_trace_x() events from one core, see trace_buffer.c
+#define LOG_RECORD_TYPE_BUFFER  4       // one chunk of a wifi_log_buffer() blob, see buffer_logger.c
+#define LOG_RECORD_TYPE_CREDIT  5       // flow control: out of credits, asking for more. no payload. answered with "wlcredit <n>"
+#define LOG_RECORD_TYPE_METRICS 6       // wifi_metric_x(): CBOR [device_id, timestamp_ms, interval_ms, {name: value, ...}], see metrics.c
+
+/**
+ * @brief writes a record header for a payload of payload_len bytes into the first LOG_RECORD_HEADER_SIZE bytes of buf
+ */
+static inline void log_record_write_header(uint8_t* buf, uint8_t type, uint16_t payload_len)
+{
+    buf[0] = LOG_RECORD_MAGIC;
+    buf[1] = type;
+    buf[2] = (uint8_t)(payload_len >> 8);
+    buf[3] = (uint8_t)payload_len;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_LOG_QUEUE_H
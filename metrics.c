@@ -0,0 +1,174 @@
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#include "cbor.h"
+#include "log_queue.h"
+#include "metrics.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+/*
+ * wifi_metric_x(): every metric's descriptor is in the .wifi_metrics section (see linker.lf), from _wifi_metrics_start
+ * to _wifi_metrics_end. Updates only touch the descriptor, with atomics. Every CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS
+ * the logger task takes what has piled up in each one (leaving updates that come in meanwhile for the next time) and
+ * queues it as LOG_RECORD_TYPE_METRICS records, as many as it takes to fit them.
+ *
+ * Record payload, CBOR: [device_id, timestamp_ms, interval_ms, {name: value, ...}]
+ *   counter:   how much it went up over the interval
+ *   gauge:     its last value, if it was set during the interval
+ *   histogram: [count, sum, [bound, ...], [count per bucket, ...]], if anything was observed during the interval
+ * Metrics that didn't change aren't sent at all.
+ *
+ * A histogram's fields are taken one after the other, so an observation that's halfway through when they are can show
+ * up in its bucket in one record and in the count in the next.
+ */
+
+extern struct wifi_metric _wifi_metrics_start;
+extern struct wifi_metric _wifi_metrics_end;
+
+// what was taken out of a metric for one record
+struct metric_snapshot {
+    int32_t value;
+    int32_t sum;
+    uint32_t buckets[WIFI_METRIC_MAX_BOUNDS + 1];
+};
+
+static uint32_t s_last_flush_ms; // only touched by the logger task
+
+/**
+ * @brief takes what has piled up in a metric since the last record
+ *
+ * @return bool false if there's nothing to send for it
+ */
+static bool take_metric(struct wifi_metric* metric, struct metric_snapshot* snapshot)
+{
+    switch (metric->type)
+    {
+    case WIFI_METRIC_TYPE_COUNTER:
+        snapshot->value = __atomic_exchange_n(&metric->value, 0, __ATOMIC_RELAXED);
+        return snapshot->value != 0;
+
+    case WIFI_METRIC_TYPE_GAUGE:
+        if (!__atomic_exchange_n(&metric->updated, 0, __ATOMIC_ACQUIRE))
+            return false;
+        snapshot->value = __atomic_load_n(&metric->value, __ATOMIC_RELAXED);
+        return true;
+
+    case WIFI_METRIC_TYPE_HISTOGRAM:
+        snapshot->value = __atomic_exchange_n(&metric->value, 0, __ATOMIC_RELAXED);
+        if (snapshot->value == 0)
+            return false;
+        snapshot->sum = __atomic_exchange_n(&metric->sum, 0, __ATOMIC_RELAXED);
+        for (uint8_t i = 0; i <= metric->num_bounds; i++)
+            snapshot->buckets[i] = __atomic_exchange_n(&metric->buckets[i], 0, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    return false;
+}
+
+static void put_metric(struct cbor_writer* w, const struct wifi_metric* metric, const struct metric_snapshot* snapshot)
+{
+    cbor_put_text(w, metric->name, strlen(metric->name));
+
+    if (metric->type != WIFI_METRIC_TYPE_HISTOGRAM) {
+        cbor_put_int(w, snapshot->value);
+        return;
+    }
+
+    cbor_put_array(w, 4);
+    cbor_put_uint(w, (uint32_t)snapshot->value);
+    cbor_put_int(w, snapshot->sum);
+    cbor_put_array(w, metric->num_bounds);
+    for (uint8_t i = 0; i < metric->num_bounds; i++)
+        cbor_put_int(w, metric->bounds[i]);
+    cbor_put_array(w, metric->num_bounds + 1);
+    for (uint8_t i = 0; i <= metric->num_bounds; i++)
+        cbor_put_uint(w, snapshot->buckets[i]);
+}
+
+static void start_record(struct cbor_writer* w, uint8_t* record, size_t size, uint32_t now, uint32_t interval_ms)
+{
+    // leave a byte at the end for the map's break, so a metric that doesn't fit never costs us the terminator
+    cbor_writer_init(w, &record[LOG_RECORD_HEADER_SIZE], size - LOG_RECORD_HEADER_SIZE - 1);
+
+    const char* device_id = udp_logging_get_device_id();
+    cbor_put_array(w, 4);
+    cbor_put_text(w, device_id, strlen(device_id));
+    cbor_put_uint(w, now);
+    cbor_put_uint(w, interval_ms);
+    cbor_put_map_indefinite(w);
+}
+
+static void queue_record(struct cbor_writer* w, uint8_t* record)
+{
+    w->size++;
+    cbor_put_break(w);
+
+    const size_t record_len = LOG_RECORD_HEADER_SIZE + w->len;
+    log_record_write_header(record, LOG_RECORD_TYPE_METRICS, (uint16_t)w->len);
+
+    // the queue consumer will free() this
+    char* message = malloc(record_len);
+    if (!message)
+        return;
+    memcpy(message, record, record_len);
+
+    const struct log_queue_item item = {
+        .message = message,
+        .flags = LOG_ITEM_FLAG_BINARY,
+        .len = (uint16_t)record_len,
+    };
+    if (send_to_queue(&item, record_len) != ESP_OK)
+        free(message);
+}
+
+/**
+ * @brief (logger task) queues what the metrics have to say, once every CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS
+ */
+void metrics_flush(void)
+{
+    const uint32_t now = esp_log_timestamp();
+    const uint32_t interval_ms = now - s_last_flush_ms;
+    if (interval_ms < CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS)
+        return;
+    s_last_flush_ms = now;
+
+    uint8_t record[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE];
+    struct cbor_writer w;
+    size_t in_record = 0;
+    start_record(&w, record, sizeof(record), now, interval_ms);
+
+    for (struct wifi_metric* metric = &_wifi_metrics_start; metric < &_wifi_metrics_end; metric++)
+    {
+        struct metric_snapshot snapshot;
+        if (!take_metric(metric, &snapshot))
+            continue;
+
+        size_t mark = cbor_mark(&w);
+        put_metric(&w, metric, &snapshot);
+
+        if (w.overflow && in_record > 0) {
+            // record's full: send it, and put this one in the next
+            cbor_rewind(&w, mark);
+            queue_record(&w, record);
+            start_record(&w, record, sizeof(record), now, interval_ms);
+            in_record = 0;
+            mark = cbor_mark(&w);
+            put_metric(&w, metric, &snapshot);
+        }
+
+        if (w.overflow) {
+            cbor_rewind(&w, mark);
+            printf("wifi_logger: metric %s doesn't fit in a record, dropped\n", metric->name);
+            continue;
+        }
+        in_record++;
+    }
+
+    if (in_record > 0)
+        queue_record(&w, record);
+}
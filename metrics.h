@@ -0,0 +1,14 @@
+#ifndef WIFI_LOGGER_METRICS_H
+#define WIFI_LOGGER_METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void metrics_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_METRICS_H
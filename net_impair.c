@@ -0,0 +1,464 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "net_impair.h"
+
+struct net_impair_scenario {
+    uint32_t seed;
+    uint32_t loss_permille;
+    uint32_t latency_ms;
+    uint32_t jitter_ms;
+    uint32_t rate_bytes_per_sec;
+    uint32_t burst_permille;
+    uint32_t burst_len;
+    uint32_t stall_every_ms;
+    uint32_t stall_ms;
+    uint32_t reset_permille;
+};
+
+// what a lost segment costs a stream at least: more than a fast retransmit (a round trip), less than most retransmission timeouts
+#define NET_IMPAIR_MIN_RTO_MS 200
+
+// the scenario and its random state are only touched by the sending task (sends, and commands from the control channel)
+static struct net_impair_scenario s_scenario;
+static uint32_t s_rng_state = 1;
+static uint32_t s_burst_remaining = 0;
+static uint32_t s_link_free_at_ms = 0;  // when the rate limited link has sent everything before
+static uint32_t s_start_ms = 0;
+
+// a send that isn't due yet
+struct delayed_send {
+    void* ctx;
+    net_impair_deliver_fn deliver;
+    uint8_t* data;          // a copy, NULL if the slot is free
+    size_t len;
+    uint32_t due_ms;
+    uint32_t order;         // which of two sends due at the same time goes first
+    bool stream;
+};
+
+// the delay line and the stats are shared with the shim's task, under s_line_lock
+static portMUX_TYPE s_line_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct delayed_send s_line[NET_IMPAIR_DELAY_LINE_SIZE];
+static uint32_t s_line_count = 0;
+static uint32_t s_next_order = 0;
+static uint32_t s_streams_queued = 0;
+static uint32_t s_stream_due_ms = 0;    // when the last stream send in the delay line is due
+static void* s_delivering_ctx = NULL;   // the shim's task is sending for this one right now
+static void* s_flushing_ctx = NULL;     // net_impair_flush() is sending for this one, the task leaves it alone
+static void* s_error_ctx = NULL;        // a stream send for this one failed after it left the delay line...
+static int s_error = 0;                 // ...with this errno, which the next send gets
+static struct net_impair_stats s_stats;
+static TaskHandle_t s_task = NULL;
+
+/**
+ * @brief xorshift32. not random at all, which is the point: the same seed always gives the same run.
+ */
+static uint32_t next_random(void)
+{
+    uint32_t x = s_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_rng_state = x;
+    return x;
+}
+
+static bool chance(uint32_t permille)
+{
+    return permille > 0 && (next_random() % 1000) < permille;
+}
+
+static uint32_t parse_permille(const char* text)
+{
+    const float percent = strtof(text, NULL);
+    return percent <= 0 ? 0 : (percent >= 100 ? 1000 : (uint32_t)(percent * 10));
+}
+
+/**
+ * @brief reads a scenario file into text, with its comments (from a '#' to the end of the line) blanked out
+ *
+ * @return bool false if it can't be read, or doesn't fit in size - 1 bytes: half a scenario isn't the scenario
+ */
+static bool read_scenario_file(const char* path, char* text, size_t size)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+    const size_t len = fread(text, 1, size, file);
+    fclose(file);
+    if (len >= size)
+        return false;
+    text[len] = '\0';
+
+    bool comment = false;
+    for (char* c = text; *c; c++) {
+        if (*c == '#')
+            comment = true;
+        else if (*c == '\n')
+            comment = false;
+        if (comment)
+            *c = ' ';
+    }
+    return true;
+}
+
+/**
+ * @brief parses a scenario (see net_impair.h) and starts it from the beginning. an empty scenario turns everything off.
+ *
+ * @param scenario the settings, or "@" and the path of a file that has them
+ * @return bool false if the scenario has a key we don't know, or its file can't be read. nothing is changed in that case.
+ */
+bool net_impair_configure(const char* scenario)
+{
+    struct net_impair_scenario parsed = { .seed = 1 };
+
+    char text[NET_IMPAIR_SCENARIO_MAX_LEN + 1];
+    if (scenario && scenario[0] == '@') {
+        if (!read_scenario_file(&scenario[1], text, sizeof(text)))
+            return false;
+    } else {
+        strncpy(text, scenario ? scenario : "", sizeof(text) - 1);
+        text[sizeof(text) - 1] = '\0';
+    }
+
+    char* save = NULL;
+    for (char* setting = strtok_r(text, " \t\r\n", &save); setting; setting = strtok_r(NULL, " \t\r\n", &save))
+    {
+        char* value = strchr(setting, '=');
+        if (!value)
+            return false;
+        *value++ = '\0';
+
+        char* second = strchr(value, ',');
+        if (second)
+            *second++ = '\0';
+
+        if (strcmp(setting, "seed") == 0)
+            parsed.seed = strtoul(value, NULL, 10);
+        else if (strcmp(setting, "loss") == 0)
+            parsed.loss_permille = parse_permille(value);
+        else if (strcmp(setting, "latency") == 0)
+            parsed.latency_ms = strtoul(value, NULL, 10);
+        else if (strcmp(setting, "jitter") == 0)
+            parsed.jitter_ms = strtoul(value, NULL, 10);
+        else if (strcmp(setting, "rate") == 0)
+            parsed.rate_bytes_per_sec = strtoul(value, NULL, 10);
+        else if (strcmp(setting, "burst") == 0 && second) {
+            parsed.burst_permille = parse_permille(value);
+            parsed.burst_len = strtoul(second, NULL, 10);
+        }
+        else if (strcmp(setting, "stall") == 0 && second) {
+            parsed.stall_every_ms = strtoul(value, NULL, 10);
+            parsed.stall_ms = strtoul(second, NULL, 10);
+        }
+        else if (strcmp(setting, "reset") == 0)
+            parsed.reset_permille = parse_permille(value);
+        else
+            return false;
+    }
+
+    s_scenario = parsed;
+    s_rng_state = parsed.seed ? parsed.seed : 1; // xorshift gets stuck on 0
+    s_burst_remaining = 0;
+    s_start_ms = esp_log_timestamp();
+    s_link_free_at_ms = s_start_ms;
+
+    portENTER_CRITICAL(&s_line_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_line_lock);
+
+    return true;
+}
+
+void net_impair_get_stats(struct net_impair_stats* stats)
+{
+    portENTER_CRITICAL(&s_line_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_line_lock);
+}
+
+/**
+ * @brief applies the scenario to one send
+ *
+ * @param len bytes about to be sent
+ * @param stream true for stream sockets (they get resets instead of losses)
+ * @param delay (out param) how much later than now it should be delivered
+ * @return int 0 to deliver it, 1 to pretend it was sent, -1 to fail it (errno is set)
+ */
+static int impair(size_t len, bool stream, uint32_t* delay)
+{
+    const uint32_t now = esp_log_timestamp();
+    *delay = 0;
+
+    // the stall is at the end of each period, so a scenario doesn't start out stalled
+    if (s_scenario.stall_every_ms > 0 && (now - s_start_ms) % s_scenario.stall_every_ms >= s_scenario.stall_every_ms - MIN(s_scenario.stall_ms, s_scenario.stall_every_ms)) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    if (s_burst_remaining == 0 && chance(s_scenario.burst_permille))
+        s_burst_remaining = s_scenario.burst_len;
+    if (s_burst_remaining > 0) {
+        s_burst_remaining--;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (stream && chance(s_scenario.reset_permille)) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    *delay = s_scenario.latency_ms;
+    if (s_scenario.jitter_ms > 0) {
+        const int32_t jitter = (int32_t)(next_random() % (2 * s_scenario.jitter_ms + 1)) - (int32_t)s_scenario.jitter_ms;
+        *delay = (jitter < 0 && (uint32_t)-jitter > *delay) ? 0 : *delay + jitter;
+    }
+
+    if (s_scenario.rate_bytes_per_sec > 0) {
+        // the link is busy until everything sent before has gone out
+        if ((int32_t)(s_link_free_at_ms - now) < 0)
+            s_link_free_at_ms = now;
+        s_link_free_at_ms += (uint32_t)((uint64_t)len * 1000 / s_scenario.rate_bytes_per_sec);
+        const uint32_t busy = s_link_free_at_ms - now;
+        if (busy > *delay)
+            *delay = busy;
+    }
+
+    // a stream can't lose data, TCP sends it again: the loss shows up as a retransmission timeout instead
+    if (stream && chance(s_scenario.loss_permille))
+        *delay += MAX(NET_IMPAIR_MIN_RTO_MS, 2 * s_scenario.latency_ms);
+
+    if (!stream && chance(s_scenario.loss_permille))
+        return 1;
+
+    return 0;
+}
+
+/**
+ * @brief finds the send in the delay line that's due first. call with s_line_lock held
+ *
+ * @param ctx only look at sends for this one, NULL for any (other than the one being flushed)
+ * @return struct delayed_send* NULL if there isn't one
+ */
+static struct delayed_send* first_due(void* ctx)
+{
+    struct delayed_send* first = NULL;
+    for (size_t i = 0; i < NET_IMPAIR_DELAY_LINE_SIZE; i++) {
+        struct delayed_send* entry = &s_line[i];
+        if (!entry->data || (ctx && entry->ctx != ctx) || (!ctx && entry->ctx == s_flushing_ctx))
+            continue;
+        if (!first || (int32_t)(entry->due_ms - first->due_ms) < 0 ||
+            (entry->due_ms == first->due_ms && (int32_t)(entry->order - first->order) < 0))
+            first = entry;
+    }
+    return first;
+}
+
+/**
+ * @brief takes a send out of the delay line. call with s_line_lock held
+ */
+static struct delayed_send take(struct delayed_send* entry)
+{
+    const struct delayed_send taken = *entry;
+    entry->data = NULL;
+    s_line_count--;
+    if (taken.stream)
+        s_streams_queued--;
+    return taken;
+}
+
+/**
+ * @brief hands a send that's come out of the delay line to the transport, and frees its copy
+ */
+static void deliver(struct delayed_send* entry)
+{
+    const int sent = entry->deliver(entry->ctx, entry->data, entry->len);
+    const int error = errno;
+
+    portENTER_CRITICAL(&s_line_lock);
+    if (sent < 0) {
+        s_stats.failed++;
+        if (entry->stream) {
+            s_error_ctx = entry->ctx;
+            s_error = error;
+        }
+    } else {
+        s_stats.sent++;
+    }
+    portEXIT_CRITICAL(&s_line_lock);
+
+    free(entry->data);
+}
+
+/**
+ * @brief the shim's task: delivers each send in the delay line when it's due
+ */
+static void net_impair_task(void* arg)
+{
+    (void) arg;
+    for (;;) {
+        portENTER_CRITICAL(&s_line_lock);
+        struct delayed_send* next = first_due(NULL);
+        const uint32_t now = esp_log_timestamp();
+        if (next && (int32_t)(next->due_ms - now) <= 0) {
+            struct delayed_send entry = take(next);
+            s_delivering_ctx = entry.ctx;
+            portEXIT_CRITICAL(&s_line_lock);
+
+            deliver(&entry);
+
+            portENTER_CRITICAL(&s_line_lock);
+            s_delivering_ctx = NULL;
+            portEXIT_CRITICAL(&s_line_lock);
+            continue;
+        }
+        const TickType_t wait = next ? pdMS_TO_TICKS(next->due_ms - now) : portMAX_DELAY;
+        portEXIT_CRITICAL(&s_line_lock);
+
+        ulTaskNotifyTake(pdTRUE, wait ? wait : 1);
+    }
+}
+
+/**
+ * @brief copies a send into the delay line
+ *
+ * @return int len, or -1 with errno set if a datagram doesn't fit
+ */
+static int defer(void* ctx, const void* data, size_t len, bool stream, net_impair_deliver_fn deliver_fn, uint32_t due_ms)
+{
+    uint8_t* copy = malloc(len);
+    if (!copy) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(copy, data, len);
+
+    if (!s_task)
+        xTaskCreatePinnedToCore(net_impair_task, "net_impair", 3072, NULL, 3, &s_task, 1);
+
+    const uint32_t start = esp_log_timestamp();
+    portENTER_CRITICAL(&s_line_lock);
+    while (s_line_count == NET_IMPAIR_DELAY_LINE_SIZE) {
+        if (!stream) {
+            // the link's buffers are full
+            s_stats.failed++;
+            portEXIT_CRITICAL(&s_line_lock);
+            free(copy);
+            errno = ENOBUFS;
+            return -1;
+        }
+        portEXIT_CRITICAL(&s_line_lock);
+        vTaskDelay(1);
+        portENTER_CRITICAL(&s_line_lock);
+    }
+    s_stats.blocked_ms += esp_log_timestamp() - start;
+
+    struct delayed_send* entry = s_line;
+    while (entry->data)
+        entry++;
+    *entry = (struct delayed_send){ .ctx = ctx, .deliver = deliver_fn, .data = copy, .len = len, .due_ms = due_ms,
+                                    .order = s_next_order++, .stream = stream };
+    s_line_count++;
+    if (stream) {
+        s_streams_queued++;
+        s_stream_due_ms = due_ms;
+    }
+    s_stats.delayed_ms += due_ms - start;
+    portEXIT_CRITICAL(&s_line_lock);
+
+    xTaskNotifyGive(s_task);
+    return (int)len;
+}
+
+/**
+ * @brief sends data through the scenario: fails it, loses it, delivers it now, or copies it into the delay line to be
+ *        delivered later by the shim's task
+ *
+ * @param ctx passed to deliver, e.g. the transport's handle. net_impair_flush() it before it goes away
+ * @param data what to send. the caller can reuse it as soon as this returns
+ * @param len number of bytes of data
+ * @param stream true for stream sockets: they get resets and retransmissions instead of losses, and stay in order
+ * @param deliver sends it for real
+ * @return int len, or what deliver returned if it went straight through. -1 with errno set if it failed, which for a
+ *         stream may be a send before this one failing late
+ */
+int net_impair_submit(void* ctx, const void* data, size_t len, bool stream, net_impair_deliver_fn deliver)
+{
+    // like a socket's pending error: a stream send that failed after leaving the delay line fails the next one
+    portENTER_CRITICAL(&s_line_lock);
+    if (stream && s_error_ctx == ctx) {
+        s_error_ctx = NULL;
+        portEXIT_CRITICAL(&s_line_lock);
+        errno = s_error;
+        return -1;
+    }
+    portEXIT_CRITICAL(&s_line_lock);
+
+    uint32_t delay;
+    const int verdict = impair(len, stream, &delay);
+    if (verdict != 0) {
+        portENTER_CRITICAL(&s_line_lock);
+        if (verdict < 0)
+            s_stats.failed++;
+        else
+            s_stats.lost++;
+        portEXIT_CRITICAL(&s_line_lock);
+        return verdict < 0 ? -1 : (int)len;
+    }
+
+    // a stream send can't overtake the ones before it, or get in the middle of one the shim's task is sending
+    const uint32_t now = esp_log_timestamp();
+    uint32_t due = now + delay;
+    portENTER_CRITICAL(&s_line_lock);
+    const bool behind = stream && (s_streams_queued > 0 || s_delivering_ctx == ctx);
+    if (stream && s_streams_queued > 0 && (int32_t)(s_stream_due_ms - due) > 0)
+        due = s_stream_due_ms;
+    portEXIT_CRITICAL(&s_line_lock);
+
+    if (delay > 0 || behind)
+        return defer(ctx, data, len, stream, deliver, due);
+
+    const int sent = deliver(ctx, data, len);
+    portENTER_CRITICAL(&s_line_lock);
+    if (sent < 0)
+        s_stats.failed++;
+    else
+        s_stats.sent++;
+    portEXIT_CRITICAL(&s_line_lock);
+    return sent;
+}
+
+/**
+ * @brief delivers everything in the delay line for ctx right away, e.g. before its socket is closed
+ */
+void net_impair_flush(void* ctx)
+{
+    portENTER_CRITICAL(&s_line_lock);
+    s_flushing_ctx = ctx;
+    while (s_delivering_ctx == ctx) {
+        portEXIT_CRITICAL(&s_line_lock);
+        vTaskDelay(1);
+        portENTER_CRITICAL(&s_line_lock);
+    }
+
+    struct delayed_send* next;
+    while ((next = first_due(ctx)) != NULL) {
+        struct delayed_send entry = take(next);
+        portEXIT_CRITICAL(&s_line_lock);
+        deliver(&entry);
+        portENTER_CRITICAL(&s_line_lock);
+    }
+
+    s_flushing_ctx = NULL;
+    if (s_error_ctx == ctx)
+        s_error_ctx = NULL;
+    portEXIT_CRITICAL(&s_line_lock);
+}
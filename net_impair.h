@@ -0,0 +1,69 @@
+#ifndef WIFI_LOGGER_NET_IMPAIR_H
+#define WIFI_LOGGER_NET_IMPAIR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <lwip/sockets.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Network impairment shim for testing: sits between the transport handlers and the socket calls and makes the link
+ * misbehave in repeatable ways. Only compiled in with CONFIG_LOGGING_SERVER_NET_IMPAIRMENT.
+ *
+ * Latency doesn't hold up the caller, as it wouldn't on a real link: a send that's due later is copied into a delay line
+ * and the caller carries on, and the shim's own task (created on first use) hands it to the transport when it's due.
+ * Datagrams come out in the order they fall due, so jitter reorders them; a stream's sends stay in order, so a late
+ * one holds up the ones behind it. The delay line holds NET_IMPAIR_DELAY_LINE_SIZE sends, like a link's buffers:
+ * a datagram that doesn't fit fails with ENOBUFS, a stream send waits for room. What goes into the delay line and
+ * what the caller waits for are counted separately (delayed_ms, blocked_ms), so a drain loop's cost can be told
+ * apart from the link's.
+ *
+ * A scenario is a string of space separated key=value settings, unset keys are off:
+ *   seed=<n>              random seed, the same seed + scenario gives the same sequence of impairments
+ *   loss=<percent>        silently drop this share of datagrams (the send still "succeeds"), e.g. loss=2.5. on stream
+ *                         sockets, delay this share of sends by a retransmission timeout (200 ms, or 2 * latency) instead
+ *   latency=<ms>          deliver every send this much later...
+ *   jitter=<ms>           ...plus or minus up to this much
+ *   rate=<bytes/sec>      bandwidth cap: sends wait until the link has room for them
+ *   burst=<percent>,<n>   chance per send of starting a run of n sends failing with ENOBUFS
+ *   stall=<every_ms>,<ms> every every_ms, all sends fail with EHOSTUNREACH (errno 118 on lwIP) for ms, like an AP roam
+ *   reset=<percent>       chance per send of a connection reset (stream sockets: fails with ECONNRESET)
+ *
+ * "@<path>" reads the scenario from a file instead (on the device, from a mounted VFS filesystem): the same settings,
+ * separated by spaces or newlines, and '#' starts a comment that runs to the end of the line.
+ */
+
+#define NET_IMPAIR_DELAY_LINE_SIZE 64
+#define NET_IMPAIR_SCENARIO_MAX_LEN 511   // a scenario, or a scenario file with its comments
+
+struct net_impair_stats {
+    uint32_t sent;          // passed through to the transport
+    uint32_t lost;          // dropped on purpose, caller was told they were sent
+    uint32_t failed;        // failed on purpose (burst, stall, reset, delay line full), or by the transport once delivered late
+    uint32_t delayed_ms;    // total time sends spent in the delay line (latency, jitter, rate limiting, retransmissions)
+    uint32_t blocked_ms;    // total time callers waited for room in the delay line
+};
+
+/**
+ * @brief sends data for real, on behalf of net_impair_submit(). may be called from the shim's task.
+ *
+ * @param ctx what the caller passed to net_impair_submit(), e.g. its handle
+ * @return int bytes sent, or -1 with errno set
+ */
+typedef int (*net_impair_deliver_fn)(void* ctx, const void* data, size_t len);
+
+bool net_impair_configure(const char* scenario);
+void net_impair_get_stats(struct net_impair_stats* stats);
+
+int net_impair_submit(void* ctx, const void* data, size_t len, bool stream, net_impair_deliver_fn deliver);
+void net_impair_flush(void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_NET_IMPAIR_H
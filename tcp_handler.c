@@ -1,13 +1,19 @@
 #include <string.h>
 #include <sys/param.h>
-#include "esp_system.h"
-#include "esp_log.h"
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
+#include <esp_log.h>
+#include <lwip/sockets.h>
 #include <lwip/netdb.h>
 
 #include "tcp_handler.h"
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+#include "net_impair.h"
+#endif
+
+// a collector that doesn't answer within this long isn't worth holding up the logger task for. it's one SYN on the
+// ESP32: lwIP's first retransmission timeout is 3 s, so a lost SYN fails the connect, and the caller tries again later
+#define TCP_CONNECT_TIMEOUT_MS 2000
+// a send that can't get into the socket buffer within this long counts as failed: the link is stalled
+#define TCP_SEND_TIMEOUT_MS 1000
 
 struct logger_tcp_network_data
 {
@@ -25,128 +31,251 @@ struct logger_tcp_network_data* create_tcp_network_manager_handle()
 {
     const size_t size = sizeof(struct logger_tcp_network_data);
     struct logger_tcp_network_data* handle = malloc(size);
+    if (!handle) {
+        printf("%s: out of memory for the handle\n", TAG);
+        return NULL;
+    }
     memset(handle, 0, size);
+    handle->sock = -1;
     return handle;
 }
 
-bool is_tcp_connected(struct logger_tcp_network_data* nm) {
-    /* Technically ENOTCONN indicates socket is not connected but I think there is a bug
-	 * Check out https://github.com/espressif/esp-idf/issues/6092 to follow the issue ticket raised
-	 * Till then keeping the following check instead of just 0 == errno
-	 **/
-    if (0 == errno || ENOTCONN == errno) {
-        ret = true;
-    }
+bool is_tcp_connected(struct logger_tcp_network_data* nm)
+{
+    assert(nm);
+    return nm && nm->sock >= 0;
 }
 
 /**
  * @brief Manages TCP connection to the server
- * 
+ *
  * @param nm tcp_network_data struct which contains necessary data for a TCP connection
- * @return void
+ * @param host name or IP of the server
+ * @param port TCP port of the server
+ * @return bool true if connected, within TCP_CONNECT_TIMEOUT_MS
  **/
 bool connect_tcp_network_manager(struct logger_tcp_network_data* nm, const char* host, int port)
 {
-    memset(handle, 0, sizeof(struct logger_tcp_network_data));
-
-    // TODO: use getbyhostname() or similar to allow DNS (not just IPs)
-
-	nm->dest_addr.sin_addr.s_addr = inet_addr(host);
-	nm->dest_addr.sin_family = AF_INET;
-	nm->dest_addr.sin_port = htons(port);
-	nm->addr_family = AF_INET;
-	nm->ip_protocol = IPPROTO_IP;
-	inet_ntoa_r(nm->dest_addr.sin_addr, nm->addr_str, sizeof(nm->addr_str) - 1);
-
-	nm->sock = socket(nm->addr_family, SOCK_STREAM, nm->ip_protocol);
-	if (nm->sock < 0)
-	{
-		ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-		tcp_close_network_manager(nm);
-		return false;
-	}
-    ESP_LOGI(TAG, "TCP Socket created");
-
-	int err = connect(nm->sock, (struct sockaddr *)&nm->dest_addr, sizeof(nm->dest_addr));
-	if (err != 0) {
-		ESP_LOGE(TAG, "Socket unable to connect: errno %d", errno);
-		tcp_close_network_manager(nm);
-		return false;
-	}
-
-    ESP_LOGI(TAG, "TCP Successfully connected to %s:%d with status %d", host, port, errno);
-	return true;
+    // use printf() for local logging to avoid anything weird with feedback loops, since we're hooked into ESP_LOG()
+
+    assert(nm);
+    if (!nm)
+        return false;
+
+    tcp_close_network_manager(nm);
+    memset(nm, 0, sizeof(struct logger_tcp_network_data));
+    nm->sock = -1;
+
+    if (!host || strlen(host) <= 0 || port <= 0)
+        return false;
+
+    struct hostent *server = gethostbyname(host);
+    if (server == NULL) {
+        printf("%s: No such host known\n", TAG);
+        return false;
+    }
+
+    memcpy((void*)&nm->dest_addr.sin_addr, server->h_addr_list[0], server->h_length);
+    nm->dest_addr.sin_family = AF_INET;
+    nm->dest_addr.sin_port = htons(port);
+    nm->addr_family = AF_INET;
+    nm->ip_protocol = IPPROTO_IP;
+    inet_ntoa_r(nm->dest_addr.sin_addr, nm->addr_str, sizeof(nm->addr_str) - 1);
+
+    nm->sock = socket(nm->addr_family, SOCK_STREAM, nm->ip_protocol);
+    if (nm->sock < 0)
+    {
+        printf("%s: Unable to create socket: errno %d\n", TAG, errno);
+        return false;
+    }
+
+    // connect without blocking, so an unreachable server costs TCP_CONNECT_TIMEOUT_MS, not the stack's SYN retries
+    const int flags = fcntl(nm->sock, F_GETFL, 0);
+    fcntl(nm->sock, F_SETFL, flags | O_NONBLOCK);
+
+    int err = connect(nm->sock, (struct sockaddr *)&nm->dest_addr, sizeof(nm->dest_addr));
+    if (err != 0 && errno == EINPROGRESS)
+    {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(nm->sock, &writable);
+        struct timeval timeout = { .tv_sec = TCP_CONNECT_TIMEOUT_MS / 1000, .tv_usec = (TCP_CONNECT_TIMEOUT_MS % 1000) * 1000 };
+
+        int so_error = ETIMEDOUT;
+        socklen_t so_error_len = sizeof(so_error);
+        if (select(nm->sock + 1, NULL, &writable, NULL, &timeout) > 0)
+            getsockopt(nm->sock, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len);
+        err = so_error ? -1 : 0;
+        errno = so_error;
+    }
+    if (err != 0) {
+        printf("%s: Socket unable to connect to %s:%d: errno %d\n", TAG, nm->addr_str, port, errno);
+        tcp_close_network_manager(nm);
+        return false;
+    }
+
+    fcntl(nm->sock, F_SETFL, flags);
+    const struct timeval send_timeout = { .tv_sec = TCP_SEND_TIMEOUT_MS / 1000, .tv_usec = (TCP_SEND_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(nm->sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    // every send is a whole batch already: don't hold it back waiting for the last one to be acked
+    const int nodelay = 1;
+    setsockopt(nm->sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    printf("%s: Socket connected to %s:%d\n", TAG, nm->addr_str, port);
+    return true;
 }
 
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
 /**
- * @brief Sends data to the server through a TCP socket
- * 
+ * @brief send()s all of it, see net_impair_deliver_fn
+ **/
+static int deliver_segment(void* ctx, const void* payload, size_t len)
+{
+    struct logger_tcp_network_data* nm = ctx;
+    size_t sent = 0;
+    while (sent < len)
+    {
+        const int err = send(nm->sock, (const char*)payload + sent, len - sent, 0);
+        if (err < 0 && errno == EINTR)
+            continue;
+        if (err < 0)
+            return -1;
+        sent += err;
+    }
+    return (int)sent;
+}
+#endif
+
+/**
+ * @brief Sends data to the server through a TCP socket, all of it
+ *
  * @param nm A pointer to tcp_network_data struct
- * @param payload char array which contains data to be sent
- * @return int - returns -1 if sending failed, number of bytes sent if successfully sent the data
+ * @param payload data to be sent, doesn't need to be null-terminated
+ * @param len number of bytes of payload to send
+ * @return int - returns -1 if sending failed (some of payload may have been sent), len if successfully sent the data
  **/
-int tcp_send_data(struct logger_tcp_network_data* nm, char* payload)
+int tcp_send_data(struct logger_tcp_network_data* nm, const char* payload, size_t len)
 {
-	if(nm->sock < 0)
-	{
-		ESP_LOGE(TAG, "%s", "Socket does not exist");
-		return -1;
-	}
-
-    int err = send(nm->sock, payload, strlen(payload), 0);
-    if (err < 0)
+    if (nm->sock < 0)
     {
-        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        printf("%s: Socket does not exist\n", TAG);
+        return -1;
     }
-    else
+
+    size_t sent = 0;
+    while (sent < len)
     {
-        ESP_LOGD(TAG, "%s", "Message sent");
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+        const int err = net_impair_submit(nm, &payload[sent], len - sent, true, deliver_segment);
+#else
+        const int err = send(nm->sock, &payload[sent], len - sent, 0);
+#endif
+        if (err < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // 118 = no network is available. we'll silently ignore it to prevent spamming
+            if (errno != 118)
+                printf("%s: Error occurred during sending: errno %d\n", TAG, errno);
+            return -1;
+        }
+        sent += err;
     }
-    return err;
+
+    return (int)sent;
 }
 
 /**
  * @brief Receives data from TCP server
- * 
+ *
  * @param nm tcp_network_data struct which contains connection info
  * @return char array which contains data received
  **/
 char* tcp_receive_data(struct logger_tcp_network_data* nm)
 {
-	if (nm->sock < 0)
-	{
-		ESP_LOGE(TAG, "%s", "Socket doesnot exist");
-		return NULL;
-	}
+    if (nm->sock < 0)
+    {
+        printf("%s: Socket does not exist\n", TAG);
+        return NULL;
+    }
 
     int len = recv(nm->sock, nm->rx_buffer, sizeof(nm->rx_buffer) - 1, 0);
     if (len < 0)
     {
-        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+        printf("%s: recv failed: errno %d\n", TAG, errno);
         return NULL;
     }
 
     nm->rx_buffer[len] = 0; // Null-terminate whatever we received and treat like a string
-    ESP_LOGD(TAG, "Received %d bytes from %s:", len, nm->addr_str);
-    ESP_LOGD(TAG, "%s", nm->rx_buffer);
     return nm->rx_buffer;
 }
 
 /**
- * @brief Shutdown active connection, deallocate memory
- * 
+ * @brief Finishes the connection: sends nothing more, then waits up to timeout_ms for the server to close its end too,
+ * which it does once it has read everything (tools/wifi_log_collector.py does), and closes it.
+ *
+ * @param nm tcp_network_data struct which contains connection info
+ * @param timeout_ms how long to wait for the server
+ * @return bool true if the server closed its end: it got everything that was sent. false if it didn't in time, or the
+ * connection broke: then some of it may never arrive
+ **/
+bool tcp_finish_network_manager(struct logger_tcp_network_data* nm, uint32_t timeout_ms)
+{
+    assert(nm);
+    if (!nm || nm->sock < 0)
+        return true;
+
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    net_impair_flush(nm);
+#endif
+    bool finished = false;
+    if (shutdown(nm->sock, SHUT_WR) == 0)
+    {
+        // waits in slices, each at most wait_ms long, so it's never longer than timeout_ms in all
+        uint32_t wait_ms = 0;
+        for (uint32_t waited_ms = 0; waited_ms < timeout_ms; waited_ms += wait_ms)
+        {
+            wait_ms = MIN(timeout_ms - waited_ms, 100);
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(nm->sock, &readable);
+            struct timeval timeout = { .tv_sec = 0, .tv_usec = wait_ms * 1000 };
+            if (select(nm->sock + 1, &readable, NULL, NULL, &timeout) <= 0)
+                continue;
+
+            // the server has nothing to say over TCP: anything it does send is thrown away
+            const int len = recv(nm->sock, nm->rx_buffer, sizeof(nm->rx_buffer), 0);
+            if (len == 0)
+                finished = true;
+            if (len <= 0)
+                break;
+        }
+    }
+    if (!finished)
+        printf("%s: the server didn't confirm it got everything, some of it may be lost\n", TAG);
+
+    tcp_close_network_manager(nm);
+    return finished;
+}
+
+/**
+ * @brief Shutdown active connection, keeping the handle around for connect_tcp_network_manager() to use again.
+ * Closes at once: data still in the socket's send buffer may never arrive, e.g. if the link is lossy or the server
+ * has gone. Use tcp_finish_network_manager() to wait for it.
+ *
  * @param nm tcp_network_data struct which contains connection info
  * @return void
  **/
 void tcp_close_network_manager(struct logger_tcp_network_data* nm)
 {
     assert(nm);
-    if (!nmn || nm->sock == -1)
+    if (!nm || nm->sock < 0)
         return;
 
-    ESP_LOGI(TAG, "%s", "Shutting down socket and restarting...");
-    shutdown(nm->sock, 0);
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    net_impair_flush(nm);
+#endif
+    printf("%s: Shutting down socket\n", TAG);
     close(nm->sock);
-
     nm->sock = -1;
 }
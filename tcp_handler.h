@@ -1,6 +1,10 @@
 #ifndef TCP_HANDLER_H
 #define TCP_HANDLER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -9,8 +13,9 @@ struct logger_tcp_network_data;
 
 struct logger_tcp_network_data* create_tcp_network_manager_handle();
 bool connect_tcp_network_manager(struct logger_tcp_network_data* nm, const char* host, int port);
-int tcp_send_data(struct logger_tcp_network_data* nm, char* payload);
+int tcp_send_data(struct logger_tcp_network_data* nm, const char* payload, size_t len);
 char* tcp_receive_data(struct logger_tcp_network_data* nm);
+bool tcp_finish_network_manager(struct logger_tcp_network_data* nm, uint32_t timeout_ms);
 void tcp_close_network_manager(struct logger_tcp_network_data* nm);
 bool is_tcp_connected(struct logger_tcp_network_data* nm);
 
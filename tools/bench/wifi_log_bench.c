@@ -0,0 +1,558 @@
+/*
+ * wifi_log_bench: what one ESP_LOGx() line costs the task that logs it, stage by stage, built for the host.
+ *
+ * Every call to ESP_LOGx() while the logger is hooked in goes through system_log_message_route(): it checks
+ * is_network_logging_allowed_here(), formats the line (vsnprintf), prepends the device id
+ * (generate_log_message_timestamp_and_device_id(), utils.cpp) and hands the result to the logger task
+ * (send_to_queue()). Each of those is timed on its own, then the whole route, with 1 up to --threads threads logging
+ * at the same time, so contention on the queue and the filter locks shows up. A thread stands in for the logger task
+ * and empties the queue, like it would, but only in between runs: this build's queue (see the Makefile) holds a whole
+ * run, so no call in one finds it full, and none of them is slowed down by the consumer waking up or taking a core.
+ *
+ * Then wifi_log_i() lines with nothing to format, short and long, which only queue a reference to their text, against
+ * the same long line going through the formatting path.
+ *
+ * malloc() and friends are wrapped to count allocations, per thread, so the consumer's free()s aren't counted.
+ *
+ * Results are compared against a baseline file: a stage that allocates more per call than the baseline says, or got
+ * more than --threshold percent slower, is a regression and the exit status is 1. Allocation counts are exact, and
+ * compare anywhere. Times don't: a stage's time is compared as a ratio to the utils stage's at the same number of
+ * threads, measured in the same run, so a faster or slower machine than the baseline's moves both and the check still
+ * passes. What it catches is one stage getting slower against the rest. Runs on a shared host are noisy: a row is off
+ * by a third now and then, hence the default --threshold of 50%. Make a new baseline with --update-baseline after a
+ * change that's meant to make a stage faster or slower.
+ *
+ * build: make -C tools/bench
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+// wifi_logger.c's. log_queue.h doesn't have these: only the logger task calls them
+esp_err_t init_queue(void);
+bool receive_from_queue(struct log_queue_item* item, TickType_t timeout);
+int system_log_message_route(const char* fmt, va_list tag);
+
+#define MAX_THREADS 64
+#define MAX_RESULTS 64
+#define SAMPLE_TAG "wifi"
+
+// what esp_log hands to the vprintf hook for ESP_LOGI(SAMPLE_TAG, "connected to %s, rssi %d dBm", ...)
+static const char* const SAMPLE_FORMAT = "\033[0;32mI (%lu) %s: connected to %s, rssi %d dBm\033[0m\n";
+// and what it looks like formatted
+static const char* const SAMPLE_LINE = "\033[0;32mI (123456) wifi: connected to office-ap-2, rssi -61 dBm\033[0m\n";
+
+// queued by the send_to_queue stage, so that stage times the queue and nothing else. the consumer doesn't free() it
+static char s_static_message[] = "I (123456) wifi: connected to office-ap-2, rssi -61 dBm\n";
+
+// a long line, for the stages that log whole lines with wifi_log_i()
+#define SAMPLE_LONG_TEXT "scan done: office-ap-2 (-61 dBm, ch 6), office-ap-1 (-67 dBm, ch 1), guest (-70 dBm, ch 11), " \
+    "printer-direct (-78 dBm, ch 6), lab-2g (-81 dBm, ch 1), neighbours-wifi (-84 dBm, ch 11), iot-bridge (-88 dBm, ch 6)"
+
+/*
+ * allocation counting. glibc's own allocator is still reachable as __libc_malloc() and friends
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static __thread uint64_t t_allocations;
+
+void* malloc(size_t size)
+{
+    t_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    t_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    t_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+/*
+ * what the benchmark doesn't run. the logger task is never started, so nothing asks the control channel anything, and
+ * nothing lists the wifi_log_x() call sites: the site registry the linker fragment makes on the device is left empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+/*
+ * the stages
+ */
+static int format_sample(char* buf, size_t size, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int len = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static int route_sample(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int len = system_log_message_route(fmt, args);
+    va_end(args);
+    return len;
+}
+
+static void stage_allowed(void)
+{
+    volatile bool allowed = is_network_logging_allowed_here();
+    (void) allowed;
+}
+
+static void stage_vsnprintf(void)
+{
+    char buf[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE];
+    format_sample(buf, sizeof(buf), SAMPLE_FORMAT, 123456ul, SAMPLE_TAG, "office-ap-2", -61);
+}
+
+static void stage_utils(void)
+{
+    free(generate_log_message_timestamp_and_device_id(true, false, 0, 0, SAMPLE_LINE));
+}
+
+static void stage_send_to_queue(void)
+{
+    const struct log_queue_item item = { .message = s_static_message };
+    send_to_queue(&item, sizeof(s_static_message) - 1);
+}
+
+static void stage_route(void)
+{
+    route_sample(SAMPLE_FORMAT, 123456ul, SAMPLE_TAG, "office-ap-2", -61);
+}
+
+static void stage_const_short(void)
+{
+    wifi_log_i(SAMPLE_TAG, "connected");
+}
+
+static void stage_const_long(void)
+{
+    wifi_log_i(SAMPLE_TAG, SAMPLE_LONG_TEXT);
+}
+
+static void stage_format_long(void)
+{
+    wifi_log_i(SAMPLE_TAG, "%s", SAMPLE_LONG_TEXT);
+}
+
+struct stage {
+    const char* name;
+    void (*run)(void);
+};
+
+static const struct stage s_stages[] = {
+    { "allowed", stage_allowed },
+    { "vsnprintf", stage_vsnprintf },
+    { "utils", stage_utils },
+    { "send_to_queue", stage_send_to_queue },
+    { "route", stage_route },
+    { "const_short", stage_const_short },
+    { "const_long", stage_const_long },
+    { "format_long", stage_format_long },
+};
+
+struct result {
+    char stage[32];
+    unsigned threads;
+    double ns_per_call;
+    double allocs_per_call;
+};
+
+struct options {
+    unsigned max_threads;
+    unsigned iterations;
+    unsigned repeat;
+    double threshold_percent;
+    const char* baseline_path;
+    bool update_baseline;
+};
+
+struct worker {
+    pthread_t thread;
+    const struct stage* stage;
+    unsigned iterations;
+    pthread_barrier_t* start;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t allocations;
+};
+
+static volatile bool s_consumer_stop = false;
+static volatile bool s_consumer_paused = false;
+static volatile unsigned s_consumer_idle_polls;
+
+/**
+ * @brief wall time, so waiting for a lock another thread holds counts. see run_stage() for what's done with it
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief stands in for the logger task: takes whatever the stages queue, and throws it away
+ */
+static void* consumer_main(void* arg)
+{
+    (void) arg;
+    struct log_queue_item item;
+    while (!s_consumer_stop) {
+        if (s_consumer_paused) {
+            usleep(1000);
+            continue;
+        }
+        if (!receive_from_queue(&item, pdMS_TO_TICKS(10))) {
+            s_consumer_idle_polls++;
+            continue;
+        }
+        if (item.message != s_static_message && !(item.flags & LOG_ITEM_FLAG_STATIC))
+            free(item.message);
+    }
+    return NULL;
+}
+
+static void* worker_main(void* arg)
+{
+    struct worker* worker = arg;
+
+    // the first calls on a thread pay for things the rest don't (the thread's task handle, stdio buffers)
+    for (unsigned i = 0; i < worker->iterations / 10 + 1; i++)
+        worker->stage->run();
+
+    pthread_barrier_wait(worker->start);
+
+    const uint64_t allocations = t_allocations;
+    worker->start_ns = now_ns();
+    for (unsigned i = 0; i < worker->iterations; i++)
+        worker->stage->run();
+    worker->end_ns = now_ns();
+    worker->allocations = t_allocations - allocations;
+    return NULL;
+}
+
+/**
+ * @brief runs a stage on threads threads at once, repeat times, and keeps the fastest run
+ *
+ * A call's time is the run's wall time, from the first thread starting to the last one finishing, times the cores the
+ * threads had, over the calls made: what a call costs its caller when each thread has a core, and with more threads
+ * than cores, what it costs the cores between them, switching from one thread to another included. Either way, it
+ * doesn't depend on how the scheduler happened to slice the run.
+ */
+static struct result run_stage(const struct stage* stage, unsigned threads, const struct options* opts)
+{
+    struct result result = { .threads = threads, .ns_per_call = -1.0 };
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned cores = (online > 0 && (unsigned long)online < threads) ? (unsigned)online : threads;
+    snprintf(result.stage, sizeof(result.stage), "%s", stage->name);
+
+    for (unsigned r = 0; r < opts->repeat; r++) {
+        struct worker workers[MAX_THREADS];
+        pthread_barrier_t start;
+        pthread_barrier_init(&start, NULL, threads);
+
+        s_consumer_paused = true;
+        for (unsigned t = 0; t < threads; t++) {
+            workers[t] = (struct worker){ .stage = stage, .iterations = opts->iterations, .start = &start };
+            pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+        }
+
+        uint64_t first_start = UINT64_MAX;
+        uint64_t last_end = 0;
+        uint64_t allocations = 0;
+        for (unsigned t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+            first_start = workers[t].start_ns < first_start ? workers[t].start_ns : first_start;
+            last_end = workers[t].end_ns > last_end ? workers[t].end_ns : last_end;
+            allocations += workers[t].allocations;
+        }
+        pthread_barrier_destroy(&start);
+
+        // and before the next run, the queue is emptied
+        const unsigned idle_polls = s_consumer_idle_polls;
+        s_consumer_paused = false;
+        while (s_consumer_idle_polls == idle_polls)
+            usleep(1000);
+
+        const double calls = (double)threads * opts->iterations;
+        const double ns_per_call = (double)(last_end - first_start) * cores / calls;
+        if (result.ns_per_call < 0.0 || ns_per_call < result.ns_per_call)
+            result.ns_per_call = ns_per_call;
+        result.allocs_per_call = (double)allocations / calls;
+    }
+
+    return result;
+}
+
+/**
+ * @brief the route stage echoes every line to the console, and send_to_queue() complains when the queue is full
+ *
+ * @return int what to pass to restore_stdout()
+ */
+static int silence_stdout(void)
+{
+    fflush(stdout);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    const int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return saved_stdout;
+}
+
+static void restore_stdout(int saved_stdout)
+{
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+/**
+ * @brief reads "<stage> <threads> <ns per call> <allocations per call>" lines
+ *
+ * @return size_t how many results were read. 0 if there's no baseline file
+ */
+static size_t load_baseline(const char* path, struct result* results, size_t max_results)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    size_t count = 0;
+    char line[256];
+    while (count < max_results && fgets(line, sizeof(line), f)) {
+        struct result* r = &results[count];
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%31s %u %lf %lf", r->stage, &r->threads, &r->ns_per_call, &r->allocs_per_call) == 4)
+            count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+static bool save_baseline(const char* path, const struct result* results, size_t count, const struct options* opts)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    fprintf(f, "# wifi_log_bench baseline, %u iterations, best of %u. regenerate with: make -C tools/bench baseline\n",
+            opts->iterations, opts->repeat);
+    fprintf(f, "# stage threads ns_per_call allocs_per_call\n");
+    for (size_t i = 0; i < count; i++)
+        fprintf(f, "%s %u %.1f %.2f\n", results[i].stage, results[i].threads, results[i].ns_per_call,
+                results[i].allocs_per_call);
+
+    fclose(f);
+    return true;
+}
+
+static const struct result* find_result(const struct result* results, size_t count, const char* stage, unsigned threads)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(results[i].stage, stage) == 0 && results[i].threads == threads)
+            return &results[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief prints one row, and how it compares to the baseline
+ *
+ * @param reference the utils stage at the same number of threads, in this run
+ * @param base this stage in the baseline, NULL if it's not there
+ * @param base_reference the utils stage in the baseline
+ * @return bool false if it's a regression
+ */
+static bool print_row(const struct result* r, const struct result* reference, const struct result* base,
+                      const struct result* base_reference, double threshold_percent)
+{
+    char versus[64] = "(no baseline)";
+    bool ok = true;
+
+    if (base && base_reference && reference) {
+        // against utils, not in ns: both move together with the machine, the load on it, and the clock it runs at
+        const double ratio = reference->ns_per_call > 0.0 ? r->ns_per_call / reference->ns_per_call : 0.0;
+        const double base_ratio = base_reference->ns_per_call > 0.0 ? base->ns_per_call / base_reference->ns_per_call : 0.0;
+        const double change = base_ratio > 0.0 ? 100.0 * (ratio / base_ratio - 1.0) : 0.0;
+        const bool slower = change > threshold_percent;
+        // allocation counts are exact: any extra one is a regression, however fast the host's malloc() is
+        const bool allocates_more = r->allocs_per_call > base->allocs_per_call + 0.005;
+        ok = !slower && !allocates_more;
+        snprintf(versus, sizeof(versus), "%+6.1f%%  %s", change,
+                 allocates_more ? "REGRESSION (allocations)" : slower ? "REGRESSION (time)" : "ok");
+    }
+
+    printf("%-14s %7u %12.1f %12.2f  %s\n", r->stage, r->threads, r->ns_per_call, r->allocs_per_call, versus);
+    fflush(stdout);
+    return ok;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t, --threads N        log from 1, 2, 4... up to N threads at once (default 4)\n"
+            "  -n, --iterations N     calls per thread per run (default 20000)\n"
+            "  -r, --repeat N         runs per stage, the fastest counts (default 5)\n"
+            "  -b, --baseline FILE    compare against this (default baseline.txt)\n"
+            "      --threshold PCT    slower than the baseline, against utils, by more than this is a regression (default 50)\n"
+            "      --update-baseline  write the results to the baseline file instead of comparing\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    enum { OPT_THRESHOLD = 256, OPT_UPDATE_BASELINE };
+    static const struct option long_options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "repeat", required_argument, NULL, 'r' },
+        { "baseline", required_argument, NULL, 'b' },
+        { "threshold", required_argument, NULL, OPT_THRESHOLD },
+        { "update-baseline", no_argument, NULL, OPT_UPDATE_BASELINE },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){
+        .max_threads = 4, .iterations = 20000, .repeat = 5, .threshold_percent = 50.0, .baseline_path = "baseline.txt",
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "t:n:r:b:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 't': opts->max_threads = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'n': opts->iterations = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'r': opts->repeat = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': opts->baseline_path = optarg; break;
+        case OPT_THRESHOLD: opts->threshold_percent = strtod(optarg, NULL); break;
+        case OPT_UPDATE_BASELINE: opts->update_baseline = true; break;
+        default: return false;
+        }
+    }
+
+    if (optind != argc || opts->max_threads == 0 || opts->max_threads > MAX_THREADS || opts->iterations == 0 ||
+        opts->repeat == 0 || opts->threshold_percent < 0.0)
+        return false;
+
+    // a run, warming up included, has to fit in the queue
+    const uint64_t queued_per_run = (uint64_t)opts->max_threads * (opts->iterations + opts->iterations / 10 + 1);
+    if (queued_per_run > CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE) {
+        fprintf(stderr, "wifi_log_bench: %u threads times %u iterations don't fit in the queue (%u)\n",
+                opts->max_threads, opts->iterations, (unsigned)CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (init_queue() != ESP_OK)
+        return 1;
+
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, consumer_main, NULL);
+
+    static struct result baseline[MAX_RESULTS];
+    const size_t baseline_count = opts.update_baseline ? 0 : load_baseline(opts.baseline_path, baseline, MAX_RESULTS);
+    if (!opts.update_baseline && baseline_count == 0)
+        fprintf(stderr, "wifi_log_bench: no baseline in %s, nothing to compare against\n", opts.baseline_path);
+
+    static struct result results[MAX_RESULTS];
+    size_t result_count = 0;
+
+    for (size_t s = 0; s < sizeof(s_stages) / sizeof(s_stages[0]); s++) {
+        for (unsigned threads = 1; threads <= opts.max_threads && result_count < MAX_RESULTS;
+             threads = (threads * 2 > opts.max_threads && threads < opts.max_threads) ? opts.max_threads : threads * 2) {
+            const int saved_stdout = silence_stdout();
+            const struct result r = run_stage(&s_stages[s], threads, &opts);
+            restore_stdout(saved_stdout);
+
+            results[result_count++] = r;
+        }
+    }
+
+    // once all of them ran: every row is compared by its ratio to utils
+    printf("%-14s %7s %12s %12s  %s\n", "stage", "threads", "ns/call", "allocs/call", "vs baseline, against utils");
+    bool ok = true;
+    for (size_t i = 0; i < result_count; i++) {
+        const struct result* r = &results[i];
+        ok &= print_row(r, find_result(results, result_count, "utils", r->threads),
+                        find_result(baseline, baseline_count, r->stage, r->threads),
+                        find_result(baseline, baseline_count, "utils", r->threads), opts.threshold_percent);
+    }
+
+    s_consumer_stop = true;
+    pthread_join(consumer, NULL);
+
+    if (opts.update_baseline)
+        return save_baseline(opts.baseline_path, results, result_count, &opts) ? 0 : 1;
+
+    if (!ok)
+        printf("\nregressions against %s (threshold %.0f%%)\n", opts.baseline_path, opts.threshold_percent);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,297 @@
+/*
+ * wifi_log_burst: how often the logger task puts something on the air, and how late lines get there, with burst mode
+ * off and then on. Built for the host: wifi_logger.c's logger task runs for real (on a thread, see tools/host/) and
+ * sends to a socket on 127.0.0.1 that this program reads.
+ *
+ * A thread logs --rate lines a second with generate_log_message(), every --error-every'th one an ERROR, each with its
+ * sequence number in it. Every datagram is timestamped as it arrives: datagrams less than --gap ms after the one before
+ * belong to the same transmit event (on the device, one wake-up of the radio), and a line's added latency is the time
+ * from queueing it to its datagram arriving. Loopback adds next to nothing, so that's the logger's doing.
+ *
+ * build: make -C tools/bench wifi_log_burst
+ * usage: see usage() below
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "wifi_logger.h"
+
+#define SEQ_MARKER "seq="
+#define DEVICE_ID "burst-harness"
+
+struct options {
+    unsigned seconds;
+    unsigned lines_per_sec;
+    unsigned error_every;
+    unsigned burst_bytes;
+    unsigned burst_age_ms;
+    unsigned gap_ms;
+};
+
+struct phase_stats {
+    unsigned lines;
+    unsigned datagrams;
+    unsigned tx_events;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t max_error_latency_ns;
+};
+
+// one entry per line logged, written by the producer before the line is queued, read by the receiver once it's in
+static uint64_t* s_queued_ns;
+static bool* s_is_error;
+static unsigned s_max_lines;
+
+static int s_sock = -1;
+static volatile bool s_receiver_stop;
+static uint64_t s_gap_ns;
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phase_stats s_stats;
+static uint64_t s_last_rx_ns;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void* receiver_main(void* arg)
+{
+    (void) arg;
+    static char datagram[65536];
+
+    while (!s_receiver_stop) {
+        const ssize_t len = recv(s_sock, datagram, sizeof(datagram) - 1, 0);
+        if (len <= 0)
+            continue; // timed out, check whether to stop
+        const uint64_t now = now_ns();
+        datagram[len] = '\0';
+
+        pthread_mutex_lock(&s_stats_lock);
+        if (s_stats.datagrams == 0 || now - s_last_rx_ns > s_gap_ns)
+            s_stats.tx_events++;
+        s_last_rx_ns = now;
+        s_stats.datagrams++;
+
+        for (const char* p = strstr(datagram, SEQ_MARKER); p; p = strstr(p, SEQ_MARKER)) {
+            p += strlen(SEQ_MARKER);
+            const unsigned long seq = strtoul(p, NULL, 10);
+            if (seq >= s_max_lines)
+                continue;
+            const uint64_t latency = now - s_queued_ns[seq];
+            s_stats.lines++;
+            s_stats.total_latency_ns += latency;
+            if (latency > s_stats.max_latency_ns)
+                s_stats.max_latency_ns = latency;
+            if (s_is_error[seq] && latency > s_stats.max_error_latency_ns)
+                s_stats.max_error_latency_ns = latency;
+        }
+        pthread_mutex_unlock(&s_stats_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief logs opts->lines_per_sec lines a second for opts->seconds, then waits for them to arrive
+ *
+ * @param first_seq sequence number of the first line, updated to the one after the last
+ */
+static struct phase_stats run_phase(const struct options* opts, unsigned* first_seq)
+{
+    pthread_mutex_lock(&s_stats_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    pthread_mutex_unlock(&s_stats_lock);
+
+    const unsigned count = opts->seconds * opts->lines_per_sec;
+    const uint64_t interval_ns = 1000000000u / opts->lines_per_sec;
+    const uint64_t start = now_ns();
+
+    for (unsigned i = 0; i < count; i++) {
+        const uint64_t due = start + i * interval_ns;
+        const uint64_t now = now_ns();
+        if (due > now) {
+            const struct timespec pause = { .tv_sec = (due - now) / 1000000000u, .tv_nsec = (due - now) % 1000000000u };
+            nanosleep(&pause, NULL);
+        }
+
+        const unsigned seq = (*first_seq)++;
+        const bool error = opts->error_every && (i + 1) % opts->error_every == 0;
+        s_is_error[seq] = error;
+        s_queued_ns[seq] = now_ns();
+        if (error)
+            generate_log_message(ESP_LOG_ERROR, "sensor", __LINE__, __func__, "read failed, code %u " SEQ_MARKER "%u", i % 7, seq);
+        else
+            generate_log_message(ESP_LOG_INFO, "sensor", __LINE__, __func__, "reading %u mV " SEQ_MARKER "%u", 3000 + i % 300, seq);
+    }
+
+    // the last burst can be up to the max age away
+    const uint64_t deadline = now_ns() + (opts->burst_age_ms + 2000) * 1000000ull;
+    struct phase_stats stats;
+    do {
+        usleep(10000);
+        pthread_mutex_lock(&s_stats_lock);
+        stats = s_stats;
+        pthread_mutex_unlock(&s_stats_lock);
+    } while (stats.lines < count && now_ns() < deadline);
+
+    return stats;
+}
+
+static void print_row(const char* mode, const struct options* opts, const struct phase_stats* stats)
+{
+    const unsigned count = opts->seconds * opts->lines_per_sec;
+    const double minutes = opts->seconds / 60.0;
+    printf("%-24s %7u %6u %10u %14.1f %12.1f %12.1f %16.1f\n", mode, stats->lines, count - stats->lines,
+           stats->datagrams, stats->tx_events / minutes,
+           stats->lines ? stats->total_latency_ns / 1e6 / stats->lines : 0.0, stats->max_latency_ns / 1e6,
+           stats->max_error_latency_ns / 1e6);
+    fflush(stdout);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --seconds N        how long each mode runs (default 20)\n"
+            "  -r, --rate N           lines a second (default 20)\n"
+            "  -e, --error-every N    every Nth line is an ERROR, 0 for none (default 200)\n"
+            "  -b, --burst-bytes N    burst mode: send once this many bytes are queued (default 4096)\n"
+            "  -a, --burst-age-ms N   burst mode: send once the oldest line is this old (default 5000)\n"
+            "  -g, --gap-ms N         datagrams closer together than this are one transmit event (default 20)\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "seconds", required_argument, NULL, 's' },
+        { "rate", required_argument, NULL, 'r' },
+        { "error-every", required_argument, NULL, 'e' },
+        { "burst-bytes", required_argument, NULL, 'b' },
+        { "burst-age-ms", required_argument, NULL, 'a' },
+        { "gap-ms", required_argument, NULL, 'g' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){
+        .seconds = 20, .lines_per_sec = 20, .error_every = 200, .burst_bytes = 4096, .burst_age_ms = 5000, .gap_ms = 20,
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:r:e:b:a:g:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's': opts->seconds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'r': opts->lines_per_sec = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'e': opts->error_every = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': opts->burst_bytes = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'a': opts->burst_age_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'g': opts->gap_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->seconds > 0 && opts->lines_per_sec > 0 && opts->lines_per_sec <= 100000 &&
+           opts->burst_bytes > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_gap_ns = opts.gap_ms * 1000000ull;
+    s_max_lines = 2 * opts.seconds * opts.lines_per_sec;
+    s_queued_ns = calloc(s_max_lines, sizeof(*s_queued_ns));
+    s_is_error = calloc(s_max_lines, sizeof(*s_is_error));
+    if (!s_queued_ns || !s_is_error)
+        return 1;
+
+    // the collector: a socket on loopback, any port
+    s_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    const struct timeval timeout = { .tv_usec = 100000 };
+    const int rcvbuf = 4 << 20;
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (s_sock < 0 || bind(s_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_sock, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_burst: socket");
+        return 1;
+    }
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiver_main, NULL);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+    wifi_logger_set_burst(0, opts.burst_age_ms);
+    if (!start_wifi_logger(&config))
+        return 1;
+
+    printf("%u s per mode, %u lines/s, every %u an ERROR\n", opts.seconds, opts.lines_per_sec, opts.error_every);
+    printf("%-24s %7s %6s %10s %14s %12s %12s %16s\n", "mode", "lines", "lost", "datagrams", "tx events/min",
+           "avg lat ms", "max lat ms", "max ERROR lat ms");
+
+    unsigned seq = 0;
+    const struct phase_stats off = run_phase(&opts, &seq);
+    print_row("off", &opts, &off);
+
+    char mode[64];
+    snprintf(mode, sizeof(mode), "burst %u B / %u ms", opts.burst_bytes, opts.burst_age_ms);
+    wifi_logger_set_burst(opts.burst_bytes, opts.burst_age_ms);
+    const struct phase_stats burst = run_phase(&opts, &seq);
+    print_row(mode, &opts, &burst);
+
+    wifi_logger_stop();
+    s_receiver_stop = true;
+    pthread_join(receiver, NULL);
+    close(s_sock);
+    return 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * wifi_log_crypto: what CONFIG_LOGGING_SERVER_ENCRYPTION costs per datagram, and a check that the logger only takes
+ * credit grants (and so acks and commands, which come in the same way) from a collector that has the key. Built for
+ * the host with the encryption on, against tools/host/mbedtls/gcm.h's stand-in for mbedTLS on OpenSSL.
+ *
+ * The cost: datagram_crypto_seal() for --count datagrams the size of a line, a batch and a full frame, and
+ * datagram_crypto_open() for a credit grant. That's the host's AES-NI, a handful of cycles a byte; the ESP32 does AES
+ * in its AES block (or in software, without CONFIG_MBEDTLS_HARDWARE_AES), which is far slower. Compare the sizes with
+ * each other, not with the device, and measure there before turning it on for a busy device.
+ *
+ * The check: wifi_logger.c's logger task runs for real (on a thread, see tools/host/) and sends to a collector on
+ * 127.0.0.1, which opens every datagram with the key like tools/wifi_log_collector.py --encryption-key does, then
+ *
+ *   clear          logs lines, which must arrive
+ *   spoofed        sends "wlcredit 0" in the clear: it must be ignored, and lines logged after it must still arrive
+ *   sealed         sends "wlcredit 0" sealed with the key: the logger must hold lines logged after it...
+ *   granted        ...until a sealed "wlcredit 1000000" lets them through
+ *
+ * and every datagram from the logger must open with the key. Exits with 1 if anything didn't happen that way.
+ *
+ * build: make -C tools/bench wifi_log_crypto
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "esp_random.h"
+#include "mbedtls/gcm.h"
+#include "datagram_crypto.h"
+#include "log_queue.h"
+#include "wifi_logger.h"
+
+#define DEVICE_ID "crypto-harness"
+#define LINES_PER_STEP 50
+#define SETTLE_MS 500           // a few times CONTROL_POLL_INTERVAL_MS: long enough for the logger to see a grant
+
+static const size_t s_sizes[] = { 64, 256, 1024, 1400 };
+
+struct options {
+    unsigned count;
+    bool verbose;
+};
+
+// the collector's side: its own context, with the same key
+static mbedtls_gcm_context s_collector_gcm;
+static int s_collector = -1;
+static struct sockaddr_in s_device;
+static volatile bool s_device_known;
+static volatile bool s_collector_stop;
+static volatile unsigned s_lines;
+static volatile unsigned s_unopened;
+
+// the results. the logger task printf()s what it's doing to stdout
+static FILE* s_out;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    const struct timespec pause = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+}
+
+static bool collector_key(void)
+{
+    const char* key_hex = CONFIG_LOGGING_SERVER_ENCRYPTION_KEY;
+    uint8_t key[32];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        unsigned byte;
+        if (sscanf(&key_hex[i * 2], "%2x", &byte) != 1)
+            return false;
+        key[i] = (uint8_t)byte;
+    }
+    mbedtls_gcm_init(&s_collector_gcm);
+    return mbedtls_gcm_setkey(&s_collector_gcm, MBEDTLS_CIPHER_ID_AES, key, sizeof(key) * 8) == 0;
+}
+
+/**
+ * @brief sends text to the logger, sealed with a random nonce as tools/wifi_log_collector.py does, or in the clear
+ */
+static void reply(const char* text, bool sealed)
+{
+    const size_t len = strlen(text);
+    uint8_t datagram[128];
+    size_t datagram_len = len;
+
+    if (sealed) {
+        const size_t header_len = 1 + DATAGRAM_NONCE_SIZE;
+        datagram[0] = DATAGRAM_SEALED_MAGIC;
+        esp_fill_random(&datagram[1], DATAGRAM_NONCE_SIZE);
+        mbedtls_gcm_crypt_and_tag(&s_collector_gcm, MBEDTLS_GCM_ENCRYPT, len, &datagram[1], DATAGRAM_NONCE_SIZE,
+                                  datagram, header_len, (const uint8_t*)text, &datagram[header_len],
+                                  DATAGRAM_TAG_SIZE, &datagram[header_len + len]);
+        datagram_len = len + DATAGRAM_SEAL_OVERHEAD;
+    } else {
+        memcpy(datagram, text, len);
+    }
+    sendto(s_collector, datagram, datagram_len, 0, (const struct sockaddr*)&s_device, sizeof(s_device));
+}
+
+/**
+ * @brief opens everything the logger sends, and counts the lines in it. never answers: the steps in main() do that
+ */
+static void* collector_main(void* arg)
+{
+    (void) arg;
+    static uint8_t sealed[65536];
+    static char opened[65536];
+
+    while (!s_collector_stop) {
+        struct pollfd fd = { .fd = s_collector, .events = POLLIN };
+        if (poll(&fd, 1, 10) <= 0)
+            continue;
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        const ssize_t len = recvfrom(s_collector, sealed, sizeof(sealed), 0, (struct sockaddr*)&from, &from_len);
+        if (len <= 0)
+            continue;
+        s_device = from;
+        s_device_known = true;
+
+        const size_t header_len = 1 + DATAGRAM_NONCE_SIZE;
+        if (len < DATAGRAM_SEAL_OVERHEAD || sealed[0] != DATAGRAM_SEALED_MAGIC ||
+            mbedtls_gcm_auth_decrypt(&s_collector_gcm, len - DATAGRAM_SEAL_OVERHEAD, &sealed[1], DATAGRAM_NONCE_SIZE,
+                                     sealed, header_len, &sealed[len - DATAGRAM_TAG_SIZE], DATAGRAM_TAG_SIZE,
+                                     &sealed[header_len], (uint8_t*)opened) != 0) {
+            __atomic_add_fetch(&s_unopened, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // lines, and the odd record (credit requests): only the lines matter here
+        const size_t opened_len = len - DATAGRAM_SEAL_OVERHEAD;
+        for (size_t i = 0; i < opened_len; i++) {
+            if (opened[i] == '\n')
+                __atomic_add_fetch(&s_lines, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief logs LINES_PER_STEP lines, then waits SETTLE_MS for them
+ *
+ * @return unsigned how many lines arrived meanwhile
+ */
+static unsigned log_lines(const char* step)
+{
+    const unsigned before = s_lines;
+    for (unsigned i = 0; i < LINES_PER_STEP; i++)
+        generate_log_message(ESP_LOG_INFO, "sensor", __LINE__, __func__, "%s %u", step, i);
+    sleep_ms(SETTLE_MS);
+    return s_lines - before;
+}
+
+static bool expect(const char* step, const char* what, bool ok, unsigned lines)
+{
+    fprintf(s_out, "%-10s %-44s %6u  %s\n", step, what, lines, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static void bench(unsigned count)
+{
+    static uint8_t payload[1400];
+    static uint8_t sealed[1400 + DATAGRAM_SEAL_OVERHEAD];
+    memset(payload, 'x', sizeof(payload));
+
+    fprintf(s_out, "%-6s %6s %9s %9s\n", "op", "bytes", "ns/call", "MB/s");
+    for (size_t i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++) {
+        const uint64_t start = now_ns();
+        for (unsigned n = 0; n < count; n++)
+            datagram_crypto_seal(payload, s_sizes[i], sealed, sizeof(sealed));
+        const double ns = (double)(now_ns() - start) / count;
+        fprintf(s_out, "%-6s %6zu %9.0f %9.1f\n", "seal", s_sizes[i], ns, s_sizes[i] / ns * 1e3);
+    }
+
+    // what opening an ack or a grant costs, on the device
+    static const char grant[] = "wlcredit 64";
+    uint8_t sealed_grant[sizeof(grant) + DATAGRAM_SEAL_OVERHEAD];
+    uint8_t opened[sizeof(grant)];
+    const size_t header_len = 1 + DATAGRAM_NONCE_SIZE;
+    const size_t grant_len = sizeof(grant) - 1;
+    sealed_grant[0] = DATAGRAM_SEALED_MAGIC;
+    esp_fill_random(&sealed_grant[1], DATAGRAM_NONCE_SIZE);
+    mbedtls_gcm_crypt_and_tag(&s_collector_gcm, MBEDTLS_GCM_ENCRYPT, grant_len, &sealed_grant[1], DATAGRAM_NONCE_SIZE,
+                              sealed_grant, header_len, (const uint8_t*)grant, &sealed_grant[header_len],
+                              DATAGRAM_TAG_SIZE, &sealed_grant[header_len + grant_len]);
+
+    const uint64_t start = now_ns();
+    for (unsigned n = 0; n < count; n++)
+        datagram_crypto_open(sealed_grant, grant_len + DATAGRAM_SEAL_OVERHEAD, opened, sizeof(opened));
+    const double ns = (double)(now_ns() - start) / count;
+    fprintf(s_out, "%-6s %6zu %9.0f %9.1f\n\n", "open", grant_len, ns, grant_len / ns * 1e3);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --count N     seals of each size, and opens (default 100000)\n"
+            "  -v, --verbose     let the logger's own console output through\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "count", required_argument, NULL, 'n' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .count = 100000 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:v", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': opts->count = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'v': opts->verbose = true; break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->count > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+
+    s_out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(s_out, NULL, _IOLBF, 0);
+    if (!opts.verbose) {
+        fflush(stdout);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    if (!datagram_crypto_init() || !collector_key()) {
+        fprintf(stderr, "wifi_log_crypto: bad CONFIG_LOGGING_SERVER_ENCRYPTION_KEY\n");
+        return 1;
+    }
+    bench(opts.count);
+
+    s_collector = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    if (s_collector < 0 || bind(s_collector, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_collector, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_crypto: socket");
+        return 1;
+    }
+    pthread_t collector;
+    pthread_create(&collector, NULL, collector_main, NULL);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+    if (!start_wifi_logger(&config))
+        return 1;
+
+    fprintf(s_out, "%-10s %-44s %6s\n", "step", "expect", "lines");
+    bool ok = true;
+    unsigned lines = log_lines("clear");
+    ok &= expect("clear", "all lines arrive", lines == LINES_PER_STEP, lines);
+
+    if (s_device_known) {
+        reply("wlcredit 0", false);
+        sleep_ms(SETTLE_MS);
+        lines = log_lines("spoofed");
+        ok &= expect("spoofed", "unsealed grant ignored, all lines arrive", lines == LINES_PER_STEP, lines);
+
+        reply("wlcredit 0", true);
+        sleep_ms(SETTLE_MS);
+        lines = log_lines("sealed");
+        ok &= expect("sealed", "sealed grant of 0 holds the lines back", lines == 0, lines);
+
+        const unsigned before = s_lines;
+        reply("wlcredit 1000000", true);
+        sleep_ms(SETTLE_MS);
+        lines = s_lines - before;
+        ok &= expect("granted", "sealed grant lets the held lines through", lines == LINES_PER_STEP, lines);
+    } else {
+        ok = false;
+    }
+    ok &= expect("all", "every datagram opens with the key", s_unopened == 0, s_unopened);
+
+    wifi_logger_stop();
+    s_collector_stop = true;
+    pthread_join(collector, NULL);
+    close(s_collector);
+    return ok ? 0 : 1;
+}
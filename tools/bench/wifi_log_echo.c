@@ -0,0 +1,377 @@
+/*
+ * wifi_log_echo: what echoing routed ESP_LOGx() lines to the console costs the task that logs them, and how late they
+ * show up there, with the console echoed by the caller (wifi_log_echo_sync) and by the logger task
+ * (wifi_log_echo, built with CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO). Built for the host: wifi_logger.c's logger task
+ * runs for real (on a thread, see tools/host/) and sends to a socket on 127.0.0.1.
+ *
+ * The console is a UART: stdout is replaced with a stream that takes bytes into a --fifo byte FIFO, drained at --baud
+ * (10 bits a byte), and blocks the writer while the FIFO is full, like the ESP-IDF console does without a driver TX
+ * buffer. A thread logs --lines lines at once every --interval ms through system_log_message_route(), each with its
+ * sequence number in it, and times every call. A line's echo lag is the time from the call to it being in the FIFO.
+ *
+ * Each build runs three phases: with the collector there, with a collector that can't be resolved, and in burst mode,
+ * where the logger task holds the lines back for --burst-age-ms.
+ *
+ * build: make -C tools/bench wifi_log_echo wifi_log_echo_sync
+ * usage: see usage() below
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "wifi_logger.h"
+
+// wifi_logger.c's. the hook esp_log calls for every ESP_LOGx() line once the logger is hooked in
+int system_log_message_route(const char* fmt, va_list tag);
+
+#define SEQ_MARKER "seq="
+#define DEVICE_ID "echo-harness"
+#define UNRESOLVABLE_HOST "collector.invalid"
+
+// what esp_log hands to the vprintf hook for ESP_LOGI("sensor", "reading %u mV seq=%u", ...)
+static const char* const SAMPLE_FORMAT = "\033[0;32mI (%lu) %s: reading %u mV " SEQ_MARKER "%u\033[0m\n";
+
+struct options {
+    unsigned seconds;
+    unsigned lines;
+    unsigned interval_ms;
+    unsigned baud;
+    unsigned fifo;
+    unsigned burst_age_ms;
+};
+
+struct phase_stats {
+    unsigned calls;
+    uint64_t total_call_ns;
+    uint64_t max_call_ns;
+    unsigned echoed;
+    uint64_t total_lag_ns;
+    uint64_t max_lag_ns;
+};
+
+// one entry per line logged, written by the producer before the call, read by the console once the line is in
+static uint64_t* s_logged_ns;
+static unsigned s_max_lines;
+static volatile unsigned s_phase_first_seq; // lines from before the current phase don't count
+
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phase_stats s_stats;
+
+static int s_sock = -1;
+static volatile bool s_receiver_stop;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    const struct timespec pause = { .tv_sec = ns / 1000000000u, .tv_nsec = ns % 1000000000u };
+    nanosleep(&pause, NULL);
+}
+
+/*
+ * the UART
+ */
+struct uart {
+    uint64_t ns_per_byte;
+    size_t fifo_size;
+    size_t level;           // bytes in the FIFO...
+    uint64_t level_ns;      // ...at this point
+    pthread_mutex_t lock;
+};
+
+static void uart_drain(struct uart* uart, uint64_t now)
+{
+    const uint64_t sent = (now - uart->level_ns) / uart->ns_per_byte;
+    uart->level = sent >= uart->level ? 0 : uart->level - sent;
+    uart->level_ns = now;
+}
+
+static ssize_t uart_write(void* cookie, const char* buf, size_t size)
+{
+    struct uart* uart = cookie;
+    pthread_mutex_lock(&uart->lock);
+    for (size_t done = 0; done < size;) {
+        uart_drain(uart, now_ns());
+        const size_t room = uart->fifo_size - uart->level;
+        if (room == 0) {
+            sleep_ns(uart->ns_per_byte);
+            continue;
+        }
+        const size_t chunk = size - done < room ? size - done : room;
+        uart->level += chunk;
+        done += chunk;
+    }
+    pthread_mutex_unlock(&uart->lock);
+
+    // the whole line is in the FIFO now
+    const char* marker = memmem(buf, size, SEQ_MARKER, strlen(SEQ_MARKER));
+    if (marker) {
+        const unsigned long seq = strtoul(marker + strlen(SEQ_MARKER), NULL, 10);
+        if (seq >= s_phase_first_seq && seq < s_max_lines && s_logged_ns[seq]) {
+            const uint64_t lag = now_ns() - s_logged_ns[seq];
+            pthread_mutex_lock(&s_stats_lock);
+            s_stats.echoed++;
+            s_stats.total_lag_ns += lag;
+            if (lag > s_stats.max_lag_ns)
+                s_stats.max_lag_ns = lag;
+            pthread_mutex_unlock(&s_stats_lock);
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief replaces stdout with the UART
+ */
+static void open_uart(const struct options* opts)
+{
+    static struct uart uart;
+    uart = (struct uart){ .ns_per_byte = 10 * 1000000000ull / opts->baud, .fifo_size = opts->fifo, .level_ns = now_ns() };
+    pthread_mutex_init(&uart.lock, NULL);
+
+    fflush(stdout);
+    const cookie_io_functions_t functions = { .write = uart_write };
+    stdout = fopencookie(&uart, "w", functions);
+    setvbuf(stdout, NULL, _IONBF, 0);
+}
+
+/*
+ * the collector: takes whatever comes, and throws it away
+ */
+static void* receiver_main(void* arg)
+{
+    (void) arg;
+    static char datagram[65536];
+    while (!s_receiver_stop)
+        recv(s_sock, datagram, sizeof(datagram), 0);
+    return NULL;
+}
+
+static int route(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int len = system_log_message_route(fmt, args);
+    va_end(args);
+    return len;
+}
+
+/**
+ * @brief logs opts->lines lines every opts->interval_ms for opts->seconds, then waits for them to be echoed
+ *
+ * @param first_seq sequence number of the first line, updated to the one after the last
+ */
+static struct phase_stats run_phase(const struct options* opts, unsigned* first_seq)
+{
+    pthread_mutex_lock(&s_stats_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_phase_first_seq = *first_seq;
+    pthread_mutex_unlock(&s_stats_lock);
+
+    const unsigned rounds = opts->seconds * 1000 / opts->interval_ms;
+    const uint64_t start = now_ns();
+    uint64_t total_call_ns = 0;
+    uint64_t max_call_ns = 0;
+
+    for (unsigned round = 0; round < rounds; round++) {
+        const uint64_t due = start + round * opts->interval_ms * 1000000ull;
+        const uint64_t now = now_ns();
+        if (due > now)
+            sleep_ns(due - now);
+
+        for (unsigned i = 0; i < opts->lines; i++) {
+            const unsigned seq = (*first_seq)++;
+            const uint64_t called = now_ns();
+            s_logged_ns[seq] = called;
+            route(SAMPLE_FORMAT, (unsigned long)(called / 1000000u), "sensor", 3000 + seq % 300, seq);
+            const uint64_t took = now_ns() - called;
+            total_call_ns += took;
+            if (took > max_call_ns)
+                max_call_ns = took;
+        }
+    }
+
+    const unsigned count = rounds * opts->lines;
+    const uint64_t deadline = now_ns() + 2000000000ull;
+    struct phase_stats stats;
+    do {
+        usleep(10000);
+        pthread_mutex_lock(&s_stats_lock);
+        stats = s_stats;
+        pthread_mutex_unlock(&s_stats_lock);
+    } while (stats.echoed < count && now_ns() < deadline);
+
+    stats.calls = count;
+    stats.total_call_ns = total_call_ns;
+    stats.max_call_ns = max_call_ns;
+    return stats;
+}
+
+static void print_row(const char* phase, const struct phase_stats* stats)
+{
+    fprintf(stderr, "%-16s %7u %14.1f %12.1f %8u %12.2f %12.2f\n", phase, stats->calls,
+            stats->calls ? (double)stats->total_call_ns / stats->calls / 1000.0 : 0.0, stats->max_call_ns / 1000.0,
+            stats->echoed, stats->echoed ? stats->total_lag_ns / 1e6 / stats->echoed : 0.0, stats->max_lag_ns / 1e6);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --seconds N        how long each phase runs (default 2: less than it takes to fill the queue)\n"
+            "  -l, --lines N          lines logged at once (default 10)\n"
+            "  -i, --interval-ms N    every this many ms (default 100)\n"
+            "  -b, --baud N           console speed (default 115200)\n"
+            "  -f, --fifo N           console FIFO size in bytes (default 128)\n"
+            "  -a, --burst-age-ms N   burst phase: lines are held back up to this long (default 2000)\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "seconds", required_argument, NULL, 's' },
+        { "lines", required_argument, NULL, 'l' },
+        { "interval-ms", required_argument, NULL, 'i' },
+        { "baud", required_argument, NULL, 'b' },
+        { "fifo", required_argument, NULL, 'f' },
+        { "burst-age-ms", required_argument, NULL, 'a' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){
+        .seconds = 2, .lines = 10, .interval_ms = 100, .baud = 115200, .fifo = 128, .burst_age_ms = 2000,
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:l:i:b:f:a:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's': opts->seconds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'l': opts->lines = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'i': opts->interval_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': opts->baud = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'f': opts->fifo = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'a': opts->burst_age_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->seconds > 0 && opts->lines > 0 && opts->interval_ms > 0 && opts->baud > 0 &&
+           opts->fifo > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_max_lines = 3 * (opts.seconds * 1000 / opts.interval_ms) * opts.lines;
+    s_logged_ns = calloc(s_max_lines, sizeof(*s_logged_ns));
+    if (!s_logged_ns)
+        return 1;
+
+    s_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    const struct timeval timeout = { .tv_usec = 100000 };
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (s_sock < 0 || bind(s_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_sock, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_echo: socket");
+        return 1;
+    }
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiver_main, NULL);
+
+    // the results go to stderr: stdout is the console being measured
+    open_uart(&opts);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+    wifi_logger_set_burst(0, opts.burst_age_ms);
+    if (!start_wifi_logger(&config))
+        return 1;
+    usleep(100000);
+
+    fprintf(stderr, "%s echo, %u lines every %u ms for %u s per phase, console %u baud with a %u byte FIFO\n",
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+            "async",
+#else
+            "sync",
+#endif
+            opts.lines, opts.interval_ms, opts.seconds, opts.baud, opts.fifo);
+    fprintf(stderr, "%-16s %7s %14s %12s %8s %12s %12s\n", "phase", "calls", "avg call us", "max call us", "echoed",
+            "avg lag ms", "max lag ms");
+
+    unsigned seq = 0;
+    struct phase_stats stats = run_phase(&opts, &seq);
+    print_row("collector up", &stats);
+
+    struct wifi_logger_config unreachable = config;
+    strcpy(unreachable.host, UNRESOLVABLE_HOST);
+    wifi_logger_reconfigure(&unreachable);
+    stats = run_phase(&opts, &seq);
+    print_row("no collector", &stats);
+
+    wifi_logger_reconfigure(&config);
+    wifi_logger_set_burst(65535, opts.burst_age_ms);
+    stats = run_phase(&opts, &seq);
+    print_row("burst hold", &stats);
+
+    wifi_logger_stop();
+    s_receiver_stop = true;
+    pthread_join(receiver, NULL);
+    close(s_sock);
+    return 0;
+}
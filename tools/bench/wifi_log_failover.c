@@ -0,0 +1,345 @@
+/*
+ * wifi_log_failover: how long the logger takes to move to a fallback collector when the one it's using dies, and how
+ * many lines are lost on the way, and the same for moving collectors on purpose with wifi_logger_reconfigure(). Built
+ * for the host with CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS: wifi_logger.c's logger task runs for real (on a thread,
+ * see tools/host/) and sends to collectors on 127.0.0.1, which answer its probes ("wlack <seq>") like
+ * tools/wifi_log_collector.py does.
+ *
+ * A thread logs --rate lines a second with generate_log_message(), each with its sequence number in it. Each run starts
+ * the logger afresh, on collector A:
+ *
+ *   kill         B is A's fallback. --before ms in, A's socket is closed, as if the collector was killed
+ *   reconfigure  --before ms in, wifi_logger_reconfigure() moves the logger to B; A is killed 100 ms later
+ *
+ * Either way logging goes on for --after ms more, then the harness waits for the stragglers.
+ *
+ *   switch ms    from the kill (or the reconfigure) to the first line arriving at B
+ *   lost         lines that never arrived anywhere, out of the ones logged
+ *
+ * build: make -C tools/bench wifi_log_failover
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "log_queue.h"
+#include "wifi_logger.h"
+
+#define SEQ_MARKER "seq="
+#define DEVICE_ID "failover-harness"
+#define RECONFIGURE_KILL_DELAY_MS 100
+
+struct options {
+    unsigned runs;
+    unsigned lines_per_sec;
+    unsigned before_ms;
+    unsigned after_ms;
+    bool verbose;
+};
+
+struct collector {
+    int sock;
+    int port;
+    volatile bool killed;
+    uint64_t first_rx_ns;   // first line in this run, 0 if none yet
+    pthread_t thread;
+};
+
+// lines delivered so far, to any collector
+static uint8_t* s_delivered;
+static unsigned s_max_lines;
+static unsigned s_delivered_count;
+static uint64_t s_last_rx_ns;
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    const struct timespec pause = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * @brief one collector: answers probes and counts lines until it's killed, then closes its socket
+ */
+static void* collector_main(void* arg)
+{
+    struct collector* collector = arg;
+    static __thread char datagram[65536];
+
+    while (!collector->killed) {
+        struct pollfd fd = { .fd = collector->sock, .events = POLLIN };
+        if (poll(&fd, 1, 10) <= 0)
+            continue;
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        const ssize_t len = recvfrom(collector->sock, datagram, sizeof(datagram) - 1, 0, (struct sockaddr*)&from, &from_len);
+        if (len <= 0 || collector->killed)
+            continue;
+
+        if (len == LOG_RECORD_HEADER_SIZE + 4 && (uint8_t)datagram[0] == LOG_RECORD_MAGIC && datagram[1] == LOG_RECORD_TYPE_PROBE) {
+            const uint8_t* seq = (const uint8_t*)&datagram[LOG_RECORD_HEADER_SIZE];
+            char ack[32];
+            const int ack_len = snprintf(ack, sizeof(ack), "wlack %u",
+                                         (unsigned)((uint32_t)seq[0] << 24 | (uint32_t)seq[1] << 16 | (uint32_t)seq[2] << 8 | seq[3]));
+            sendto(collector->sock, ack, ack_len, 0, (struct sockaddr*)&from, from_len);
+            continue;
+        }
+
+        datagram[len] = '\0';
+        const uint64_t now = now_ns();
+        pthread_mutex_lock(&s_stats_lock);
+        for (const char* p = strstr(datagram, SEQ_MARKER); p; p = strstr(p, SEQ_MARKER)) {
+            p += strlen(SEQ_MARKER);
+            const unsigned long seq = strtoul(p, NULL, 10);
+            if (seq >= s_max_lines || s_delivered[seq])
+                continue;
+            s_delivered[seq] = 1;
+            s_delivered_count++;
+            s_last_rx_ns = now;
+            if (!collector->first_rx_ns)
+                collector->first_rx_ns = now;
+        }
+        pthread_mutex_unlock(&s_stats_lock);
+    }
+
+    close(collector->sock);
+    return NULL;
+}
+
+static bool start_collector(struct collector* collector)
+{
+    *collector = (struct collector){ .sock = socket(AF_INET, SOCK_DGRAM, 0) };
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    const int rcvbuf = 4 << 20;
+    setsockopt(collector->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (collector->sock < 0 || bind(collector->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(collector->sock, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_failover: socket");
+        return false;
+    }
+    collector->port = ntohs(addr.sin_port);
+    return pthread_create(&collector->thread, NULL, collector_main, collector) == 0;
+}
+
+static void kill_collector(struct collector* collector)
+{
+    if (collector->killed)
+        return;
+    collector->killed = true;
+    pthread_join(collector->thread, NULL);
+}
+
+struct run_stats {
+    unsigned lines;
+    unsigned delivered;
+    double switch_ms;   // < 0 if B never got anything
+};
+
+/**
+ * @brief starts the logger on collector A, logs for opts->before_ms, moves it to B (by killing A, or by reconfiguring),
+ *        logs for opts->after_ms more, then waits for the lines to arrive
+ *
+ * @param first_seq sequence number of the first line, updated to the one after the last
+ */
+static struct run_stats run(const struct options* opts, bool reconfigure, unsigned* first_seq)
+{
+    struct collector a, b;
+    if (!start_collector(&a) || !start_collector(&b))
+        exit(1);
+
+    pthread_mutex_lock(&s_stats_lock);
+    s_delivered_count = 0;
+    pthread_mutex_unlock(&s_stats_lock);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", a.port, false);
+    strcpy(config.device_id, DEVICE_ID);
+    if (!reconfigure)
+        wifi_logger_add_fallback_collector(&config, "127.0.0.1", b.port);
+    if (!start_wifi_logger(&config))
+        exit(1);
+
+    const unsigned count = (opts->before_ms + opts->after_ms) * opts->lines_per_sec / 1000;
+    const uint64_t interval_ns = 1000000000u / opts->lines_per_sec;
+    const uint64_t start = now_ns();
+    const uint64_t switch_at = start + (uint64_t)opts->before_ms * 1000000u;
+    uint64_t switched = 0;
+    uint64_t kill_at = 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        const uint64_t due = start + i * interval_ns;
+        uint64_t now = now_ns();
+        if (due > now) {
+            const struct timespec pause = { .tv_sec = (due - now) / 1000000000u, .tv_nsec = (due - now) % 1000000000u };
+            nanosleep(&pause, NULL);
+            now = now_ns();
+        }
+
+        if (!switched && now >= switch_at) {
+            switched = now;
+            if (reconfigure) {
+                struct wifi_logger_config moved;
+                set_wifi_logger_config(&moved, "127.0.0.1", b.port, false);
+                strcpy(moved.device_id, DEVICE_ID);
+                wifi_logger_reconfigure(&moved);
+                kill_at = now + RECONFIGURE_KILL_DELAY_MS * 1000000u;
+            } else {
+                kill_collector(&a);
+            }
+        }
+        if (kill_at && now >= kill_at) {
+            kill_collector(&a);
+            kill_at = 0;
+        }
+
+        generate_log_message(ESP_LOG_INFO, "sensor", __LINE__, __func__, "reading %u mV " SEQ_MARKER "%u", 3000 + i % 300, (*first_seq)++);
+    }
+
+    // done once nothing has arrived for a while: whatever hasn't by then was lost
+    unsigned delivered;
+    uint64_t last_rx;
+    do {
+        sleep_ms(100);
+        pthread_mutex_lock(&s_stats_lock);
+        delivered = s_delivered_count;
+        last_rx = s_last_rx_ns;
+        pthread_mutex_unlock(&s_stats_lock);
+    } while (delivered < count && now_ns() - last_rx < 2000000000ull);
+
+    wifi_logger_stop();
+    kill_collector(&a);
+    kill_collector(&b);
+
+    struct run_stats stats = { .lines = count, .delivered = delivered, .switch_ms = -1 };
+    if (b.first_rx_ns && switched)
+        stats.switch_ms = ((double)b.first_rx_ns - (double)switched) / 1e6;
+    return stats;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --runs N      runs of each kind (default 5)\n"
+            "  -r, --rate N      lines a second (default 200)\n"
+            "  -b, --before MS   logging before the switch (default 2000)\n"
+            "  -a, --after MS    logging after the switch (default 3000)\n"
+            "  -v, --verbose     let the logger's own console output through\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "runs", required_argument, NULL, 'n' },
+        { "rate", required_argument, NULL, 'r' },
+        { "before", required_argument, NULL, 'b' },
+        { "after", required_argument, NULL, 'a' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .runs = 5, .lines_per_sec = 200, .before_ms = 2000, .after_ms = 3000 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:r:b:a:v", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': opts->runs = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'r': opts->lines_per_sec = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': opts->before_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'a': opts->after_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'v': opts->verbose = true; break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->runs > 0 && opts->lines_per_sec > 0 && opts->lines_per_sec <= 100000 &&
+           opts->before_ms > 0 && opts->after_ms > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_max_lines = 2 * opts.runs * (opts.before_ms + opts.after_ms) * opts.lines_per_sec / 1000;
+    s_delivered = calloc(s_max_lines, 1);
+    if (!s_delivered)
+        return 1;
+
+    // the table goes to stdout. the logger task printf()s what it's doing (failovers, full queue...) to the same place
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!opts.verbose) {
+        fflush(stdout);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    fprintf(out, "%u lines/s, switching %u ms in, %u ms after\n", opts.lines_per_sec, opts.before_ms, opts.after_ms);
+    fprintf(out, "%-12s %4s %7s %6s %10s\n", "how", "run", "lines", "lost", "switch ms");
+
+    unsigned seq = 0;
+    for (int reconfigure = 0; reconfigure <= 1; reconfigure++) {
+        for (unsigned i = 0; i < opts.runs; i++) {
+            const struct run_stats stats = run(&opts, reconfigure, &seq);
+            fprintf(out, "%-12s %4u %7u %6u %10.1f\n", reconfigure ? "reconfigure" : "kill", i + 1, stats.lines,
+                    stats.lines - stats.delivered, stats.switch_ms);
+            fflush(out);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * wifi_log_flow: checks flow control in wifi_logger.c against a collector that grants credits, built for the host with
+ * a control channel key, so grants must be signed (control_channel.c and mbedTLS's HMAC, on OpenSSL, see tools/host/).
+ * The logger task runs for real (on a thread) and sends to a collector on 127.0.0.1 that never grants on its own:
+ * each step below sends one grant, then logs a few lines and counts what arrives.
+ *
+ *   no grants      lines arrive: flow control is off until the first grant
+ *   unsigned 0     "wlcredit 0" without a mac is ignored: lines still arrive
+ *   signed         a signed grant is taken: lines arrive
+ *   signed 0       a signed "wlcredit 0" is taken: lines are held back
+ *   replayed       the signed grant from before, sent again, is ignored: lines still held
+ *   bad mac        a grant with the wrong mac is ignored: lines still held
+ *   give up        with no grant for FLOW_CONTROL_GIVE_UP_MS, the held lines go out anyway (and how long that took)
+ *   signed 0 again after giving up, the next signed grant turns flow control back on: lines are held back
+ *   signed again   ...and the next one lets them through
+ *
+ * Exits with 1 if anything didn't happen that way.
+ *
+ * build: make -C tools/bench wifi_log_flow
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "wifi_logger.h"
+
+#define DEVICE_ID "flow-harness"
+#define LINES_PER_STEP 50
+#define SETTLE_MS 500           // a few times CONTROL_POLL_INTERVAL_MS: long enough for the logger to see a grant
+#define GIVE_UP_WAIT_MS 10000   // twice FLOW_CONTROL_GIVE_UP_MS
+#define MAC_HEX_CHARS 32        // CONTROL_MAC_LEN * 2
+
+struct options {
+    bool verbose;
+};
+
+static int s_collector = -1;
+static struct sockaddr_in s_device;
+static volatile bool s_device_known;
+static volatile bool s_collector_stop;
+static volatile unsigned s_lines;
+static uint64_t s_grant_seq = 1000;
+
+// the results. the logger task printf()s what it's doing to stdout
+static FILE* s_out;
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    const struct timespec pause = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+}
+
+static void send_to_device(const char* text)
+{
+    sendto(s_collector, text, strlen(text), 0, (const struct sockaddr*)&s_device, sizeof(s_device));
+}
+
+/**
+ * @brief builds a grant like tools/wifi_log_collector.py's sign_grant(), computed here rather than with
+ *        control_channel.c, so the two are checked against each other
+ *
+ * @param grant where to put it
+ * @param size size of grant
+ * @param credits how many datagrams the device may send
+ * @param seq must go up from one grant to the next
+ */
+static void sign_grant(char* grant, size_t size, unsigned credits, uint64_t seq)
+{
+    const int body_len = snprintf(grant, size, "wlcredit %u %llu", credits, (unsigned long long)seq);
+    char signed_text[128];
+    const int signed_len = snprintf(signed_text, sizeof(signed_text), "%s %s", DEVICE_ID, grant);
+
+    uint8_t mac[32];
+    const char* key = CONFIG_LOGGING_SERVER_CONTROL_KEY;
+    HMAC(EVP_sha256(), key, (int)strlen(key), (const uint8_t*)signed_text, (size_t)signed_len, mac, NULL);
+
+    size_t used = (size_t)body_len;
+    used += snprintf(&grant[used], size - used, " ");
+    for (int i = 0; i < MAC_HEX_CHARS / 2; i++)
+        used += snprintf(&grant[used], size - used, "%02x", mac[i]);
+}
+
+/**
+ * @brief counts the lines the logger sends. never answers: the steps in main() do that
+ */
+static void* collector_main(void* arg)
+{
+    (void) arg;
+    static char datagram[65536];
+
+    while (!s_collector_stop) {
+        struct pollfd fd = { .fd = s_collector, .events = POLLIN };
+        if (poll(&fd, 1, 10) <= 0)
+            continue;
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        const ssize_t len = recvfrom(s_collector, datagram, sizeof(datagram), 0, (struct sockaddr*)&from, &from_len);
+        if (len <= 0)
+            continue;
+        s_device = from;
+        s_device_known = true;
+
+        // lines, and the odd record (credit requests): only the lines matter here
+        for (ssize_t i = 0; i < len; i++) {
+            if (datagram[i] == '\n')
+                __atomic_add_fetch(&s_lines, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief sends grant (if any) and lets the logger see it, then logs LINES_PER_STEP lines and waits SETTLE_MS for them
+ *
+ * @return unsigned how many lines arrived meanwhile
+ */
+static unsigned step(const char* name, const char* grant)
+{
+    if (grant) {
+        send_to_device(grant);
+        sleep_ms(SETTLE_MS);
+    }
+
+    const unsigned before = s_lines;
+    for (unsigned i = 0; i < LINES_PER_STEP; i++)
+        generate_log_message(ESP_LOG_INFO, "sensor", __LINE__, __func__, "%s %u", name, i);
+    sleep_ms(SETTLE_MS);
+    return s_lines - before;
+}
+
+static bool expect(const char* name, const char* what, bool ok, unsigned lines)
+{
+    fprintf(s_out, "%-14s %-46s %6u  %s\n", name, what, lines, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -v, --verbose     let the logger's own console output through\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ 0 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "v", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'v': opts->verbose = true; break;
+        default: return false;
+        }
+    }
+
+    return optind == argc;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(s_out, NULL, _IOLBF, 0);
+    if (!opts.verbose) {
+        fflush(stdout);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    s_collector = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    if (s_collector < 0 || bind(s_collector, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_collector, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_flow: socket");
+        return 1;
+    }
+    pthread_t collector;
+    pthread_create(&collector, NULL, collector_main, NULL);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+    if (!start_wifi_logger(&config))
+        return 1;
+
+    fprintf(s_out, "%-14s %-46s %6s\n", "step", "expect", "lines");
+    bool ok = true;
+    unsigned lines = step("no grants", NULL);
+    ok &= expect("no grants", "flow control off, all lines arrive", lines == LINES_PER_STEP, lines);
+    if (!s_device_known) {
+        fprintf(s_out, "wifi_log_flow: nothing arrived from the logger\n");
+        return 1;
+    }
+
+    lines = step("unsigned 0", "wlcredit 0");
+    ok &= expect("unsigned 0", "unsigned grant ignored, all lines arrive", lines == LINES_PER_STEP, lines);
+
+    char granted[128];
+    sign_grant(granted, sizeof(granted), 1000000, s_grant_seq++);
+    lines = step("signed", granted);
+    ok &= expect("signed", "signed grant taken, all lines arrive", lines == LINES_PER_STEP, lines);
+
+    char held[128];
+    sign_grant(held, sizeof(held), 0, s_grant_seq++);
+    lines = step("signed 0", held);
+    ok &= expect("signed 0", "signed grant of 0 taken, lines held back", lines == 0, lines);
+    const uint64_t held_at = now_ns() - 2ull * SETTLE_MS * 1000000u;
+    unsigned held_lines = LINES_PER_STEP;
+
+    lines = step("replayed", granted);
+    ok &= expect("replayed", "replayed grant ignored, lines still held", lines == 0, lines);
+    held_lines += LINES_PER_STEP;
+
+    char bad[128];
+    sign_grant(bad, sizeof(bad), 1000000, s_grant_seq++);
+    bad[strlen(bad) - 1] = bad[strlen(bad) - 1] == '0' ? '1' : '0';
+    lines = step("bad mac", bad);
+    ok &= expect("bad mac", "grant with a wrong mac ignored, lines held", lines == 0, lines);
+    held_lines += LINES_PER_STEP;
+
+    // no more grants: the held lines go out once the logger gives up on them
+    const unsigned before = s_lines;
+    uint64_t released_at = 0;
+    while (!released_at && now_ns() - held_at < GIVE_UP_WAIT_MS * 1000000ull) {
+        sleep_ms(10);
+        if (s_lines - before >= held_lines)
+            released_at = now_ns();
+    }
+    char what[64];
+    snprintf(what, sizeof(what), "held lines sent after %.1f s without a grant",
+             released_at ? (double)(released_at - held_at) / 1e9 : -1.0);
+    ok &= expect("give up", what, released_at != 0, s_lines - before);
+
+    sign_grant(held, sizeof(held), 0, s_grant_seq++);
+    lines = step("signed 0 again", held);
+    ok &= expect("signed 0 again", "flow control back on, lines held back", lines == 0, lines);
+
+    const unsigned before_grant = s_lines;
+    sign_grant(granted, sizeof(granted), 1000000, s_grant_seq++);
+    step("signed again", granted);
+    lines = s_lines - before_grant;
+    ok &= expect("signed again", "held lines, and new ones, arrive", lines == 2 * LINES_PER_STEP, lines);
+
+    wifi_logger_stop();
+    s_collector_stop = true;
+    pthread_join(collector, NULL);
+    close(s_collector);
+    return ok ? 0 : 1;
+}
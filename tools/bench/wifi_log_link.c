@@ -0,0 +1,491 @@
+/*
+ * wifi_log_link: how many lines get through, and how fast, over links of different quality, with log data pinned to
+ * UDP, pinned to TCP, and left to the adaptive transport. Built for the host with CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT
+ * and CONFIG_LOGGING_SERVER_NET_IMPAIRMENT: wifi_logger.c's logger task runs for real (on a thread, see tools/host/),
+ * and every send it makes goes through net_impair.c on its way to this program's collector on 127.0.0.1.
+ *
+ * The collector listens on one port for both: it answers probes ("wlack <seq>") over UDP, and reads TCP frames. The
+ * acks themselves aren't impaired, so the loss the device measures is the loss on its way out. net_impair.c drops
+ * datagrams; TCP doesn't lose data, so a lost segment costs a send a retransmission timeout instead.
+ *
+ * A thread logs --rate lines a second with generate_log_message(), each with its sequence number in it, for --seconds,
+ * then waits for the stragglers. A run starts the logger afresh, so each one starts out on UDP knowing nothing.
+ *
+ *   delivered   lines that arrived at least once, out of the ones logged
+ *   lines/s     delivered lines per second, from the first line logged to the last one arriving
+ *   p50, p99    how long delivered lines took from generate_log_message() to this program: queueing in the logger,
+ *               and the link's latency, which net_impair.c adds in its delay line without holding up the logger
+ *   on          the transport log data was on at the end, and how many times it switched
+ *   loss, rtt   what the device measured with its probes at the end
+ *   stall       share of TCP sends that blocked for longer than a probe may go unanswered, the last time TCP was used
+ *
+ * Before that, it checks tcp_handler.c's connect timeout: connecting to a listener, to a closed port (refused at once),
+ * and to a listener whose backlog is full, so the SYN goes unanswered and only TCP_CONNECT_TIMEOUT_MS ends it.
+ * Exits with 1 if one of those didn't go that way.
+ *
+ * build: make -C tools/bench wifi_log_link
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "log_queue.h"
+#include "tcp_handler.h"
+#include "wifi_logger.h"
+
+#define SEQ_MARKER "seq="
+#define DEVICE_ID "link-harness"
+#define MAX_CONNECTIONS 8
+#define TCP_FRAME_HEADER_SIZE 2
+// tcp_handler.c's TCP_CONNECT_TIMEOUT_MS, and how far off the measured one may be
+#define CONNECT_TIMEOUT_MS 2000
+#define CONNECT_TIMEOUT_SLACK_MS 300
+
+struct link_profile {
+    const char* name;
+    const char* scenario;   // see net_impair.h
+};
+
+static const struct link_profile s_profiles[] = {
+    { "clean", "seed=1 latency=2" },
+    { "lossy 5%", "seed=2 loss=5 latency=5 jitter=3" },
+    { "lossy 20%", "seed=3 loss=20 latency=5 jitter=3" },
+    { "lossy 40%", "seed=4 loss=40 latency=5 jitter=3" },
+    { "slow, 20%", "seed=5 loss=20 latency=30 jitter=10 rate=40000" },
+};
+
+static const struct {
+    const char* name;
+    enum wifi_logger_transport transport;
+} s_modes[] = {
+    { "udp", WIFI_LOGGER_TRANSPORT_UDP },
+    { "tcp", WIFI_LOGGER_TRANSPORT_TCP },
+    { "auto", WIFI_LOGGER_TRANSPORT_AUTO },
+};
+
+struct options {
+    unsigned seconds;
+    unsigned lines_per_sec;
+    bool verbose;
+};
+
+struct connection {
+    int sock;
+    size_t len;
+    uint8_t buffer[TCP_FRAME_HEADER_SIZE + 65536];
+};
+
+// lines delivered so far in this run: which ones, how long each took, and when the last one arrived
+static uint8_t* s_delivered;
+static uint64_t* s_logged_ns;
+static uint32_t* s_latency_us;
+static unsigned s_max_lines;
+static unsigned s_delivered_count;
+static uint64_t s_last_rx_ns;
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int s_udp = -1;
+static int s_listener = -1;
+static struct connection s_connections[MAX_CONNECTIONS];
+static volatile bool s_receiver_stop;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief counts the lines in one datagram, however it came
+ */
+static void handle_datagram(char* datagram, size_t len)
+{
+    datagram[len] = '\0';
+    const uint64_t now = now_ns();
+
+    pthread_mutex_lock(&s_stats_lock);
+    for (const char* p = strstr(datagram, SEQ_MARKER); p; p = strstr(p, SEQ_MARKER)) {
+        p += strlen(SEQ_MARKER);
+        const unsigned long seq = strtoul(p, NULL, 10);
+        if (seq >= s_max_lines || s_delivered[seq])
+            continue;
+        s_delivered[seq] = 1;
+        s_latency_us[s_delivered_count++] = (uint32_t)((now - __atomic_load_n(&s_logged_ns[seq], __ATOMIC_ACQUIRE)) / 1000);
+        s_last_rx_ns = now;
+    }
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+static void receive_udp(void)
+{
+    static char datagram[65536];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    const ssize_t len = recvfrom(s_udp, datagram, sizeof(datagram) - 1, 0, (struct sockaddr*)&from, &from_len);
+    if (len <= 0)
+        return;
+
+    if (len == LOG_RECORD_HEADER_SIZE + 4 && (uint8_t)datagram[0] == LOG_RECORD_MAGIC && datagram[1] == LOG_RECORD_TYPE_PROBE) {
+        const uint8_t* seq = (const uint8_t*)&datagram[LOG_RECORD_HEADER_SIZE];
+        char ack[32];
+        const int ack_len = snprintf(ack, sizeof(ack), "wlack %u",
+                                     (unsigned)((uint32_t)seq[0] << 24 | (uint32_t)seq[1] << 16 | (uint32_t)seq[2] << 8 | seq[3]));
+        sendto(s_udp, ack, ack_len, 0, (struct sockaddr*)&from, from_len);
+        return;
+    }
+
+    handle_datagram(datagram, (size_t)len);
+}
+
+/**
+ * @brief reads what's waiting on a TCP connection, and handles every frame that completes
+ *
+ * @return bool false once the device has closed it
+ */
+static bool receive_tcp(struct connection* conn)
+{
+    const ssize_t len = recv(conn->sock, &conn->buffer[conn->len], sizeof(conn->buffer) - 1 - conn->len, 0);
+    if (len <= 0)
+        return false;
+    conn->len += (size_t)len;
+
+    size_t pos = 0;
+    while (conn->len - pos >= TCP_FRAME_HEADER_SIZE) {
+        const size_t frame_len = (size_t)conn->buffer[pos] << 8 | conn->buffer[pos + 1];
+        if (conn->len - pos < TCP_FRAME_HEADER_SIZE + frame_len)
+            break;
+
+        // handle_datagram() null-terminates: keep the byte after the frame
+        char* frame = (char*)&conn->buffer[pos + TCP_FRAME_HEADER_SIZE];
+        const char next = frame[frame_len];
+        handle_datagram(frame, frame_len);
+        frame[frame_len] = next;
+        pos += TCP_FRAME_HEADER_SIZE + frame_len;
+    }
+
+    memmove(conn->buffer, &conn->buffer[pos], conn->len - pos);
+    conn->len -= pos;
+    return true;
+}
+
+static void* receiver_main(void* arg)
+{
+    (void) arg;
+
+    while (!s_receiver_stop) {
+        struct pollfd fds[2 + MAX_CONNECTIONS];
+        fds[0] = (struct pollfd){ .fd = s_udp, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = s_listener, .events = POLLIN };
+        for (int i = 0; i < MAX_CONNECTIONS; i++)
+            fds[2 + i] = (struct pollfd){ .fd = s_connections[i].sock, .events = POLLIN };
+
+        if (poll(fds, 2 + MAX_CONNECTIONS, 100) <= 0)
+            continue; // timed out, check whether to stop
+
+        if (fds[0].revents & POLLIN)
+            receive_udp();
+
+        if (fds[1].revents & POLLIN) {
+            const int sock = accept(s_listener, NULL, NULL);
+            for (int i = 0; sock >= 0 && i < MAX_CONNECTIONS; i++) {
+                if (s_connections[i].sock < 0) {
+                    s_connections[i].sock = sock;
+                    s_connections[i].len = 0;
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            if (s_connections[i].sock >= 0 && (fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                !receive_tcp(&s_connections[i])) {
+                close(s_connections[i].sock);
+                s_connections[i].sock = -1; // a frame cut short here was sent again over UDP
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+struct run_stats {
+    unsigned lines;
+    unsigned delivered;
+    double seconds;
+    double p50_ms;
+    double p99_ms;
+    struct wifi_logger_link_stats link;
+};
+
+/**
+ * @brief starts the logger on a fresh link, logs opts->lines_per_sec lines a second for opts->seconds, then waits
+ *        for them to arrive
+ *
+ * @param first_seq sequence number of the first line, updated to the one after the last
+ */
+static struct run_stats run(const struct options* opts, const struct wifi_logger_config* config, const char* scenario,
+                            enum wifi_logger_transport transport, unsigned* first_seq)
+{
+    pthread_mutex_lock(&s_stats_lock);
+    s_delivered_count = 0;
+    pthread_mutex_unlock(&s_stats_lock);
+
+    struct wifi_logger_link_stats before;
+    wifi_logger_get_link_stats(&before);
+
+    // start_wifi_logger() starts the impairment scenario, see the Makefile
+    setenv("WIFI_LOG_LINK_SCENARIO", scenario, 1);
+    wifi_logger_set_transport(transport);
+    if (!start_wifi_logger(config))
+        exit(1);
+
+    const unsigned count = opts->seconds * opts->lines_per_sec;
+    const uint64_t interval_ns = 1000000000u / opts->lines_per_sec;
+    const uint64_t start = now_ns();
+
+    for (unsigned i = 0; i < count; i++) {
+        const uint64_t due = start + i * interval_ns;
+        const uint64_t now = now_ns();
+        if (due > now) {
+            const struct timespec pause = { .tv_sec = (due - now) / 1000000000u, .tv_nsec = (due - now) % 1000000000u };
+            nanosleep(&pause, NULL);
+        }
+        __atomic_store_n(&s_logged_ns[*first_seq], now_ns(), __ATOMIC_RELEASE);
+        generate_log_message(ESP_LOG_INFO, "sensor", __LINE__, __func__, "reading %u mV " SEQ_MARKER "%u", 3000 + i % 300, (*first_seq)++);
+    }
+
+    // done once nothing has arrived for a while: whatever hasn't by then was lost
+    unsigned delivered;
+    uint64_t last_rx;
+    do {
+        usleep(100000);
+        pthread_mutex_lock(&s_stats_lock);
+        delivered = s_delivered_count;
+        last_rx = s_last_rx_ns;
+        pthread_mutex_unlock(&s_stats_lock);
+    } while (delivered < count && now_ns() - last_rx < 3000000000ull);
+
+    struct run_stats stats = { .lines = count, .delivered = delivered };
+    stats.seconds = (last_rx > start ? last_rx - start : 0) / 1e9;
+    pthread_mutex_lock(&s_stats_lock);
+    qsort(s_latency_us, s_delivered_count, sizeof(s_latency_us[0]), compare_u32);
+    if (s_delivered_count > 0) {
+        stats.p50_ms = s_latency_us[s_delivered_count / 2] / 1000.0;
+        stats.p99_ms = s_latency_us[(s_delivered_count - 1) * 99 / 100] / 1000.0;
+    }
+    pthread_mutex_unlock(&s_stats_lock);
+    wifi_logger_get_link_stats(&stats.link);
+    stats.link.switches -= before.switches;
+    wifi_logger_stop();
+    return stats;
+}
+
+static void print_row(FILE* out, const char* profile, const char* mode, const struct run_stats* stats)
+{
+    const unsigned lost = stats->lines - stats->delivered;
+    fprintf(out, "%-12s %-5s %7u %7u %10.1f%% %9.0f %7.1f %7.1f %5s %8u %7u%% %7u %5u%%\n", profile, mode, stats->lines,
+           lost, 100.0 * stats->delivered / stats->lines, stats->seconds > 0 ? stats->delivered / stats->seconds : 0.0,
+           stats->p50_ms, stats->p99_ms,
+           stats->link.transport == WIFI_LOGGER_TRANSPORT_TCP ? "tcp" : "udp", (unsigned)stats->link.switches,
+           stats->link.loss_percent, (unsigned)stats->link.rtt_ms, stats->link.tcp_stall_percent);
+    fflush(out);
+}
+
+/**
+ * @brief times one connect_tcp_network_manager() to 127.0.0.1:port
+ *
+ * @return bool whether it went as expected: connected if it should have, otherwise failed, within the timeout if
+ *         timeout_expected, and quickly if not
+ */
+static bool check_connect(FILE* out, const char* what, uint16_t port, bool connects, bool timeout_expected)
+{
+    struct logger_tcp_network_data* nm = create_tcp_network_manager_handle();
+    const uint64_t start = now_ns();
+    const bool connected = connect_tcp_network_manager(nm, "127.0.0.1", port);
+    const double took_ms = (now_ns() - start) / 1e6;
+    tcp_close_network_manager(nm);
+    free(nm);
+
+    bool ok = connected == connects;
+    if (timeout_expected)
+        ok &= took_ms >= CONNECT_TIMEOUT_MS - CONNECT_TIMEOUT_SLACK_MS && took_ms <= CONNECT_TIMEOUT_MS + CONNECT_TIMEOUT_SLACK_MS;
+    else
+        ok &= took_ms < CONNECT_TIMEOUT_SLACK_MS;
+    fprintf(out, "connect, %-24s %-9s in %7.1f ms  %s\n", what, connected ? "connected" : "failed", took_ms,
+            ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/**
+ * @brief checks the connect timeout against a listener, a closed port, and a listener that never answers the SYN
+ */
+static bool check_connects(FILE* out, uint16_t listener_port)
+{
+    bool ok = check_connect(out, "to the collector", listener_port, true, false);
+
+    const int closed = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    bind(closed, (struct sockaddr*)&addr, sizeof(addr));
+    getsockname(closed, (struct sockaddr*)&addr, &addr_len);
+    ok &= check_connect(out, "to a closed port", ntohs(addr.sin_port), false, false);
+
+    // with a backlog of 0, the first connection fills the queue and Linux drops the SYNs after it
+    listen(closed, 0);
+    const int filler = socket(AF_INET, SOCK_STREAM, 0);
+    connect(filler, (struct sockaddr*)&addr, sizeof(addr));
+    ok &= check_connect(out, "that is never answered", ntohs(addr.sin_port), false, true);
+    close(filler);
+    close(closed);
+    return ok;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --seconds N   how long each run logs for (default 10)\n"
+            "  -r, --rate N      lines a second (default 200)\n"
+            "  -v, --verbose     let the logger's own console output through\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "seconds", required_argument, NULL, 's' },
+        { "rate", required_argument, NULL, 'r' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .seconds = 10, .lines_per_sec = 200 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:r:v", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's': opts->seconds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'r': opts->lines_per_sec = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'v': opts->verbose = true; break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->seconds > 0 && opts->lines_per_sec > 0 && opts->lines_per_sec <= 100000;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const unsigned runs = sizeof(s_profiles) / sizeof(s_profiles[0]) * sizeof(s_modes) / sizeof(s_modes[0]);
+    s_max_lines = runs * opts.seconds * opts.lines_per_sec;
+    s_delivered = calloc(s_max_lines, 1);
+    s_logged_ns = calloc(s_max_lines, sizeof(s_logged_ns[0]));
+    s_latency_us = calloc(s_max_lines, sizeof(s_latency_us[0]));
+    if (!s_delivered || !s_logged_ns || !s_latency_us)
+        return 1;
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+        s_connections[i].sock = -1;
+
+    // the collector: UDP and TCP on loopback, the same port for both
+    s_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    s_listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    const int rcvbuf = 4 << 20;
+    setsockopt(s_udp, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (s_udp < 0 || s_listener < 0 || bind(s_udp, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_udp, (struct sockaddr*)&addr, &addr_len) != 0 ||
+        bind(s_listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s_listener, 4) != 0) {
+        perror("wifi_log_link: socket");
+        return 1;
+    }
+
+    // the table goes to stdout. the logger task printf()s what it's doing (switches, full queue...) to the same place
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!opts.verbose) {
+        fflush(stdout);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiver_main, NULL);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+
+    const bool connects_ok = check_connects(out, ntohs(addr.sin_port));
+
+    fprintf(out, "%u s per run, %u lines/s\n", opts.seconds, opts.lines_per_sec);
+    fprintf(out, "%-12s %-5s %7s %7s %11s %9s %7s %7s %5s %8s %8s %7s %6s\n", "link", "mode", "lines", "lost", "delivered",
+           "lines/s", "p50 ms", "p99 ms", "on", "switches", "loss", "rtt ms", "stall");
+
+    unsigned seq = 0;
+    for (size_t p = 0; p < sizeof(s_profiles) / sizeof(s_profiles[0]); p++) {
+        for (size_t m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); m++) {
+            const struct run_stats stats = run(&opts, &config, s_profiles[p].scenario, s_modes[m].transport, &seq);
+            print_row(out, s_profiles[p].name, s_modes[m].name, &stats);
+        }
+    }
+
+    s_receiver_stop = true;
+    pthread_join(receiver, NULL);
+    close(s_udp);
+    close(s_listener);
+    return connects_ok ? 0 : 1;
+}
@@ -0,0 +1,389 @@
+/*
+ * wifi_log_metrics: checks metrics.c end to end, built for the host with CONFIG_LOGGING_SERVER_METRICS. A counter, a
+ * gauge and a histogram are updated from a few threads at once while the logger task (on a thread) sends what they
+ * have to say every CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS, to tools/wifi_log_collector.py on 127.0.0.1, which
+ * decodes the records and writes them out as JSON Lines. Once the logger is stopped, the harness adds up every record
+ * and compares the totals with what the threads did:
+ *
+ *   events         counter: the adds
+ *   skew_us        histogram: observations, their sum (some are negative) and the count in each bucket
+ *   heap           gauge: the last value set
+ *
+ * Nothing may be lost or counted twice between records. It also says what an update costs, with every thread
+ * hammering the same metric (the worst case for the atomics). The descriptors go in the .wifi_metrics section as on
+ * the device: tools/host/wifi_metrics.ld stands in for linker.lf.
+ *
+ * Exits with 1 if a total doesn't match.
+ *
+ * build: make -C tools/bench wifi_log_metrics
+ * usage: see usage() below
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "log_queue.h"
+#include "wifi_logger.h"
+
+#define DEVICE_ID "metrics-harness"
+#define MAX_THREADS 16
+#define NUM_BOUNDS 4
+#define GAUGE_VALUE 4242
+#define COLLECTOR_START_MS 5000
+#define SETTLE_MS (3 * CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS)
+
+WIFI_METRIC_COUNTER(s_events, "events");
+WIFI_METRIC_GAUGE(s_heap, "heap");
+WIFI_METRIC_HISTOGRAM(s_skew, "skew_us", -100, 0, 100, 300);
+
+static const int32_t s_bounds[NUM_BOUNDS] = { -100, 0, 100, 300 };   // s_skew's, for working out the buckets here
+
+struct options {
+    unsigned threads;
+    unsigned count;
+    const char* collector;
+};
+
+// what the threads did, or what the collector got
+struct totals {
+    int64_t events;
+    int64_t count;
+    int64_t sum;
+    int64_t buckets[NUM_BOUNDS + 1];
+    int64_t gauge;
+    unsigned records;
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned count;
+    unsigned seed;
+    struct totals done;
+};
+
+// the results. the logger task printf()s what it's doing to stdout
+static FILE* s_out;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(unsigned ms)
+{
+    const struct timespec pause = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+}
+
+static void* worker_main(void* arg)
+{
+    struct worker* worker = arg;
+    for (unsigned i = 0; i < worker->count; i++) {
+        wifi_metric_add(&s_events, 1);
+        worker->done.events++;
+
+        // -300 to 399: every bucket, and a sum that goes down as well as up. small on average: the sum of one interval's
+        // observations has to stay under 2^31
+        const int32_t value = (int32_t)(rand_r(&worker->seed) % 700) - 300;
+        wifi_metric_observe(&s_skew, value);
+        unsigned bucket = 0;
+        while (bucket < NUM_BOUNDS && value > s_bounds[bucket])
+            bucket++;
+        worker->done.buckets[bucket]++;
+        worker->done.sum += value;
+        worker->done.count++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief starts tools/wifi_log_collector.py on 127.0.0.1, writing records to jsonl, and waits for it to listen
+ *
+ * @return pid_t the collector's, or -1
+ */
+static pid_t start_collector(const char* collector, uint16_t port, const char* jsonl)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        char port_text[8];
+        snprintf(port_text, sizeof(port_text), "%u", port);
+        execlp("python3", "python3", collector, port_text, "--bind", "127.0.0.1", "--jsonl", jsonl,
+               "--flow-window", "0", (char*)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+
+    // it's up once it answers a probe, as it would a device's
+    const struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                      .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    uint8_t probe[LOG_RECORD_HEADER_SIZE + 4] = { 0 };
+    log_record_write_header(probe, LOG_RECORD_TYPE_PROBE, 4);
+    const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    const uint64_t start = now_ns();
+    while (now_ns() - start < COLLECTOR_START_MS * 1000000ull) {
+        sendto(sock, probe, sizeof(probe), 0, (const struct sockaddr*)&addr, sizeof(addr));
+        struct pollfd fd = { .fd = sock, .events = POLLIN };
+        char ack[32];
+        if (poll(&fd, 1, 20) > 0 && recv(sock, ack, sizeof(ack), 0) > 0) {
+            close(sock);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            break;
+    }
+    close(sock);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static uint16_t free_port(void)
+{
+    const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+    getsockname(sock, (struct sockaddr*)&addr, &addr_len);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+static bool parse_int(const char* line, const char* key, int64_t* value)
+{
+    const char* found = strstr(line, key);
+    return found && sscanf(found + strlen(key), "%" SCNd64, value) == 1;
+}
+
+/**
+ * @brief adds up what the collector wrote for DEVICE_ID. json.dumps() writes every record the same way:
+ *        {"device": ..., "ts": ..., "interval_ms": ..., "metrics": {"events": 5, "skew_us": {"count": 3,
+ *        "sum": 120, "buckets": [[10, 1], [50, 0], [100, 2], [500, 0], [null, 0]]}, "heap": 4242}}
+ *
+ * @return bool false if a record for it didn't look like that
+ */
+static bool read_totals(const char* jsonl, struct totals* got)
+{
+    FILE* file = fopen(jsonl, "r");
+    if (!file)
+        return false;
+
+    *got = (struct totals){ .gauge = -1 };
+    bool ok = true;
+    static char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (!strstr(line, "\"device\": \"" DEVICE_ID "\""))
+            continue;
+        got->records++;
+
+        int64_t value;
+        if (parse_int(line, "\"events\": ", &value))
+            got->events += value;
+        if (parse_int(line, "\"heap\": ", &value))
+            got->gauge = value;
+
+        const char* histogram = strstr(line, "\"skew_us\": ");
+        if (!histogram)
+            continue;
+        int64_t count, sum;
+        if (!parse_int(histogram, "\"count\": ", &count) || !parse_int(histogram, "\"sum\": ", &sum)) {
+            ok = false;
+            continue;
+        }
+        got->count += count;
+        got->sum += sum;
+
+        // at the outer '[': each bucket is the next "[bound, count]" after it
+        const char* bucket = strstr(histogram, "\"buckets\": [");
+        if (bucket)
+            bucket += strlen("\"buckets\": ");
+        for (unsigned i = 0; bucket && i <= NUM_BOUNDS; i++) {
+            bucket = strchr(bucket + 1, '[');
+            if (!bucket || !parse_int(bucket, ", ", &value)) {
+                ok = false;
+                break;
+            }
+            got->buckets[i] += value;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool expect(const char* what, int64_t want, int64_t got)
+{
+    const bool ok = want == got;
+    fprintf(s_out, "%-22s %14lld %14lld  %s\n", what, (long long)want, (long long)got, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t, --threads N      threads updating the metrics at once (default 4, at most %d)\n"
+            "  -n, --count N        updates of each metric per thread (default 2000000)\n"
+            "  -c, --collector PATH wifi_log_collector.py (default ../wifi_log_collector.py)\n",
+            name, MAX_THREADS);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "count", required_argument, NULL, 'n' },
+        { "collector", required_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .threads = 4, .count = 2000000, .collector = "../wifi_log_collector.py" };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "t:n:c:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 't': opts->threads = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'n': opts->count = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'c': opts->collector = optarg; break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->threads > 0 && opts->threads <= MAX_THREADS && opts->count > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(s_out, NULL, _IOLBF, 0);
+    fflush(stdout);
+    dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    char jsonl[] = "/tmp/wifi_log_metrics.XXXXXX";
+    const int jsonl_fd = mkstemp(jsonl);
+    if (jsonl_fd < 0) {
+        perror("wifi_log_metrics: mkstemp");
+        return 1;
+    }
+    close(jsonl_fd);
+
+    const uint16_t port = free_port();
+    const pid_t collector = start_collector(opts.collector, port, jsonl);
+    if (collector < 0) {
+        fprintf(s_out, "wifi_log_metrics: couldn't start %s\n", opts.collector);
+        unlink(jsonl);
+        return 1;
+    }
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", port, false);
+    strcpy(config.device_id, DEVICE_ID);
+    if (!start_wifi_logger(&config))
+        return 1;
+
+    wifi_metric_set(&s_heap, 1);
+    struct worker workers[MAX_THREADS] = { 0 };
+    const uint64_t start = now_ns();
+    for (unsigned i = 0; i < opts.threads; i++) {
+        workers[i].count = opts.count;
+        workers[i].seed = i + 1;
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    struct totals want = { .gauge = GAUGE_VALUE };
+    for (unsigned i = 0; i < opts.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        want.events += workers[i].done.events;
+        want.count += workers[i].done.count;
+        want.sum += workers[i].done.sum;
+        for (unsigned b = 0; b <= NUM_BOUNDS; b++)
+            want.buckets[b] += workers[i].done.buckets[b];
+    }
+    const uint64_t elapsed_ns = now_ns() - start;
+    wifi_metric_set(&s_heap, GAUGE_VALUE);
+
+    // the last interval's record, then whatever wifi_logger_stop() flushes
+    sleep_ms(SETTLE_MS);
+    wifi_logger_stop();
+    sleep_ms(SETTLE_MS);
+    kill(collector, SIGINT);
+    waitpid(collector, NULL, 0);
+
+    struct totals got = { 0 };
+    const bool parsed = read_totals(jsonl, &got);
+    unlink(jsonl);
+
+    const unsigned cores = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned busy = opts.threads < cores ? opts.threads : cores;
+    fprintf(s_out, "%u threads, %u add+observe each: %.1f ns per pair, %u records every %u ms\n", opts.threads,
+            opts.count, (double)elapsed_ns * busy / ((double)opts.threads * opts.count), got.records,
+            (unsigned)CONFIG_LOGGING_SERVER_METRICS_INTERVAL_MS);
+    fprintf(s_out, "%-22s %14s %14s\n", "total", "updates", "collector");
+
+    bool ok = parsed && got.records > 0;
+    ok &= expect("events", want.events, got.events);
+    ok &= expect("heap", want.gauge, got.gauge);
+    ok &= expect("skew_us count", want.count, got.count);
+    ok &= expect("skew_us sum", want.sum, got.sum);
+    for (unsigned b = 0; b <= NUM_BOUNDS; b++) {
+        char what[32];
+        if (b < NUM_BOUNDS)
+            snprintf(what, sizeof(what), "skew_us <=%d", (int)s_bounds[b]);
+        else
+            snprintf(what, sizeof(what), "skew_us >%d", (int)s_bounds[NUM_BOUNDS - 1]);
+        ok &= expect(what, want.buckets[b], got.buckets[b]);
+    }
+    if (!parsed)
+        fprintf(s_out, "wifi_log_metrics: a record didn't look like the collector's JSON\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,436 @@
+/*
+ * wifi_log_static: that lines queued by reference (wifi_log_x() with nothing to format, wifi_log_static_x()) come out
+ * byte for byte as the same lines formatted the usual way would have. Built for the host: wifi_logger.c's logger task
+ * runs for real (on a thread, see tools/host/) and sends to a socket on 127.0.0.1 that this program reads.
+ *
+ *   formatter   render_log_line() against generate_log_message_timestamp_and_device_id(), with and without the device
+ *               ID, for every level, a few tags and texts of every length around the buffer sizes, whole and cut short
+ *   batched     static lines mixed with formatted ones, the way the logger task batches them (item_batch_len(),
+ *               append_to_batch()), and one too long for a batch, sent in fragments (send_static_line())
+ *   unbatched   the same with batching off: static lines rendered straight into the datagram, or fragmented
+ *   burst       burst mode counts a static line as the line it sends, not its text: lines of one char still add up to
+ *               a burst before the max age
+ *
+ * Each received line's timestamp is taken as it is, everything else has to match. Exits 1 on any mismatch.
+ *
+ * build: make -C tools/bench wifi_log_static
+ * usage: see usage() below
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "log_queue.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+#define DEVICE_ID "static-harness"
+#define SITE_TAG "harness"
+
+#define BURST_MAX_BYTES 2000
+#define BURST_MAX_AGE_MS 60000  // BURST_MAX_AGE_LIMIT_MS: a burst that comes sooner was sent for its bytes
+
+// "harness (func:line) text" for a line logged with SITE_TAG, as generate_log_message_v() makes it
+#define EXPECT(LEVEL, TEXT) expect(LEVEL, __func__, __LINE__, TEXT)
+
+struct options {
+    unsigned rounds;
+};
+
+struct expected_line {
+    uint8_t level;  // 0-4 (E, W, I, D, V), as utils.cpp takes it
+    char* body;
+};
+
+static char s_long_text[CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE + 200];   // too long for a batch, so fragmented
+static char s_mid_text[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE + 40];    // batched, or fragmented when batching is off
+
+static struct expected_line* s_expected;
+static unsigned s_expected_count;
+static unsigned s_expected_max;
+
+// the receiver's side: whole lines with SITE_TAG, in order, guarded by s_lines_lock
+static char** s_lines;
+static volatile unsigned s_line_count;
+static pthread_mutex_t s_lines_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int s_sock = -1;
+static volatile bool s_receiver_stop;
+
+/*
+ * what this build doesn't run: nothing sends commands, and the sites aren't listed, so the site registry the linker
+ * fragment makes on the device is left empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief remembers a line that was just logged with SITE_TAG, to compare with what arrives
+ */
+static void expect(esp_log_level_t level, const char* func, int line, const char* text)
+{
+    if (s_expected_count == s_expected_max) {
+        s_expected_max = s_expected_max ? 2 * s_expected_max : 256;
+        s_expected = realloc(s_expected, s_expected_max * sizeof(*s_expected));
+    }
+
+    const size_t size = strlen(SITE_TAG) + strlen(func) + strlen(text) + 32;
+    struct expected_line* expected = &s_expected[s_expected_count++];
+    expected->level = (uint8_t)(level - ESP_LOG_ERROR);
+    expected->body = malloc(size);
+    snprintf(expected->body, size, "%s (%s:%d) %s", SITE_TAG, func, line, text);
+}
+
+static void keep_line(const char* line, size_t len)
+{
+    if (!strstr(line, " " SITE_TAG " ("))
+        return; // the logger's own, through the vprintf hook
+
+    char* copy = malloc(len + 1);
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+
+    pthread_mutex_lock(&s_lines_lock);
+    s_lines = realloc(s_lines, (s_line_count + 1) * sizeof(*s_lines));
+    s_lines[s_line_count] = copy;
+    s_line_count++;
+    pthread_mutex_unlock(&s_lines_lock);
+}
+
+/**
+ * @brief stands in for the collector: stitches fragments back together (see send_udp_log_message()), splits batches
+ *        into lines, and keeps the ones logged with SITE_TAG
+ */
+static void* receiver_main(void* arg)
+{
+    (void) arg;
+    static char datagram[65536];
+    static char fragments[65536];
+    size_t fragments_len = 0;
+    const char* fragment_prefix = DEVICE_ID "|+";
+
+    while (!s_receiver_stop) {
+        const ssize_t len = recv(s_sock, datagram, sizeof(datagram) - 1, 0);
+        if (len <= 0)
+            continue; // timed out, check whether to stop
+        datagram[len] = '\0';
+
+        if (strncmp(datagram, fragment_prefix, strlen(fragment_prefix)) == 0) {
+            char* end;
+            strtoul(&datagram[strlen(fragment_prefix)], &end, 10);
+            const bool more = (*end == '+');
+            const char* piece = end + (more ? 2 : 1);
+            const size_t piece_len = (size_t)(&datagram[len] - piece);
+            if (fragments_len + piece_len < sizeof(fragments)) {
+                memcpy(&fragments[fragments_len], piece, piece_len);
+                fragments_len += piece_len;
+            }
+            if (!more) {
+                fragments[fragments_len] = '\0';
+                keep_line(fragments, fragments_len);
+                fragments_len = 0;
+            }
+            continue;
+        }
+
+        // a batch is lines back to back, each ending in a newline
+        for (const char* line = datagram; line < &datagram[len];) {
+            const char* newline = strchr(line, '\n');
+            const char* end = newline ? newline + 1 : &datagram[len];
+            keep_line(line, (size_t)(end - line));
+            line = end;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief waits for count lines with SITE_TAG to have arrived in all, or for timeout_ms
+ *
+ * @return uint64_t how long it took in ns, or 0 if they didn't all arrive
+ */
+static uint64_t wait_for_lines(unsigned count, unsigned timeout_ms)
+{
+    const uint64_t start = now_ns();
+    const uint64_t deadline = start + timeout_ms * 1000000ull;
+    while (s_line_count < count) {
+        if (now_ns() > deadline)
+            return 0;
+        usleep(1000);
+    }
+    return now_ns() - start;
+}
+
+/**
+ * @brief compares the lines that arrived from first on with what was logged, taking each one's timestamp as it is
+ *
+ * @return unsigned how many didn't match (or didn't arrive)
+ */
+static unsigned compare_lines(const char* what, unsigned first)
+{
+    unsigned mismatched = 0;
+    pthread_mutex_lock(&s_lines_lock);
+    for (unsigned i = first; i < s_expected_count; i++) {
+        const char* line = i < s_line_count ? s_lines[i] : NULL;
+        const char* stamp = line ? strstr(line, " (") : NULL;
+        const uint32_t timestamp = stamp ? (uint32_t)strtoul(stamp + 2, NULL, 10) : 0;
+
+        char* want = generate_log_message_timestamp_and_device_id(true, true, s_expected[i].level, timestamp,
+                                                                  s_expected[i].body);
+        if (!line || strcmp(line, want) != 0) {
+            if (mismatched++ == 0)
+                printf("%s: line %u\n  want: %s  got:  %s\n", what, i, want, line ? line : "(nothing)\n");
+        }
+        free(want);
+    }
+    pthread_mutex_unlock(&s_lines_lock);
+    return mismatched;
+}
+
+/**
+ * @brief render_log_line() against generate_log_message_timestamp_and_device_id(), whole, measured, and into buffers
+ *        too small for it
+ *
+ * @return unsigned how many cases didn't match
+ */
+static unsigned check_formatter(unsigned* cases)
+{
+    static const char* tags[] = { "", "t", "wifi_logger", "a_rather_long_tag_name" };
+    static const uint32_t timestamps[] = { 0, 15517, UINT32_MAX };
+    static const size_t text_lengths[] = {
+        0, 1, 10, CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE - 40, CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE,
+        CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE, sizeof(s_long_text) - 1,
+    };
+
+    static char text[sizeof(s_long_text)];
+    static char body[sizeof(s_long_text) + 128];
+    static char rendered[sizeof(body) + 128];
+    unsigned mismatched = 0;
+
+    for (int device_id = 0; device_id < 2; device_id++)
+    for (uint8_t level = 0; level < 7; level++) // past 4 too: both wrap around
+    for (size_t t = 0; t < sizeof(tags) / sizeof(tags[0]); t++)
+    for (size_t s = 0; s < sizeof(timestamps) / sizeof(timestamps[0]); s++)
+    for (size_t l = 0; l < sizeof(text_lengths) / sizeof(text_lengths[0]); l++) {
+        memcpy(text, s_long_text, text_lengths[l]);
+        text[text_lengths[l]] = '\0';
+        snprintf(body, sizeof(body), "%s (%s:%d) %s", tags[t], __func__, 1234, text);
+
+        char* want = generate_log_message_timestamp_and_device_id(device_id, true, level, timestamps[s], body);
+        const size_t want_len = strlen(want);
+
+        const size_t measured = render_log_line(NULL, 0, device_id, level, timestamps[s], tags[t], __func__, 1234, text);
+        const size_t len = render_log_line(rendered, sizeof(rendered), device_id, level, timestamps[s], tags[t],
+                                           __func__, 1234, text);
+        bool ok = measured == want_len && len == want_len && strcmp(rendered, want) == 0;
+
+        // cut short, like snprintf(): as much as fits, still terminated, and the whole length
+        const size_t cut_sizes[] = { 1, want_len / 2, want_len };
+        for (size_t c = 0; c < sizeof(cut_sizes) / sizeof(cut_sizes[0]); c++) {
+            memset(rendered, 'X', sizeof(rendered));
+            const size_t cut_len = render_log_line(rendered, cut_sizes[c], device_id, level, timestamps[s], tags[t],
+                                                   __func__, 1234, text);
+            ok &= cut_len == want_len && strlen(rendered) == cut_sizes[c] - 1 &&
+                  memcmp(rendered, want, cut_sizes[c] - 1) == 0;
+        }
+
+        if (!ok && mismatched++ == 0)
+            printf("formatter: level %u, tag \"%s\", %zu chars, device id %s\n  want: %s", level, tags[t],
+                   text_lengths[l], device_id ? "on" : "off", want);
+        (*cases)++;
+        free(want);
+    }
+
+    return mismatched;
+}
+
+/**
+ * @brief logs static lines of every kind, mixed with formatted ones, remembering what each one should come out as
+ */
+static void log_mixed(unsigned round)
+{
+    wifi_log_i(SITE_TAG, "connected"); EXPECT(ESP_LOG_INFO, "connected");
+    wifi_log_static_w(SITE_TAG, s_mid_text); EXPECT(ESP_LOG_WARN, s_mid_text);
+    char text[32];
+    snprintf(text, sizeof(text), "round %u", round);
+    wifi_log_i(SITE_TAG, "round %u", round); EXPECT(ESP_LOG_INFO, text);
+
+    wifi_log_static_d(SITE_TAG, ""); EXPECT(ESP_LOG_DEBUG, "");
+    wifi_log_static_i(SITE_TAG, s_long_text); EXPECT(ESP_LOG_INFO, s_long_text);
+    wifi_log_e(SITE_TAG, "sensor not found"); EXPECT(ESP_LOG_ERROR, "sensor not found");
+    wifi_log_i(SITE_TAG, "%s", s_mid_text); EXPECT(ESP_LOG_INFO, s_mid_text);
+    wifi_log_static_v(SITE_TAG, "x"); EXPECT(ESP_LOG_VERBOSE, "x");
+}
+
+/**
+ * @brief logs opts->rounds of log_mixed(), and checks what arrives
+ */
+static bool run_mixed(const char* what, const struct options* opts)
+{
+    const unsigned first = s_expected_count;
+    for (unsigned round = 0; round < opts->rounds; round++) {
+        log_mixed(round);
+        if (round % 8 == 7)
+            wait_for_lines(s_expected_count, 1000); // nothing may be dropped for a full queue: let the logger task keep up
+    }
+
+    wait_for_lines(s_expected_count, 5000);
+    const unsigned mismatched = compare_lines(what, first);
+    printf("%-10s %8u %8u %10u\n", what, s_expected_count - first, s_line_count - first, mismatched);
+    return mismatched == 0;
+}
+
+/**
+ * @brief one-char static lines, until they should make a burst. they'd have to wait for the max age if they were
+ *        counted by their text
+ */
+static bool run_burst(void)
+{
+    const unsigned first = s_expected_count;
+    wifi_logger_set_burst(BURST_MAX_BYTES, BURST_MAX_AGE_MS);
+    usleep(200000); // it sends what's queued first, which is nothing: that mustn't be the burst these lines go out in
+
+    char probe[256];
+    const size_t line_len = render_log_line(probe, sizeof(probe), true, 2, esp_log_timestamp(), SITE_TAG, __func__,
+                                            __LINE__, "x");
+    const unsigned count = BURST_MAX_BYTES / line_len + 1;
+    for (unsigned i = 0; i < count; i++) {
+        wifi_log_static_i(SITE_TAG, "x"); EXPECT(ESP_LOG_INFO, "x");
+    }
+
+    const uint64_t took = wait_for_lines(s_expected_count, 2000);
+    wifi_logger_set_burst(0, BURST_MAX_AGE_MS);
+    wait_for_lines(s_expected_count, 2000);
+
+    const unsigned mismatched = compare_lines("burst", first);
+    printf("%-10s %8u %8u %10u   %u lines of %zu bytes: ", "burst", count, s_line_count - first, mismatched, count,
+           line_len);
+    if (took)
+        printf("sent after %.1f ms\n", took / 1e6);
+    else
+        printf("not sent for %u B\n", BURST_MAX_BYTES);
+    return took && mismatched == 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -r, --rounds N   rounds of mixed lines, batched and not (default 40)\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "rounds", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .rounds = 40 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "r:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'r': opts->rounds = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->rounds > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(s_long_text) - 1; i++)
+        s_long_text[i] = 'a' + i % 26;
+    memcpy(s_mid_text, s_long_text, sizeof(s_mid_text) - 1);
+
+    // the collector: a socket on loopback, any port
+    s_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    const struct timeval timeout = { .tv_usec = 100000 };
+    const int rcvbuf = 4 << 20;
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (s_sock < 0 || bind(s_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s_sock, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("wifi_log_static: socket");
+        return 1;
+    }
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiver_main, NULL);
+
+    struct wifi_logger_config config;
+    set_wifi_logger_config(&config, "127.0.0.1", ntohs(addr.sin_port), false);
+    strcpy(config.device_id, DEVICE_ID);
+    if (!start_wifi_logger(&config))
+        return 1;
+
+    unsigned cases = 0;
+    const unsigned formatter_mismatched = check_formatter(&cases);
+    printf("formatter: %u cases, %u mismatched\n", cases, formatter_mismatched);
+
+    printf("%-10s %8s %8s %10s\n", "lines", "logged", "arrived", "mismatched");
+    bool ok = formatter_mismatched == 0;
+    wifi_logger_set_batching(CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE, 10);
+    ok &= run_mixed("batched", &opts);
+    wifi_logger_set_batching(0, 0);
+    ok &= run_mixed("unbatched", &opts);
+    wifi_logger_set_batching(CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE, 0);
+    ok &= run_burst();
+
+    wifi_logger_stop();
+    s_receiver_stop = true;
+    pthread_join(receiver, NULL);
+    close(s_sock);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+"""
+wifi_log_tail_fanout: how wifi_log_collector.py's live tail (--tail-port) holds up with many viewers at once.
+
+Runs the collector on 127.0.0.1, connects --viewers viewers to its tail port (a third with no filter, a third with
+"level=W", a third with "tag=wifi level=I") and one more that asks for everything but never reads until the end, then
+sends --rate lines a second for --seconds, --batch lines to a datagram, the way a batching device does. The viewers
+are read as fast as this process can, on one thread, next to the sender.
+
+  lines in        lines sent to the collector, and how many the unfiltered viewers got (the rest were lost at UDP
+                  ingest, before any fan-out: the collector's socket buffer overflowed)
+  per filter      bytes each viewer got, fewest and most, against what all the lines sent that match would be
+  fan-out         bytes sent to all viewers together, per second
+  collector cpu   the collector's CPU time over the wall time (1.0 = one core busy the whole time)
+  slow viewer     the notes it got when the ring lapped it
+
+Exits with 1 if viewers with the same filter didn't all get the same lines, or the slow viewer wasn't told it missed
+some.
+
+usage: python3 tools/bench/wifi_log_tail_fanout.py [--viewers N] [--rate N] [--seconds N] [--batch N]
+   or: make -C tools/bench tail
+"""
+
+import argparse
+import os
+import re
+import selectors
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+COLLECTOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "wifi_log_collector.py")
+
+FILTERS = [b"", b"level=W", b"tag=wifi level=I"]
+LEVELS = b"EWIDV"
+
+
+def free_port(kind):
+    with socket.socket(socket.AF_INET, kind) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def make_batch(batch_lines):
+    """one datagram's worth of lines from 4 devices, 2 tags, every level. returns it, and its lines"""
+    lines = []
+    for i in range(batch_lines):
+        level = LEVELS[i % 5:i % 5 + 1]
+        tag = b"wifi" if i % 2 else b"app"
+        lines.append(b"dev%d| \x1b[0;3%dm%s (%d) %s: some log text number %d here\x1b[0m\n"
+                     % (i % 4, i % 3, level, 1000 + i, tag, i))
+    return b"".join(lines), lines
+
+
+def matching_bytes(lines, tail_filter):
+    """bytes of lines that tail_filter lets through, worked out here rather than with the collector's own code"""
+    total = 0
+    for line in lines:
+        level = re.search(rb"m([EWIDV]) \(", line).group(1)
+        tag = re.search(rb"\) (\w+):", line).group(1)
+        if b"level=W" in tail_filter and LEVELS.index(level) > LEVELS.index(b"W"):
+            continue
+        if b"level=I" in tail_filter and LEVELS.index(level) > LEVELS.index(b"I"):
+            continue
+        if b"tag=wifi" in tail_filter and tag != b"wifi":
+            continue
+        total += len(line)
+    return total
+
+
+def cpu_seconds(pid):
+    with open("/proc/%d/stat" % pid) as stat:
+        fields = stat.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def send_lines(port, batch, datagrams, rate_datagrams):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    start = time.monotonic()
+    for i in range(datagrams):
+        due = start + i / rate_datagrams
+        now = time.monotonic()
+        if due > now:
+            time.sleep(due - now)
+        sock.sendto(batch, ("127.0.0.1", port))
+    sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="live tail fan-out harness for wifi_log_collector.py")
+    parser.add_argument("--viewers", type=int, default=300, help="viewers, spread over three filters (default 300)")
+    parser.add_argument("--rate", type=int, default=20000, help="lines a second (default 20000)")
+    parser.add_argument("--seconds", type=float, default=5, help="how long to send (default 5)")
+    parser.add_argument("--batch", type=int, default=20, help="lines per datagram (default 20)")
+    parser.add_argument("--tail-lines", type=int, default=4096, help="the collector's --tail-lines (default 4096)")
+    args = parser.parse_args()
+
+    udp_port = free_port(socket.SOCK_DGRAM)
+    tail_port = free_port(socket.SOCK_STREAM)
+    collector = subprocess.Popen([sys.executable, COLLECTOR, str(udp_port), "--bind", "127.0.0.1",
+                                  "--tail-port", str(tail_port), "--tail-lines", str(args.tail_lines)],
+                                 stdout=subprocess.DEVNULL)
+    try:
+        deadline = time.monotonic() + 5
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", tail_port)).close()
+                break
+            except ConnectionRefusedError:
+                if time.monotonic() > deadline or collector.poll() is not None:
+                    print("wifi_log_tail_fanout: the collector didn't start")
+                    return 1
+                time.sleep(0.05)
+        return run(args, collector, udp_port, tail_port)
+    finally:
+        collector.send_signal(signal.SIGINT)
+        collector.wait()
+
+
+def run(args, collector, udp_port, tail_port):
+    selector = selectors.DefaultSelector()
+    received = []
+    for i in range(args.viewers):
+        viewer = socket.create_connection(("127.0.0.1", tail_port))
+        viewer.sendall(FILTERS[i % len(FILTERS)] + b"\n")
+        viewer.setblocking(False)
+        received.append(0)
+        selector.register(viewer, selectors.EVENT_READ, i)
+
+    slow = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    slow.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    slow.connect(("127.0.0.1", tail_port))
+    slow.sendall(b"\n")
+    time.sleep(0.5)  # every viewer's filter is in before the first line
+
+    batch, batch_lines = make_batch(args.batch)
+    rate_datagrams = args.rate / args.batch
+    datagrams = int(args.seconds * rate_datagrams)
+    cpu_before = cpu_seconds(collector.pid)
+    start = time.monotonic()
+    sender = threading.Thread(target=send_lines, args=(udp_port, batch, datagrams, rate_datagrams))
+    sender.start()
+
+    # read until the sender is done and the viewers have gone quiet
+    while True:
+        events = selector.select(0.3)
+        if not events and not sender.is_alive():
+            break
+        for key, _ in events:
+            try:
+                received[key.data] += len(key.fileobj.recv(1 << 20))
+            except BlockingIOError:
+                pass
+    elapsed = time.monotonic() - start
+    cpu = cpu_seconds(collector.pid) - cpu_before
+    sender.join()
+
+    # the slow viewer only hears it was lapped once it reads again, and the collector gets to send to it
+    slow.settimeout(0.5)
+    slow_data = b""
+    try:
+        while True:
+            chunk = slow.recv(1 << 20)
+            if not chunk:
+                break
+            slow_data += chunk
+    except socket.timeout:
+        pass
+    skips = re.findall(rb"skipped \d+ lines", slow_data)
+
+    lines_sent = datagrams * args.batch
+    unfiltered = received[0::len(FILTERS)]
+    lines_in = round(min(unfiltered) / len(batch) * args.batch) if unfiltered else 0
+    print("%u viewers, %u lines/s in %u line datagrams for %.1f s" % (args.viewers, args.rate, args.batch, args.seconds))
+    print("lines in             %u sent, %u (%.0f%%) reached the unfiltered viewers"
+          % (lines_sent, lines_in, 100.0 * lines_in / lines_sent))
+
+    ok = True
+    for f, tail_filter in enumerate(FILTERS):
+        got = received[f::len(FILTERS)]
+        if not got:
+            continue
+        want = matching_bytes(batch_lines, tail_filter) * datagrams
+        same = min(got) == max(got)
+        ok &= same
+        print("%-20s %10u %10u of %10u bytes%s" % ("\"%s\"" % tail_filter.decode(), min(got), max(got), want,
+                                                   "" if same else "  FAILED: viewers got different lines"))
+
+    total = sum(received)
+    print("fan-out              %.1f MB in %.1f s, %.1f MB/s" % (total / 1e6, elapsed, total / elapsed / 1e6))
+    print("collector cpu        %.2f" % (cpu / elapsed))
+    print("slow viewer          %u notes, e.g. %s" % (len(skips), skips[0].decode() if skips else "none  FAILED"))
+    ok &= bool(skips)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
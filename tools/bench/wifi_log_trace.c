@@ -0,0 +1,236 @@
+/*
+ * wifi_log_trace: what one wifi_trace_begin()/wifi_trace_end()/wifi_trace_counter() event costs the code it wraps, and
+ * what draining it costs the logger task, built for the host with CONFIG_LOGGING_SERVER_TRACE.
+ *
+ * trace_buffer.c runs as it is, against tools/host/: the cycle counter is the TSC (a register read, like CCOUNT), and
+ * masking interrupts is free, since there are none. On the ESP32 that's an RSIL and a WSR more per event, a few cycles.
+ * The events are recorded in rounds of a quarter of the ring. In between, trace_buffer_flush() empties it (timed on its
+ * own) into the queue, and the harness waits for a thread standing in for the logger task to take and count them.
+ *
+ *   ns/event       wall time per call, in the code being traced
+ *   cycles/event   the same in TSC ticks. compare with ESP32 cycles (240 MHz) with care: the host retires far more
+ *                  instructions per cycle. this is the number to measure on the device
+ *   flush ns/event trace_buffer_flush() per event, in the logger task: copying into records and queueing them
+ *   dropped        events that didn't fit in the ring (should be 0)
+ *
+ * For comparison, wifi_log_bench times a formatted ESP_LOGx() line the same way.
+ *
+ * build: make -C tools/bench wifi_log_trace
+ * usage: see usage() below
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "log_queue.h"
+#include "trace_buffer.h"
+#include "wifi_logger.h"
+
+// wifi_logger.c's. log_queue.h doesn't have these: only the logger task calls them
+esp_err_t init_queue(void);
+bool receive_from_queue(struct log_queue_item* item, TickType_t timeout);
+
+#define TRACE_ID 42
+#define ROUND_EVENTS (CONFIG_LOGGING_SERVER_TRACE_BUFFER_EVENTS / 4)   // what one trace_buffer_flush() empties
+
+struct options {
+    unsigned count;
+};
+
+struct result {
+    uint64_t events;
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t flush_ns;
+};
+
+static volatile bool s_consumer_stop;
+static uint64_t s_recorded;
+static volatile uint64_t s_received;
+static volatile uint64_t s_dropped;
+
+/*
+ * what this build doesn't run: nothing sends commands, and there are no wifi_log_x() call sites in it, so the site
+ * registry the linker fragment makes on the device is empty
+ */
+bool control_channel_enabled(void)
+{
+    return false;
+}
+
+bool control_channel_handle(const char* message, char* reply, size_t reply_size)
+{
+    (void) message;
+    (void) reply;
+    (void) reply_size;
+    return false;
+}
+
+bool control_channel_check_mac(const char* text, size_t text_len, const char* mac_hex)
+{
+    (void) text;
+    (void) text_len;
+    (void) mac_hex;
+    return false;
+}
+
+struct wifi_log_site _wifi_log_sites_start[1];
+extern struct wifi_log_site _wifi_log_sites_end __attribute__((alias("_wifi_log_sites_start")));
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t get_u32_le(const uint8_t* buf)
+{
+    return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+/**
+ * @brief stands in for the logger task: takes the trace records, counts the events in them, and throws them away
+ */
+static void* consumer_main(void* arg)
+{
+    (void) arg;
+    struct log_queue_item item;
+    while (!s_consumer_stop) {
+        if (!receive_from_queue(&item, pdMS_TO_TICKS(10)))
+            continue;
+
+        const uint8_t* record = (const uint8_t*)item.message;
+        if ((item.flags & LOG_ITEM_FLAG_BINARY) && record[1] == LOG_RECORD_TYPE_TRACE) {
+            // see trace_buffer.c for the layout
+            const uint8_t* payload = &record[LOG_RECORD_HEADER_SIZE];
+            const size_t header_len = LOG_RECORD_HEADER_SIZE + 21 + payload[20];
+            __atomic_add_fetch(&s_received, (item.len - header_len) / 16, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&s_dropped, get_u32_le(&payload[4]), __ATOMIC_RELAXED);
+        }
+        if (!(item.flags & LOG_ITEM_FLAG_STATIC))
+            free(item.message);
+    }
+    return NULL;
+}
+
+static void trace_span(uint32_t i)
+{
+    (void) i;
+    wifi_trace_begin(TRACE_ID);
+    wifi_trace_end(TRACE_ID);
+}
+
+static void trace_counter(uint32_t i)
+{
+    wifi_trace_counter(TRACE_ID, (int32_t)i);
+}
+
+/**
+ * @brief records count events in rounds of ROUND_EVENTS, emptying the ring in between
+ *
+ * @param record records two events (a span) or one (a counter)
+ * @param events_per_call 2 or 1, to match
+ */
+static struct result run(void (*record)(uint32_t), unsigned events_per_call, unsigned count)
+{
+    struct result result = { 0 };
+    const unsigned calls_per_round = ROUND_EVENTS / events_per_call;
+
+    while (result.events < count) {
+        const uint64_t start = now_ns();
+        const uint32_t start_cycles = esp_cpu_get_cycle_count();
+        for (unsigned i = 0; i < calls_per_round; i++)
+            record(i);
+        result.cycles += esp_cpu_get_cycle_count() - start_cycles;
+        const uint64_t flush_start = now_ns();
+        result.ns += flush_start - start;
+
+        trace_buffer_flush();
+        result.flush_ns += now_ns() - flush_start;
+        result.events += calls_per_round * events_per_call;
+
+        // the queue is far shorter than a run: let the consumer keep up, like the logger task would between rounds
+        s_recorded += calls_per_round * events_per_call;
+        while (s_received < s_recorded)
+            sched_yield();
+    }
+    return result;
+}
+
+static void print_result(const char* name, const struct result* result)
+{
+    printf("%-16s %10llu %9.1f %13.1f %15.1f\n", name, (unsigned long long)result->events,
+           (double)result->ns / result->events, (double)result->cycles / result->events,
+           (double)result->flush_ns / result->events);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --count N   events of each kind (default 1000000)\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    static const struct option long_options[] = {
+        { "count", required_argument, NULL, 'n' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){ .count = 1000000 };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': opts->count = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    return optind == argc && opts->count > 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (init_queue() != ESP_OK)
+        return 1;
+
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, consumer_main, NULL);
+
+    // the first round pays for things the rest don't (the thread's task handle, the cycle counter calibration)
+    run(trace_counter, 1, ROUND_EVENTS);
+
+    printf("%u events per round, TSC %u ticks/us\n", ROUND_EVENTS, (unsigned)esp_rom_get_cpu_ticks_per_us());
+    printf("%-16s %10s %9s %13s %15s\n", "event", "events", "ns/event", "cycles/event", "flush ns/event");
+    const struct result span = run(trace_span, 2, opts.count);
+    print_result("begin+end", &span);
+    const struct result counter = run(trace_counter, 1, opts.count);
+    print_result("counter", &counter);
+
+    printf("received %llu of %llu events, %llu dropped\n", (unsigned long long)s_received,
+           (unsigned long long)s_recorded, (unsigned long long)s_dropped);
+
+    s_consumer_stop = true;
+    pthread_join(consumer, NULL);
+    return s_dropped == 0 ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+#ifndef WIFI_LOGGER_HOST_ESP_ATTR_H
+#define WIFI_LOGGER_HOST_ESP_ATTR_H
+
+// everything is in RAM on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif // WIFI_LOGGER_HOST_ESP_ATTR_H
@@ -0,0 +1,36 @@
+#ifndef WIFI_LOGGER_HOST_ESP_CPU_H
+#define WIFI_LOGGER_HOST_ESP_CPU_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// one core, as far as the component can tell (portNUM_PROCESSORS is 1 on the host)
+static inline int esp_cpu_get_core_id(void)
+{
+    return 0;
+}
+
+// the TSC on x86, which like CCOUNT is a register read. nanoseconds anywhere else
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_CPU_H
@@ -0,0 +1,14 @@
+#ifndef WIFI_LOGGER_HOST_ESP_ERR_H
+#define WIFI_LOGGER_HOST_ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+#define ESP_ERR_NVS_NOT_INITIALIZED 0x1101
+#define ESP_ERR_NVS_NOT_FOUND       0x1102
+
+const char* esp_err_to_name(esp_err_t code);
+
+#endif // WIFI_LOGGER_HOST_ESP_ERR_H
@@ -0,0 +1,126 @@
+/*
+ * The ESP-IDF functions declared in this directory's esp_*.h and nvs.h, for host builds of the component.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+static vprintf_like_t s_log_vprintf = vprintf;
+
+uint32_t esp_log_timestamp(void)
+{
+    // milliseconds, like esp_log's. since the host booted, not the program: nothing here cares
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+    const vprintf_like_t previous = s_log_vprintf;
+    s_log_vprintf = func;
+    return previous;
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    // esp_log isn't there to filter anything on the host
+    (void) tag;
+    (void) level;
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac)
+{
+    static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    for (int i = 0; i < 6; i++)
+        mac[i] = host_mac[i];
+    return ESP_OK;
+}
+
+void esp_fill_random(void* buf, size_t len)
+{
+    uint8_t* p = buf;
+    while (len > 0) {
+        const ssize_t got = getrandom(p, len, 0);
+        if (got <= 0)
+            continue;
+        p += got;
+        len -= (size_t)got;
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    static uint32_t s_ticks_per_us;
+    if (s_ticks_per_us == 0) {
+        const int64_t start_us = esp_timer_get_time();
+        const uint32_t start = esp_cpu_get_cycle_count();
+        usleep(20000);
+        const uint32_t ticks = esp_cpu_get_cycle_count() - start;
+        s_ticks_per_us = (uint32_t)(ticks / (uint64_t)(esp_timer_get_time() - start_us));
+    }
+    return s_ticks_per_us;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    (void) name;
+    (void) open_mode;
+    (void) out_handle;
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char* key, uint64_t* out_value)
+{
+    (void) handle;
+    (void) key;
+    (void) out_value;
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char* key, uint64_t value)
+{
+    (void) handle;
+    (void) key;
+    (void) value;
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void) handle;
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void) handle;
+}
@@ -0,0 +1,45 @@
+#ifndef WIFI_LOGGER_HOST_ESP_LOG_H
+#define WIFI_LOGGER_HOST_ESP_LOG_H
+
+/*
+ * Just enough of ESP-IDF's esp_log.h to build the component on Linux, for the load generator and the benchmarks.
+ * The functions are in esp_host.c.
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+typedef int (*vprintf_like_t)(const char*, va_list);
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do { (void) (tag); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { (void) (tag); } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { (void) (tag); } while (0)
+
+uint32_t esp_log_timestamp(void);
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func);
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_LOG_H
@@ -0,0 +1,18 @@
+#ifndef WIFI_LOGGER_HOST_ESP_MAC_H
+#define WIFI_LOGGER_HOST_ESP_MAC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a fixed, locally administered address. virtual devices in the load generator get their ids from it instead
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_MAC_H
@@ -0,0 +1,17 @@
+#ifndef WIFI_LOGGER_HOST_ESP_RANDOM_H
+#define WIFI_LOGGER_HOST_ESP_RANDOM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// from getrandom(), where the device has its hardware RNG
+void esp_fill_random(void* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_RANDOM_H
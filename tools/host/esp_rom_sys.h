@@ -0,0 +1,17 @@
+#ifndef WIFI_LOGGER_HOST_ESP_ROM_SYS_H
+#define WIFI_LOGGER_HOST_ESP_ROM_SYS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// esp_cpu_get_cycle_count() ticks per microsecond, measured the first time it's asked for
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_ROM_SYS_H
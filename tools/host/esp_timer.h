@@ -0,0 +1,17 @@
+#ifndef WIFI_LOGGER_HOST_ESP_TIMER_H
+#define WIFI_LOGGER_HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// microseconds, from CLOCK_MONOTONIC
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_ESP_TIMER_H
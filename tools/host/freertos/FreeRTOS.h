@@ -0,0 +1,56 @@
+#ifndef WIFI_LOGGER_HOST_FREERTOS_H
+#define WIFI_LOGGER_HOST_FREERTOS_H
+
+/*
+ * The parts of FreeRTOS (and ESP-IDF's port of it) the component uses, on top of pthreads. See freertos_host.c.
+ * One tick is one millisecond. Nothing runs in an interrupt on the host.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+#define errQUEUE_FULL 0
+
+#define portMAX_DELAY       ((TickType_t) 0xffffffffu)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+// critical sections are plain mutexes: they only need to keep other threads out
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+
+#define portENTER_CRITICAL(mux)  pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)   pthread_mutex_unlock(mux)
+#define taskENTER_CRITICAL(mux)  portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux)   portEXIT_CRITICAL(mux)
+
+// one core. masking interrupts masks nothing: there are none, so code that relies on it (trace_buffer.c's rings) must
+// only be called from one thread
+#define portNUM_PROCESSORS 1
+#define portSET_INTERRUPT_MASK_FROM_ISR()          0u
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(state)   ((void)(state))
+
+static inline BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_FREERTOS_H
@@ -0,0 +1,35 @@
+#ifndef WIFI_LOGGER_HOST_FREERTOS_TASK_H
+#define WIFI_LOGGER_HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+/**
+ * @brief starts a thread. stack size, priority and core are ignored
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_size, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task); // only NULL (the calling task) is supported
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+/**
+ * @brief threads that weren't started by xTaskCreatePinnedToCore() get a handle too, named "host"
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char* pcTaskGetName(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_FREERTOS_TASK_H
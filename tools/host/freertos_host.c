@@ -0,0 +1,277 @@
+/*
+ * FreeRTOS tasks, queues and notifications on top of pthreads, for host builds of the component. Only what the
+ * component itself calls is here, see the headers in freertos/.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+struct host_task {
+    char name[16];
+    TaskFunction_t function;
+    void* param;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notify_count;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t* items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static __thread struct host_task* s_current_task;
+static __thread struct host_task s_adopted_task; // for threads xTaskCreatePinnedToCore() didn't start
+
+static void init_task(struct host_task* task, const char* name)
+{
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    pthread_mutex_init(&task->lock, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->notified, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief absolute CLOCK_MONOTONIC time ticks from now, for pthread_cond_timedwait()
+ */
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/**
+ * @brief waits on cond until it's signalled or the deadline passes. portMAX_DELAY waits forever
+ *
+ * @return bool false on timeout
+ */
+static bool wait_on(pthread_cond_t* cond, pthread_mutex_t* lock, TickType_t ticks, const struct timespec* deadline)
+{
+    if (ticks == portMAX_DELAY)
+        return pthread_cond_wait(cond, lock) == 0;
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static void* task_main(void* arg)
+{
+    s_current_task = arg;
+    s_current_task->function(s_current_task->param);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_size, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+    (void) stack_size;
+    (void) priority;
+    (void) core;
+
+    struct host_task* task = calloc(1, sizeof(struct host_task));
+    if (!task)
+        return pdFAIL;
+    init_task(task, name);
+    task->function = function;
+    task->param = param;
+
+    // the handle has to be there before the task runs: it may wait for a notification right away
+    if (handle)
+        *handle = task;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_main, task) != 0) {
+        if (handle)
+            *handle = NULL;
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // the task struct stays around: whoever was notified of the exit may still hold the handle
+    if (task == NULL || task == s_current_task)
+        pthread_exit(NULL);
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * 1000u);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!s_current_task) {
+        init_task(&s_adopted_task, "host");
+        s_current_task = &s_adopted_task;
+    }
+    return s_current_task;
+}
+
+char* pcTaskGetName(TaskHandle_t task)
+{
+    if (!task)
+        task = xTaskGetCurrentTaskHandle();
+    return task->name;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_task* task = xTaskGetCurrentTaskHandle();
+    const struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_count == 0 && ticks_to_wait > 0) {
+        if (!wait_on(&task->notified, &task->lock, ticks_to_wait, &deadline))
+            break;
+    }
+    const uint32_t count = task->notify_count;
+    if (count > 0)
+        task->notify_count = clear_on_exit ? 0 : count - 1;
+    pthread_mutex_unlock(&task->lock);
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue* queue = calloc(1, sizeof(struct host_queue));
+    if (!queue)
+        return NULL;
+
+    queue->items = malloc((size_t)length * item_size);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    return queue;
+}
+
+static uint8_t* queue_slot(struct host_queue* queue, UBaseType_t index)
+{
+    return &queue->items[(size_t)((queue->head + index) % queue->length) * queue->item_size];
+}
+
+static BaseType_t queue_send(struct host_queue* queue, const void* item, TickType_t ticks_to_wait, bool to_front)
+{
+    const struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (ticks_to_wait == 0 || !wait_on(&queue->changed, &queue->lock, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return errQUEUE_FULL;
+        }
+    }
+
+    if (to_front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        memcpy(queue_slot(queue, 0), item, queue->item_size);
+    } else {
+        memcpy(queue_slot(queue, queue->count), item, queue->item_size);
+    }
+    queue->count++;
+
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, true);
+}
+
+static BaseType_t queue_receive(struct host_queue* queue, void* item, TickType_t ticks_to_wait, bool remove)
+{
+    const struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (ticks_to_wait == 0 || !wait_on(&queue->changed, &queue->lock, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    memcpy(item, queue_slot(queue, 0), queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, item, ticks_to_wait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    const UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
@@ -0,0 +1,6 @@
+#ifndef WIFI_LOGGER_HOST_LWIP_NETDB_H
+#define WIFI_LOGGER_HOST_LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif // WIFI_LOGGER_HOST_LWIP_NETDB_H
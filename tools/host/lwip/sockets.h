@@ -0,0 +1,25 @@
+#ifndef WIFI_LOGGER_HOST_LWIP_SOCKETS_H
+#define WIFI_LOGGER_HOST_LWIP_SOCKETS_H
+
+// lwIP's BSD socket API is the real one on Linux. lwip/sockets.h also pulls in the libc headers the component relies on
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static inline char* inet_ntoa_r(struct in_addr addr, char* buf, int buflen)
+{
+    return (char*)inet_ntop(AF_INET, &addr, buf, (socklen_t)buflen);
+}
+
+#endif // WIFI_LOGGER_HOST_LWIP_SOCKETS_H
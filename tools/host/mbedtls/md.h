@@ -0,0 +1,32 @@
+#ifndef WIFI_LOGGER_HOST_MBEDTLS_MD_H
+#define WIFI_LOGGER_HOST_MBEDTLS_MD_H
+
+/*
+ * The parts of mbedTLS's message digest API control_channel.c uses (HMAC-SHA256), on top of OpenSSL (link with
+ * -lcrypto). See mbedtls_host.c.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MBEDTLS_ERR_MD_BAD_INPUT_DATA -0x5100
+
+typedef enum {
+    MBEDTLS_MD_NONE = 0,
+    MBEDTLS_MD_SHA256 = 6,
+} mbedtls_md_type_t;
+
+typedef struct mbedtls_md_info_t mbedtls_md_info_t;
+
+const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t md_type);
+int mbedtls_md_hmac(const mbedtls_md_info_t* md_info, const unsigned char* key, size_t keylen,
+                    const unsigned char* input, size_t ilen, unsigned char* output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_HOST_MBEDTLS_MD_H
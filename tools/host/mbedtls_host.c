@@ -0,0 +1,93 @@
+/*
+ * mbedTLS's AES-GCM and HMAC on OpenSSL, for host builds of datagram_crypto.c and control_channel.c. See mbedtls/gcm.h
+ * and mbedtls/md.h.
+ */
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "mbedtls/gcm.h"
+#include "mbedtls/md.h"
+
+void mbedtls_gcm_init(mbedtls_gcm_context* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_gcm_setkey(mbedtls_gcm_context* ctx, mbedtls_cipher_id_t cipher, const unsigned char* key, unsigned int keybits)
+{
+    if (cipher != MBEDTLS_CIPHER_ID_AES || keybits != 256)
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+
+    mbedtls_gcm_free(ctx);
+    EVP_CIPHER_CTX* encrypt = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX* decrypt = EVP_CIPHER_CTX_new();
+    ctx->encrypt = encrypt;
+    ctx->decrypt = decrypt;
+    if (!encrypt || !decrypt ||
+        EVP_EncryptInit_ex(encrypt, EVP_aes_256_gcm(), NULL, key, NULL) != 1 ||
+        EVP_DecryptInit_ex(decrypt, EVP_aes_256_gcm(), NULL, key, NULL) != 1) {
+        mbedtls_gcm_free(ctx);
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+    }
+    return 0;
+}
+
+int mbedtls_gcm_crypt_and_tag(mbedtls_gcm_context* ctx, int mode, size_t length,
+                              const unsigned char* iv, size_t iv_len, const unsigned char* add, size_t add_len,
+                              const unsigned char* input, unsigned char* output, size_t tag_len, unsigned char* tag)
+{
+    EVP_CIPHER_CTX* evp = ctx->encrypt;
+    int out_len;
+    if (mode != MBEDTLS_GCM_ENCRYPT || !evp || iv_len != 12 ||
+        EVP_EncryptInit_ex(evp, NULL, NULL, NULL, iv) != 1 ||
+        (add_len && EVP_EncryptUpdate(evp, NULL, &out_len, add, (int)add_len) != 1) ||
+        (length && EVP_EncryptUpdate(evp, output, &out_len, input, (int)length) != 1) ||
+        EVP_EncryptFinal_ex(evp, output + length, &out_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_GET_TAG, (int)tag_len, tag) != 1)
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+    return 0;
+}
+
+int mbedtls_gcm_auth_decrypt(mbedtls_gcm_context* ctx, size_t length,
+                             const unsigned char* iv, size_t iv_len, const unsigned char* add, size_t add_len,
+                             const unsigned char* tag, size_t tag_len, const unsigned char* input, unsigned char* output)
+{
+    EVP_CIPHER_CTX* evp = ctx->decrypt;
+    int out_len;
+    if (!evp || iv_len != 12 ||
+        EVP_DecryptInit_ex(evp, NULL, NULL, NULL, iv) != 1 ||
+        (add_len && EVP_DecryptUpdate(evp, NULL, &out_len, add, (int)add_len) != 1) ||
+        (length && EVP_DecryptUpdate(evp, output, &out_len, input, (int)length) != 1) ||
+        EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_SET_TAG, (int)tag_len, (void*)tag) != 1)
+        return MBEDTLS_ERR_GCM_BAD_INPUT;
+
+    if (EVP_DecryptFinal_ex(evp, output + length, &out_len) != 1) {
+        // like mbedTLS: nothing of a forgery is left in output
+        memset(output, 0, length);
+        return MBEDTLS_ERR_GCM_AUTH_FAILED;
+    }
+    return 0;
+}
+
+void mbedtls_gcm_free(mbedtls_gcm_context* ctx)
+{
+    EVP_CIPHER_CTX_free(ctx->encrypt);
+    EVP_CIPHER_CTX_free(ctx->decrypt);
+    ctx->encrypt = NULL;
+    ctx->decrypt = NULL;
+}
+
+const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t md_type)
+{
+    return md_type == MBEDTLS_MD_SHA256 ? (const mbedtls_md_info_t*)EVP_sha256() : NULL;
+}
+
+int mbedtls_md_hmac(const mbedtls_md_info_t* md_info, const unsigned char* key, size_t keylen,
+                    const unsigned char* input, size_t ilen, unsigned char* output)
+{
+    if (!md_info || !HMAC((const EVP_MD*)md_info, key, (int)keylen, input, ilen, output, NULL))
+        return MBEDTLS_ERR_MD_BAD_INPUT_DATA;
+    return 0;
+}
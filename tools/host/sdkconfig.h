@@ -0,0 +1,6 @@
+#ifndef WIFI_LOGGER_HOST_SDKCONFIG_H
+#define WIFI_LOGGER_HOST_SDKCONFIG_H
+
+// the CONFIG_ values come from the -D flags in the Makefiles
+
+#endif // WIFI_LOGGER_HOST_SDKCONFIG_H
@@ -0,0 +1,782 @@
+/*
+ * wifi_log_loadgen: thousands of virtual wifi_logger devices on one Linux box, to find out how many real ones a
+ * collector (tools/wifi_log_collector.py, a syslog server, plain nc...) can take before buying the hardware.
+ *
+ * Every virtual device replays a corpus of recorded log lines (see corpus.log) with the timing they were recorded
+ * with: boot storms, error loops, quiet periods. Lines are formatted by the component's own
+ * generate_log_message_timestamp_and_device_id() (utils.cpp), batched the way the logger task batches them, and sent
+ * by its own UDP code (udp_handler.c), one socket per device.
+ *
+ * With --tcp, each device sends its batches over TCP instead (tcp_handler.c), framed like the adaptive transport frames
+ * them ([length, 2 bytes big-endian][datagram]), which tools/wifi_log_collector.py --tcp takes on the same port. Every device
+ * connects once and keeps the connection for the whole run, like the logger task does; a connection that breaks is
+ * reopened TCP_RETRY_MS later, and what the device has due meanwhile is shed. The total shows how many connects that took.
+ * A send waits for room in the socket buffer (TCP_SEND_TIMEOUT_MS in tcp_handler.c at most), so a receiver that can't
+ * keep up slows the whole generator down, the way it slows real devices down: offered load drops instead of lines being
+ * lost. The collector doesn't answer probes over TCP, so there are none: TCP delivers what it takes, barring a
+ * connection that breaks with lines still in its send buffer. At the end, each device shuts its connection down and
+ * waits for the receiver to close its end too, the sign that it read everything, and the total counts those that didn't.
+ *
+ * To see what the receiver actually took in, each device also sends a health probe (LOG_RECORD_TYPE_PROBE) every
+ * --probe-ms. Probes wait in the receiver's socket buffer along with the lines, and are dropped along with them when
+ * it overflows, so the share of probes answered is the share of datagrams the receiver got. tools/wifi_log_collector.py
+ * answers probes; for receivers that don't (nc), only the offered load is reported.
+ *
+ * With --ramp, the number of devices goes up in steps over the run, and each step gets a row: a capacity curve.
+ *
+ * build: make -C tools/loadgen
+ * usage: see usage() below
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log_queue.h"
+#include "tcp_handler.h"
+#include "udp_handler.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+#define PROBE_ACK_PREFIX    "wlack "
+#define CREDIT_GRANT_PREFIX "wlcredit "
+
+// the longest a single corpus line can wait for the next one, so a corpus recorded across a long idle stretch still replays
+#define MAX_LINE_DELAY_MS 60000
+// lines a device sends per wakeup at most, in case a corpus has no delays at all
+#define MAX_LINES_PER_WAKEUP 64
+#define MAX_BATCH_SIZE 1472
+// like wifi_logger.c's
+#define TCP_FRAME_HEADER_SIZE 2
+#define TCP_RETRY_MS 5000
+#define TCP_FINISH_TIMEOUT_MS 1000   // how long the logger task waits for the collector to confirm, too
+
+struct corpus_line {
+    uint32_t delay_ms; // after the line before it
+    uint8_t level;     // 0-4 = E, W, I, D, V, like the logger's log_level_opt
+    char* text;        // "tag: message"
+};
+
+struct corpus {
+    struct corpus_line* lines;
+    size_t count;
+    size_t loop_from; // where replay carries on after the last line ("#loop" in the file), 0 = from the start
+};
+
+struct virtual_device {
+    struct logger_udp_network_data* net;
+    struct logger_tcp_network_data* tcp;    // with --tcp
+    uint64_t next_connect_us;                // with --tcp, while disconnected
+    char id[DEVICE_ID_SIZE];
+    uint64_t boot_us;
+    uint64_t next_line_us;  // when lines[pos] is due
+    uint64_t next_probe_us;
+    size_t pos;
+    uint32_t probe_seq;
+    bool flow_control;      // the receiver grants credits, see check_flow_control() in wifi_logger.c
+    int32_t credits;
+    size_t heap_index;
+};
+
+struct stats {
+    uint64_t lines_offered;
+    uint64_t lines_sent;
+    uint64_t lines_shed;   // out of credits with --flow-control
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t send_errors;
+    uint64_t probes_sent;
+    uint64_t probes_acked;
+    uint64_t grants;
+    uint64_t connects;     // with --tcp
+};
+
+struct options {
+    const char* host;
+    int port;
+    unsigned devices;
+    unsigned duration_s;
+    const char* corpus_path;
+    unsigned ramp_steps;
+    unsigned boot_spread_ms;
+    double speed;
+    unsigned batch;
+    unsigned probe_ms;
+    unsigned report_ms;
+    bool flow_control;
+    bool tcp;
+    unsigned seed;
+};
+
+static struct corpus s_corpus;
+static struct virtual_device* s_devices;
+static struct virtual_device* s_current_device; // whose line utils.cpp is formatting
+static struct stats s_window;
+static struct stats s_total;
+
+// the results. udp_handler.c and tcp_handler.c printf() hello, goodbye and every send error for every socket, which
+// isn't interesting times thousands: stdout goes to /dev/null
+static FILE* s_out;
+
+// devices by next wakeup, earliest first
+static struct virtual_device** s_heap;
+static size_t s_heap_size;
+
+static char s_batch[MAX_BATCH_SIZE];
+static uint8_t s_tcp_frame[TCP_FRAME_HEADER_SIZE + MAX_BATCH_SIZE];
+
+/**
+ * @brief the device id utils.cpp puts in front of every line: the virtual device being replayed right now
+ */
+const char* udp_logging_get_device_id()
+{
+    return s_current_device ? s_current_device->id : "";
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void sleep_until_us(uint64_t deadline)
+{
+    const uint64_t now = now_us();
+    if (deadline <= now)
+        return;
+    const uint64_t wait = deadline - now;
+    const struct timespec ts = { .tv_sec = (time_t)(wait / 1000000u), .tv_nsec = (long)(wait % 1000000u) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static void stats_add(struct stats* to, const struct stats* from)
+{
+    to->lines_offered += from->lines_offered;
+    to->lines_sent += from->lines_sent;
+    to->lines_shed += from->lines_shed;
+    to->datagrams += from->datagrams;
+    to->bytes += from->bytes;
+    to->send_errors += from->send_errors;
+    to->probes_sent += from->probes_sent;
+    to->probes_acked += from->probes_acked;
+    to->grants += from->grants;
+    to->connects += from->connects;
+}
+
+/*
+ * Corpus: log lines as the collector (or idf.py monitor) prints them, e.g.
+ *
+ *   aa:bb:cc:dd:ee:ff| I (1234) wifi: connected
+ *   E (1290) app: sensor timeout
+ *
+ * The device id and color codes are optional. The (timestamp) of each line sets how long after the line before it it's
+ * replayed. Lines starting with '#' are comments, except "#loop": after the last line, replay carries on from there,
+ * so a boot storm at the top of the file only happens once per device.
+ */
+
+/**
+ * @brief takes color codes out of a line, in place
+ */
+static void strip_colors(char* line)
+{
+    char* out = line;
+    for (const char* in = line; *in; ) {
+        if (in[0] == '\x1b' && in[1] == '[') {
+            in += 2;
+            while (*in && *in != 'm')
+                in++;
+            if (*in)
+                in++;
+            continue;
+        }
+        *out++ = *in++;
+    }
+    *out = '\0';
+}
+
+static bool parse_corpus_line(char* line, uint8_t* level, uint32_t* timestamp, char** text)
+{
+    static const char levels[] = "EWIDV";
+
+    strip_colors(line);
+    line[strcspn(line, "\r\n")] = '\0';
+
+    // "<device_id>| " in front
+    char* bar = strchr(line, '|');
+    if (bar && bar[1] == ' ' && memchr(line, ' ', (size_t)(bar - line)) == NULL)
+        line = &bar[2];
+
+    const char* found = line[0] ? strchr(levels, line[0]) : NULL;
+    unsigned long ts;
+    int consumed = 0;
+    if (!found || sscanf(line, "%*c (%lu) %n", &ts, &consumed) != 1 || consumed == 0)
+        return false;
+
+    *level = (uint8_t)(found - levels);
+    *timestamp = (uint32_t)ts;
+    *text = &line[consumed];
+    return true;
+}
+
+static bool load_corpus(const char* path, struct corpus* corpus)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "wifi_log_loadgen: can't open corpus %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t capacity = 0;
+    uint32_t last_ts = 0;
+    bool have_ts = false;
+    char line[1024];
+
+    memset(corpus, 0, sizeof(*corpus));
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "#loop", 5) == 0) {
+            corpus->loop_from = corpus->count;
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        uint8_t level;
+        uint32_t ts;
+        char* text;
+        if (!parse_corpus_line(line, &level, &ts, &text)) {
+            // not an ESP-IDF log line: replay it as it is, right after the one before it
+            level = 2;
+            ts = last_ts;
+            text = line;
+        }
+
+        if (corpus->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            corpus->lines = realloc(corpus->lines, capacity * sizeof(*corpus->lines));
+            if (!corpus->lines) {
+                fclose(f);
+                return false;
+            }
+        }
+
+        // a timestamp going backwards is a reboot in the recording: replay it straight away
+        const uint32_t delay = (have_ts && ts >= last_ts) ? ts - last_ts : 0;
+        struct corpus_line* entry = &corpus->lines[corpus->count++];
+        entry->delay_ms = delay < MAX_LINE_DELAY_MS ? delay : MAX_LINE_DELAY_MS;
+        entry->level = level;
+        entry->text = strdup(text);
+        last_ts = ts;
+        have_ts = true;
+    }
+    fclose(f);
+
+    if (corpus->count == 0) {
+        fprintf(stderr, "wifi_log_loadgen: no log lines in %s\n", path);
+        return false;
+    }
+    if (corpus->loop_from >= corpus->count)
+        corpus->loop_from = 0;
+    return true;
+}
+
+static uint64_t device_wakeup(const struct virtual_device* device)
+{
+    return device->next_line_us < device->next_probe_us ? device->next_line_us : device->next_probe_us;
+}
+
+static void heap_swap(size_t a, size_t b)
+{
+    struct virtual_device* tmp = s_heap[a];
+    s_heap[a] = s_heap[b];
+    s_heap[b] = tmp;
+    s_heap[a]->heap_index = a;
+    s_heap[b]->heap_index = b;
+}
+
+static void heap_sift_down(size_t i)
+{
+    while (true) {
+        size_t smallest = i;
+        const size_t left = 2 * i + 1;
+        const size_t right = left + 1;
+        if (left < s_heap_size && device_wakeup(s_heap[left]) < device_wakeup(s_heap[smallest]))
+            smallest = left;
+        if (right < s_heap_size && device_wakeup(s_heap[right]) < device_wakeup(s_heap[smallest]))
+            smallest = right;
+        if (smallest == i)
+            return;
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_push(struct virtual_device* device)
+{
+    size_t i = s_heap_size++;
+    s_heap[i] = device;
+    device->heap_index = i;
+    while (i > 0 && device_wakeup(s_heap[(i - 1) / 2]) > device_wakeup(s_heap[i])) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * @brief (re)opens a device's TCP connection, unless it broke less than TCP_RETRY_MS ago
+ *
+ * @return bool true if it's connected
+ */
+static bool connect_device_tcp(struct virtual_device* device, const struct options* opts, uint64_t now)
+{
+    if (is_tcp_connected(device->tcp))
+        return true;
+    if (now < device->next_connect_us)
+        return false;
+
+    const bool connected = connect_tcp_network_manager(device->tcp, opts->host, opts->port);
+
+    s_window.connects++;
+    if (!connected)
+        device->next_connect_us = now + TCP_RETRY_MS * 1000u;
+    return connected;
+}
+
+/**
+ * @brief sends one datagram over a device's TCP connection, as a frame. the connection stays open for the next one
+ *
+ * @return int bytes sent, -1 if the connection broke (it's closed then, and reopened later)
+ */
+static int send_tcp_frame(struct virtual_device* device, const char* payload, size_t len)
+{
+    s_tcp_frame[0] = (uint8_t)(len >> 8);
+    s_tcp_frame[1] = (uint8_t)len;
+    memcpy(&s_tcp_frame[TCP_FRAME_HEADER_SIZE], payload, len);
+
+    const int sent = tcp_send_data(device->tcp, (const char*)s_tcp_frame, TCP_FRAME_HEADER_SIZE + len);
+    if (sent < 0) {
+        tcp_close_network_manager(device->tcp);
+        device->next_connect_us = now_us() + TCP_RETRY_MS * 1000u;
+    }
+    return sent;
+}
+
+/**
+ * @brief sends one datagram from a device, unless it's out of credits (or, with --tcp, not connected)
+ *
+ * @return bool false if it wasn't sent
+ */
+static bool send_datagram(struct virtual_device* device, const char* payload, size_t len)
+{
+    if (device->tcp) {
+        if (!is_tcp_connected(device->tcp))
+            return false;
+        const int len_sent = send_tcp_frame(device, payload, len);
+        if (len_sent < 0) {
+            s_window.send_errors++;
+            return false;
+        }
+        s_window.datagrams++;
+        s_window.bytes += (uint64_t)len_sent;
+        return true;
+    }
+
+    if (device->flow_control && device->credits <= 0)
+        return false;
+
+    int len_sent = 0;
+    send_udp_data(device->net, payload, len, &len_sent);
+    device->credits--;
+    if (len_sent < 0) {
+        s_window.send_errors++;
+        return false;
+    }
+    s_window.datagrams++;
+    s_window.bytes += (uint64_t)len_sent;
+    return true;
+}
+
+static void flush_batch(struct virtual_device* device, size_t* batch_len, unsigned* batch_lines)
+{
+    if (*batch_len == 0)
+        return;
+    if (send_datagram(device, s_batch, *batch_len))
+        s_window.lines_sent += *batch_lines;
+    else
+        s_window.lines_shed += *batch_lines;
+    *batch_len = 0;
+    *batch_lines = 0;
+}
+
+static void poll_replies(struct virtual_device* device, bool honor_credits)
+{
+    const char* message;
+    while ((message = receive_udp_data(device->net, NULL)) != NULL) {
+        if (strncmp(message, PROBE_ACK_PREFIX, strlen(PROBE_ACK_PREFIX)) == 0) {
+            const unsigned long seq = strtoul(&message[strlen(PROBE_ACK_PREFIX)], NULL, 10);
+            if (seq > 0 && seq <= device->probe_seq)
+                s_window.probes_acked++;
+        } else if (strncmp(message, CREDIT_GRANT_PREFIX, strlen(CREDIT_GRANT_PREFIX)) == 0) {
+            s_window.grants++;
+            if (honor_credits) {
+                device->flow_control = true;
+                device->credits = (int32_t)strtol(&message[strlen(CREDIT_GRANT_PREFIX)], NULL, 10);
+            }
+        }
+    }
+}
+
+static void send_probe(struct virtual_device* device)
+{
+    uint8_t record[LOG_RECORD_HEADER_SIZE + 4];
+    const uint32_t seq = ++device->probe_seq;
+    log_record_write_header(record, LOG_RECORD_TYPE_PROBE, 4);
+    record[4] = (uint8_t)(seq >> 24);
+    record[5] = (uint8_t)(seq >> 16);
+    record[6] = (uint8_t)(seq >> 8);
+    record[7] = (uint8_t)seq;
+
+    // probes are how we measure what got through: they never wait for credits
+    int len_sent = 0;
+    send_udp_data(device->net, (const char*)record, sizeof(record), &len_sent);
+    if (len_sent < 0) {
+        s_window.send_errors++;
+        return;
+    }
+    s_window.probes_sent++;
+}
+
+/**
+ * @brief sends whatever lines (and probe) the device has due
+ */
+static void run_device(struct virtual_device* device, const struct options* opts, uint64_t now)
+{
+    if (device->tcp)
+        connect_device_tcp(device, opts, now);
+    else
+        poll_replies(device, opts->flow_control);
+
+    if (opts->probe_ms && now >= device->next_probe_us) {
+        send_probe(device);
+        device->next_probe_us += (uint64_t)opts->probe_ms * 1000u;
+        if (device->next_probe_us < now)
+            device->next_probe_us = now + (uint64_t)opts->probe_ms * 1000u;
+    }
+
+    size_t batch_len = 0;
+    unsigned batch_lines = 0;
+    s_current_device = device;
+
+    for (unsigned n = 0; n < MAX_LINES_PER_WAKEUP && device->next_line_us <= now; n++) {
+        const struct corpus_line* line = &s_corpus.lines[device->pos];
+        const uint32_t uptime_ms = (uint32_t)((device->next_line_us - device->boot_us) / 1000u);
+
+        char* message = generate_log_message_timestamp_and_device_id(true, true, line->level, uptime_ms, line->text);
+        s_window.lines_offered++;
+        if (message) {
+            const size_t len = strlen(message);
+            if (batch_len + len > opts->batch)
+                flush_batch(device, &batch_len, &batch_lines);
+
+            if (len > opts->batch) {
+                // too big to batch (or batching is off): on its own, like the logger task does it
+                if (send_datagram(device, message, len))
+                    s_window.lines_sent++;
+                else
+                    s_window.lines_shed++;
+            } else {
+                memcpy(&s_batch[batch_len], message, len);
+                batch_len += len;
+                batch_lines++;
+            }
+            free(message);
+        }
+
+        device->pos = (device->pos + 1 < s_corpus.count) ? device->pos + 1 : s_corpus.loop_from;
+        device->next_line_us += (uint64_t)(s_corpus.lines[device->pos].delay_ms * 1000.0 / opts->speed);
+    }
+    flush_batch(device, &batch_len, &batch_lines);
+
+    // a corpus with no delays in it: don't spin on one device
+    if (device->next_line_us <= now)
+        device->next_line_us = now + 1000u;
+    s_current_device = NULL;
+}
+
+static bool start_device(struct virtual_device* device, unsigned index, const struct options* opts, uint64_t boot_us)
+{
+    memset(device, 0, sizeof(*device));
+    snprintf(device->id, sizeof(device->id), "vdev-%05u", index);
+
+    if (opts->tcp) {
+        // connected once here, and reused for every batch after
+        device->tcp = create_tcp_network_manager_handle();
+        if (!device->tcp || !connect_device_tcp(device, opts, boot_us))
+            return false;
+    } else {
+        device->net = create_udp_network_manager_handle();
+        if (!device->net || !init_udp_network_manager(device->net, opts->host, opts->port))
+            return false;
+    }
+
+    device->boot_us = boot_us;
+    device->next_line_us = boot_us;
+    device->next_probe_us = opts->probe_ms ? boot_us + (uint64_t)(rand() % opts->probe_ms) * 1000u : UINT64_MAX;
+    heap_push(device);
+    return true;
+}
+
+/**
+ * @brief starts devices up to count, booting at random times over the next spread_ms
+ */
+static bool start_devices(unsigned* started, unsigned count, const struct options* opts, unsigned spread_ms)
+{
+    bool ok = true;
+    const uint64_t now = now_us();
+    for (; *started < count; (*started)++) {
+        const uint64_t boot = now + (spread_ms ? (uint64_t)(rand() % spread_ms) * 1000u : 0);
+        if (!start_device(&s_devices[*started], *started, opts, boot)) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok)
+        fprintf(stderr, "wifi_log_loadgen: couldn't start device %u (%s). raise ulimit -n?\n", *started, strerror(errno));
+    return ok;
+}
+
+static void print_header(void)
+{
+    fprintf(s_out, "%7s %7s %10s %9s %9s %7s %9s %9s %13s\n",
+           "time_s", "devices", "lines/s", "dgrams/s", "kB/s", "errors", "shed/s", "answered", "~delivered/s");
+}
+
+/**
+ * @brief prints one row: what was offered over the last seconds, and the share of probes the receiver answered
+ *
+ * @param tcp with --tcp: there are no probes, and what TCP took is what got delivered
+ */
+static void print_row(double time_s, unsigned devices, const struct stats* s, double seconds, bool tcp)
+{
+    // until the receiver answers a probe, it might not be one that does (nc): don't claim it got nothing
+    char answered[16] = "-";
+    char delivered[24] = "-";
+    if (s->probes_sent > 0 && s_total.probes_acked + s->probes_acked > 0) {
+        const double share = (double)s->probes_acked / (double)s->probes_sent;
+        snprintf(answered, sizeof(answered), "%.1f%%", 100.0 * (share > 1.0 ? 1.0 : share));
+        snprintf(delivered, sizeof(delivered), "%.0f", (double)s->lines_sent / seconds * (share > 1.0 ? 1.0 : share));
+    } else if (tcp) {
+        snprintf(delivered, sizeof(delivered), "%.0f", (double)s->lines_sent / seconds);
+    }
+
+    fprintf(s_out, "%7.1f %7u %10.0f %9.0f %9.1f %7" PRIu64 " %9.0f %9s %13s\n", time_s, devices,
+           (double)s->lines_offered / seconds, (double)s->datagrams / seconds, (double)s->bytes / seconds / 1000.0,
+           s->send_errors, (double)s->lines_shed / seconds, answered, delivered);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s <host> <port> [options]\n"
+            "  -d, --devices N       virtual devices (default 100)\n"
+            "  -t, --duration S      how long to run, seconds (default 30)\n"
+            "  -c, --corpus FILE     recorded log lines to replay (default corpus.log)\n"
+            "  -r, --ramp STEPS      go up to --devices in this many steps, one row per step: a capacity curve\n"
+            "  -b, --boot-spread MS  devices boot at random times over this long (default 10000)\n"
+            "  -s, --speed X         replay the corpus X times faster (default 1)\n"
+            "      --batch BYTES     pack lines into datagrams of up to this size, 0 = one per line (default 1024)\n"
+            "      --probe-ms MS     probe the receiver this often per device, 0 = never (default 1000)\n"
+            "      --report-ms MS    print a row this often (default 1000, not with --ramp)\n"
+            "      --flow-control    honor credit grants (wlcredit) like real devices: lines are shed while out of them\n"
+            "      --tcp             send over TCP, one connection per device kept for the whole run (no probes)\n"
+            "      --seed N          for boot times (default 1)\n",
+            name);
+}
+
+static bool parse_options(int argc, char** argv, struct options* opts)
+{
+    enum { OPT_BATCH = 256, OPT_PROBE_MS, OPT_REPORT_MS, OPT_FLOW_CONTROL, OPT_TCP, OPT_SEED };
+    static const struct option long_options[] = {
+        { "devices", required_argument, NULL, 'd' },
+        { "duration", required_argument, NULL, 't' },
+        { "corpus", required_argument, NULL, 'c' },
+        { "ramp", required_argument, NULL, 'r' },
+        { "boot-spread", required_argument, NULL, 'b' },
+        { "speed", required_argument, NULL, 's' },
+        { "batch", required_argument, NULL, OPT_BATCH },
+        { "probe-ms", required_argument, NULL, OPT_PROBE_MS },
+        { "report-ms", required_argument, NULL, OPT_REPORT_MS },
+        { "flow-control", no_argument, NULL, OPT_FLOW_CONTROL },
+        { "tcp", no_argument, NULL, OPT_TCP },
+        { "seed", required_argument, NULL, OPT_SEED },
+        { NULL, 0, NULL, 0 },
+    };
+
+    *opts = (struct options){
+        .devices = 100, .duration_s = 30, .corpus_path = "corpus.log", .boot_spread_ms = 10000, .speed = 1.0,
+        .batch = 1024, .probe_ms = 1000, .report_ms = 1000, .seed = 1,
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:t:c:r:b:s:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'd': opts->devices = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 't': opts->duration_s = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'c': opts->corpus_path = optarg; break;
+        case 'r': opts->ramp_steps = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': opts->boot_spread_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 's': opts->speed = strtod(optarg, NULL); break;
+        case OPT_BATCH: opts->batch = (unsigned)strtoul(optarg, NULL, 10); break;
+        case OPT_PROBE_MS: opts->probe_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case OPT_REPORT_MS: opts->report_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        case OPT_FLOW_CONTROL: opts->flow_control = true; break;
+        case OPT_TCP: opts->tcp = true; break;
+        case OPT_SEED: opts->seed = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    if (argc - optind != 2)
+        return false;
+    opts->host = argv[optind];
+    opts->port = atoi(argv[optind + 1]);
+
+    if (opts->batch > MAX_BATCH_SIZE)
+        opts->batch = MAX_BATCH_SIZE;
+    if (opts->devices == 0 || opts->duration_s == 0 || opts->speed <= 0.0 || opts->port <= 0 || opts->report_ms == 0)
+        return false;
+    // probes and credit grants only go over UDP
+    if (opts->tcp && opts->flow_control)
+        return false;
+    if (opts->tcp)
+        opts->probe_ms = 0;
+    if (opts->ramp_steps > opts->devices)
+        opts->ramp_steps = opts->devices;
+    return true;
+}
+
+static void raise_fd_limit(unsigned devices)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= devices + 64)
+        return;
+    limit.rlim_cur = (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > devices + 64) ? devices + 64 : limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!load_corpus(opts.corpus_path, &s_corpus))
+        return 1;
+
+    s_out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(s_out, NULL, _IOLBF, 0);
+    fflush(stdout);
+    dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    srand(opts.seed);
+    // a send on a connection the receiver closed is an error to handle, like it is with lwIP, not the end of the run
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit(opts.devices);
+
+    s_devices = calloc(opts.devices, sizeof(*s_devices));
+    s_heap = calloc(opts.devices, sizeof(*s_heap));
+    if (!s_devices || !s_heap)
+        return 1;
+
+    const unsigned steps = opts.ramp_steps ? opts.ramp_steps : 1;
+    const uint64_t step_us = (uint64_t)opts.duration_s * 1000000u / steps;
+    const uint64_t report_us = opts.ramp_steps ? step_us : (uint64_t)opts.report_ms * 1000u;
+
+    fprintf(s_out, "%u devices, %zu corpus lines, to %s:%d over %s%s\n", opts.devices, s_corpus.count, opts.host, opts.port,
+           opts.tcp ? "TCP" : "UDP", opts.ramp_steps ? ", ramping up" : "");
+    print_header();
+
+    unsigned started = 0;
+    const uint64_t start = now_us();
+    uint64_t next_report = start + report_us;
+    uint64_t last_report = start;
+
+    for (unsigned step = 1; step <= steps; step++) {
+        const unsigned target = (unsigned)((uint64_t)opts.devices * step / steps);
+        const unsigned spread = opts.ramp_steps ? (unsigned)(step_us / 4000u) : opts.boot_spread_ms;
+        if (!start_devices(&started, target, &opts, spread))
+            return 1;
+
+        const uint64_t step_end = start + step_us * step;
+        while (true) {
+            const uint64_t now = now_us();
+            if (now >= next_report) {
+                print_row((double)(now - start) / 1e6, started, &s_window, (double)(now - last_report) / 1e6,
+                          opts.tcp);
+                stats_add(&s_total, &s_window);
+                memset(&s_window, 0, sizeof(s_window));
+                last_report = now;
+                next_report += report_us;
+            }
+            if (now >= step_end)
+                break;
+
+            struct virtual_device* device = s_heap[0];
+            if (device_wakeup(device) > now) {
+                uint64_t until = device_wakeup(device);
+                if (until > next_report)
+                    until = next_report;
+                sleep_until_us(until);
+                continue;
+            }
+
+            run_device(device, &opts, now);
+            heap_sift_down(device->heap_index);
+        }
+    }
+
+    // late answers: probes sent in the last moments are still on their way back
+    usleep(500000);
+    for (unsigned i = 0; i < started && !opts.tcp; i++)
+        poll_replies(&s_devices[i], false);
+    stats_add(&s_total, &s_window);
+
+    // over TCP, the receiver closing its end once the device has closed its own is the only sign it read everything
+    unsigned unconfirmed = 0;
+    for (unsigned i = 0; i < started && opts.tcp; i++) {
+        if (is_tcp_connected(s_devices[i].tcp) && !tcp_finish_network_manager(s_devices[i].tcp, TCP_FINISH_TIMEOUT_MS))
+            unconfirmed++;
+    }
+
+    const double seconds = (double)(now_us() - start) / 1e6;
+    fprintf(s_out, "\ntotal over %.1f s: %" PRIu64 " lines offered, %" PRIu64 " sent in %" PRIu64 " datagrams (%.1f MB), %" PRIu64
+           " shed, %" PRIu64 " send errors, %" PRIu64 " credit grants\n",
+           seconds, s_total.lines_offered, s_total.lines_sent, s_total.datagrams, (double)s_total.bytes / 1e6,
+           s_total.lines_shed, s_total.send_errors, s_total.grants);
+    if (opts.tcp) {
+        fprintf(s_out, "%" PRIu64 " TCP connects for %u devices, %u connections not confirmed read in full at the end\n",
+                s_total.connects, started, unconfirmed);
+    } else if (s_total.probes_acked > 0) {
+        const double share = (double)s_total.probes_acked / (double)s_total.probes_sent;
+        fprintf(s_out, "receiver answered %" PRIu64 " of %" PRIu64 " probes (%.1f%%): about %.0f lines delivered\n",
+               s_total.probes_acked, s_total.probes_sent, 100.0 * share, (double)s_total.lines_sent * share);
+    } else if (s_total.probes_sent > 0) {
+        fprintf(s_out, "receiver answered none of %" PRIu64 " probes: it doesn't (like nc), or nothing got through. "
+               "only the offered load is known\n", s_total.probes_sent);
+    }
+
+    for (unsigned i = 0; i < started && !opts.tcp; i++)
+        close_udp_network_manager(s_devices[i].net);
+    return 0;
+}
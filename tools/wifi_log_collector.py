@@ -0,0 +1,420 @@
+#!/usr/bin/env python3
+"""
+Receives log lines sent by the wifi_logger component and prints them, same as `nc -lu <port>`, except that long
+lines the device split into fragments (see CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE) are stitched back together.
+
+Fragment format, per device: every fragment is a datagram of its own, starting with "<device_id>|+<n>+ " (n counting
+up from 0), except the last one, which starts with "<device_id>|+<n> ". The rest of it is the next piece of the line.
+
+Datagrams can hold a batch of lines, and binary records (see wifi_log_records.py). wifi_log_kv() and wifi_metric_x()
+records are written as JSON Lines, wifi_log_buffer() blobs as hexdumps.
+
+With --control-key (same as CONFIG_LOGGING_SERVER_CONTROL_KEY on the device), commands typed on stdin as
+"<device_id> <command> [args...]" are signed and sent to that device, e.g. "aa:bb:cc:dd:ee:ff level wifi D".
+See control_channel.c for the list of commands. The device's reply shows up as a "wlctl" log line.
+
+With --encryption-key (same as CONFIG_LOGGING_SERVER_ENCRYPTION_KEY), sealed datagrams are decrypted, and anything
+that isn't sealed with that key is dropped. Probe acks, credit grants and commands are sealed on the way back: the
+device ignores any that aren't. Needs the "cryptography" package.
+
+With --trace, wifi_trace_x() events are written out as Chrome trace / Perfetto JSON (see wifi_log_trace.py).
+
+With --tail-port, any number of viewers can connect over TCP and watch the lines as they come in, filtered by device,
+tag and level. See wifi_log_tail.py.
+
+Health probes from devices with fallback collectors (CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS) or the adaptive
+transport are always answered.
+
+Devices with the adaptive transport (CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT) move their logs to TCP while UDP loses
+too much: with --tcp, the collector also listens for TCP on the same port, where each datagram comes as
+[length, 2 bytes big-endian] [datagram]. Probes, credit requests and command replies stay on UDP. A long line's
+fragments are put back together by device id, not by address, so a line split across a switch still comes out whole.
+
+Flow control: whenever the collector has caught up with everything waiting on its socket, it grants --flow-window more
+datagrams ("wlcredit <n>") to each device that has used up half its window since its last grant, or asked for more.
+A device that runs out holds its lines (packing them into full batches) until the next grant, so when the collector, or whatever it writes to, falls behind, the devices
+slow down instead of sending datagrams that would be dropped at the socket. --flow-window 0 turns this off. With
+--control-key, grants are signed like commands: devices with a control key ignore unsigned ones. A device that hears
+no grant for 5 s goes back to sending without flow control.
+
+usage: wifi_log_collector.py <port> [--tcp] [--flow-window <n>] [--jsonl <file>] [--control-key <key>] [--encryption-key <hex>] [--tail-port <port>] [--trace <file>]
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import re
+import selectors
+import socket
+import struct
+import sys
+import time
+
+import wifi_log_records
+import wifi_log_tail
+import wifi_log_trace
+
+FRAGMENT_HEADER = re.compile(rb"^[^|\n]*\|\+(\d+)(\+?) ")
+LOST_FRAGMENT_NOTE = b" [wifi_log_collector: rest of line lost]\n"
+DEVICE_ID_PREFIX = re.compile(rb"^([^|\n]*)\|")
+
+SEALED_MAGIC = 0x1D
+SEALED_NONCE_SIZE = 12
+
+MAX_DATAGRAMS_PER_WAKEUP = 256
+
+TCP_FRAME_HEADER = struct.Struct(">H")
+
+CONTROL_MESSAGE_PREFIX = "wlctl "
+CONTROL_MAC_HEX_CHARS = 32
+
+
+class FragmentReassembler:
+    """
+    Joins the fragments of split log lines back together, keeping track of one partial line per device (or per sender,
+    for lines without a device id): a device that moves between UDP and TCP sends from two addresses.
+    """
+
+    def __init__(self):
+        self._pending = {}  # device id or sender -> (next expected fragment index, [parts])
+
+    def feed(self, key, datagram):
+        """Returns the list of complete log messages that this datagram finishes (usually 0 or 1)."""
+        complete = []
+        header = FRAGMENT_HEADER.match(datagram)
+        pending = self._pending.pop(key, None)
+
+        if header:
+            index = int(header.group(1))
+            if pending is not None and pending[0] != index:
+                # we missed the end of the line we had, or a middle piece of this one. show what we have.
+                complete.append(b"".join(pending[1]) + LOST_FRAGMENT_NOTE)
+                pending = None
+            if pending is None:
+                pending = (index, [])
+            parts = pending[1]
+            parts.append(datagram[header.end():])
+            if header.group(2):
+                self._pending[key] = (index + 1, parts)
+            else:
+                complete.append(b"".join(parts))
+        else:
+            if pending is not None:
+                complete.append(b"".join(pending[1]) + LOST_FRAGMENT_NOTE)
+            complete.append(datagram)
+
+        return complete
+
+
+def sign_grant(key, device_id, seq, credits):
+    """Builds a credit grant a device with a control key will take (see handle_credit_grant() in wifi_logger.c)."""
+    body = "wlcredit %d %d" % (credits, seq)
+    mac = hmac.new(key.encode(), ("%s %s" % (device_id, body)).encode(), hashlib.sha256).hexdigest()
+    return (body + " " + mac[:CONTROL_MAC_HEX_CHARS]).encode()
+
+
+def sign_command(key, device_id, seq, command):
+    """Builds a control message the device will accept (see control_channel.c)."""
+    body = "%d %s" % (seq, command)
+    mac = hmac.new(key.encode(), ("%s %s" % (device_id, body)).encode(), hashlib.sha256).hexdigest()
+    return (CONTROL_MESSAGE_PREFIX + body + " " + mac[:CONTROL_MAC_HEX_CHARS] + "\n").encode()
+
+
+class DatagramOpener:
+    """
+    Opens datagrams sealed by datagram_crypto.c: [0x1d] [nonce, 12 bytes] [AES-256-GCM ciphertext + 16 byte tag],
+    with the magic byte and nonce as associated data.
+    """
+
+    def __init__(self, key_hex):
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+        key = bytes.fromhex(key_hex)
+        if len(key) != 32:
+            raise ValueError("encryption key must be 64 hex chars")
+        self.aead = AESGCM(key)
+
+    def open(self, datagram):
+        """returns the datagram as the device would have sent it in the clear, None if it isn't sealed with our key"""
+        from cryptography.exceptions import InvalidTag
+
+        header_len = 1 + SEALED_NONCE_SIZE
+        if len(datagram) < header_len or datagram[0] != SEALED_MAGIC:
+            return None
+        try:
+            return self.aead.decrypt(datagram[1:header_len], datagram[header_len:], datagram[:header_len])
+        except InvalidTag:
+            return None
+
+    def seal(self, payload):
+        """seals a reply for the device. the nonce is random: the device's own are salt + counter, and never repeat"""
+        nonce = os.urandom(SEALED_NONCE_SIZE)
+        header = bytes([SEALED_MAGIC]) + nonce
+        return header + self.aead.encrypt(nonce, payload, header)
+
+
+class FrameStream:
+    """A device's TCP connection: the datagrams it would have sent over UDP, each one a frame."""
+
+    def __init__(self, sock, sender):
+        self.sock = sock
+        self.sender = sender
+        self.buffer = bytearray()
+
+    def read(self):
+        """Returns the frames completed by what was waiting on the socket, or None once the device has closed it."""
+        try:
+            data = self.sock.recv(65536)
+        except BlockingIOError:
+            return []
+        except ConnectionError:
+            data = b""
+        if not data:
+            # a frame cut short here was never sent in full: the device sends it again over UDP
+            return None
+
+        self.buffer += data
+        frames = []
+        while len(self.buffer) >= TCP_FRAME_HEADER.size:
+            (length,) = TCP_FRAME_HEADER.unpack_from(self.buffer)
+            end = TCP_FRAME_HEADER.size + length
+            if len(self.buffer) < end:
+                break
+            frames.append(bytes(self.buffer[TCP_FRAME_HEADER.size:end]))
+            del self.buffer[:end]
+        return frames
+
+
+class Collector:
+    def __init__(self, sock, out, jsonl, control_key=None, opener=None, tail=None, trace=None, flow_window=0):
+        self.sock = sock
+        self.out = out
+        self.jsonl = jsonl
+        self.control_key = control_key
+        self.opener = opener
+        self.tail = tail
+        self.trace = trace
+        self.reassembler = FragmentReassembler()
+        self.kv_decoder = wifi_log_records.KvDecoder()
+        self.buffer_renderer = wifi_log_records.BufferRenderer()
+        self.device_addresses = {}  # device id -> where its logs come from, which is where commands go
+        self.flow_window = flow_window
+        self.datagrams_since_grant = {}  # sender -> datagrams received since we last granted it credits
+        self.credit_requests = set()     # senders that ran out, and asked
+        self.last_seq = 0
+        self.last_grant_seq = 0
+
+    def handle_datagram(self, datagram, sender, stream=False):
+        """stream: it came over TCP. commands, acks and credits can't go back that way, they go to the UDP sender"""
+        reply_to = None if stream else sender
+        if self.flow_window and not stream:
+            if sender not in self.datagrams_since_grant:
+                self.credit_requests.add(sender)  # first contact: let it know we do flow control
+            self.datagrams_since_grant[sender] = self.datagrams_since_grant.get(sender, 0) + 1
+
+        if self.opener:
+            datagram = self.opener.open(datagram)
+            if datagram is None:
+                sys.stderr.write("wifi_log_collector: dropped a datagram from %s:%d that isn't sealed with our key\n" % sender)
+                return
+
+        # fragments of a long line are always sent on their own, and must be fed to the reassembler whole
+        if FRAGMENT_HEADER.match(datagram):
+            self._handle_text(datagram, sender, reply_to)
+        else:
+            for part in wifi_log_records.split_datagram(datagram):
+                if part[0] == "text":
+                    self._handle_text(part[1], sender, reply_to)
+                elif reply_to is not None or part[1] not in (wifi_log_records.RECORD_TYPE_PROBE, wifi_log_records.RECORD_TYPE_CREDIT):
+                    self._handle_record(part[1], part[2], reply_to)
+
+        self.out.flush()
+        self.jsonl.flush()
+
+    def _reply(self, data, address):
+        self.sock.sendto(self.opener.seal(data) if self.opener else data, address)
+
+    def _remember(self, device, reply_to):
+        if reply_to is not None:
+            self.device_addresses[device] = reply_to
+
+    def _handle_text(self, text, sender, reply_to):
+        device = DEVICE_ID_PREFIX.match(text)
+        if device:
+            self._remember(device.group(1).decode(errors="replace"), reply_to)
+
+        for message in self.reassembler.feed(device.group(1) if device else sender, text):
+            self.out.write(message)
+            if self.tail:
+                self.tail.publish(message)
+
+    def _handle_record(self, record_type, payload, reply_to):
+        if record_type == wifi_log_records.RECORD_TYPE_PROBE:
+            # a device with fallback collectors checking we're still here (lines are held back until we answer), or
+            # measuring loss and round trip time for the adaptive transport
+            if len(payload) == 4:
+                self._reply(b"wlack %d" % struct.unpack(">I", payload)[0], reply_to)
+        elif record_type == wifi_log_records.RECORD_TYPE_CREDIT:
+            self.credit_requests.add(reply_to)
+        elif record_type == wifi_log_records.RECORD_TYPE_TRACE:
+            if self.trace:
+                try:
+                    self.trace.write_record(payload)
+                except (ValueError, struct.error):
+                    return
+        elif record_type == wifi_log_records.RECORD_TYPE_BUFFER:
+            try:
+                device, level, tag, lines = self.buffer_renderer.render(payload)
+            except (ValueError, struct.error):
+                return
+            self._remember(device, reply_to)
+            for line in lines:
+                self.out.write(line)
+                if self.tail:
+                    self.tail.publish_record(device, tag, level, line)
+        elif record_type == wifi_log_records.RECORD_TYPE_KV:
+            try:
+                record = self.kv_decoder.decode(payload)
+            except (wifi_log_records.CborError, ValueError):
+                return
+            self._remember(record["device"], reply_to)
+            line = json.dumps(record).encode() + b"\n"
+            self.jsonl.write(line)
+            if self.tail:
+                self.tail.publish_record(record["device"], record["tag"], record["level"], line)
+        elif record_type == wifi_log_records.RECORD_TYPE_METRICS:
+            try:
+                record = wifi_log_records.decode_metrics_record(payload)
+            except (wifi_log_records.CborError, ValueError, TypeError):
+                return
+            self._remember(record["device"], reply_to)
+            line = json.dumps(record).encode() + b"\n"
+            self.jsonl.write(line)
+            if self.tail:
+                self.tail.publish_record(record["device"], "metrics", "I", line)
+
+    def grant_credits(self):
+        """call once everything that was waiting on the socket has been handled (and written out)"""
+        # only top up devices that need it: a grant per datagram would double what the collector sends and receives
+        grant = b"wlcredit %d" % self.flow_window
+        devices = {address: device for device, address in self.device_addresses.items()}
+        for sender, count in self.datagrams_since_grant.items():
+            if count >= self.flow_window // 2 or sender in self.credit_requests:
+                if self.control_key:
+                    # signed for one device: wait until one of its lines says which one it is
+                    device = devices.get(sender)
+                    if device is None:
+                        continue
+                    self.last_grant_seq = max(self.last_grant_seq + 1, int(time.time() * 1000))
+                    self._reply(sign_grant(self.control_key, device, self.last_grant_seq, self.flow_window), sender)
+                else:
+                    self._reply(grant, sender)
+                self.datagrams_since_grant[sender] = 0
+        self.credit_requests.clear()
+
+    def send_command(self, device_id, command):
+        address = self.device_addresses.get(device_id)
+        if address is None:
+            sys.stderr.write("wifi_log_collector: haven't heard from %s yet, don't know where it is\n" % device_id)
+            return
+
+        # the device only accepts increasing sequence numbers: use the clock, so it also works across restarts
+        self.last_seq = max(self.last_seq + 1, int(time.time() * 1000))
+        self._reply(sign_command(self.control_key, device_id, self.last_seq, command), address)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="wifi_logger UDP collector")
+    parser.add_argument("port", type=int, help="UDP port to listen on (and TCP port, with --tcp)")
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on (default: all)")
+    parser.add_argument("--tcp", action="store_true",
+                        help="also take frames over TCP on the same port (adaptive transport, wifi_log_loadgen.c --tcp)")
+    parser.add_argument("--jsonl", help="write structured (wifi_log_kv) and metrics records to this file instead of stdout")
+    parser.add_argument("--control-key", help="key for signing commands read from stdin (CONFIG_LOGGING_SERVER_CONTROL_KEY)")
+    parser.add_argument("--encryption-key", help="key for opening sealed datagrams (CONFIG_LOGGING_SERVER_ENCRYPTION_KEY)")
+    parser.add_argument("--trace", help="write wifi_trace_x() events to this file as Chrome trace / Perfetto JSON")
+    parser.add_argument("--trace-names", help="file of \"<id> <name>\" lines naming trace ids")
+    parser.add_argument("--tail-port", type=int, help="TCP port for live-tail viewers (see wifi_log_tail.py)")
+    parser.add_argument("--tail-lines", type=int, default=4096, help="how many lines the live tail keeps for slow viewers")
+    parser.add_argument("--flow-window", type=int, default=32,
+                        help="datagrams each device may send per grant, 0 = no flow control (default: 32)")
+    args = parser.parse_args()
+
+    opener = DatagramOpener(args.encryption_key) if args.encryption_key else None
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.setblocking(False)
+
+    out = sys.stdout.buffer
+    jsonl = open(args.jsonl, "ab") if args.jsonl else out
+    selector = selectors.DefaultSelector()
+    selector.register(sock, selectors.EVENT_READ, "sock")
+    listener = None
+    if args.tcp:
+        listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        listener.bind((args.bind, args.port))
+        listener.listen()
+        listener.setblocking(False)
+        selector.register(listener, selectors.EVENT_READ, "listener")
+
+    tail = wifi_log_tail.TailServer(selector, args.bind, args.tail_port, args.tail_lines) if args.tail_port else None
+    trace = None
+    if args.trace:
+        names = wifi_log_trace.load_names(args.trace_names) if args.trace_names else None
+        trace = wifi_log_trace.ChromeTraceWriter(open(args.trace, "wb"), names)
+    collector = Collector(sock, out, jsonl, args.control_key, opener, tail, trace, args.flow_window)
+    if args.control_key:
+        selector.register(sys.stdin, selectors.EVENT_READ, "stdin")
+
+    while True:
+        for key, mask in selector.select():
+            if key.data == "sock":
+                # take everything that's waiting before passing it on to tail viewers: one send per viewer, not per datagram
+                for _ in range(MAX_DATAGRAMS_PER_WAKEUP):
+                    try:
+                        datagram, sender = sock.recvfrom(65535)
+                    except BlockingIOError:
+                        # caught up: devices can send more
+                        collector.grant_credits()
+                        break
+                    collector.handle_datagram(datagram, sender)
+                if tail:
+                    tail.pump()
+            elif key.data == "listener":
+                try:
+                    conn, sender = listener.accept()
+                except BlockingIOError:
+                    continue
+                conn.setblocking(False)
+                selector.register(conn, selectors.EVENT_READ, FrameStream(conn, sender))
+            elif isinstance(key.data, FrameStream):
+                frames = key.data.read()
+                if frames is None:
+                    selector.unregister(key.data.sock)
+                    key.data.sock.close()
+                    continue
+                for frame in frames:
+                    collector.handle_datagram(frame, key.data.sender, stream=True)
+                if tail:
+                    tail.pump()
+            elif key.data != "stdin":
+                tail.handle_event(key, mask)
+            else:
+                line = sys.stdin.readline()
+                if not line:
+                    selector.unregister(sys.stdin)
+                    continue
+                words = line.split(None, 1)
+                if len(words) == 2:
+                    collector.send_command(words[0], words[1].strip())
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
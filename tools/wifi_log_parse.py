@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""
+Parses the text lines the wifi_logger component sends, a whole batch at a time, into columns: device, level,
+timestamp, tag, and the line itself with and without its color codes.
+
+Lines look like "<device_id>| I (1234) tag: text" (ESP_LOGx) or "<device_id>| I (1234) tag (func:line) text"
+(wifi_log_x), with ANSI color codes around the level and text (see utils.cpp). Nothing here loops over lines or
+bytes in Python: one regex pass over the whole batch picks out the headers, the color codes are removed from the
+whole batch at once (and only if it has an escape character in it at all), and each column is decoded with one
+decode() of the column joined together. The byte scans underneath (bytes.find/split, the "in" checks) are memchr(),
+which glibc vectorizes with SSE2/AVX2.
+
+Python parses on one core at a time; ParserPool spreads big inputs (a captured log file) over worker processes.
+There are no native (SIMD) parse kernels, and the live collector doesn't use the pool: it parses on its own thread,
+tens of MB/s of lines on one core (see --bench), far more than the devices behind one collector send. A kernel would
+need a compiled extension next to tools that are otherwise plain Python, and handing each wakeup's datagrams to
+another process costs more than parsing them where they are.
+
+usage:
+  wifi_log_parse.py <captured log> [--workers N] [--csv <file>]   columns as CSV (stdout by default)
+  wifi_log_parse.py --bench [--workers N] [--mb N]                 MB/s per core, against parsing line by line
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import os
+import re
+import sys
+import time
+
+ANSI_ESCAPE = re.compile(rb"\x1b\[[0-9;]*m")
+
+# one match per line, header or not: (line, device, level, timestamp, tag), empty where the line doesn't have it
+LINE = re.compile(rb"^((?:([^|\n]*)\|[ +])?(?:(?:\x1b\[[0-9;]*m)?([EWIDV]) \((\d+)\) ([^ :\n]+))?[^\n]*\n)", re.MULTILINE)
+
+COLUMN_SEPARATOR = b"\n"  # can't be in any column but the lines themselves
+
+CHUNK_SIZE = 4 << 20  # what ParserPool hands each worker at a time
+
+
+def strip_colors(data):
+    """data without its ANSI color codes. cheap when there aren't any"""
+    return ANSI_ESCAPE.sub(b"", data) if b"\x1b" in data else data
+
+
+def _decode_column(values):
+    return COLUMN_SEPARATOR.join(values).decode(errors="replace").split("\n") if values else []
+
+
+class LineBatch:
+    """
+    Parsed lines, one list per column, all the same length. Columns are "" (timestamps None) for lines that don't
+    have that part, e.g. a line that isn't from ESP_LOGx or wifi_log_x.
+    """
+
+    def __init__(self, data):
+        if data and not data.endswith(b"\n"):
+            data += b"\n"
+        rows = LINE.findall(data)
+        columns = list(zip(*rows)) if rows else [(), (), (), (), ()]
+
+        self._data = data
+        self.lines = list(columns[0])             # bytes, as received, newline included
+        self.devices = _decode_column(columns[1])
+        self.levels = _decode_column(columns[2])  # "E", "W", "I", "D" or "V"
+        self.timestamps = [int(t) if t else None for t in columns[3]]
+        self.tags = _decode_column(columns[4])
+        self._texts = None
+
+    def __len__(self):
+        return len(self.lines)
+
+    @property
+    def texts(self):
+        """the lines without color codes or newlines, as str. worked out the first time it's asked for"""
+        if self._texts is None:
+            self._texts = strip_colors(self._data).decode(errors="replace").split("\n")[:-1]
+        return self._texts
+
+
+def parse_lines(data):
+    """parses a batch of lines (bytes, each ending in a newline) into a LineBatch"""
+    return LineBatch(data)
+
+
+def split_chunks(data, size=CHUNK_SIZE):
+    """splits data into pieces of about size bytes, on line boundaries"""
+    start = 0
+    while start < len(data):
+        end = data.find(b"\n", min(start + size, len(data)) - 1)
+        end = len(data) if end < 0 else end + 1
+        yield data[start:end]
+        start = end
+
+
+class ParserPool:
+    """parses chunks of lines on worker processes. results come back in order"""
+
+    def __init__(self, workers):
+        self.executor = concurrent.futures.ProcessPoolExecutor(workers) if workers > 1 else None
+
+    def parse(self, chunks):
+        if self.executor is None:
+            return map(parse_lines, chunks)
+        return self.executor.map(parse_lines, chunks)
+
+    def close(self):
+        if self.executor:
+            self.executor.shutdown()
+
+
+# the line by line way: what wifi_log_tail.py used to do for every line it got
+NAIVE_HEADER = re.compile(rb"^([^|\n]*)\| ([EWIDV]) \((\d+)\) ([^ :]+)")
+
+
+def parse_naive(data):
+    rows = []
+    for line in data.split(b"\n")[:-1]:
+        text = ANSI_ESCAPE.sub(b"", line)
+        match = NAIVE_HEADER.match(text)
+        if match:
+            device, level, timestamp, tag = match.groups()
+            rows.append((device.decode(errors="replace"), level.decode(), int(timestamp),
+                         tag.decode(errors="replace"), text.decode(errors="replace")))
+        else:
+            rows.append((None, None, None, None, text.decode(errors="replace")))
+    return rows
+
+
+def sample_lines(size):
+    """about size bytes of lines like a few devices send them: ESP_LOGx ones, wifi_log_x ones, and some others"""
+    lines = []
+    total = 0
+    n = 0
+    while total < size:
+        device = "30:ae:a4:%02x:%02x:%02x" % (n % 7, n % 13, n % 5)
+        if n % 3 == 0:
+            line = "%s| \x1b[0;32mI (%d) wifi: connected to office-ap-%d, rssi -%d dBm\x1b[0m\n" % (device, n, n % 9, 40 + n % 50)
+        elif n % 3 == 1:
+            line = "%s| \x1b[33mW (%d) app (sensor_poll:%d) reading %d out of range\x1b[39m\n" % (device, n, n % 300, n)
+        elif n % 10 == 2:
+            line = "%s|+1 rest of a long line\n" % device
+        else:
+            line = "%s| \x1b[31mE (%d) http_client: request %d failed: ESP_ERR_HTTP_CONNECT\x1b[39m\n" % (device, n, n)
+        lines.append(line.encode())
+        total += len(line)
+        n += 1
+    return b"".join(lines)
+
+
+def bench(megabytes, workers):
+    data = sample_lines(megabytes << 20)
+    lines = data.count(b"\n")
+    print("%d MB, %d lines" % (len(data) >> 20, lines))
+
+    def report(name, seconds, cores):
+        rate = len(data) / seconds / 1e6
+        print("%-24s %8.1f MB/s %8.1f MB/s per core %10.0f lines/s" % (name, rate, rate / cores, lines / seconds))
+
+    start = time.perf_counter()
+    parse_naive(data)
+    report("line by line", time.perf_counter() - start, 1)
+
+    start = time.perf_counter()
+    for _ in map(parse_lines, split_chunks(data)):
+        pass
+    report("batch", time.perf_counter() - start, 1)
+
+    if workers > 1:
+        pool = ParserPool(workers)
+        list(pool.parse([b"warm up\n"] * workers))
+        start = time.perf_counter()
+        for _ in pool.parse(split_chunks(data)):
+            pass
+        report("batch, %d workers" % workers, time.perf_counter() - start, workers)
+        pool.close()
+
+
+def write_csv(path, workers, out):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    writer = csv.writer(out)
+    writer.writerow(["device", "level", "timestamp", "tag", "text"])
+    pool = ParserPool(workers)
+    for batch in pool.parse(split_chunks(data)):
+        writer.writerows(zip(batch.devices, batch.levels, batch.timestamps, batch.tags, batch.texts))
+    pool.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="parses wifi_logger lines into columns")
+    parser.add_argument("log", nargs="?", help="captured log, e.g. wifi_log_collector.py's output")
+    parser.add_argument("--csv", help="write the columns here (default: stdout)")
+    parser.add_argument("--workers", type=int, default=os.cpu_count() or 1, help="parser processes (default: one per core)")
+    parser.add_argument("--bench", action="store_true", help="compare against parsing line by line, on generated lines")
+    parser.add_argument("--mb", type=int, default=64, help="how much to generate for --bench (default: 64)")
+    args = parser.parse_args()
+
+    if args.bench:
+        bench(args.mb, args.workers)
+    elif args.log:
+        if args.csv:
+            with open(args.csv, "w", newline="") as out:
+                write_csv(args.log, args.workers, out)
+        else:
+            write_csv(args.log, args.workers, sys.stdout)
+    else:
+        parser.error("give a log file, or --bench")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,228 @@
+"""
+Decoders for the binary records the wifi_logger component sends alongside its text lines (see log_queue.h).
+
+  [0x1e] [type] [payload length, 2 bytes big-endian] [payload]
+"""
+
+import struct
+
+RECORD_MAGIC = 0x1E
+RECORD_HEADER_SIZE = 4
+RECORD_AFTER_LINE = b"\n" + bytes([RECORD_MAGIC])
+
+RECORD_TYPE_KV = 1
+RECORD_TYPE_PROBE = 2  # collector health probe: 4-byte big-endian sequence number, answered with "wlack <seq>"
+RECORD_TYPE_TRACE = 3  # wifi_trace_x() events, see wifi_log_trace.py
+RECORD_TYPE_BUFFER = 4  # one chunk of a wifi_log_buffer() blob, see BufferRenderer
+RECORD_TYPE_CREDIT = 5  # flow control: the device is out of credits, answered with "wlcredit <n>"
+RECORD_TYPE_METRICS = 6  # wifi_metric_x() values for one interval, see decode_metrics_record
+
+LEVEL_CHARS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+
+
+class CborError(ValueError):
+    pass
+
+
+class _Break:
+    pass
+
+
+_BREAK = _Break()
+
+
+def cbor_decode(data, pos=0):
+    """Decodes one CBOR item (the subset the device writes). Returns (item, next position)."""
+    if pos >= len(data):
+        raise CborError("truncated")
+
+    initial = data[pos]
+    major = initial >> 5
+    additional = initial & 0x1F
+    pos += 1
+
+    if initial == 0xFF:
+        return _BREAK, pos
+    if major == 7:
+        if initial == 0xF4:
+            return False, pos
+        if initial == 0xF5:
+            return True, pos
+        if initial == 0xF6:
+            return None, pos
+        if initial == 0xFA:
+            return struct.unpack_from(">f", data, pos)[0], pos + 4
+        if initial == 0xFB:
+            return struct.unpack_from(">d", data, pos)[0], pos + 8
+        raise CborError("unsupported simple value 0x%02x" % initial)
+
+    if additional < 24:
+        value = additional
+    elif additional in (24, 25, 26, 27):
+        n = 1 << (additional - 24)
+        if pos + n > len(data):
+            raise CborError("truncated")
+        value = int.from_bytes(data[pos:pos + n], "big")
+        pos += n
+    elif additional == 31 and major in (4, 5):
+        value = None  # indefinite length
+    else:
+        raise CborError("unsupported additional info %d" % additional)
+
+    if major == 0:
+        return value, pos
+    if major == 1:
+        return -1 - value, pos
+    if major in (2, 3):
+        if pos + value > len(data):
+            raise CborError("truncated")
+        raw = bytes(data[pos:pos + value])
+        return (raw if major == 2 else raw.decode("utf-8", "replace")), pos + value
+    if major == 4:
+        items = []
+        while value is None or len(items) < value:
+            item, pos = cbor_decode(data, pos)
+            if item is _BREAK:
+                break
+            items.append(item)
+        return items, pos
+    if major == 5:
+        pairs = []
+        while value is None or len(pairs) < value:
+            key, pos = cbor_decode(data, pos)
+            if key is _BREAK:
+                break
+            item, pos = cbor_decode(data, pos)
+            pairs.append((key, item))
+        return pairs, pos
+
+    raise CborError("unsupported major type %d" % major)
+
+
+def split_datagram(datagram):
+    """
+    Splits a (possibly batched) datagram into its parts. Yields ("text", lines) for runs of text lines, newlines
+    included, and ("record", type, payload) for binary records.
+    """
+    pos = 0
+    end = len(datagram)
+    while pos < end:
+        if datagram[pos] == RECORD_MAGIC and pos + RECORD_HEADER_SIZE <= end:
+            record_type = datagram[pos + 1]
+            length = (datagram[pos + 2] << 8) | datagram[pos + 3]
+            start = pos + RECORD_HEADER_SIZE
+            if start + length > end:
+                return  # truncated, nothing sensible left in here
+            yield "record", record_type, datagram[start:start + length]
+            pos = start + length
+        else:
+            # a record can only start where a line does: everything up to the next one is text
+            record = datagram.find(RECORD_AFTER_LINE, pos)
+            text_end = end if record < 0 else record + 1
+            yield "text", datagram[pos:text_end]
+            pos = text_end
+
+
+BUFFER_HEADER = struct.Struct(">BIHII")
+HEXDUMP_BYTES_PER_LINE = 16
+
+
+def decode_buffer_record(payload):
+    """returns (device, level, timestamp, tag, blob_id, offset, total_len, data) for one buffer record chunk"""
+    level, timestamp, blob_id, offset, total_len = BUFFER_HEADER.unpack_from(payload)
+    pos = BUFFER_HEADER.size
+    device_len = payload[pos]
+    device = payload[pos + 1:pos + 1 + device_len].decode(errors="replace")
+    pos += 1 + device_len
+    tag_len = payload[pos]
+    tag = payload[pos + 1:pos + 1 + tag_len].decode(errors="replace")
+    pos += 1 + tag_len
+    if pos > len(payload):
+        raise ValueError("buffer record too short")
+    return device, LEVEL_CHARS.get(level, str(level)), timestamp, tag, blob_id, offset, total_len, payload[pos:]
+
+
+class BufferRenderer:
+    """
+    Turns wifi_log_buffer() chunks into hexdump lines, laid out like ordinary log lines (so they can be filtered the
+    same way), with offsets into the whole blob. Chunks are rendered as they arrive; a gap in a blob is pointed out.
+    """
+
+    def __init__(self):
+        self._next_offset = {}  # (device, blob id) -> offset the next chunk should start at
+
+    def render(self, payload):
+        """returns (device, level, tag, [line, ...]) for one chunk. lines are bytes ending in a newline"""
+        device, level, timestamp, tag, blob_id, offset, total_len, data = decode_buffer_record(payload)
+        prefix = "%s| %s (%d) %s: " % (device, level, timestamp, tag)
+        lines = []
+
+        key = (device, blob_id)
+        expected = self._next_offset.pop(key, 0)
+        if offset == 0:
+            lines.append("%s%d bytes\n" % (prefix, total_len))
+        if offset != expected:
+            lines.append("%s[wifi_log_collector: bytes 0x%04x-0x%04x lost]\n" % (prefix, expected, offset - 1))
+
+        for start in range(0, len(data), HEXDUMP_BYTES_PER_LINE):
+            row = data[start:start + HEXDUMP_BYTES_PER_LINE]
+            hex_part = " ".join("%02x" % b for b in row)
+            text_part = "".join(chr(b) if 32 <= b < 127 else "." for b in row)
+            lines.append("%s0x%04x   %-47s  |%s|\n" % (prefix, offset + start, hex_part, text_part))
+
+        end = offset + len(data)
+        if end < total_len:
+            self._next_offset[key] = end
+
+        return device, level, tag, [line.encode() for line in lines]
+
+
+class KvDecoder:
+    """Turns wifi_log_kv() records into dicts, keeping track of each device's interned key names."""
+
+    def __init__(self):
+        self._keys = {}  # device id -> {key id: name}
+
+    def decode(self, payload):
+        (device, level, timestamp, tag, pairs), _ = cbor_decode(payload)
+        keys = self._keys.setdefault(device, {})
+
+        fields = {}
+        for key, value in pairs:
+            if isinstance(key, list):
+                key_id, name = key
+                keys[key_id] = name
+                key = name
+            elif isinstance(key, int):
+                key = keys.get(key, "#%d" % key)
+            fields[key] = value
+
+        return {
+            "device": device,
+            "ts": timestamp,
+            "level": LEVEL_CHARS.get(level, str(level)),
+            "tag": tag,
+            "fields": fields,
+        }
+
+
+def decode_metrics_record(payload):
+    """
+    Turns a metrics record into a dict. Counters are how much they went up over the interval, gauges their last value,
+    histograms {"count", "sum", "buckets": [[upper bound, count], ...]}, the last bound being None (no upper bound).
+    """
+    (device, timestamp, interval_ms, pairs), _ = cbor_decode(payload)
+
+    metrics = {}
+    for name, value in pairs:
+        if isinstance(value, list):
+            count, total, bounds, buckets = value
+            value = {"count": count, "sum": total, "buckets": [list(b) for b in zip(bounds + [None], buckets)]}
+        metrics[name] = value
+
+    return {
+        "device": device,
+        "ts": timestamp,
+        "interval_ms": interval_ms,
+        "metrics": metrics,
+    }
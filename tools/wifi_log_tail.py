@@ -0,0 +1,275 @@
+"""
+Live tail for wifi_log_collector.py: any number of viewers connect over TCP and get the lines the collector receives,
+as they come in, filtered to what they asked for.
+
+A viewer sends one line of space separated filters first (an empty line means everything), then just reads:
+
+  device=<id>[,<id>...]   only these devices
+  tag=<tag>[,<tag>...]    only these tags
+  level=<E|W|I|D|V>       only this level and more severe ones
+
+e.g. `(echo "tag=wifi level=W"; cat) | nc <collector> <tail port>`
+
+Lines are parsed a batch at a time (see wifi_log_parse.py), and each is checked once against each distinct filter.
+Viewers with the same filter share a ring of the lines that match it; each viewer only has a cursor into that ring, and
+is sent the ring's own bytes objects with sendmsg(), so nothing is copied per viewer. A viewer that falls so far behind that the ring laps it skips ahead to the
+oldest line still in the ring, and is told how many lines it missed.
+"""
+
+import collections
+import selectors
+import socket
+
+import wifi_log_parse
+
+LEVEL_ORDER = "EWIDV"
+
+MAX_BUFFERS_PER_SEND = 256
+MAX_REQUEST_SIZE = 1024
+
+TailLine = collections.namedtuple("TailLine", "device tag level data")
+
+
+class TailFilter:
+    def __init__(self, request):
+        self.devices = None
+        self.tags = None
+        self.max_level = None
+
+        for word in request.split():
+            name, _, value = word.partition("=")
+            if name == "device" and value:
+                self.devices = set(value.split(","))
+            elif name == "tag" and value:
+                self.tags = set(value.split(","))
+            elif name == "level" and value in LEVEL_ORDER and len(value) == 1:
+                self.max_level = LEVEL_ORDER.index(value)
+            else:
+                raise ValueError("unknown filter %r" % word)
+
+    def matches(self, line):
+        if self.devices is not None and line.device not in self.devices:
+            return False
+        if self.tags is not None and line.tag not in self.tags:
+            return False
+        if self.max_level is not None and (not line.level or LEVEL_ORDER.index(line.level) > self.max_level):
+            return False
+        return True
+
+
+class TailStream:
+    """
+    The last `capacity` lines that match one filter, numbered from 0 as they come in. Viewers that ask for the same
+    filter share a stream, so each line is matched once per distinct filter, not once per viewer.
+    """
+
+    def __init__(self, tail_filter, capacity):
+        self.filter = tail_filter
+        self.capacity = capacity
+        self.lines = [None] * capacity
+        self.next_seq = 0
+        self.viewers = 0
+
+    def publish(self, line):
+        if self.filter.matches(line):
+            self.lines[self.next_seq % self.capacity] = line.data
+            self.next_seq += 1
+
+    @property
+    def oldest_seq(self):
+        return max(0, self.next_seq - self.capacity)
+
+    def get_range(self, start, end):
+        """lines start..end-1 (all still in the ring), without copying them"""
+        first = start % self.capacity
+        last = first + (end - start)
+        if last <= self.capacity:
+            return self.lines[first:last]
+        return self.lines[first:] + self.lines[:last - self.capacity]
+
+
+class TailViewer:
+    def __init__(self, sock):
+        self.sock = sock
+        self.stream = None          # None until the viewer has sent its filter line
+        self.request = b""
+        self.cursor = 0             # next stream line to send
+        self.pending = []           # ring lines (or notes) taken from the stream but not sent yet
+        self.waiting_for_write = False  # registered for EVENT_WRITE, because the socket buffer filled up
+
+    def wants_to_write(self):
+        return self.stream is not None and (self.pending or self.cursor < self.stream.next_seq)
+
+    def read(self):
+        """returns the filter line once it's all there, None while waiting for it. raises EOFError if the viewer is gone"""
+        try:
+            data = self.sock.recv(MAX_REQUEST_SIZE)
+        except BlockingIOError:
+            return None
+        except OSError:
+            raise EOFError()
+
+        if not data:
+            raise EOFError()  # viewers keep their side open for as long as they want lines
+
+        if self.stream is not None:
+            return None  # nothing else is expected after the filter line. ignore it
+
+        self.request += data
+        if b"\n" not in self.request:
+            if len(self.request) >= MAX_REQUEST_SIZE:
+                raise EOFError()
+            return None
+
+        return self.request.split(b"\n", 1)[0].decode(errors="replace")
+
+    def send_note(self, note):
+        try:
+            self.sock.send(note)
+        except OSError:
+            pass
+
+    def _fill(self):
+        stream = self.stream
+        if self.cursor < stream.oldest_seq:
+            skipped = stream.oldest_seq - self.cursor
+            self.cursor = stream.oldest_seq
+            self.pending.append(b"[wifi_log_tail: too slow, skipped %d lines]\n" % skipped)
+
+        end = min(stream.next_seq, self.cursor + MAX_BUFFERS_PER_SEND)
+        if self.cursor < end:
+            self.pending.extend(stream.get_range(self.cursor, end))
+            self.cursor = end
+
+    def write(self):
+        """sends as much as the socket takes without blocking. returns False if the viewer is gone"""
+        while self.wants_to_write():
+            if not self.pending:
+                self._fill()
+
+            try:
+                sent = self.sock.sendmsg(self.pending)
+            except (BlockingIOError, InterruptedError):
+                return True
+            except OSError:
+                return False
+
+            if sent == sum(map(len, self.pending)):
+                self.pending.clear()
+                continue
+
+            # drop what went out, and trim the one that only partly did
+            done = 0
+            while done < len(self.pending) and sent >= len(self.pending[done]):
+                sent -= len(self.pending[done])
+                done += 1
+            del self.pending[:done]
+            if sent:
+                self.pending[0] = memoryview(self.pending[0])[sent:]
+
+            if self.pending:
+                return True  # socket buffer is full
+        return True
+
+
+class TailServer:
+    def __init__(self, selector, bind, port, capacity):
+        self.selector = selector
+        self.capacity = capacity
+        self.streams = {}  # filter line -> TailStream
+        self.viewers = set()
+
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind((bind, port))
+        self.listener.listen(128)
+        self.listener.setblocking(False)
+        selector.register(self.listener, selectors.EVENT_READ, self)
+
+    def publish(self, data):
+        """adds received lines (bytes, each ending in a newline). call pump() after a batch of these"""
+        if not self.streams:
+            return  # nobody's watching: don't even parse them
+        batch = wifi_log_parse.parse_lines(data)
+        for line in map(TailLine, batch.devices, batch.tags, batch.levels, batch.lines):
+            self.publish_line(line)
+
+    def publish_record(self, device, tag, level, data):
+        """adds a line that's already been picked apart (like a wifi_log_kv() record as JSON)"""
+        self.publish_line(TailLine(device, tag, level, data))
+
+    def publish_line(self, line):
+        for stream in self.streams.values():
+            stream.publish(line)
+
+    def pump(self):
+        """sends new lines to every viewer that can take them"""
+        for viewer in list(self.viewers):
+            if viewer.wants_to_write() and not viewer.waiting_for_write:
+                self._write(viewer)
+
+    def handle_event(self, key, mask):
+        if key.fileobj is self.listener:
+            self._accept()
+            return
+
+        viewer = key.data[1]
+        if mask & selectors.EVENT_READ:
+            try:
+                request = viewer.read()
+            except EOFError:
+                self._drop(viewer)
+                return
+            if request is not None and not self._subscribe(viewer, request):
+                return
+        self._write(viewer)
+
+    def _accept(self):
+        try:
+            sock, _ = self.listener.accept()
+        except BlockingIOError:
+            return
+        sock.setblocking(False)
+        viewer = TailViewer(sock)
+        self.viewers.add(viewer)
+        self.selector.register(sock, selectors.EVENT_READ, (self, viewer))
+
+    def _subscribe(self, viewer, request):
+        key = " ".join(sorted(request.split()))
+        stream = self.streams.get(key)
+        if stream is None:
+            try:
+                stream = TailStream(TailFilter(request), self.capacity)
+            except ValueError as e:
+                viewer.send_note(b"wifi_log_tail: %s\n" % str(e).encode())
+                self._drop(viewer)
+                return False
+            self.streams[key] = stream
+
+        # viewers start with what comes in after they connect
+        stream.viewers += 1
+        viewer.stream = stream
+        viewer.cursor = stream.next_seq
+        return True
+
+    def _write(self, viewer):
+        if not viewer.write():
+            self._drop(viewer)
+            return
+
+        # only ask to hear about the socket being writable while it's full. that's rare, so this is rarely a syscall
+        blocked = bool(viewer.pending)
+        if blocked != viewer.waiting_for_write:
+            viewer.waiting_for_write = blocked
+            events = selectors.EVENT_READ | (selectors.EVENT_WRITE if blocked else 0)
+            self.selector.modify(viewer.sock, events, (self, viewer))
+
+    def _drop(self, viewer):
+        if viewer.stream is not None:
+            viewer.stream.viewers -= 1
+            if viewer.stream.viewers == 0:
+                self.streams = {k: v for k, v in self.streams.items() if v is not viewer.stream}
+            viewer.stream = None
+        self.viewers.discard(viewer)
+        self.selector.unregister(viewer.sock)
+        viewer.sock.close()
@@ -0,0 +1,109 @@
+"""
+Turns the wifi_trace_x() records the wifi_logger component sends (see trace_buffer.c) into Chrome trace / Perfetto
+JSON: open the file in https://ui.perfetto.dev or chrome://tracing.
+
+The file is written as the events come in, in the JSON Array Format, which both viewers read without the closing
+bracket, so it can be opened while the collector is still running.
+"""
+
+import json
+import struct
+
+TRACE_RECORD_VERSION = 1
+TRACE_HEADER = struct.Struct("<BBHIIQ")
+TRACE_EVENT = struct.Struct("<IHBxiI")
+
+EVENT_BEGIN = 1
+EVENT_END = 2
+EVENT_COUNTER = 3
+
+PHASES = {EVENT_BEGIN: "B", EVENT_END: "E", EVENT_COUNTER: "C"}
+
+
+def decode_trace_record(payload):
+    """
+    returns (device_id, core, dropped, [(timestamp_us, type, id, value, task), ...]) for one trace record.
+    raises ValueError if it isn't one.
+    """
+    if len(payload) < TRACE_HEADER.size + 1:
+        raise ValueError("trace record too short")
+
+    version, core, cpu_mhz, dropped, sync_cycles, sync_us = TRACE_HEADER.unpack_from(payload)
+    if version != TRACE_RECORD_VERSION or cpu_mhz == 0:
+        raise ValueError("unknown trace record version %d" % version)
+
+    pos = TRACE_HEADER.size
+    device_len = payload[pos]
+    pos += 1
+    device = payload[pos:pos + device_len].decode(errors="replace")
+    pos += device_len
+
+    events = []
+    end = len(payload) - (len(payload) - pos) % TRACE_EVENT.size
+    for cycles, event_id, event_type, value, task in TRACE_EVENT.iter_unpack(payload[pos:end]):
+        # every event happened before the sync point, less than one 32 bit cycle counter wrap before it
+        ago = (sync_cycles - cycles) & 0xFFFFFFFF
+        events.append((sync_us - ago / cpu_mhz, event_type, event_id, value, task))
+
+    return device, core, dropped, events
+
+
+def load_names(path):
+    """reads "<id> <name>" lines, one per trace id"""
+    names = {}
+    with open(path) as f:
+        for line in f:
+            words = line.split(None, 1)
+            if len(words) == 2 and not words[0].startswith("#"):
+                names[int(words[0], 0)] = words[1].strip()
+    return names
+
+
+class ChromeTraceWriter:
+    def __init__(self, out, names=None):
+        self.out = out
+        self.names = names or {}
+        self.pids = {}      # device id -> pid
+        self.threads = set()
+        self.out.write(b"[\n")
+
+    def _write(self, event):
+        self.out.write(json.dumps(event, separators=(",", ":")).encode() + b",\n")
+
+    def _pid(self, device):
+        pid = self.pids.get(device)
+        if pid is None:
+            pid = self.pids[device] = len(self.pids) + 1
+            self._write({"ph": "M", "name": "process_name", "pid": pid, "args": {"name": device}})
+        return pid
+
+    def _tid(self, pid, task):
+        # spans are per task: a task can be preempted in the middle of one, or move to the other core
+        if (pid, task) not in self.threads:
+            self.threads.add((pid, task))
+            self._write({"ph": "M", "name": "thread_name", "pid": pid, "tid": task,
+                         "args": {"name": "task 0x%08x" % task}})
+        return task
+
+    def write_record(self, payload):
+        device, core, dropped, events = decode_trace_record(payload)
+        pid = self._pid(device)
+
+        if dropped:
+            self._write({"ph": "i", "s": "p", "name": "%d trace events dropped" % dropped, "pid": pid, "tid": 0,
+                         "ts": events[0][0] if events else 0})
+
+        for timestamp, event_type, event_id, value, task in events:
+            phase = PHASES.get(event_type)
+            if phase is None:
+                continue
+            name = self.names.get(event_id, "trace %d" % event_id)
+            event = {"ph": phase, "name": name, "pid": pid, "ts": round(timestamp, 3)}
+            if phase == "C":
+                event["args"] = {"value": value}
+            else:
+                event["tid"] = self._tid(pid, task)
+                event["args"] = {"core": core}
+            self._write(event)
+
+        self.out.flush()
@@ -0,0 +1,200 @@
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#if !CONFIG_FREERTOS_UNICORE
+#include <esp_ipc.h>
+#endif
+
+#include "log_queue.h"
+#include "trace_buffer.h"
+#include "utils.h"
+#include "wifi_logger.h"
+
+/*
+ * wifi_trace_x() events: fixed size, timestamped with the cycle counter of the core they happened on, and put in that
+ * core's ring with interrupts masked for a few dozen cycles. No formatting, no allocation, no locks, and no queue:
+ * the logger task drains the rings into LOG_RECORD_TYPE_TRACE records every time around its loop.
+ *
+ * Each ring has one writer (its core, with interrupts masked, so nothing else on that core can get in) and one reader
+ * (the logger task), so head and tail are all the synchronisation it needs.
+ *
+ * Record payload, little-endian:
+ *   [version = 1] [core] [cpu MHz, 2 bytes] [events dropped since the last record, 4] [sync cycles, 4] [sync us, 8]
+ *   [device id length] [device id] [event, 16 bytes]...
+ *
+ * The sync pair is that core's cycle counter and esp_timer_get_time(), read together on that core after the events
+ * were taken out of the ring. Every event in the record happened before it (and less than one cycle counter wrap
+ * before it, i.e. seconds), which is all the receiver needs to turn cycles into microseconds.
+ */
+
+#define TRACE_RECORD_VERSION 1
+#define TRACE_RECORD_FIXED_HEADER_SIZE 20
+
+struct trace_event {
+    uint32_t cycles;
+    uint16_t id;
+    uint8_t type;       // TRACE_EVENT_xxx
+    uint8_t reserved;
+    int32_t value;      // TRACE_EVENT_COUNTER only
+    uint32_t task;      // task that was running, so spans from different tasks on one core can be told apart
+};
+
+_Static_assert(sizeof(struct trace_event) == 16, "trace events go on the wire as they are");
+
+struct trace_ring {
+    struct trace_event events[CONFIG_LOGGING_SERVER_TRACE_BUFFER_EVENTS];
+    volatile uint32_t head;     // only written by the ring's own core
+    volatile uint32_t tail;     // only written by the logger task
+    volatile uint32_t dropped;  // only written by the ring's own core
+    uint32_t dropped_reported;  // only touched by the logger task
+};
+
+static struct trace_ring s_rings[portNUM_PROCESSORS];
+
+static IRAM_ATTR void trace_record(uint8_t type, uint16_t id, int32_t value)
+{
+    // with interrupts masked, this task can't be preempted or moved to the other core, so the ring is all ours
+    const UBaseType_t irq_state = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    struct trace_ring* ring = &s_rings[esp_cpu_get_core_id()];
+    const uint32_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= CONFIG_LOGGING_SERVER_TRACE_BUFFER_EVENTS) {
+        ring->dropped++;
+    } else {
+        struct trace_event* event = &ring->events[head % CONFIG_LOGGING_SERVER_TRACE_BUFFER_EVENTS];
+        event->cycles = esp_cpu_get_cycle_count();
+        event->id = id;
+        event->type = type;
+        event->value = value;
+        event->task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq_state);
+}
+
+IRAM_ATTR void wifi_trace_begin(uint16_t id)
+{
+    trace_record(TRACE_EVENT_BEGIN, id, 0);
+}
+
+IRAM_ATTR void wifi_trace_end(uint16_t id)
+{
+    trace_record(TRACE_EVENT_END, id, 0);
+}
+
+IRAM_ATTR void wifi_trace_counter(uint16_t id, int32_t value)
+{
+    trace_record(TRACE_EVENT_COUNTER, id, value);
+}
+
+struct trace_sync {
+    uint32_t cycles;
+    int64_t us;
+};
+
+static void sample_sync(void* arg)
+{
+    struct trace_sync* sync = (struct trace_sync*)arg;
+    sync->cycles = esp_cpu_get_cycle_count();
+    sync->us = esp_timer_get_time();
+}
+
+static void put_u32_le(uint8_t* buf, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * @brief takes up to one record's worth of events out of a core's ring, and queues them as a trace record
+ *
+ * @return bool true if a full record was queued, so there may be more waiting
+ */
+static bool flush_core(int core)
+{
+    struct trace_ring* ring = &s_rings[core];
+    const char* device_id = udp_logging_get_device_id();
+    const size_t device_id_len = strnlen(device_id, DEVICE_ID_SIZE);
+    const size_t header_len = LOG_RECORD_HEADER_SIZE + TRACE_RECORD_FIXED_HEADER_SIZE + 1 + device_id_len;
+    const uint32_t max_events = (TRACE_RECORD_MAX_SIZE - header_len) / sizeof(struct trace_event);
+
+    const uint32_t tail = ring->tail;
+    const uint32_t available = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    const uint32_t dropped = ring->dropped - ring->dropped_reported;
+    const uint32_t count = MIN(available, max_events);
+    if (count == 0 && dropped == 0)
+        return false;
+
+    const size_t record_len = header_len + count * sizeof(struct trace_event);
+    uint8_t* record = malloc(record_len);
+    if (!record)
+        return false; // try again next time. the ring may drop events meanwhile
+
+    log_record_write_header(record, LOG_RECORD_TYPE_TRACE, record_len - LOG_RECORD_HEADER_SIZE);
+    uint8_t* events = &record[header_len];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // the ring may wrap in the middle of what we take
+        memcpy(&events[i * sizeof(struct trace_event)],
+               &ring->events[(tail + i) % CONFIG_LOGGING_SERVER_TRACE_BUFFER_EVENTS], sizeof(struct trace_event));
+    }
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    ring->dropped_reported += dropped;
+
+    // after the events were taken: every one of them happened before this
+    struct trace_sync sync;
+#if CONFIG_FREERTOS_UNICORE
+    sample_sync(&sync);
+#else
+    esp_ipc_call_blocking(core, sample_sync, &sync);
+#endif
+
+    uint8_t* payload = &record[LOG_RECORD_HEADER_SIZE];
+    const uint32_t cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+    payload[0] = TRACE_RECORD_VERSION;
+    payload[1] = (uint8_t)core;
+    payload[2] = (uint8_t)cpu_mhz;
+    payload[3] = (uint8_t)(cpu_mhz >> 8);
+    put_u32_le(&payload[4], dropped);
+    put_u32_le(&payload[8], sync.cycles);
+    put_u32_le(&payload[12], (uint32_t)sync.us);
+    put_u32_le(&payload[16], (uint32_t)((uint64_t)sync.us >> 32));
+    payload[20] = (uint8_t)device_id_len;
+    memcpy(&payload[21], device_id, device_id_len);
+
+    const struct log_queue_item item = {
+        .message = (char*)record,
+        .flags = LOG_ITEM_FLAG_BINARY,
+        .len = (uint16_t)record_len,
+    };
+    if (send_to_queue(&item, record_len) != ESP_OK) {
+        free(record);
+        return false;
+    }
+
+    return count == max_events;
+}
+
+/**
+ * @brief (logger task) moves whatever trace events are waiting into the queue, as trace records
+ */
+void trace_buffer_flush(void)
+{
+    if (!is_network_logging_allowed_here())
+        return;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        // a few records per core at most, so a busy core can't keep the logger task from sending
+        for (int i = 0; i < 4 && flush_core(core); i++)
+            ;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef WIFI_LOGGER_TRACE_BUFFER_H
+#define WIFI_LOGGER_TRACE_BUFFER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// event types, as sent
+#define TRACE_EVENT_BEGIN   1
+#define TRACE_EVENT_END     2
+#define TRACE_EVENT_COUNTER 3
+
+// largest LOG_RECORD_TYPE_TRACE record, header included
+#define TRACE_RECORD_MAX_SIZE 1024
+
+void trace_buffer_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_LOGGER_TRACE_BUFFER_H
@@ -2,12 +2,15 @@
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
 #include "udp_handler.h"
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+#include "net_impair.h"
+#endif
 
 static const char *TAG = "udp_logger";
 
 struct logger_udp_network_data
 {
-    char rx_buffer[128];
+    char rx_buffer[256];
     char addr_str[128];
     int addr_family;
     int ip_protocol;
@@ -19,6 +22,10 @@ struct logger_udp_network_data* create_udp_network_manager_handle()
 {
     const size_t size = sizeof(struct logger_udp_network_data);
     struct logger_udp_network_data* handle = malloc(size);
+    if (!handle) {
+        printf("%s: out of memory for the handle\n", TAG);
+        return NULL;
+    }
     memset(handle, 0, size);
     handle->sock = -1;
     return handle;
@@ -76,17 +83,31 @@ bool is_logging_udp_connected(struct logger_udp_network_data* nm) {
     return nm && nm->sock > 0;
 }
 
+/**
+ * @brief sendto() the server, see net_impair_deliver_fn
+ **/
+static int deliver_datagram(void* ctx, const void* payload, size_t len)
+{
+    struct logger_udp_network_data* nm = ctx;
+    return sendto(nm->sock, payload, len, 0, (struct sockaddr *)&(nm->dest_addr), sizeof(nm->dest_addr));
+}
+
 /**
  * @brief Sends data to the server through a UDP socket
  * 
  * @param nm A pointer to logger_udp_network_data struct
- * @param payload char array which contains data to be sent
+ * @param payload data to be sent, doesn't need to be null-terminated
+ * @param len number of bytes of payload to send
  * @param len_sent int (out parm) - returns -1 if sending failed, number of bytes sent if successfully sent the data
  **/
-void send_udp_data(struct logger_udp_network_data* nm, char* payload, int* len_sent)
+void send_udp_data(struct logger_udp_network_data* nm, const char* payload, size_t len, int* len_sent)
 {
-	int len = sendto(nm->sock, payload, strlen(payload), 0, (struct sockaddr *)&(nm->dest_addr), sizeof(nm->dest_addr));
-	if (len < 0)
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+	int sent = net_impair_submit(nm, payload, len, false, deliver_datagram);
+#else
+	int sent = deliver_datagram(nm, payload, len);
+#endif
+	if (sent < 0)
 	{
         // 118 = no network is available. we'll silently ignore it to prevent spamming
         if (errno != 118) {
@@ -99,33 +120,65 @@ void send_udp_data(struct logger_udp_network_data* nm, char* payload, int* len_s
 	}
 
     if (len_sent)
-        *len_sent = len;
+        *len_sent = sent;
 }
 
 /**
- * @brief Receives data from UDP server
+ * @brief Receives data from UDP server, without blocking
  * 
  * @param nm logger_udp_network_data struct which contains connection info
- * @return char array which contains data received
+ * @param len where to put its length (it may not be text), or NULL
+ * @return char array which contains data received (valid until the next call), NULL if nothing is waiting
  **/
-char* receive_udp_data(struct logger_udp_network_data* nm)
+char* receive_udp_data(struct logger_udp_network_data* nm, size_t* len)
 {
+    // use printf() for local logging to avoid anything weird with feedback loops, since we're hooked into ESP_LOG()
+
 	struct sockaddr_in source_addr;
 	socklen_t socklen = sizeof(source_addr);
-	int len = recvfrom(nm->sock, nm->rx_buffer, sizeof(nm->rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+	int received = recvfrom(nm->sock, nm->rx_buffer, sizeof(nm->rx_buffer) - 1, MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen);
 
-	if (len < 0)
+	if (received < 0)
 	{
-		ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		    printf("%s: recvfrom failed: errno %d\n", TAG, errno);
+        }
 		return NULL;
 	}
 
-    nm->rx_buffer[len] = 0; // Null-terminate whatever we received and treat like a string
-    ESP_LOGD(TAG, "Received %d bytes from %s:", len, nm->addr_str);
-    ESP_LOGD(TAG, "%s", nm->rx_buffer);
+    // only listen to the server we're sending to
+    if (source_addr.sin_addr.s_addr != nm->dest_addr.sin_addr.s_addr) {
+        return NULL;
+    }
+
+    nm->rx_buffer[received] = 0; // Null-terminate whatever we received and treat like a string
+    if (len)
+        *len = (size_t)received;
     return nm->rx_buffer;
 }
 
+/**
+ * @brief Shutdown active connection, keeping the handle around for init_udp_network_manager() to use again
+ * 
+ * @param nm logger_udp_network_data struct which contains connection info
+ * @return void
+ **/
+void disconnect_udp_network_manager(struct logger_udp_network_data* nm)
+{
+    assert(nm);
+    if (!nm || nm->sock < 0) {
+        return;
+    }
+
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    net_impair_flush(nm);
+#endif
+    printf("%s: Shutting down socket\n", TAG);
+	shutdown(nm->sock, 0);
+	close(nm->sock);
+	nm->sock = -1;
+}
+
 /**
  * @brief Shutdown active connection, deallocate memory
  * 
@@ -139,8 +192,6 @@ void close_udp_network_manager(struct logger_udp_network_data* nm)
         return;
     }
 
-	ESP_LOGI(TAG, "%s", "Shutting down socket");
-	shutdown(nm->sock, 0);
-	close(nm->sock);
+	disconnect_udp_network_manager(nm);
 	free(nm);
 }
@@ -1,5 +1,10 @@
 #include <esp_mac.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <sys/time.h>
 #include "utils.h"
+#include "wifi_logger.h"
 
 static constexpr char log_level_char[5] = { 'E', 'W', 'I', 'D', 'V'};
 static constexpr char log_level_color[5][7] = {"\e[31m", "\e[33m", "\e[32m", "\e[39m", "\e[39m"};
@@ -58,4 +63,192 @@ char* generate_log_message_timestamp_and_device_id(
 
     memcpy(c_log_string, log_string.c_str(), log_string.size()+1);
     return c_log_string;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief renders a wifi_log_x() line straight into buf, exactly as generate_log_message_timestamp_and_device_id() would
+ *        have made it (with print_timestamp) from "tag (func:line) text". No allocations, no intermediate copies.
+ *
+ * @param buf where to put it. may be NULL if size is 0, to measure the line
+ * @param size size of buf, including room for the null terminator
+ * @param print_device_id if true, prepend the device's ID
+ * @param log_level log level of the line (0-4 = E, W, I, D, V)
+ * @param timestamp timestamp provided by ESP in milliseconds
+ * @return size_t length of the whole line, like snprintf(): if it's size or more, buf only holds the start of it
+ */
+size_t render_log_line(
+    char* buf,
+    const size_t size,
+    const bool print_device_id,
+    const uint8_t log_level,
+    const uint32_t timestamp,
+    const char* tag,
+    const char* func,
+    const int line,
+    const char* text)
+{
+    const uint8_t final_log_level = log_level%5;
+
+    const char* device_id = print_device_id ? udp_logging_get_device_id() : nullptr;
+    const bool has_device_id = device_id && strlen(device_id) > 0;
+
+    const int len = snprintf(buf, size, "%s%s%s%c (%u) %s (%s:%d) %s\e[39m\n",
+                             has_device_id ? device_id : "", has_device_id ? "| " : "",
+                             log_level_color[final_log_level], log_level_char[final_log_level], (unsigned)timestamp,
+                             tag, func, line, text);
+    return len < 0 ? 0 : (size_t)len;
+}
+
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+
+// RFC 5424 severities for each of our log levels: E, W, I, D, V
+static constexpr uint8_t syslog_severity[5] = { 3, 4, 6, 7, 7 };
+
+// the part of every syslog message that never changes: " HOSTNAME APP-NAME PROCID MSGID [SD-ELEMENT sysUpTime=\""
+// rendered once by syslog_prepare_header(), so each message only needs PRI, TIMESTAMP, sysUpTime and the body.
+static char syslog_header[DEVICE_ID_SIZE + 96] = " - - - - [meta sysUpTime=\"";
+static size_t syslog_header_len = strlen(syslog_header);
+
+/**
+ * @brief copies a syslog header field, replacing anything that isn't printable US-ASCII (or is a space, the separator)
+ */
+static std::string syslog_header_field(const char* value)
+{
+    if (!value || !value[0])
+        return "-"; // NILVALUE
+
+    std::string field(value);
+    for (char& c : field) {
+        if (c <= ' ' || c > '~')
+            c = '_';
+    }
+    return field;
+}
+
+/**
+ * @brief renders the constant part of the syslog header. call once at startup, before any messages are generated.
+ *
+ * @param hostname goes in the HOSTNAME field (the device id). empty means NILVALUE
+ * @param app_name goes in the APP-NAME field. empty means NILVALUE
+ */
+void syslog_prepare_header(const char* hostname, const char* app_name)
+{
+    const std::string header = " " + syslog_header_field(hostname) + " " + syslog_header_field(app_name) + " - - [meta sysUpTime=\"";
+    syslog_header_len = std::min(header.size(), sizeof(syslog_header) - 1);
+    memcpy(syslog_header, header.c_str(), syslog_header_len);
+    syslog_header[syslog_header_len] = '\0';
+}
+
+/**
+ * @brief builds an RFC 5424 syslog message
+ *
+ * With CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_TCP, the message gets RFC 6587 octet-counting framing ("LEN " in front),
+ * so messages can be streamed back to back.
+ *
+ * @param log_level log level of the message (0-4 = E, W, I, D, V)
+ * @param timestamp device uptime in ms, sent as sysUpTime
+ * @param body message text (no trailing newline)
+ * @param body_len length of body
+ * @param console_line if not NULL, a copy of this is stored right after the syslog message's null terminator
+ * @return char* the message (caller is responsible for [eventually] freeing this)
+ */
+char* generate_syslog_message(
+    const uint8_t log_level,
+    const uint32_t timestamp,
+    const char* body,
+    const size_t body_len,
+    const char* console_line)
+{
+    // the only per-message header work: PRI, TIMESTAMP and sysUpTime
+    char head[48];
+    const unsigned pri = CONFIG_LOGGING_SERVER_SYSLOG_FACILITY * 8 + syslog_severity[log_level % 5];
+    int head_len = snprintf(head, sizeof(head), "<%u>1 ", pri);
+
+    // wall clock time, if something (like SNTP) has set it. NILVALUE otherwise.
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec > 1577836800) { // 2020-01-01
+        struct tm utc;
+        gmtime_r(&now.tv_sec, &utc);
+        head_len += strftime(&head[head_len], sizeof(head) - head_len, "%Y-%m-%dT%H:%M:%S", &utc);
+        head_len += snprintf(&head[head_len], sizeof(head) - head_len, ".%03ldZ", (long)(now.tv_usec / 1000));
+    } else {
+        head[head_len++] = '-';
+    }
+
+    // sysUpTime is in hundredths of a second
+    char uptime[16];
+    const int uptime_len = snprintf(uptime, sizeof(uptime), "%u\"] ", (unsigned)(timestamp / 10));
+
+    const size_t message_len = head_len + syslog_header_len + uptime_len + body_len;
+
+    char frame[12] = "";
+    int frame_len = 0;
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_TCP==1
+    frame_len = snprintf(frame, sizeof(frame), "%u ", (unsigned)message_len);
+#endif
+
+    const size_t console_len = console_line ? strlen(console_line) + 1 : 0;
+    char* message = (char*) malloc(frame_len + message_len + 1 + console_len);
+    if (!message)
+        return nullptr;
+
+    char* out = message;
+    memcpy(out, frame, frame_len);                      out += frame_len;
+    memcpy(out, head, head_len);                        out += head_len;
+    memcpy(out, syslog_header, syslog_header_len);      out += syslog_header_len;
+    memcpy(out, uptime, uptime_len);                    out += uptime_len;
+    memcpy(out, body, body_len);                        out += body_len;
+    *out++ = '\0';
+    if (console_line)
+        memcpy(out, console_line, console_len);
+
+    return message;
+}
+
+/**
+ * @brief picks apart a line printed by ESP_LOGx(), e.g. "\e[0;32mI (1234) tag: text\e[0m\n"
+ *
+ * @param line the line
+ * @param log_level (out param) level of the line (0-4 = E, W, I, D, V). INFO if it doesn't look like an ESP_LOGx() line
+ * @param timestamp (out param) timestamp from the line. left alone if it doesn't have one
+ * @param body_len (out param) length of the returned text
+ * @return const char* the text of the line ("tag: text"), without colors, level, timestamp or line ending
+ */
+const char* parse_esp_log_line(const char* line, uint8_t* log_level, uint32_t* timestamp, size_t* body_len)
+{
+    const char* start = line;
+    const char* end = line + strlen(line);
+
+    // trailing newline and color reset
+    while (end > start && (end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+    if (end - start >= 4 && memcmp(end - 4, "\e[0m", 4) == 0)
+        end -= 4;
+
+    // leading color, e.g. "\e[0;32m"
+    if (start[0] == '\e') {
+        const char* color_end = (const char*) memchr(start, 'm', end - start);
+        if (color_end)
+            start = color_end + 1;
+    }
+
+    *log_level = 2;
+
+    // "L (1234) "
+    const char* level = (start < end) ? (const char*) memchr(log_level_char, start[0], sizeof(log_level_char)) : nullptr;
+    if (level && end - start > 3 && start[1] == ' ' && start[2] == '(') {
+        char* after = nullptr;
+        const unsigned long ts = strtoul(&start[3], &after, 10);
+        if (after && after + 1 < end && after[0] == ')' && after[1] == ' ') {
+            *log_level = level - log_level_char;
+            *timestamp = ts;
+            start = after + 2;
+        }
+    }
+
+    *body_len = end - start;
+    return start;
+}
+
+#endif // CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG
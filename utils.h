@@ -8,9 +8,14 @@ extern "C" {
 #endif
 
 char* generate_log_message_timestamp_and_device_id(bool print_device_id, bool print_timestamp, uint8_t log_level, uint32_t timestamp, const char* log_message);
+size_t render_log_line(char* buf, size_t size, bool print_device_id, uint8_t log_level, uint32_t timestamp, const char* tag, const char* func, int line, const char* text);
 
 const char* udp_logging_get_device_id();
 
+void syslog_prepare_header(const char* hostname, const char* app_name);
+char* generate_syslog_message(uint8_t log_level, uint32_t timestamp, const char* body, size_t body_len, const char* console_line);
+const char* parse_esp_log_line(const char* line, uint8_t* log_level, uint32_t* timestamp, size_t* body_len);
+
 #ifdef __cplusplus
 }
 #endif
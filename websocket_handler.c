@@ -141,6 +141,31 @@ int websocket_send_data(esp_websocket_client_handle_t network_handle, char* payl
 	return -1;
 }
 
+/**
+ * @brief Sends a binary record (see log_queue.h) to the websocket server, as a binary frame
+ * 
+ * @param network_handle network handle returned by network manager
+ * @param payload record to be sent to the server
+ * @param len length of payload in bytes
+ * @return int returns number of bytes sent, -1 if any error occurs in sending
+ */
+int websocket_send_binary(esp_websocket_client_handle_t network_handle, const char* payload, size_t len)
+{
+	if (esp_websocket_client_is_connected(network_handle))
+	{
+		int err = esp_websocket_client_send_bin(network_handle, payload, len, portMAX_DELAY);
+
+		if (err < 0)
+		{
+			ESP_LOGE(TAG, "Error occured during sending: errno %d", errno);
+		}
+
+		return err;
+	}
+
+	return -1;
+}
+
 /**
  * @brief stop and destroy websocket client
  * 
@@ -1,6 +1,8 @@
 #ifndef WEBSOCKET_HANDLER_H
 #define WEBSOCKET_HANDLER_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -9,6 +11,7 @@ struct websocket_network_manager;
 
 struct websocket_network_manager* init_websocket_network_manager();
 int websocket_send_data(struct websocket_network_manager* nm, char* payload);
+int websocket_send_binary(struct websocket_network_manager* nm, const char* payload, size_t len);
 void websocket_close_network_manager(struct websocket_network_manager* nm);
 bool is_websocket_connected(struct websocket_network_manager* nm);
 
@@ -1,10 +1,32 @@
 #include <esp_log.h>
 #include <string.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 
 #include "utils.h"
+#include "log_queue.h"
+#include "log_filter.h"
+#include "control_channel.h"
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+#include "datagram_crypto.h"
+#endif
+#if CONFIG_LOGGING_SERVER_TRACE==1
+#include "trace_buffer.h"
+#endif
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+#include "net_impair.h"
+#endif
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+#include "flight_recorder.h"
+#endif
+#if CONFIG_LOGGING_SERVER_METRICS==1
+#include "metrics.h"
+#endif
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+#include "link_monitor.h"
+#endif
 
 // if true, local console spews a lot of debug output
 #define DEBUG_VERBOSE_LOCAL_LOGGING 0
@@ -12,7 +34,7 @@
 #if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
 #include "udp_handler.h"
 #endif
-#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_TCP==1
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_TCP==1 || CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
 #include "tcp_handler.h"
 #endif
 #if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_WEBSOCKET==1
@@ -25,11 +47,40 @@
 
 static const char* TAG = "wifi_logger";
 
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG!=1
 static bool s_print_device_id = true; // TODO: set from config
+#endif
 
 static volatile bool s_wifi_logging_sending_enabled = true;
 static char s_device_id[DEVICE_ID_SIZE] = {}; // set from config->device_id (or the efuse MAC) at start.
 
+// logger task lifecycle, see wifi_logger_stop() / wifi_logger_reconfigure()
+static TaskHandle_t s_logger_task = NULL;
+static volatile bool s_stop_requested = false;
+static vprintf_like_t s_previous_vprintf = NULL;
+
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+static TaskHandle_t s_stop_waiter = NULL;
+
+// a new config for the logger task to pick up. guarded by s_config_lock
+static struct wifi_logger_config* s_pending_config = NULL;
+static portMUX_TYPE s_config_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief (logger task) takes the config handed over by wifi_logger_reconfigure(), if there is one
+ *
+ * @return struct wifi_logger_config* the new config, NULL if there isn't one. caller must free() it
+ */
+static struct wifi_logger_config* take_pending_config(void)
+{
+    taskENTER_CRITICAL(&s_config_lock);
+    struct wifi_logger_config* config = s_pending_config;
+    s_pending_config = NULL;
+    taskEXIT_CRITICAL(&s_config_lock);
+    return config;
+}
+#endif
+
 const char* udp_logging_get_device_id() {
 	// either the mac address, or null-terminated zero-len str
     return s_device_id;
@@ -40,19 +91,198 @@ void udp_logging_set_sending_enabled(bool sending_enabled)
     // this call is safe to call before init, but enabling has no effect unless we previously started up logging.
     // it just enables/disabling network logging AFTER we already set everything else up.
     s_wifi_logging_sending_enabled = sending_enabled;
+    // lets wifi_log_x() calls bail out before evaluating their arguments
+    log_filter_set_site_flag(WIFI_LOG_SITE_SENDING_OFF, !sending_enabled);
     ESP_LOGW(TAG, "udp logging state now set to: %d", s_wifi_logging_sending_enabled);
 }
 
 
+// batching: up to this many bytes of queued messages are packed into one datagram, waiting up to
+// s_batch_max_wait_ms for more to show up. 0 ms means only what's already queued gets batched, so no added latency.
+// syslog over UDP is one message per datagram (RFC 5426), so batching stays off in that format.
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+#define BATCH_MAX_BYTES_LIMIT 0
+#else
+#define BATCH_MAX_BYTES_LIMIT CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE
+#endif
+static volatile uint32_t s_batch_max_bytes = BATCH_MAX_BYTES_LIMIT;
+static volatile uint32_t s_batch_max_wait_ms = 0;
+
+// upper limit for s_batch_max_wait_ms. the logger task doesn't check the control channel while it waits.
+#define BATCH_MAX_WAIT_LIMIT_MS 1000
+
+/**
+ * @brief changes how messages get batched at runtime
+ *
+ * @param max_bytes max datagram size for a batch, capped at CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE (0 for syslog). 0 turns batching off
+ * @param max_wait_ms how long to wait for more messages to fill a batch, capped at BATCH_MAX_WAIT_LIMIT_MS
+ */
+void wifi_logger_set_batching(uint32_t max_bytes, uint32_t max_wait_ms)
+{
+    s_batch_max_bytes = MIN(max_bytes, BATCH_MAX_BYTES_LIMIT);
+    s_batch_max_wait_ms = MIN(max_wait_ms, BATCH_MAX_WAIT_LIMIT_MS);
+}
+
+#ifdef LOG_ITEM_STATIC_LINES
+static size_t render_static_line(const struct log_queue_item* item, char* buf, size_t size);
+#endif
+
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+// burst mode, for devices in modem sleep: rather than sending lines as they come (and waking the radio for each one),
+// the logger task leaves them queued until s_burst_max_bytes of them have piled up, the oldest has waited
+// s_burst_max_age_ms, or an ERROR is queued, then sends everything back to back in full batches. 0 bytes = off.
+static volatile uint32_t s_burst_max_bytes = CONFIG_LOGGING_SERVER_BURST_MAX_BYTES;
+static volatile uint32_t s_burst_max_age_ms = CONFIG_LOGGING_SERVER_BURST_MAX_AGE_MS;
+
+// what's waiting for the next burst. whoever queues something adds to it, the logger task starts over when it sends
+static uint32_t s_burst_queued_bytes;
+static TickType_t s_burst_oldest_tick;  // when the first line since the last burst was queued
+static bool s_burst_due;                // send now, don't wait for the oldest line to age
+static portMUX_TYPE s_burst_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define BURST_MAX_AGE_LIMIT_MS 60000
+
+/**
+ * @brief keeps track of what's waiting for the next burst, and wakes the logger task when it's time for one
+ *
+ * @param item what was just queued
+ * @param len see send_to_queue()
+ * @param queue_full true if item didn't fit: the queue has to be emptied now, not when the thresholds say so
+ */
+static void burst_note_queued(const struct log_queue_item* item, size_t len, bool queue_full)
+{
+    if (s_burst_max_bytes == 0)
+        return;
+
+    if (queue_full)
+        len = 0;
+    else if (len == 0 && (item->flags & LOG_ITEM_FLAG_BINARY))
+        len = item->len;
+#ifdef LOG_ITEM_STATIC_LINES
+    else if (len == 0 && (item->flags & LOG_ITEM_FLAG_STATIC))
+        len = render_static_line(item, NULL, 0); // message is only the text: the line is longer
+#endif
+    else if (len == 0)
+        len = strlen(item->message);
+
+    portENTER_CRITICAL(&s_burst_lock);
+    if (s_burst_queued_bytes == 0)
+        s_burst_oldest_tick = xTaskGetTickCount();
+    s_burst_queued_bytes += len;
+    const bool wake = !s_burst_due &&
+        (queue_full || (item->flags & LOG_ITEM_FLAG_URGENT) || s_burst_queued_bytes >= s_burst_max_bytes);
+    if (wake)
+        s_burst_due = true;
+    portEXIT_CRITICAL(&s_burst_lock);
+
+    TaskHandle_t logger_task = s_logger_task;
+    if (wake && logger_task)
+        xTaskNotifyGive(logger_task);
+}
+#endif
+
+/**
+ * @brief turns burst mode on or off, or changes its thresholds. whatever is queued at the time is sent right away.
+ *
+ * @param max_bytes send once this many bytes are queued. 0 turns burst mode off
+ * @param max_age_ms send once the oldest queued line is this old, capped at BURST_MAX_AGE_LIMIT_MS
+ * @return bool false if not UDP
+ */
+bool wifi_logger_set_burst(uint32_t max_bytes, uint32_t max_age_ms)
+{
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+    portENTER_CRITICAL(&s_burst_lock);
+    s_burst_max_bytes = max_bytes;
+    s_burst_max_age_ms = MIN(max_age_ms, BURST_MAX_AGE_LIMIT_MS);
+    s_burst_due = true;
+    portEXIT_CRITICAL(&s_burst_lock);
+
+    TaskHandle_t logger_task = s_logger_task;
+    if (logger_task)
+        xTaskNotifyGive(logger_task);
+    return true;
+#else
+    (void) max_bytes;
+    (void) max_age_ms;
+    return false;
+#endif
+}
+
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+static volatile enum wifi_logger_transport s_transport_mode = WIFI_LOGGER_TRANSPORT_AUTO;
+#endif
+
+/**
+ * @brief pins log data to UDP or TCP, or leaves the choice to the logger (WIFI_LOGGER_TRANSPORT_AUTO). the logger task
+ *        switches between datagrams, so nothing still queued is lost, but frames TCP already took may be (see
+ *        TCP_FINISH_TIMEOUT_MS).
+ *
+ * @return bool false without CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT
+ */
+bool wifi_logger_set_transport(enum wifi_logger_transport transport)
+{
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (transport != WIFI_LOGGER_TRANSPORT_AUTO && transport != WIFI_LOGGER_TRANSPORT_UDP && transport != WIFI_LOGGER_TRANSPORT_TCP)
+        return false;
+
+    s_transport_mode = transport;
+    TaskHandle_t logger_task = s_logger_task;
+    if (logger_task)
+        xTaskNotifyGive(logger_task);
+    return true;
+#else
+    (void) transport;
+    return false;
+#endif
+}
+
+/**
+ * @brief what the adaptive transport measured on the link to the collector, and what it's sending over because of it
+ *
+ * @return bool false without CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT
+ */
+bool wifi_logger_get_link_stats(struct wifi_logger_link_stats* stats)
+{
+    assert(stats);
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    link_monitor_get_stats(stats);
+    return true;
+#else
+    (void) stats;
+    return false;
+#endif
+}
+
 /**
  * @brief Initialises message queue
  * 
  * @return esp_err_t ESP_OK - if queue init sucessfully, ESP_FAIL - if queue init failed
  **/
 static volatile QueueHandle_t s_wifi_logger_queue;
+static uint32_t s_queue_full_dropped = 0; // lines thrown away because the queue was full, not reported yet
+static portMUX_TYPE s_queue_full_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+/*
+ * Async console echo. Whenever the logger task waits (between datagrams, while it can't resolve the collector, while
+ * it holds lines back for a collector that doesn't answer, for credits or for a burst), it first takes everything off
+ * the queue, echoes it, and keeps it here, oldest first, until it can be sent. So console output doesn't stop while
+ * nothing goes out. These count towards CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE, see send_to_queue().
+ */
+#define ECHOED_LINES_MAX CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE
+static struct log_queue_item s_echoed_lines[ECHOED_LINES_MAX];
+static unsigned s_echoed_first;             // only ever touched by the logger task
+static volatile unsigned s_echoed_count;    // only ever changed by the logger task
+static volatile bool s_echo_wake;           // the logger task is in a long wait: wake it up for every line
+#endif
+
 esp_err_t init_queue(void)
 {
-	s_wifi_logger_queue = xQueueCreate(CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE, sizeof(char*));
+	// restarting after wifi_logger_stop(): keep the queue, and whatever is still in it
+	if (s_wifi_logger_queue != NULL)
+		return ESP_OK;
+
+	s_wifi_logger_queue = xQueueCreate(CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE, sizeof(struct log_queue_item));
 
 	if (s_wifi_logger_queue == NULL)
 	{
@@ -69,11 +299,13 @@ esp_err_t init_queue(void)
 /**
  * @brief Sends log message to message queue
  * 
- * @param log_message log message to be sent to the queue
+ * @param item log message to be sent to the queue (copied into the queue)
+ * @param len length of item->message, which burst mode counts. 0 if the caller doesn't have it: it's only worked out
+ *            here if burst mode is on
  * @return esp_err_t ESP_OK - if queue init successfully, ESP_FAIL - if queue init failed.
- *							  if enqueueing is OK, consumer is responsible for free()'ing. on failure, caller must free()
+ *							  if enqueueing is OK, consumer is responsible for free()'ing item->message. on failure, caller must free()
  **/
-esp_err_t send_to_queue(char* log_message)
+esp_err_t send_to_queue(const struct log_queue_item* item, size_t len)
 {
     // use printf() for local logging (since ESP_LOGxxx may create a weird feedback loop since we potentially have it hooked)
 
@@ -82,18 +314,34 @@ esp_err_t send_to_queue(char* log_message)
         return ESP_FAIL;
     }
 
-	const BaseType_t qerror = xQueueSendToBack(s_wifi_logger_queue, (void*)&log_message, (TickType_t) 0/portTICK_PERIOD_MS);
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+	// the lines the logger task took off the queue to echo them are still waiting to be sent
+	const BaseType_t qerror = (uxQueueMessagesWaiting(s_wifi_logger_queue) + s_echoed_count >= CONFIG_LOGGING_SERVER_MESSAGE_QUEUE_SIZE) ?
+		errQUEUE_FULL : xQueueSendToBack(s_wifi_logger_queue, (const void*)item, (TickType_t) 0/portTICK_PERIOD_MS);
+#else
+	const BaseType_t qerror = xQueueSendToBack(s_wifi_logger_queue, (const void*)item, (TickType_t) 0/portTICK_PERIOD_MS);
+#endif
 
 	if(qerror == pdPASS)
 	{
         #if DEBUG_VERBOSE_LOCAL_LOGGING==1
 		printf("log msg sent to Queue"); // spammy.
         #endif
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+		burst_note_queued(item, len, false);
+#endif
 		return ESP_OK;
 	}
 	else if(qerror == errQUEUE_FULL)
 	{
 		printf("wifi_logger: queue full, not sending data\n");
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+		burst_note_queued(item, len, true);
+#endif
+		// the logger task tells the server how many went missing
+		portENTER_CRITICAL(&s_queue_full_lock);
+		s_queue_full_dropped++;
+		portEXIT_CRITICAL(&s_queue_full_lock);
 		return ESP_FAIL;
 	}
 	else
@@ -104,22 +352,17 @@ esp_err_t send_to_queue(char* log_message)
 }
 
 /**
- * @brief Receive data from queue. Timeout is set to portMAX_DELAY, which is around 50 days (confirm from esp32 specs)
+ * @brief Receive data from queue
  * 
- * @return char* - returns log message received from the queue, returns NULL if error. CALLER MUST free() THIS STRING WHEN DONE
+ * @param item (out param) filled in with the dequeued message. CALLER MUST free() item->message WHEN DONE
+ * @param timeout how long to wait for a message. portMAX_DELAY waits forever.
+ * @return bool - true if a message was received, false on timeout or error (item->message is NULL)
  **/
-char* receive_from_queue(void)
+bool receive_from_queue(struct log_queue_item* item, TickType_t timeout)
 {
     // use printf() for local logging (since ESP_LOGxxx may create a weird feedback loop since we potentially have it hooked)
 
-	char* data;
-	// ************************* IMPORTANT *******************************************************************
-	// Timeout period is set to portMAX_DELAY, so if it doesnot receive a log message for ~50 days, config assert will fail and program will crash
-	//
-	BaseType_t qerror = xQueueReceive(s_wifi_logger_queue, &data, (TickType_t) portMAX_DELAY);
-	configASSERT(qerror);
-	//
-	// *******************************************************************************************************
+	BaseType_t qerror = xQueueReceive(s_wifi_logger_queue, item, timeout);
 
 	if(qerror == pdPASS)
 	{
@@ -127,31 +370,48 @@ char* receive_from_queue(void)
 		printf("Data received from Queue"); // spammy
         #endif
 	}
-	else if(qerror == pdFALSE)
-	{
-        printf("wifi_logger: dequeue: Data not received from Queue");
-		data = NULL;
-	}
 	else
 	{
-		free((void*)data);
-        printf("wifi_logger: dequeue: Unknown error");
-		data = NULL;
+		// nothing arrived within the timeout. not an error.
+		item->message = NULL;
 	}
 
-	return data;
+	return item->message != NULL;
 }
 
 /**
- * @brief generates log message, of the format generated by ESP_LOG function
- * 
+ * @brief ESP log level to the 0-4 (E, W, I, D, V) utils.cpp uses
+ */
+static uint8_t log_level_index(esp_log_level_t level)
+{
+	switch (level)
+	{
+	case ESP_LOG_ERROR:
+		return 0;
+	case ESP_LOG_WARN:
+		return 1;
+	case ESP_LOG_INFO:
+		return 2;
+	case ESP_LOG_DEBUG:
+		return 3;
+	case ESP_LOG_VERBOSE:
+		return 4;
+	default:
+		return 2;
+	}
+}
+
+/**
+ * @brief generates log message, of the format generated by ESP_LOG function, and queues it
+ *
  * @param level set ESP LOG level {E, W, I, D, V}
  * @param log_tag Tag for the log message
  * @param line line
  * @param func func
  * @param fmt fmt
+ * @param args fmt's arguments
  */
-void generate_log_message(esp_log_level_t level, const char *log_tag, int line, const char *func, const char *fmt, ...)
+static void generate_log_message_v(esp_log_level_t level, const char *log_tag, int line, const char *func, const char *fmt, va_list args)
 {
     // this function is NOT used during hooking of ESP_LOGxx() functions.
     // it is only used as a manual call for sending msgs that should ONLY go through network logging.
@@ -159,54 +419,60 @@ void generate_log_message(esp_log_level_t level, const char *log_tag, int line,
     if (!s_wifi_logging_sending_enabled)
         return;
 
-    const uint32_t buffer_size = CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE;
-    char log_print_buffer[buffer_size];
+    // check the cheap stuff before formatting anything
+    if (!log_filter_level_allows(log_tag, level) || !log_filter_rate_allows())
+        return;
 
-	memset(log_print_buffer, '\0', buffer_size);
-	snprintf(log_print_buffer, buffer_size, "%s (%s:%d) ", log_tag, func, line);
-	va_list args;
-	va_start(args, fmt);
+    // short lines are formatted on the stack. anything longer gets a heap buffer of exactly the size it
+    // needs, the logger task splits it into CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE fragments when sending.
+    char stack_buffer[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE];
+    char* log_print_buffer = stack_buffer;
 
-	const size_t len = strlen(log_print_buffer);
+	va_list measure_args;
+	va_copy(measure_args, args);
+	const int header_len = snprintf(NULL, 0, "%s (%s:%d) ", log_tag, func, line);
+	const int body_len = vsnprintf(NULL, 0, fmt, measure_args);
+	va_end(measure_args);
 
-	if (buffer_size - len > 1)
-	{
-		vsnprintf(&log_print_buffer[len], (buffer_size - len), fmt, args);
-	}
-	else
+	if (header_len < 0 || body_len < 0)
+		return;
+
+	const size_t buffer_size = (size_t)header_len + (size_t)body_len + 1;
+	if (buffer_size > sizeof(stack_buffer))
 	{
-		memset(log_print_buffer, '\0', buffer_size);
-		sprintf(log_print_buffer, "%s", "Buffer overflowed, increase buffer size");
+		log_print_buffer = malloc(buffer_size);
+		if (!log_print_buffer)
+			return;
 	}
-	va_end(args);
 
-	uint8_t log_level_opt = 2;
+	snprintf(log_print_buffer, buffer_size, "%s (%s:%d) ", log_tag, func, line);
+	vsnprintf(&log_print_buffer[header_len], buffer_size - header_len, fmt, args);
 
-	switch (level)
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+	// quiet lines only go as far as the recorder, as they are
+	if (level > CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_SEND_LEVEL)
 	{
-	case ESP_LOG_ERROR:
-		log_level_opt = 0;
-		break;
-	case ESP_LOG_WARN:
-		log_level_opt = 1;
-		break;
-	case ESP_LOG_INFO:
-		log_level_opt = 2;
-		break;
-	case ESP_LOG_DEBUG:
-		log_level_opt = 3;
-		break;
-	case ESP_LOG_VERBOSE:
-		log_level_opt = 4;
-		break;
-	default:
-		log_level_opt = 2;
-		break;
+		flight_recorder_capture(level, false, log_print_buffer, buffer_size - 1);
+		if (log_print_buffer != stack_buffer)
+			free(log_print_buffer);
+		return;
 	}
+#endif
+
+	const uint8_t log_level_opt = log_level_index(level);
 
 	// this malloc()'s a new string, stored in final_log_message
 	// someone must free this later.
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+    char* final_log_message = generate_syslog_message(log_level_opt, esp_log_timestamp(), log_print_buffer, strlen(log_print_buffer), NULL);
+#else
     char* final_log_message = generate_log_message_timestamp_and_device_id(s_print_device_id, true, log_level_opt, esp_log_timestamp(), log_print_buffer);
+#endif
+
+	if (log_print_buffer != stack_buffer)
+		free(log_print_buffer);
+	log_print_buffer = NULL;
+
 	if (!final_log_message)
 		return;
 
@@ -215,13 +481,109 @@ void generate_log_message(esp_log_level_t level, const char *log_tag, int line,
 	// The function returns the malloc'd char* and is passed to the queue
 	//
 	// the queue consumer will free() whatever str is passed to it
-	if (send_to_queue(final_log_message) != ESP_OK)
+	const struct log_queue_item item = {
+		.message = final_log_message,
+		.flags = (level == ESP_LOG_ERROR) ? LOG_ITEM_FLAG_URGENT : 0,
+	};
+	if (send_to_queue(&item, 0) != ESP_OK)
 	{
 		free(final_log_message);
 		final_log_message = NULL;
 	}
 	//
 	//********************************************************************************************************
+
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+	// the recorded lines from before it get sent too
+	if (level == ESP_LOG_ERROR)
+		flight_recorder_trigger(false);
+#endif
+}
+
+/**
+ * @brief generates log message, of the format generated by ESP_LOG function
+ *
+ * @param level set ESP LOG level {E, W, I, D, V}
+ * @param log_tag Tag for the log message
+ * @param line line
+ * @param func func
+ * @param fmt fmt
+ */
+void generate_log_message(esp_log_level_t level, const char *log_tag, int line, const char *func, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	generate_log_message_v(level, log_tag, line, func, fmt, args);
+	va_end(args);
+}
+
+/**
+ * @brief logs one wifi_log_x() call. Only called for sites that aren't muted, see WIFI_LOG_SITE()
+ *
+ * @param site the call site
+ * @param log_tag Tag for the log message
+ * @param fmt site->fmt
+ */
+void wifi_log_site_message(struct wifi_log_site* site, const char *log_tag, const char *fmt, ...)
+{
+	// TAG isn't known until run time. remember it, so the site can be listed with it
+	if (site->tag != log_tag)
+		site->tag = log_tag;
+
+	va_list args;
+	va_start(args, fmt);
+	generate_log_message_v((esp_log_level_t) site->level, log_tag, site->line, site->func, fmt, args);
+	va_end(args);
+}
+
+/**
+ * @brief logs one wifi_log_x() call that has nothing to format, or a wifi_log_static_x() one, by queueing a reference
+ *        to its text. The logger task renders the line when it sends it (see render_static_line()).
+ *
+ * @param site the call site
+ * @param log_tag Tag for the log message
+ * @param text the line's text. must stay as it is until the line has been sent
+ */
+void wifi_log_site_static(struct wifi_log_site* site, const char *log_tag, const char *text)
+{
+	const esp_log_level_t level = (esp_log_level_t) site->level;
+
+	// queued lines are rendered with site->tag, so it can't change once it's set. a site that logs under more than
+	// one tag (from more than one task, maybe at once) formats the lines with the others
+	const char* tag = NULL;
+	__atomic_compare_exchange_n(&site->tag, &tag, log_tag, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+#ifdef LOG_ITEM_STATIC_LINES
+	bool by_reference = (!tag || tag == log_tag);
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+	// quiet lines only go as far as the recorder, which keeps a copy
+	by_reference &= (level <= CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_SEND_LEVEL);
+#endif
+
+	if (by_reference)
+	{
+		if (!s_wifi_logging_sending_enabled)
+			return;
+		if (!log_filter_level_allows(log_tag, level) || !log_filter_rate_allows())
+			return;
+
+		const struct log_queue_item item = {
+			.message = (char*) text,
+			.flags = LOG_ITEM_FLAG_STATIC | ((level == ESP_LOG_ERROR) ? LOG_ITEM_FLAG_URGENT : 0),
+			.timestamp = esp_log_timestamp(),
+			.site = site,
+		};
+		send_to_queue(&item, 0); // nothing to free if it doesn't fit
+
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+		if (level == ESP_LOG_ERROR)
+			flight_recorder_trigger(false);
+#endif
+		return;
+	}
+#endif
+
+	generate_log_message(level, log_tag, site->line, site->func, "%s", text);
 }
 
 bool is_network_logging_allowed_here()
@@ -242,26 +604,65 @@ bool is_network_logging_allowed_here()
 	return true;
 }
 
-void format_log_and_queue_for_send(const char* fmt, const va_list tag)
-{
-	if (!is_network_logging_allowed_here())
-		return;
-
-	// we do want to send to UDP! let's prep.
+// ESP_LOGx() lines longer than this are cut short. console_offset is a uint16_t (see struct log_queue_item), and it
+// has to reach past the whole line plus what goes in front of it: the device id, or the syslog header
+#define ROUTED_LINE_MAX_LEN (UINT16_MAX - 1024)
 
-	// we're going to only allow CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE-1 size strings. anything less will be cutoff
+/**
+ * @brief formats a log message generated by ESP_LOGX, for sending over the network
+ *
+ * @param fmt logger string format
+ * @param tag arguments
+ * @param console_offset (out param) offset into the returned string where the plain console line starts (skips the device id prefix,
+ *                       or, for syslog, the whole syslog message: the console line is stored after its null terminator)
+ * @return char* the formatted message with device id prepended, NULL on error. CALLER MUST free() THIS STRING
+ */
+static char* format_log_message(const char* fmt, va_list tag, uint16_t* console_offset)
+{
+	// the line is formatted into a heap buffer of exactly the size it needs. there's no truncation here:
+	// lines longer than CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE get split into continuation fragments by
+	// the logger task when they're sent, so short lines don't pay for the longest one we might see.
 	// remember to always free() this.
 	// Note: we COULD do this as an array declared on the stack HOWEVER, many tasks have very small stack sizes, so,
 	// we might quickly blow up their stack.  so, we'll do a malloc() here.
 	// WARNING: this many mallocs done so quickly might fragment memory quickly.
 	// we may want some kind of better approach, like a buffer pool.
-	char *log_print_buffer = malloc(sizeof(char) * CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE);
+	va_list args;
+	va_copy(args, tag);
+	int len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (len < 0)
+		return NULL;
+	const bool cut = (len > ROUTED_LINE_MAX_LEN);
+	if (cut)
+		len = ROUTED_LINE_MAX_LEN;
+
+	char *log_print_buffer = malloc(sizeof(char) * (len + 1));
 	if (!log_print_buffer)
-		return;
+		return NULL;
+
+	va_copy(args, tag);
+	vsnprintf(log_print_buffer, len + 1, fmt, args);
+	va_end(args);
+	if (cut)
+		log_print_buffer[len - 1] = '\n'; // still a whole line, on the console and for the collector
+
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+	// pull the level, timestamp and text back out of the "I (1234) tag: text" line esp_log made,
+	// and keep the line itself after the syslog message for the console.
+	uint8_t log_level = 2;
+	uint32_t timestamp = esp_log_timestamp();
+	size_t body_len = 0;
+	const char* body = parse_esp_log_line(log_print_buffer, &log_level, &timestamp, &body_len);
+
+	char* final_log_message = generate_syslog_message(log_level, timestamp, body, body_len, log_print_buffer);
+	free(log_print_buffer);
 
-	vsnprintf(log_print_buffer, CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE, fmt, tag);
-	log_print_buffer[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE - 1] = '\0';
+	if (final_log_message)
+		*console_offset = (uint16_t)(strlen(final_log_message) + 1);
 
+	return final_log_message;
+#else
 	// but, here's a version that prepends the mac address.
 	// note that this does an additional malloc that the queue consumer must free.
 	// note that log_print_buffer is copied into this new malloc()'d data, so, WE need to free it right after.
@@ -273,16 +674,11 @@ void format_log_and_queue_for_send(const char* fmt, const va_list tag)
 	free(log_print_buffer);
 	log_print_buffer = NULL;
 
-	if (!final_log_message)
-		return;
+	if (final_log_message)
+		*console_offset = (uint16_t)(strlen(final_log_message) - len);
 
-	// if queued, queue consumer is responsible for free()'ing our string.
-	// if not, we need to free() it ourselves here.
-	if (send_to_queue(final_log_message) != ESP_OK)
-	{
-		free(final_log_message);
-		final_log_message = NULL;
-	}
+	return final_log_message;
+#endif
 }
 
 /**
@@ -290,9 +686,9 @@ void format_log_and_queue_for_send(const char* fmt, const va_list tag)
  * 
  * @param fmt logger string format
  * @param tag arguments
- * @return int return value of vprintf
+ * @return int number of chars written to the console, like vprintf
  */
-int system_log_message_route(const char* fmt, const va_list tag)
+int system_log_message_route(const char* fmt, va_list tag)
 {
 	// WARNING: REMEMBER: this can be called from multiple threads at once
 
@@ -302,19 +698,70 @@ int system_log_message_route(const char* fmt, const va_list tag)
     // we perform 2 decisions:
     // 1. do we want to send this message out over the network?
     // 2. do we want to echo this locally
+    // the line is formatted exactly once, and that same buffer is used for both.
+
+	// not sending this one, just do the same as the normal behavior of ESP_LOGxxx() functions (print to the console)
+	// (per-tag levels for these are applied by esp_log itself, before we ever get called)
+	if (!is_network_logging_allowed_here())
+		return vprintf(fmt, tag);
+
+	const esp_log_level_t level = log_filter_line_level(fmt);
+
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+	// quiet lines only go as far as the recorder (and the console). lines that don't look like ESP_LOGx() ones are sent
+	if (level > CONFIG_LOGGING_SERVER_FLIGHT_RECORDER_SEND_LEVEL)
+		return flight_recorder_capture_v(level, fmt, tag);
+	// the recorded lines from before it get sent too
+	if (level == ESP_LOG_ERROR)
+		flight_recorder_trigger(false);
+#endif
 
-    // ---------------------------
-    // STEP 1 - NETWORK SENDING
-    // ---------------------------
-	format_log_and_queue_for_send(fmt, tag);
+	if (!log_filter_rate_allows())
+		return vprintf(fmt, tag);
 
-    // ---------------------------
-    // STEP 2 - LOCAL ECHO
-    // ---------------------------
-	// note: even if we're skipping sending to UDP, we can still call vprintf() below to display the log msg locally.
-    // pass along to original normal logging system now. (this actually just prints it to the console, normally)
-	// basically, this is the same as the normal behavior of ESP_LOGxxx() functions
-	return vprintf(fmt, tag);
+	uint16_t console_offset = 0;
+	char* final_log_message = format_log_message(fmt, tag, &console_offset);
+	if (!final_log_message)
+		return vprintf(fmt, tag); // out of memory. still try to show it locally.
+
+	const char* console_line = &final_log_message[console_offset];
+	const int console_len = (int)strlen(console_line);
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+	const size_t message_len = console_offset - 1; // the console line is after the message's terminator
+#else
+	const size_t message_len = console_offset + console_len;
+#endif
+
+	struct log_queue_item item = {
+		.message = final_log_message,
+		.flags = (level == ESP_LOG_ERROR) ? LOG_ITEM_FLAG_URGENT : 0,
+		.console_offset = console_offset,
+	};
+
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+	// the logger task echoes it to the console when it dequeues it, so we don't sit here waiting on the UART.
+	item.flags |= LOG_ITEM_FLAG_ECHO_TO_CONSOLE;
+	if (send_to_queue(&item, message_len) == ESP_OK)
+	{
+		TaskHandle_t logger_task = s_logger_task;
+		if (s_echo_wake && logger_task)
+			xTaskNotifyGive(logger_task);
+		return console_len;
+	}
+
+	// queue is full. nothing will be sent over the network, but still show it locally.
+	fputs(console_line, stdout);
+#else
+	// local echo first: once it's queued, the logger task owns (and may already have freed) the string
+	fputs(console_line, stdout);
+	if (send_to_queue(&item, message_len) == ESP_OK)
+		return console_len;
+#endif
+
+	// if queued, queue consumer is responsible for free()'ing our string.
+	// if not, we need to free() it ourselves here.
+	free(final_log_message);
+	return console_len;
 }
 
 /*
@@ -345,51 +792,1036 @@ bool is_connected(void* handle_t)
  * 
  */
 #if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
-bool update_udp_logging(struct logger_udp_network_data *handle, const char *host, int port)
-{
-    // use printf() for local logging to avoid anything weird with feedback loops, since we're hooked into ESP_LOG()
 
-    if (!is_logging_udp_connected(handle) && !init_udp_network_manager(handle, host, port)) {
-        return false;
-    }
+// how long the logger task waits for a log message before checking the control channel again
+#define CONTROL_POLL_INTERVAL_MS 100
 
-    char *log_message = receive_from_queue();
-    if (log_message == NULL) {
-        printf("%s: receive_from_queue() got NULL, can't send anything. ignoring", TAG);
-        return false;
-    }
+// scratch space for building fragments of long log lines, and batches of short ones. only ever touched by the logger task.
+static char s_fragment_buffer[CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE];
+static char s_batch_buffer[CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE + 1];
 
-    int len_sent;
-    send_udp_data(handle, log_message, &len_sent);
-    #if DEBUG_VERBOSE_LOCAL_LOGGING==1
-    printf("%s: %d %s", TAG, len_sent, "bytes of data sent"); // spammy
-    #endif
+// the biggest datagram the logger task sends: a batch, a fragment of a long line, or a record
+#if CONFIG_LOGGING_SERVER_TRACE==1
+#define DATAGRAM_MAX_PAYLOAD MAX(MAX(CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE, CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE), TRACE_RECORD_MAX_SIZE)
+#else
+#define DATAGRAM_MAX_PAYLOAD MAX(CONFIG_LOGGING_SERVER_BATCH_MAX_SIZE, CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE)
+#endif
 
-    free((void *) log_message);
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+// sealed copy of whatever is being sent. only ever touched by the logger task.
+static uint8_t s_sealed_buffer[DATAGRAM_MAX_PAYLOAD + DATAGRAM_SEAL_OVERHEAD];
+#define DATAGRAM_MAX_WIRE_SIZE (DATAGRAM_MAX_PAYLOAD + DATAGRAM_SEAL_OVERHEAD)
+#else
+#define DATAGRAM_MAX_WIRE_SIZE DATAGRAM_MAX_PAYLOAD
+#endif
 
-    return true;
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+/*
+ * Adaptive transport: while link_monitor.c finds UDP losing too much, log data goes over a TCP connection to the same
+ * collector instead, as a stream of frames, each the datagram it would have been: [length, 2 bytes big-endian] [datagram].
+ * Probes, credit requests and control replies stay on UDP. Lines stay queued until they're sent, and a frame TCP won't
+ * take goes out over UDP instead (the logger then stays on UDP for TCP_RETRY_MS). Once TCP has taken a frame, though,
+ * it's gone from the queue: moving back to UDP, or stopping, waits up to TCP_FINISH_TIMEOUT_MS for the collector to
+ * confirm it got everything, and what's still in flight when a connection breaks (or doesn't finish in time) is lost.
+ */
+#define TCP_FRAME_HEADER_SIZE 2
+#define TCP_RETRY_MS 5000
+#define TCP_FINISH_TIMEOUT_MS 1000
+// how long the logger task waits for a log message while a probe answer may be on its way
+#define ACK_POLL_INTERVAL_MS 10
+
+// only ever touched by the logger task
+static struct logger_tcp_network_data* s_tcp;
+static enum wifi_logger_transport s_transport = WIFI_LOGGER_TRANSPORT_UDP;  // UDP or TCP
+static bool s_tcp_failed;               // the last connect or send failed...
+static TickType_t s_tcp_failed_tick;    // ...at this point
+static uint8_t s_tcp_frame[TCP_FRAME_HEADER_SIZE + DATAGRAM_MAX_WIRE_SIZE];
+#endif
+
+/*
+ * Flow control. A collector that wants it sends "wlcredit <n>" whenever it has caught up with everything it received
+ * from us: we may send n more datagrams. It's off until the first grant, so collectors that don't grant (nc, syslog
+ * servers) get everything as before, and it's reset whenever we switch collectors.
+ *
+ * Out of credits, nothing is sent but a LOG_RECORD_TYPE_CREDIT record now and then asking for more: lines stay queued,
+ * and are packed into full batches once credits come back. Once the queue is full, new lines are dropped, and the
+ * server is told how many. If no grant comes for FLOW_CONTROL_GIVE_UP_MS, flow control is turned off until the next
+ * one: a collector that died, or a forged "wlcredit 0", can't hold the logs back for good.
+ *
+ * With a control channel key, a grant is signed like a command, and only taken if its seq is higher than the last one:
+ *
+ *   wlcredit <n> <seq> <mac>    mac over "<device_id> wlcredit <n> <seq>", see control_channel_check_mac()
+ */
+#define CREDIT_GRANT_PREFIX "wlcredit "
+#define FLOW_CONTROL_REQUEST_INTERVAL_MS 100
+#define FLOW_CONTROL_GIVE_UP_MS 5000
+// below this many credits, every datagram is packed as full as the batch limit allows
+#define FLOW_CONTROL_LOW_CREDITS 4
+
+// only ever touched by the logger task
+static bool s_flow_control;             // the current collector grants credits
+static int32_t s_flow_credits;          // log data datagrams we may still send (see send_log_datagram()). can dip below 0: a long line's fragments go out together
+static TickType_t s_flow_request_tick;  // when we last asked for credits
+static TickType_t s_flow_grant_tick;    // when the last grant came
+static unsigned long long s_flow_grant_seq; // (signed grants only) seq of the last grant taken
+
+/**
+ * @brief sends one datagram to the collector, sealed first if CONFIG_LOGGING_SERVER_ENCRYPTION is on.
+ *        everything the logger task sends over UDP goes through here, so a whole batch is sealed in one go.
+ *
+ * @param handle UDP network handle
+ * @param payload what to send
+ * @param len length of payload
+ * @param len_sent (out param, optional) bytes put on the wire, -1 if sending failed
+ */
+static void send_udp_datagram(struct logger_udp_network_data *handle, const char *payload, size_t len, int* len_sent)
+{
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+    const int sealed_len = datagram_crypto_seal((const uint8_t*)payload, len, s_sealed_buffer, sizeof(s_sealed_buffer));
+    if (sealed_len < 0) {
+        // never fall back to sending it in the clear
+        printf("%s: couldn't encrypt a %u byte datagram, dropped\n", TAG, (unsigned)len);
+        if (len_sent)
+            *len_sent = -1;
+        return;
+    }
+    send_udp_data(handle, (const char*)s_sealed_buffer, sealed_len, len_sent);
+#else
+    send_udp_data(handle, payload, len, len_sent);
+#endif
 }
 
-_Noreturn void wifi_logger_task(void* param)
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+static const char* transport_name(enum wifi_logger_transport transport)
 {
-    assert(param);
-    struct wifi_logger_config* config = (struct wifi_logger_config*)param;
-    assert(config->host);
+    return (transport == WIFI_LOGGER_TRANSPORT_TCP) ? "TCP" : "UDP";
+}
 
-    struct logger_udp_network_data* handle = create_udp_network_manager_handle();
+// a line for the collector about the last switch, sent the next time around the logger task's loop
+static char s_transport_notice[128];
+static bool s_transport_notice_pending;
 
-	while (true)
-	{
-        bool ok = update_udp_logging(handle, config->host, config->port);
+/**
+ * @brief moves log data over to transport (connected already, if TCP), from the next datagram on
+ *
+ * @param why what made us switch, for the console and the collector
+ */
+static void set_transport(enum wifi_logger_transport transport, const char* why)
+{
+    s_transport = transport;
+    link_monitor_switched(transport, xTaskGetTickCount());
+
+    struct wifi_logger_link_stats stats;
+    link_monitor_get_stats(&stats);
+    printf("%s: %s, sending over %s (loss %u%% of %u probes, rtt %u ms, TCP stalls %u%%)\n", TAG, why,
+           transport_name(transport), stats.loss_percent, stats.samples, (unsigned)stats.rtt_ms, stats.tcp_stall_percent);
+    snprintf(s_transport_notice, sizeof(s_transport_notice),
+             "%s| wifi_logger: %s, sending over %s (loss %u%% of %u probes, rtt %u ms, TCP stalls %u%%)\n",
+             udp_logging_get_device_id(), why, transport_name(transport), stats.loss_percent, stats.samples,
+             (unsigned)stats.rtt_ms, stats.tcp_stall_percent);
+    s_transport_notice_pending = true;
+}
+
+/**
+ * @brief gives up on TCP for TCP_RETRY_MS, and goes back to UDP if that's what was in use
+ */
+static void tcp_failed(const char* why)
+{
+    tcp_close_network_manager(s_tcp);
+    s_tcp_failed = true;
+    s_tcp_failed_tick = xTaskGetTickCount();
+    if (s_transport == WIFI_LOGGER_TRANSPORT_TCP)
+        set_transport(WIFI_LOGGER_TRANSPORT_UDP, why);
+}
+
+/**
+ * @brief sends one datagram over the TCP connection, as a frame. sealed first if CONFIG_LOGGING_SERVER_ENCRYPTION is on.
+ *
+ * @param len_sent (out param, optional) bytes handed to TCP, -1 if it couldn't be sealed
+ * @return bool false if the connection is broken: the datagram wasn't (all) sent, and should go over UDP instead
+ */
+static bool send_tcp_frame(const char *payload, size_t len, int* len_sent)
+{
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+    const int sealed_len = datagram_crypto_seal((const uint8_t*)payload, len, &s_tcp_frame[TCP_FRAME_HEADER_SIZE],
+                                                sizeof(s_tcp_frame) - TCP_FRAME_HEADER_SIZE);
+    if (sealed_len < 0) {
+        // never fall back to sending it in the clear. not the connection's fault, though
+        printf("%s: couldn't encrypt a %u byte datagram, dropped\n", TAG, (unsigned)len);
+        if (len_sent)
+            *len_sent = -1;
+        return true;
+    }
+    const size_t frame_len = sealed_len;
+#else
+    memcpy(&s_tcp_frame[TCP_FRAME_HEADER_SIZE], payload, len);
+    const size_t frame_len = len;
+#endif
+    s_tcp_frame[0] = (uint8_t)(frame_len >> 8);
+    s_tcp_frame[1] = (uint8_t)frame_len;
+
+    const TickType_t start = xTaskGetTickCount();
+    const int sent = tcp_send_data(s_tcp, (const char*)s_tcp_frame, TCP_FRAME_HEADER_SIZE + frame_len);
+    if (sent < 0)
+        return false;
+    link_monitor_tcp_sent(xTaskGetTickCount() - start);
+    if (len_sent)
+        *len_sent = sent;
+    return true;
+}
+#endif
+
+/**
+ * @brief sends one datagram of log data (lines, records, drop reports) over whichever transport is in use.
+ *        probes, credit requests and control replies always go over UDP, with send_udp_datagram(). Only what goes
+ *        through here uses up flow control credits: the collector grants them for log data, not for our own traffic.
+ */
+static void send_log_datagram(struct logger_udp_network_data *handle, const char *payload, size_t len, int* len_sent)
+{
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (s_transport == WIFI_LOGGER_TRANSPORT_TCP && len <= DATAGRAM_MAX_PAYLOAD) {
+        if (send_tcp_frame(payload, len, len_sent))
+            return;
+        tcp_failed("TCP connection broke");
+    }
+#endif
+    s_flow_credits--;
+    send_udp_datagram(handle, payload, len, len_sent);
+}
+
+/**
+ * @brief Sends a log message as one datagram, or, if it's longer than CONFIG_LOGGING_SERVER_BUFFER_MAX_SIZE,
+ *        as a chain of fragments the receiver stitches back together.
+ *
+ * Every fragment starts with "<device_id>|+<n>+ ", n counting up from 0, except the last one, which starts with
+ * "<device_id>|+<n> ". The rest of the fragment is the next piece of the line, as it is. The header alone tells the
+ * receiver which line a datagram continues, whether more is coming, and whether any went missing: nothing in the
+ * line itself can look like a fragment.
+ *
+ * @param handle UDP network handle
+ * @param log_message null-terminated log message
+ * @return int total bytes put on the wire, -1 if any fragment failed to send
+ */
+static int send_udp_log_message(struct logger_udp_network_data *handle, const char *log_message)
+{
+    const size_t len = strlen(log_message);
+    int len_sent = 0;
+
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+    // syslog receivers don't know about our fragments. RFC 5426 says to truncate instead.
+    send_log_datagram(handle, log_message, MIN(len, sizeof(s_fragment_buffer)), &len_sent);
+    return len_sent;
+#endif
+
+    if (len <= sizeof(s_fragment_buffer)) {
+        send_log_datagram(handle, log_message, len, &len_sent);
+        return len_sent;
+    }
+
+    int total_sent = 0;
+    size_t offset = 0;
+
+    for (unsigned fragment = 0; offset < len; fragment++)
+    {
+        // the last fragment's header is one char shorter: no "+"
+        size_t header_len = snprintf(s_fragment_buffer, sizeof(s_fragment_buffer), "%s|+%u ", udp_logging_get_device_id(), fragment);
+        if (header_len + 2 >= sizeof(s_fragment_buffer))
+            return -1; // device id can't fit in a fragment. config is broken.
+
+        size_t chunk = len - offset;
+        if (chunk > sizeof(s_fragment_buffer) - header_len) {
+            header_len = snprintf(s_fragment_buffer, sizeof(s_fragment_buffer), "%s|+%u+ ", udp_logging_get_device_id(), fragment);
+            chunk = sizeof(s_fragment_buffer) - header_len;
+        }
+
+        memcpy(&s_fragment_buffer[header_len], &log_message[offset], chunk);
+        offset += chunk;
+
+        send_log_datagram(handle, s_fragment_buffer, header_len + chunk, &len_sent);
+        if (len_sent < 0)
+            return -1;
+        total_sent += len_sent;
+    }
+
+    return total_sent;
+}
+
+#ifdef LOG_ITEM_STATIC_LINES
+/**
+ * @brief renders a LOG_ITEM_FLAG_STATIC item's line into buf, reading its text for the first time
+ *
+ * @return size_t length of the whole line, like snprintf(). pass a NULL buf and 0 size to measure it
+ */
+static size_t render_static_line(const struct log_queue_item* item, char* buf, size_t size)
+{
+    const struct wifi_log_site* site = item->site;
+    return render_log_line(buf, size, s_print_device_id, log_level_index((esp_log_level_t) site->level), item->timestamp,
+                           site->tag, site->func, site->line, item->message);
+}
+
+/**
+ * @brief sends a LOG_ITEM_FLAG_STATIC item on its own: rendered straight into the datagram if it fits in one, otherwise
+ *        into a heap buffer to be split into fragments
+ */
+static int send_static_line(struct logger_udp_network_data *handle, const struct log_queue_item* item)
+{
+    int len_sent = 0;
+    const size_t len = render_static_line(item, NULL, 0);
+    if (len < sizeof(s_fragment_buffer)) {
+        render_static_line(item, s_fragment_buffer, sizeof(s_fragment_buffer));
+        send_log_datagram(handle, s_fragment_buffer, len, &len_sent);
+        return len_sent;
+    }
+
+    char* line = malloc(len + 1);
+    if (!line)
+        return -1;
+    render_static_line(item, line, len + 1);
+    len_sent = send_udp_log_message(handle, line);
+    free(line);
+    return len_sent;
+}
+#endif
+
+/**
+ * @brief frees a dequeued item's message, if it's ours
+ */
+static void free_item(const struct log_queue_item* item)
+{
+    if (!(item->flags & LOG_ITEM_FLAG_STATIC))
+        free(item->message);
+}
+
+/**
+ * @brief how many bytes an item takes up in a batch
+ */
+static size_t item_batch_len(const struct log_queue_item* item)
+{
+    if (item->flags & LOG_ITEM_FLAG_BINARY)
+        return item->len;
+#ifdef LOG_ITEM_STATIC_LINES
+    if (item->flags & LOG_ITEM_FLAG_STATIC)
+        return render_static_line(item, NULL, 0); // always ends in a newline
+#endif
+
+    // lines in a batch must end in a newline, or the receiver can't tell where one stops and the next starts
+    const size_t len = strlen(item->message);
+    return (len > 0 && item->message[len - 1] == '\n') ? len : len + 1;
+}
+
+static void append_to_batch(size_t* batch_len, const struct log_queue_item* item, size_t item_len)
+{
+    if (item->flags & LOG_ITEM_FLAG_BINARY) {
+        memcpy(&s_batch_buffer[*batch_len], item->message, item_len);
+#ifdef LOG_ITEM_STATIC_LINES
+    } else if (item->flags & LOG_ITEM_FLAG_STATIC) {
+        // the one copy of the text there is: from where it lives into the datagram
+        render_static_line(item, &s_batch_buffer[*batch_len], sizeof(s_batch_buffer) - *batch_len);
+#endif
+    } else {
+        const size_t len = strlen(item->message);
+        memcpy(&s_batch_buffer[*batch_len], item->message, len);
+        if (len < item_len)
+            s_batch_buffer[*batch_len + len] = '\n';
+    }
+    *batch_len += item_len;
+}
+
+static void echo_to_console(const struct log_queue_item* item)
+{
+    if (item->flags & LOG_ITEM_FLAG_ECHO_TO_CONSOLE) {
+        fputs(&item->message[item->console_offset], stdout);
+    }
+}
+
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+/**
+ * @brief (async console echo) takes whatever is queued off the queue and echoes it, to be sent later
+ */
+static void echo_queued_lines(void)
+{
+    struct log_queue_item item;
+    while (s_echoed_count < ECHOED_LINES_MAX)
+    {
+        // count it before it leaves the queue, or send_to_queue() could see room for one more than there is
+        s_echoed_count++;
+        if (xQueueReceive(s_wifi_logger_queue, &item, 0) != pdPASS) {
+            s_echoed_count--;
+            break;
+        }
+        echo_to_console(&item);
+        item.flags &= ~LOG_ITEM_FLAG_ECHO_TO_CONSOLE;
+        s_echoed_lines[(s_echoed_first + s_echoed_count - 1) % ECHOED_LINES_MAX] = item;
+    }
+}
+#endif
+
+/**
+ * @brief the next item to send, echoed lines first. like receive_from_queue()
+ */
+static bool take_item(struct log_queue_item* item, TickType_t timeout)
+{
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+    if (s_echoed_count > 0) {
+        *item = s_echoed_lines[s_echoed_first];
+        s_echoed_first = (s_echoed_first + 1) % ECHOED_LINES_MAX;
+        s_echoed_count--;
+        return true;
+    }
+#endif
+    return receive_from_queue(item, timeout);
+}
+
+/**
+ * @brief a copy of the next item to send, which stays where it is
+ */
+static bool peek_item(struct log_queue_item* item, TickType_t timeout)
+{
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+    if (s_echoed_count > 0) {
+        *item = s_echoed_lines[s_echoed_first];
+        return true;
+    }
+#endif
+    return xQueuePeek(s_wifi_logger_queue, item, timeout) == pdPASS;
+}
+
+/**
+ * @brief how many items are waiting to be sent
+ */
+static unsigned items_waiting(void)
+{
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+    return uxQueueMessagesWaiting(s_wifi_logger_queue) + s_echoed_count;
+#else
+    return uxQueueMessagesWaiting(s_wifi_logger_queue);
+#endif
+}
+
+/**
+ * @brief the logger task's ulTaskNotifyTake(). with async console echo, what gets queued before and during the wait is
+ *        echoed, so the console doesn't wait for the network
+ *
+ * @param wake_for_lines wake up for each line that gets queued, to echo it right away. for the long waits, short ones
+ *                       just echo on the way out
+ */
+static void logger_task_wait(TickType_t ticks, bool wake_for_lines)
+{
+#if CONFIG_LOGGING_SERVER_ASYNC_CONSOLE_ECHO==1
+    s_echo_wake = wake_for_lines;
+    echo_queued_lines();
+    ulTaskNotifyTake(pdTRUE, ticks);
+    s_echo_wake = false;
+    echo_queued_lines();
+#else
+    (void) wake_for_lines;
+    ulTaskNotifyTake(pdTRUE, ticks);
+#endif
+}
+
+/**
+ * @brief sends a dequeued item, packing whatever is queued up behind it (or arrives within the batch wait time) into
+ *        the same datagram, up to the batch size.
+ *
+ * @param handle UDP network handle
+ * @param item the item to send. its message is free()'d (unless it's LOG_ITEM_FLAG_STATIC), as are those of any other items sent with it.
+ * @return int bytes sent, -1 on error
+ */
+static int send_udp_items(struct logger_udp_network_data *handle, struct log_queue_item* item)
+{
+    // short of credits, or sending a burst, make each datagram count. a burst doesn't wait for more, it's all queued already
+    const bool low_credits = s_flow_control && s_flow_credits < FLOW_CONTROL_LOW_CREDITS;
+    const bool burst = s_burst_max_bytes > 0;
+    const size_t max_bytes = (low_credits || burst) ? BATCH_MAX_BYTES_LIMIT : s_batch_max_bytes;
+    int len_sent = 0;
+
+    echo_to_console(item);
+
+    size_t item_len = item_batch_len(item);
+    if (item_len > max_bytes)
+    {
+        // too big to batch (or batching is off): send it on its own
+        if (item->flags & LOG_ITEM_FLAG_BINARY) {
+            // binary records are always small enough for one datagram, they're never fragmented
+            send_log_datagram(handle, item->message, item->len, &len_sent);
+#ifdef LOG_ITEM_STATIC_LINES
+        } else if (item->flags & LOG_ITEM_FLAG_STATIC) {
+            len_sent = send_static_line(handle, item);
+#endif
+        } else {
+            len_sent = send_udp_log_message(handle, item->message);
+        }
+        free_item(item);
+        return len_sent;
+    }
+
+    size_t batch_len = 0;
+    append_to_batch(&batch_len, item, item_len);
+    free_item(item);
+
+    const TickType_t start = xTaskGetTickCount();
+    const TickType_t max_wait = burst ? 0 : pdMS_TO_TICKS(s_batch_max_wait_ms);
+
+    while (true)
+    {
+        const TickType_t waited = xTaskGetTickCount() - start;
+
+        // peek first: if the next one doesn't fit, it stays queued for the next datagram
+        if (!peek_item(item, waited < max_wait ? max_wait - waited : 0))
+            break;
+
+        item_len = item_batch_len(item);
+        if (batch_len + item_len > max_bytes)
+            break;
+
+        take_item(item, 0);
+        echo_to_console(item);
+        append_to_batch(&batch_len, item, item_len);
+        free_item(item);
+    }
+
+    send_log_datagram(handle, s_batch_buffer, batch_len, &len_sent);
+    return len_sent;
+}
+
+/*
+ * Collector failover. With fallback collectors configured, the logger task probes the collector it's sending to every
+ * CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS with a LOG_RECORD_TYPE_PROBE record, which the collector answers with
+ * "wlack <seq>". While a probe goes unanswered for longer than PROBE_HOLD_AFTER_MS, lines are left in the queue instead
+ * of being sent into the void. After PROBE_FAILOVER_AFTER_MS, the next collector in the list is tried, and lines are
+ * held until it answers.
+ */
+#define PROBE_ACK_PREFIX "wlack "
+#if CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS > 0 && CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG!=1
+#define PROBE_HOLD_AFTER_MS     (CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS)
+#define PROBE_FAILOVER_AFTER_MS (3 * CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS)
+#endif
+// the adaptive transport measures the link with the same probes
+#if defined(PROBE_FAILOVER_AFTER_MS) || CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+#define SEND_PROBES 1
+#endif
+
+// how long the logger task waits before trying to resolve the collectors again, once none of them could be
+#define COLLECTOR_RETRY_MS 2000
+
+// only ever touched by the logger task
+static unsigned s_collector_index;      // 0 = config->host/port, 1.. = config->fallback[index - 1]
+static bool s_collectors_unreachable;           // none of them could be resolved...
+static TickType_t s_collectors_unreachable_tick; // ...at this point
+static uint32_t s_probe_seq;            // last probe sent
+static uint32_t s_probe_first_seq;      // first probe sent to the current collector. acks for older ones don't count
+#ifdef SEND_PROBES
+static TickType_t s_probe_sent_tick;    // when the last probe was sent
+#endif
+#ifdef PROBE_FAILOVER_AFTER_MS
+static TickType_t s_probe_unacked_tick; // when the oldest unanswered probe was sent
+#endif
+static bool s_probe_unacked;
+static bool s_collector_answered;       // the current collector has answered at least once
+
+static unsigned collector_count(const struct wifi_logger_config* config)
+{
+    unsigned count = 1;
+    while (count <= WIFI_LOGGER_MAX_FALLBACK_COLLECTORS && config->fallback[count - 1].port > 0)
+        count++;
+    return count;
+}
+
+static void get_collector(const struct wifi_logger_config* config, unsigned index, const char** host, int* port)
+{
+    if (index == 0) {
+        *host = config->host;
+        *port = config->port;
+    } else {
+        *host = config->fallback[index - 1].host;
+        *port = config->fallback[index - 1].port;
+    }
+}
+
+static bool collector_probing_enabled(const struct wifi_logger_config* config)
+{
+#ifdef PROBE_FAILOVER_AFTER_MS
+    // with just the one collector, there's nowhere to fail over to. don't make it answer probes
+    return collector_count(config) > 1;
+#else
+    (void) config;
+    return false;
+#endif
+}
+
+/**
+ * @brief starts sending to collector number index (see s_collector_index), on the next update_udp_logging()
+ */
+static void switch_collector(struct logger_udp_network_data *handle, unsigned index)
+{
+    disconnect_udp_network_manager(handle);
+    s_collector_index = index;
+    s_probe_first_seq = s_probe_seq + 1;
+    s_probe_unacked = false;
+    s_collector_answered = false;
+    s_flow_control = false;
+    s_flow_grant_seq = 0; // the new collector's clock may be behind the old one's
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    // the new collector gets measured from scratch, starting out on UDP. the old one may be dead: don't wait on it
+    tcp_close_network_manager(s_tcp);
+    s_transport = WIFI_LOGGER_TRANSPORT_UDP;
+    s_tcp_failed = false;
+    link_monitor_reset(xTaskGetTickCount());
+#endif
+}
+
+#ifdef SEND_PROBES
+static void send_probe(struct logger_udp_network_data *handle)
+{
+    uint8_t record[LOG_RECORD_HEADER_SIZE + 4];
+    const uint32_t seq = ++s_probe_seq;
+    log_record_write_header(record, LOG_RECORD_TYPE_PROBE, 4);
+    record[4] = (uint8_t)(seq >> 24);
+    record[5] = (uint8_t)(seq >> 16);
+    record[6] = (uint8_t)(seq >> 8);
+    record[7] = (uint8_t)seq;
+    send_udp_datagram(handle, (const char*)record, sizeof(record), NULL);
+
+    s_probe_sent_tick = xTaskGetTickCount();
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    link_monitor_probe_sent(seq, s_probe_sent_tick);
+#endif
+#ifdef PROBE_FAILOVER_AFTER_MS
+    if (!s_probe_unacked) {
+        s_probe_unacked = true;
+        s_probe_unacked_tick = s_probe_sent_tick;
+    }
+#endif
+}
+#endif
+
+static void handle_probe_ack(const char* message)
+{
+    char* end = NULL;
+    const unsigned long seq = strtoul(&message[strlen(PROBE_ACK_PREFIX)], &end, 10);
+    if (end == &message[strlen(PROBE_ACK_PREFIX)] || seq < s_probe_first_seq || seq > s_probe_seq)
+        return;
+
+    s_probe_unacked = false;
+    s_collector_answered = true;
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    link_monitor_probe_acked((uint32_t)seq, xTaskGetTickCount());
+#endif
+}
+
+/**
+ * @brief probes the current collector, and moves on to the next one if it stopped answering
+ *
+ * @return bool true if lines can be sent to the current collector, false if they should stay queued for now
+ */
+static bool check_collector_health(struct logger_udp_network_data *handle, const struct wifi_logger_config* config)
+{
+#ifdef PROBE_FAILOVER_AFTER_MS
+    const TickType_t now = xTaskGetTickCount();
+
+    if (now - s_probe_sent_tick >= pdMS_TO_TICKS(CONFIG_LOGGING_SERVER_PROBE_INTERVAL_MS) || s_probe_first_seq > s_probe_seq)
+        send_probe(handle);
+
+    if (!s_probe_unacked)
+        return s_collector_answered;
+
+    // not now: send_probe() may have just started the wait, on a later tick
+    const TickType_t waited = xTaskGetTickCount() - s_probe_unacked_tick;
+    if (waited >= pdMS_TO_TICKS(PROBE_FAILOVER_AFTER_MS)) {
+        const unsigned next = (s_collector_index + 1) % collector_count(config);
+        printf("%s: collector %u isn't answering, switching to collector %u\n", TAG, s_collector_index, next);
+        switch_collector(handle, next);
+        return false;
+    }
+
+    return s_collector_answered && waited < pdMS_TO_TICKS(PROBE_HOLD_AFTER_MS);
+#else
+    (void) handle;
+    (void) config;
+    return true;
+#endif
+}
+
+static void handle_credit_grant(const char* message)
+{
+    const char* credits_text = &message[strlen(CREDIT_GRANT_PREFIX)];
+    char* end = NULL;
+    const unsigned long credits = strtoul(credits_text, &end, 10);
+    if (end == credits_text)
+        return;
+
+    if (control_channel_enabled()) {
+        // anyone could send "wlcredit 0": with a key, only the collector can
+        const char* seq_text = end;
+        const unsigned long long seq = strtoull(seq_text, &end, 10);
+        if (end == seq_text || *end != ' ' || seq <= s_flow_grant_seq ||
+            !control_channel_check_mac(message, end - message, end + 1))
+            return;
+        s_flow_grant_seq = seq;
+    }
+
+    s_flow_control = true;
+    s_flow_credits = (int32_t)MIN(credits, (unsigned long)INT32_MAX);
+    s_flow_grant_tick = xTaskGetTickCount();
+}
+
+/**
+ * @brief checks the collector has room for more, asking it for credits if we're out
+ *
+ * @return bool true if lines can be sent, false if they should stay queued for now
+ */
+static bool check_flow_control(struct logger_udp_network_data *handle)
+{
+    if (!s_flow_control || s_flow_credits > 0)
+        return true;
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (s_transport == WIFI_LOGGER_TRANSPORT_TCP)
+        return true; // credits are counted in datagrams. TCP does its own flow control
+#endif
+
+    const TickType_t now = xTaskGetTickCount();
+    if (now - s_flow_grant_tick >= pdMS_TO_TICKS(FLOW_CONTROL_GIVE_UP_MS)) {
+        printf("%s: no credits from the collector for %d ms, sending without flow control\n", TAG, FLOW_CONTROL_GIVE_UP_MS);
+        s_flow_control = false;
+        return true;
+    }
+    if (now - s_flow_request_tick >= pdMS_TO_TICKS(FLOW_CONTROL_REQUEST_INTERVAL_MS)) {
+        uint8_t record[LOG_RECORD_HEADER_SIZE];
+        log_record_write_header(record, LOG_RECORD_TYPE_CREDIT, 0);
+        send_udp_datagram(handle, (const char*)record, sizeof(record), NULL);
+        s_flow_request_tick = now;
+    }
+    return false;
+}
+
+/**
+ * @brief handles any probe acks, credit grants and commands that came in from the log server, without blocking
+ */
+static void poll_udp_incoming(struct logger_udp_network_data *handle)
+{
+    char line[128];
+    const char* message;
+    size_t received;
+
+    while ((message = receive_udp_data(handle, &received)) != NULL)
+    {
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+        // acks, grants and commands all decide what we send: with a key, only take them from someone who has it
+        char opened[256];
+        const int opened_len = datagram_crypto_open((const uint8_t*)message, received, (uint8_t*)opened, sizeof(opened) - 1);
+        if (opened_len < 0)
+            continue;
+        opened[opened_len] = 0;
+        message = opened;
+#else
+        (void) received;
+#endif
+        if (strncmp(message, PROBE_ACK_PREFIX, strlen(PROBE_ACK_PREFIX)) == 0) {
+            handle_probe_ack(message);
+            continue;
+        }
+        if (strncmp(message, CREDIT_GRANT_PREFIX, strlen(CREDIT_GRANT_PREFIX)) == 0) {
+            handle_credit_grant(message);
+            continue;
+        }
+
+        char reply[96];
+        if (!control_channel_enabled() || !control_channel_handle(message, reply, sizeof(reply)))
+            continue;
+
+        const int len = snprintf(line, sizeof(line), "%s| wlctl %s\n", udp_logging_get_device_id(), reply);
+        if (len > 0)
+            send_udp_datagram(handle, line, MIN((size_t)len, sizeof(line) - 1), NULL);
+    }
+}
+
+/**
+ * @brief lets the server know when lines are being thrown away
+ *
+ * @param handle UDP network handle
+ * @param reason what dropped them, e.g. "rate limit"
+ * @param dropped how many were dropped since the last report
+ */
+static void report_drops(struct logger_udp_network_data *handle, const char* reason, uint32_t dropped)
+{
+    if (dropped == 0)
+        return;
+
+    char line[96];
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+    const int len = snprintf(line, sizeof(line), "wifi_logger: %s dropped %u lines", reason, (unsigned)dropped);
+    char* message = (len > 0) ? generate_syslog_message(1, esp_log_timestamp(), line, MIN((size_t)len, sizeof(line) - 1), NULL) : NULL;
+    if (message) {
+        send_log_datagram(handle, message, strlen(message), NULL);
+        free(message);
+    }
+#else
+    const int len = snprintf(line, sizeof(line), "%s| wifi_logger: %s dropped %u lines\n", udp_logging_get_device_id(), reason, (unsigned)dropped);
+    if (len > 0)
+        send_log_datagram(handle, line, MIN((size_t)len, sizeof(line) - 1), NULL);
+#endif
+}
+
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+/**
+ * @brief probes the link to the collector, and moves log data to the transport that suits it (or that it's pinned to)
+ */
+static void check_transport(struct logger_udp_network_data *handle, const struct wifi_logger_config* config)
+{
+    const TickType_t now = xTaskGetTickCount();
+
+    if (now - s_probe_sent_tick >= pdMS_TO_TICKS(CONFIG_LOGGING_SERVER_ADAPTIVE_PROBE_INTERVAL_MS) || s_probe_first_seq > s_probe_seq)
+        send_probe(handle);
+
+    // measure even when pinned, so the stats stay current
+    const char* reason = NULL;
+    const enum wifi_logger_transport chosen = link_monitor_choose(s_transport, now, &reason);
+    const enum wifi_logger_transport mode = s_transport_mode;
+    const enum wifi_logger_transport wanted = (mode == WIFI_LOGGER_TRANSPORT_AUTO) ? chosen : mode;
+    if (wanted == s_transport)
+        return;
+
+    const char* why = (mode == WIFI_LOGGER_TRANSPORT_AUTO) ? reason : "pinned";
+
+    if (wanted == WIFI_LOGGER_TRANSPORT_UDP) {
+        tcp_finish_network_manager(s_tcp, TCP_FINISH_TIMEOUT_MS);
+        set_transport(WIFI_LOGGER_TRANSPORT_UDP, why);
+        return;
+    }
+
+    if (s_tcp_failed && now - s_tcp_failed_tick < pdMS_TO_TICKS(TCP_RETRY_MS))
+        return;
+
+    const char* host;
+    int port;
+    get_collector(config, s_collector_index, &host, &port);
+    if (!connect_tcp_network_manager(s_tcp, host, port)) {
+        tcp_failed("can't connect over TCP");
+        return;
+    }
+
+    s_tcp_failed = false;
+    set_transport(WIFI_LOGGER_TRANSPORT_TCP, why);
+}
+#endif
+
+// most datagrams in one burst before the logger task goes back around its loop (commands, collector changes, watchdog)
+#define BURST_MAX_DATAGRAMS 64
+
+/**
+ * @brief (burst mode) whether it's time to send what's queued
+ *
+ * @param wait (out param) if not, how long until the oldest queued line is due. portMAX_DELAY if nothing is queued
+ */
+static bool burst_is_due(TickType_t* wait)
+{
+    const TickType_t now = xTaskGetTickCount();
+    const TickType_t max_age = pdMS_TO_TICKS(s_burst_max_age_ms);
+
+    portENTER_CRITICAL(&s_burst_lock);
+    const TickType_t age = now - s_burst_oldest_tick;
+    const bool due = s_burst_due || (s_burst_queued_bytes > 0 && age >= max_age);
+    *wait = (s_burst_queued_bytes > 0 && !due) ? max_age - age : portMAX_DELAY;
+    portEXIT_CRITICAL(&s_burst_lock);
+
+    return due;
+}
+
+/**
+ * @brief (burst mode) sends everything that's queued, back to back in full batches
+ */
+static void send_burst(struct logger_udp_network_data *handle)
+{
+    portENTER_CRITICAL(&s_burst_lock);
+    s_burst_due = false;
+    s_burst_queued_bytes = 0;
+    portEXIT_CRITICAL(&s_burst_lock);
+
+    struct log_queue_item item;
+    for (int i = 0; i < BURST_MAX_DATAGRAMS; i++)
+    {
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+        flight_recorder_pump();
+#endif
+        if (!check_flow_control(handle) || !take_item(&item, 0))
+            break;
+        send_udp_items(handle, &item);
+    }
+
+    // out of credits, or too much for one burst: the rest goes next time around the loop, not after another wait
+    if (items_waiting() > 0) {
+        portENTER_CRITICAL(&s_burst_lock);
+        s_burst_due = true;
+        portEXIT_CRITICAL(&s_burst_lock);
+    }
+}
+
+bool update_udp_logging(struct logger_udp_network_data *handle, const struct wifi_logger_config* config)
+{
+    // use printf() for local logging to avoid anything weird with feedback loops, since we're hooked into ESP_LOG()
+
+    const bool probing = collector_probing_enabled(config);
+
+    if (!is_logging_udp_connected(handle))
+    {
+        // none of them could be resolved a moment ago. the logger task may be woken up before it's time to try again
+        if (s_collectors_unreachable && xTaskGetTickCount() - s_collectors_unreachable_tick < pdMS_TO_TICKS(COLLECTOR_RETRY_MS))
+            return false;
+        s_collectors_unreachable = false;
+
+        const char* host;
+        int port;
+        get_collector(config, s_collector_index, &host, &port);
+        if (!init_udp_network_manager(handle, host, port)) {
+            // can't even resolve this one. try the next one right away, unless we've been through all of them
+            const unsigned next = (s_collector_index + 1) % collector_count(config);
+            switch_collector(handle, next);
+            if (next == 0) {
+                s_collectors_unreachable = true;
+                s_collectors_unreachable_tick = xTaskGetTickCount();
+            }
+            return next != 0;
+        }
+    }
+
+    // always listen: any collector may start granting credits
+    poll_udp_incoming(handle);
+
+    TickType_t burst_wait;
+    const bool burst = s_burst_max_bytes > 0;
+    if (burst && !burst_is_due(&burst_wait)) {
+#if CONFIG_LOGGING_SERVER_TRACE==1
+        trace_buffer_flush(); // only queues them
+#endif
+#if CONFIG_LOGGING_SERVER_METRICS==1
+        metrics_flush(); // same
+#endif
+        // nothing goes on the air until the burst. sleep until it's due, or a line makes it due, checking for commands.
+        // the console doesn't wait for the burst: lines queued meanwhile are echoed as they come
+        logger_task_wait(MIN(burst_wait, pdMS_TO_TICKS(CONTROL_POLL_INTERVAL_MS)), true);
+        if (s_stop_requested || !burst_is_due(&burst_wait))
+            return true;
+    }
+
+    if (probing && !check_collector_health(handle, config))
+        return true; // leave the lines queued until there's a collector that answers
+
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    check_transport(handle, config);
+#endif
+
+    if (!check_flow_control(handle))
+        return true; // the collector is behind: leave the lines queued until it catches up
+
+    portENTER_CRITICAL(&s_queue_full_lock);
+    const uint32_t queue_full_dropped = s_queue_full_dropped;
+    s_queue_full_dropped = 0;
+    portEXIT_CRITICAL(&s_queue_full_lock);
+
+    report_drops(handle, "rate limit", log_filter_take_rate_dropped());
+    report_drops(handle, "full queue", queue_full_dropped);
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (s_transport_notice_pending) {
+        s_transport_notice_pending = false;
+        send_log_datagram(handle, s_transport_notice, strlen(s_transport_notice), NULL);
+    }
+#endif
+#if CONFIG_LOGGING_SERVER_TRACE==1
+    trace_buffer_flush();
+#endif
+#if CONFIG_LOGGING_SERVER_METRICS==1
+    metrics_flush();
+#endif
+#if CONFIG_LOGGING_SERVER_FLIGHT_RECORDER==1
+    flight_recorder_pump();
+#endif
+
+    if (burst) {
+        send_burst(handle);
+        return true;
+    }
+
+    // don't wait forever: we need to get back to the control channel every so often
+    TickType_t wait = pdMS_TO_TICKS(CONTROL_POLL_INTERVAL_MS);
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (link_monitor_awaiting_ack(xTaskGetTickCount()))
+        wait = MAX(pdMS_TO_TICKS(ACK_POLL_INTERVAL_MS), 1);
+#endif
+    struct log_queue_item item;
+    if (!take_item(&item, wait)) {
+        return true;
+    }
+
+    int len_sent = send_udp_items(handle, &item);
+    (void) len_sent;
+    #if DEBUG_VERBOSE_LOCAL_LOGGING==1
+    printf("%s: %d %s", TAG, len_sent, "bytes of data sent"); // spammy
+    #endif
+
+    return true;
+}
+
+void wifi_logger_task(void* param)
+{
+    assert(param);
+    struct wifi_logger_config* config = (struct wifi_logger_config*)param;
+    assert(config->host);
+
+    struct logger_udp_network_data* handle = create_udp_network_manager_handle();
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    s_tcp = create_tcp_network_manager_handle();
+#endif
+    // out of memory this early: keep the lines queued and try again, rather than give up on logging for good
+    while (!s_stop_requested && (!handle
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+                                 || !s_tcp
+#endif
+                                 ))
+    {
+        logger_task_wait(COLLECTOR_RETRY_MS / portTICK_PERIOD_MS, true);
+        if (!handle)
+            handle = create_udp_network_manager_handle();
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+        if (!s_tcp)
+            s_tcp = create_tcp_network_manager_handle();
+#endif
+    }
+    if (handle) {
+        switch_collector(handle, 0);
+    }
+
+	while (!s_stop_requested)
+	{
+        struct wifi_logger_config* new_config = take_pending_config();
+        if (new_config) {
+            free(config);
+            config = new_config;
+            switch_collector(handle, 0);
+        }
+
+        bool ok = update_udp_logging(handle, config);
 
         //Checkout following link to understand why we need this delay if want watchdog running.
         //https://github.com/espressif/esp-idf/issues/1646#issuecomment-367507724
-        // 10 = shortest possible delay
-        vTaskDelay((ok ? 10 : 2000) / portTICK_PERIOD_MS);
+        // 10 = shortest possible delay. wifi_logger_stop() and wifi_logger_reconfigure() cut it short.
+        logger_task_wait((ok ? 10 : COLLECTOR_RETRY_MS) / portTICK_PERIOD_MS, !ok);
     }
 
-    close_udp_network_manager(handle);
+    if (handle)
+        close_udp_network_manager(handle);
     handle = NULL;
+#if CONFIG_LOGGING_SERVER_ADAPTIVE_TRANSPORT==1
+    if (s_tcp)
+        tcp_finish_network_manager(s_tcp, TCP_FINISH_TIMEOUT_MS);
+    free(s_tcp);
+    s_tcp = NULL;
+#endif
+    free(config);
+
+    // anything left in the queue stays there for the next start_wifi_logger()
+    s_logger_task = NULL;
+    xTaskNotifyGive(s_stop_waiter);
+    vTaskDelete(NULL);
 }
 #endif
 
@@ -400,25 +1832,31 @@ bool send_next_tcp_queue_msg(struct logger_tcp_network_data *handle)
     if (!is_connected(handle))
         return false;
 
-    char* log_message = receive_from_queue(); // wait forever for a msg to come in
+    struct log_queue_item item;
+    receive_from_queue(&item, portMAX_DELAY); // wait forever for a msg to come in
+    char* log_message = item.message;
 
     // is this a busted log msg?
     if (log_message == NULL) {
-        int len = tcp_send_data(handle, "Unknown error - receiving log message");
+        const char* error = "Unknown error - receiving log message";
+        int len = tcp_send_data(handle, error, strlen(error));
         ESP_LOGE(TAG, "%d %s", len, "Unknown error");
         return false;
     }
 
-    int len = tcp_send_data(handle, log_message);
+    const size_t message_len = (item.flags & LOG_ITEM_FLAG_BINARY) ? item.len : strlen(log_message);
+    int len = tcp_send_data(handle, log_message, message_len);
     if (len < 0) {
         /* Trying to push it back to queue if sending fails, but might lose some logs if frequency is high
         * Might see garbage at first when reconnected.
         */
-        xQueueSendToFront(wifi_logger_queue, (void *) log_message, (TickType_t) portMAX_DELAY);
+        xQueueSendToFront(s_wifi_logger_queue, (void *) &item, (TickType_t) portMAX_DELAY);
         return false;
     }
 
     ESP_LOGD(TAG, "%d %s", len, "bytes of data sent");
+    if (item.flags & LOG_ITEM_FLAG_ECHO_TO_CONSOLE)
+        fputs(&log_message[item.console_offset], stdout);
     free(log_message);
     return true;
 }
@@ -477,12 +1915,22 @@ _Noreturn void wifi_logger_task()
 	{
 		if(is_connected(handle))
 		{
-			char* log_message = receive_from_queue();
+			struct log_queue_item item;
+			receive_from_queue(&item, portMAX_DELAY);
+			char* log_message = item.message;
 
             if (log_message == NULL) {
                 log_message = "Unknown error - log message corrupt";
                 int len = websocket_send_data(handle, log_message);
                 ESP_LOGE(TAG, "%d %s", len, "Unknown error");
+            } else if (item.flags & LOG_ITEM_FLAG_BINARY) {
+                // records aren't null-terminated, and may have zeros in them. they go as binary frames
+                int len = websocket_send_binary(handle, log_message, item.len);
+
+                if (len > 0) {
+                    ESP_LOGD(TAG, "%d %s", len, "bytes of data sent");
+                }
+                free(log_message);
             } else {
                 int len = websocket_send_data(handle, log_message);
 
@@ -490,6 +1938,8 @@ _Noreturn void wifi_logger_task()
                     ESP_LOGD(TAG, "%d %s", len, "bytes of data sent");
                 }
 
+                if (item.flags & LOG_ITEM_FLAG_ECHO_TO_CONSOLE)
+                    fputs(&log_message[item.console_offset], stdout);
                 free(log_message);
             }
         }
@@ -522,10 +1972,38 @@ bool set_wifi_logger_config(struct wifi_logger_config* config, const char* host,
     config->port = port;
     config->route_esp_idf_api_logs_to_wifi = route_esp_idf_api_logs_to_wifi;
     config->device_id[0] = '\0'; // default: empty => use the efuse MAC. Caller may set it after this.
+    memset(config->fallback, 0, sizeof(config->fallback));
 
     return true;
 }
 
+/**
+ * @brief adds a collector to try when the ones before it stop answering (UDP only)
+ *
+ * @return bool false if the list is full or host/port are invalid
+ */
+bool wifi_logger_add_fallback_collector(struct wifi_logger_config* config, const char* host, int port)
+{
+    assert(config);
+    if (!config || !host || strlen(host) <= 0 || strlen(host) >= sizeof(config->fallback[0].host) || port <= 0) {
+        ESP_LOGE(TAG, "fallback collector params invalid");
+        return false;
+    }
+
+    for (int i = 0; i < WIFI_LOGGER_MAX_FALLBACK_COLLECTORS; i++)
+    {
+        if (config->fallback[i].port > 0)
+            continue;
+
+        strcpy(config->fallback[i].host, host);
+        config->fallback[i].port = port;
+        return true;
+    }
+
+    ESP_LOGE(TAG, "no room for another fallback collector (max %d)", WIFI_LOGGER_MAX_FALLBACK_COLLECTORS);
+    return false;
+}
+
 void utils_get_mac_address(char *formatted_mac_address)  // provide at least 18 byte buffer (17 chars + null) i.e. "12:45:78:90:23:56"
 {
 	uint8_t mac_address[6];
@@ -538,10 +2016,21 @@ void utils_get_mac_address(char *formatted_mac_address)  // provide at least 18
  */
 bool start_wifi_logger(const struct wifi_logger_config* config)
 {
+    if (s_logger_task) {
+        ESP_LOGE(TAG, "already started");
+        return false;
+    }
+
     if (init_queue() != ESP_OK) {
 	    return false;
     }
 
+#if CONFIG_LOGGING_SERVER_NET_IMPAIRMENT==1
+    if (!net_impair_configure(CONFIG_LOGGING_SERVER_NET_IMPAIRMENT_SCENARIO)) {
+        ESP_LOGE(TAG, "network impairment scenario is invalid, running without impairment");
+    }
+#endif
+
 	// device id: use the caller-supplied one, or default to the efuse MAC if empty.
 	assert(strlen(config->device_id) < DEVICE_ID_SIZE);
 	if (strlen(config->device_id) == 0)
@@ -549,6 +2038,17 @@ bool start_wifi_logger(const struct wifi_logger_config* config)
 	else
 		strcpy(s_device_id, config->device_id);
 
+#if CONFIG_LOGGING_SERVER_OUTPUT_FORMAT_SYSLOG==1
+	syslog_prepare_header(s_device_id, CONFIG_LOGGING_SERVER_SYSLOG_APP_NAME);
+#endif
+
+#if CONFIG_LOGGING_SERVER_ENCRYPTION==1
+    if (!datagram_crypto_init()) {
+        ESP_LOGE(TAG, "encryption key is invalid, not starting: logs would go out in the clear");
+        return false;
+    }
+#endif
+
     // make a copy to pass in
     struct wifi_logger_config* config_copy = malloc(sizeof(struct wifi_logger_config));
     if(!config_copy) {
@@ -558,10 +2058,75 @@ bool start_wifi_logger(const struct wifi_logger_config* config)
     memcpy(config_copy, config, sizeof(struct wifi_logger_config));
 
     if (config->route_esp_idf_api_logs_to_wifi) {
-        esp_log_set_vprintf(system_log_message_route); // after queue init only. routes all ESP_LOGx() functions to our handler from now on.
+        s_previous_vprintf = esp_log_set_vprintf(system_log_message_route); // after queue init only. routes all ESP_LOGx() functions to our handler from now on.
     }
 
-    xTaskCreatePinnedToCore(wifi_logger_task, "wifi_logger", 4096, config_copy, 2, NULL, 1);
+    s_stop_requested = false;
+    xTaskCreatePinnedToCore(wifi_logger_task, "wifi_logger", 4096, config_copy, 2, &s_logger_task, 1);
     ESP_LOGI(TAG, "****** ============ !! UDP LOGGING HAS STARTED !! ============ ******");
     return true;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief stops the logger task, and stops routing ESP_LOGx() to it. waits for the task to finish what it's sending.
+ * whatever is still queued stays queued: start_wifi_logger() picks up where this left off.
+ *
+ * @return bool false if the logger isn't running (or isn't UDP)
+ */
+bool wifi_logger_stop(void)
+{
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+    if (!s_logger_task || s_logger_task == xTaskGetCurrentTaskHandle())
+        return false;
+
+    if (s_previous_vprintf) {
+        esp_log_set_vprintf(s_previous_vprintf);
+        s_previous_vprintf = NULL;
+    }
+
+    s_stop_waiter = xTaskGetCurrentTaskHandle();
+    s_stop_requested = true;
+    xTaskNotifyGive(s_logger_task);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // the logger task lets us know once it's done
+
+    free(take_pending_config());
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief switches the running logger to new collectors. the logger task reconnects between datagrams, so nothing
+ * that's queued is lost. the device id and ESP_LOGx() routing stay the way start_wifi_logger() set them up.
+ *
+ * @param config the new collectors: host/port and fallback
+ * @return bool false if the logger isn't running (or isn't UDP), or out of memory
+ */
+bool wifi_logger_reconfigure(const struct wifi_logger_config* config)
+{
+#if CONFIG_LOGGING_SERVER_TRANSPORT_PROTOCOL_UDP==1
+    assert(config);
+    if (!config || !s_logger_task)
+        return false;
+
+    struct wifi_logger_config* config_copy = malloc(sizeof(struct wifi_logger_config));
+    if (!config_copy) {
+        ESP_LOGE(TAG, "out of memory copying config for reconfigure");
+        return false;
+    }
+    memcpy(config_copy, config, sizeof(struct wifi_logger_config));
+
+    taskENTER_CRITICAL(&s_config_lock);
+    struct wifi_logger_config* replaced = s_pending_config;
+    s_pending_config = config_copy;
+    taskEXIT_CRITICAL(&s_config_lock);
+
+    free(replaced); // never picked up: this one supersedes it
+    xTaskNotifyGive(s_logger_task);
+    return true;
+#else
+    (void) config;
+    return false;
+#endif
+}